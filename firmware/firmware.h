@@ -49,6 +49,19 @@ struct pru1_ds {
 	uint32_t all_data[AUDIO_TOTAL_SIZE];
 };
 
+/* The PRU runs in order, has no cache, and its local memory is mapped
+ * uncached on the ARM, so on the PRU side volatile is all it takes. The ARM
+ * (and any host that stands in for either side) needs real barriers between
+ * the ring data and the index that publishes it, and as the PRU is outside the
+ * ARM's inner shareable domain, on the ARM it has to be a full system one. */
+#ifndef __TI_COMPILER_VERSION__
+#if defined(__arm__) || defined(__aarch64__)
+#define pru_ring_barrier() __asm__ volatile("dmb sy" ::: "memory")
+#else
+#define pru_ring_barrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+#endif
+
 /* We put the data structures at 0x200 in each PRU, as the first 0x200 bytes
  * are taken up by the stack and the heap.
  *
@@ -0,0 +1,324 @@
+#include "audio_backend.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dsp/dsp_perf.h"
+#include "pru/pru_interface.h"
+#include "telemetry.h"
+
+/* The null backend's default length, in seconds. */
+#define AUDIO_NULL_DEFAULT_SECONDS 10
+
+/* --- PRU --- */
+
+static bool
+pru_backend_open(audio_backend *b, const char *arg) {
+	(void)b;
+	(void)arg;
+	return true;
+}
+
+static void
+pru_backend_start(audio_backend *b) {
+	(void)b;
+	pru_audio_prepare_writing();
+	pru_audio_prepare_reading();
+}
+
+static uint32_t
+pru_backend_read_block(audio_backend *b, dsp_num *samples, uint32_t count) {
+	(void)b;
+	pru_audio_read_block(samples, count);
+	return count;
+}
+
+static void
+pru_backend_write_block(audio_backend *b, const dsp_num *samples, uint32_t count) {
+	(void)b;
+	pru_audio_write_block(samples, count);
+}
+
+static uint32_t
+pru_backend_latency(audio_backend *b) {
+	(void)b;
+	return pru_audio_out_fill();
+}
+
+static uint32_t
+pru_backend_input_pending(audio_backend *b) {
+	(void)b;
+	return pru_audio_in_fill();
+}
+
+static void
+pru_backend_take_stats(audio_backend *b, audio_backend_stats *out) {
+	(void)b;
+	pru_audio_stats stats;
+	pru_audio_take_stats(&stats);
+
+	out->read_wait_ns = stats.read_spin_ns;
+	out->write_wait_ns = stats.write_spin_ns;
+	out->underruns = stats.underruns;
+}
+
+/* --- WAV files --- */
+
+static bool
+wav_backend_open(audio_backend *b, const char *arg) {
+	const char *comma = arg ? strchr(arg, ',') : NULL;
+	if(!comma || comma == arg || !comma[1]) {
+		puts("the wav backend needs both files: wav:<in.wav>,<out.wav>");
+		return false;
+	}
+
+	char *in_path = strndup(arg, comma - arg);
+	if(!in_path) return false;
+	wav_read_or_die(&b->in, in_path);
+	free(in_path);
+
+	if(b->in.sample_rate != SAMPLE_RATE) {
+		printf("WARNING: modulator sample rate does not match output (%d vs %d)\n", b->in.sample_rate, SAMPLE_RATE);
+	}
+
+	/* The loop writes a sample for every one it reads */
+	b->out_path = comma + 1;
+	wav_blank_or_die(&b->out, b->in.frames, 1, SAMPLE_RATE);
+	return true;
+}
+
+static uint32_t
+wav_backend_read_block(audio_backend *b, dsp_num *samples, uint32_t count) {
+	const uint64_t left = b->in.frames - b->in_pos;
+	const uint32_t n = (left < count) ? (uint32_t)left : count;
+
+	/* Only use the leftmost channel */
+	for(uint32_t i = 0; i < n; ++i) {
+		samples[i] = b->in.buffer[(b->in_pos + i) * b->in.channels];
+	}
+	b->in_pos += n;
+	return n;
+}
+
+static void
+wav_backend_write_block(audio_backend *b, const dsp_num *samples, uint32_t count) {
+	const uint64_t left = b->out.frames - b->out_pos;
+	const uint32_t n = (left < count) ? (uint32_t)left : count;
+
+	memcpy(b->out.buffer + b->out_pos, samples, n * sizeof(*samples));
+	b->out_pos += n;
+}
+
+static void
+wav_backend_close(audio_backend *b) {
+	b->out.frames = b->out_pos;
+	wav_write_or_warn(&b->out, b->out_path);
+
+	free(b->in.buffer);
+	free(b->out.buffer);
+}
+
+/* --- Raw PCM on stdin / stdout --- */
+
+static bool
+pcm_backend_open(audio_backend *b, const char *arg) {
+	(void)arg;
+
+	/* Keep stdout for the audio, and send everything else that would be
+	 * printed there to stderr */
+	fflush(stdout);
+	b->out_fd = dup(STDOUT_FILENO);
+	if(b->out_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		puts("could not move stdout out of the way for the pcm backend");
+		return false;
+	}
+	return true;
+}
+
+static uint32_t
+pcm_backend_read_block(audio_backend *b, dsp_num *samples, uint32_t count) {
+	(void)b;
+
+	int16_t pcm[256];
+	uint32_t got = 0;
+	while(got < count) {
+		const uint32_t want = (count - got < 256) ? count - got : 256;
+
+		/* Keep reading until we have whole samples, or the input ends */
+		size_t bytes = 0;
+		while(bytes < want * sizeof(*pcm)) {
+			const ssize_t r = read(STDIN_FILENO, (char*)pcm + bytes, want * sizeof(*pcm) - bytes);
+			if(r < 0 && errno == EINTR) continue;
+			if(r <= 0) break;
+			bytes += r;
+		}
+
+		const uint32_t n = bytes / sizeof(*pcm);
+		for(uint32_t i = 0; i < n; ++i) {
+			samples[got + i] = dsp_from_double(pcm[i] / 32768.0);
+		}
+		got += n;
+
+		if(n < want) break;
+	}
+	return got;
+}
+
+static void
+pcm_backend_write_block(audio_backend *b, const dsp_num *samples, uint32_t count) {
+	b->out_pos += count;
+
+	int16_t pcm[256];
+	while(count > 0) {
+		const uint32_t n = (count < 256) ? count : 256;
+		for(uint32_t i = 0; i < n; ++i) {
+			double s = dsp_to_float(samples[i]) * 32768.0;
+			if(s > 32767.0) s = 32767.0;
+			if(s < -32768.0) s = -32768.0;
+			pcm[i] = (int16_t)s;
+		}
+
+		size_t bytes = 0;
+		while(bytes < n * sizeof(*pcm)) {
+			const ssize_t w = write(b->out_fd, (char*)pcm + bytes, n * sizeof(*pcm) - bytes);
+			if(w < 0 && errno == EINTR) continue;
+			if(w <= 0) return; /* Nobody is listening any more */
+			bytes += w;
+		}
+
+		samples += n;
+		count -= n;
+	}
+}
+
+static void
+pcm_backend_close(audio_backend *b) {
+	close(b->out_fd);
+}
+
+/* --- Null --- */
+
+static bool
+null_backend_open(audio_backend *b, const char *arg) {
+	const int seconds = arg ? atoi(arg) : AUDIO_NULL_DEFAULT_SECONDS;
+	if(seconds <= 0) {
+		puts("the null backend takes a positive number of seconds: null:<seconds>");
+		return false;
+	}
+	b->null_frames = (uint64_t)seconds * SAMPLE_RATE;
+	return true;
+}
+
+static uint32_t
+null_backend_read_block(audio_backend *b, dsp_num *samples, uint32_t count) {
+	const uint64_t left = b->null_frames - b->in_pos;
+	const uint32_t n = (left < count) ? (uint32_t)left : count;
+
+	memset(samples, 0, n * sizeof(*samples));
+	b->in_pos += n;
+	return n;
+}
+
+static void
+null_backend_write_block(audio_backend *b, const dsp_num *samples, uint32_t count) {
+	(void)samples;
+	b->out_pos += count;
+}
+
+static const audio_backend_ops backend_ops[] = {
+	[AUDIO_BACKEND_PRU] = {
+		.name = "pru",
+		.realtime = true,
+		.open = pru_backend_open,
+		.start = pru_backend_start,
+		.read_block = pru_backend_read_block,
+		.write_block = pru_backend_write_block,
+		.latency = pru_backend_latency,
+		.input_pending = pru_backend_input_pending,
+		.take_stats = pru_backend_take_stats,
+	},
+	[AUDIO_BACKEND_WAV] = {
+		.name = "wav",
+		.open = wav_backend_open,
+		.read_block = wav_backend_read_block,
+		.write_block = wav_backend_write_block,
+		.close = wav_backend_close,
+	},
+	[AUDIO_BACKEND_PCM] = {
+		.name = "pcm",
+		.open = pcm_backend_open,
+		.read_block = pcm_backend_read_block,
+		.write_block = pcm_backend_write_block,
+		.close = pcm_backend_close,
+	},
+	[AUDIO_BACKEND_NULL] = {
+		.name = "null",
+		.open = null_backend_open,
+		.read_block = null_backend_read_block,
+		.write_block = null_backend_write_block,
+	},
+};
+
+#define BACKEND_COUNT (int)(sizeof(backend_ops) / sizeof(backend_ops[0]))
+
+bool
+audio_backend_open(audio_backend *b, const char *spec) {
+	memset(b, 0, sizeof(*b));
+	b->out_fd = -1;
+
+	const char *colon = strchr(spec, ':');
+	const size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+	for(int i = 0; i < BACKEND_COUNT; ++i) {
+		if(strlen(backend_ops[i].name) == len && !strncmp(spec, backend_ops[i].name, len)) {
+			b->kind = (audio_backend_kind)i;
+			b->ops = &backend_ops[i];
+			return b->ops->open(b, colon ? colon + 1 : NULL);
+		}
+	}
+
+	printf("unknown audio backend '%s'\n", spec);
+	audio_backend_print_help();
+	return false;
+}
+
+void
+audio_backend_start(audio_backend *b) {
+	b->start_ns = telemetry_now_ns();
+	if(b->ops->start) {
+		b->ops->start(b);
+	}
+}
+
+void
+audio_backend_close(audio_backend *b) {
+	/* Everything but the PRU runs as fast as it can, so say how fast */
+	if(!audio_backend_realtime(b)) {
+		const double elapsed = (telemetry_now_ns() - b->start_ns) * 1e-9;
+		const double audio = (double)b->out_pos / SAMPLE_RATE;
+		printf("%s backend: %llu samples in %.2f s, %.1fx real time\n",
+			b->ops->name, (unsigned long long)b->out_pos, elapsed,
+			elapsed > 0 ? audio / elapsed : 0.0);
+	}
+
+	if(b->ops->close) {
+		b->ops->close(b);
+	}
+}
+
+const char*
+audio_backend_name(audio_backend_kind kind) {
+	return backend_ops[kind].name;
+}
+
+void
+audio_backend_print_help(void) {
+	puts("audio=<backend>: where the modulator comes from and the output goes (default pru)\n"
+		"  pru: the PRU rings, in real time\n"
+		"  wav:<in.wav>,<out.wav>: a WAV file in, a WAV file out, as fast as possible\n"
+		"  pcm: raw 16 bit PCM on stdin and stdout, as fast as possible\n"
+		"  null[:seconds]: silence in, nothing out, to measure throughput (default 10 s)");
+}
@@ -0,0 +1,164 @@
+#ifndef AUDIO_BACKEND_H
+#define AUDIO_BACKEND_H
+
+#include "types.h"
+#include "dsp/dsp.h"
+#include "wav/wav.h"
+
+/* audio_backend.h: where main_app gets its modulator from and sends its output
+ * to. The PRU rings are the real thing; the others let the same loop run
+ * against files, as fast as it can, or in a shell pipeline.
+ *
+ * All of them move mono dsp_num samples at SAMPLE_RATE. */
+
+typedef enum {
+	/** The PRU audio rings (see pru_interface.h), in real time. Needs
+	 * hardware_init() or hardware_init_emulated() first. */
+	AUDIO_BACKEND_PRU,
+	/** Reads the modulator from a WAV file, and writes the output to another
+	 * when closed. "wav:<in.wav>,<out.wav>" */
+	AUDIO_BACKEND_WAV,
+	/** Raw signed 16 bit little endian PCM on stdin and stdout. Anything else
+	 * printed to stdout goes to stderr instead. "pcm" */
+	AUDIO_BACKEND_PCM,
+	/** Reads silence and throws the output away, to measure throughput.
+	 * "null[:seconds]" (default 10) */
+	AUDIO_BACKEND_NULL,
+} audio_backend_kind;
+
+/**
+ * What a backend has seen since the last audio_backend_take_stats(). Only the
+ * PRU backend has anything to report.
+ */
+typedef struct {
+	/* Time spent waiting for input and for room for output. */
+	uint64_t read_wait_ns;
+	uint64_t write_wait_ns;
+	/* Times the output was seen to have run dry. */
+	uint32_t underruns;
+} audio_backend_stats;
+
+typedef struct audio_backend audio_backend;
+
+/**
+ * The functions behind each kind of backend. Any of latency, input_pending
+ * and take_stats can be NULL, which means 0.
+ */
+typedef struct {
+	const char *name;
+
+	/* Whether samples move in real time. The others run as fast as they can,
+	 * so anything else timed against the audio has to count samples instead
+	 * of watching the clock. */
+	bool realtime;
+
+	/* Starts the backend. arg is what came after the colon in the spec, or
+	 * NULL. Returns false, after printing why, if it can't. */
+	bool (*open)(audio_backend *b, const char *arg);
+
+	/* Called just before the first block is read. Can be NULL. */
+	void (*start)(audio_backend *b);
+
+	/* Reads up to count samples, returning how many were read. Fewer than
+	 * count means the input has ended. */
+	uint32_t (*read_block)(audio_backend *b, dsp_num *samples, uint32_t count);
+
+	void (*write_block)(audio_backend *b, const dsp_num *samples, uint32_t count);
+
+	/* The number of samples written but not yet played. */
+	uint32_t (*latency)(audio_backend *b);
+
+	/* The number of samples that can be read without waiting. */
+	uint32_t (*input_pending)(audio_backend *b);
+
+	void (*take_stats)(audio_backend *b, audio_backend_stats *out);
+
+	void (*close)(audio_backend *b);
+} audio_backend_ops;
+
+struct audio_backend {
+	audio_backend_kind kind;
+	const audio_backend_ops *ops;
+
+	/* State for the file backends */
+	wav_io in;
+	wav_io out;
+	uint64_t in_pos;
+	uint64_t out_pos;
+	const char *out_path;
+
+	/* The PCM backend's output, moved off stdout */
+	int out_fd;
+
+	/* The null backend's length, and when it started */
+	uint64_t null_frames;
+	uint64_t start_ns;
+};
+
+/**
+ * Parses a backend spec, "<kind>[:<arg>]", and opens that backend. Returns
+ * false, after printing why, if the spec is bad or the backend won't open.
+ */
+bool audio_backend_open(audio_backend *b, const char *spec);
+
+/**
+ * Starts moving samples. Call this as close as possible to the first read, as
+ * the PRU backend resets its rings here; anything before that is latency.
+ */
+void audio_backend_start(audio_backend *b);
+
+/**
+ * Closes the backend, writing out anything it still holds (e.g. the WAV
+ * output).
+ */
+void audio_backend_close(audio_backend *b);
+
+/**
+ * Returns a short human-readable name for the kind, e.g. "wav".
+ */
+const char *audio_backend_name(audio_backend_kind kind);
+
+/**
+ * Prints the possible specs.
+ */
+void audio_backend_print_help(void);
+
+static inline bool
+audio_backend_realtime(const audio_backend *b) {
+	return b->ops->realtime;
+}
+
+static inline uint32_t
+audio_backend_read_block(audio_backend *b, dsp_num *samples, uint32_t count) {
+	return b->ops->read_block(b, samples, count);
+}
+
+static inline void
+audio_backend_write_block(audio_backend *b, const dsp_num *samples, uint32_t count) {
+	b->ops->write_block(b, samples, count);
+}
+
+static inline uint32_t
+audio_backend_latency(audio_backend *b) {
+	return b->ops->latency ? b->ops->latency(b) : 0;
+}
+
+static inline uint32_t
+audio_backend_input_pending(audio_backend *b) {
+	return b->ops->input_pending ? b->ops->input_pending(b) : 0;
+}
+
+/**
+ * Copies the stats into out, and resets them.
+ */
+static inline void
+audio_backend_take_stats(audio_backend *b, audio_backend_stats *out) {
+	if(b->ops->take_stats) {
+		b->ops->take_stats(b, out);
+	}
+	else {
+		*out = (audio_backend_stats){ 0 };
+	}
+}
+
+#endif
@@ -3,7 +3,7 @@
 #include "pru/pru_interface.h"
 #include "gpio.h"
 
-#include <stdio.h> /* For verbose */
+#include "log_ring.h" /* For verbose */
 
 #define INPUT_MAX 65536 /* NOTE: Must be synchronized with ADC_VIRTUAL_SAMPLES */
 
@@ -43,6 +43,23 @@ param_gain(uint32_t adc_value) {
 	return dsp_from_double(pow(0.9999, adc_value));
 }
 
+/* The inverses, for emulating the knobs. These only need to be close. */
+static double
+param_linear_inverse(dsp_num value) {
+	return (1.0 - dsp_to_float(value)) * INPUT_MAX;
+}
+
+static double
+param_tuning_inverse(dsp_num value) {
+	const double in = 6.0 * log2(dsp_to_float(value));
+	return (0.5 - in / 2) * INPUT_MAX;
+}
+
+static double
+param_gain_inverse(dsp_num value) {
+	return log(dsp_to_float(value)) / log(0.9999);
+}
+
 static int32_t multiplexer_idx = 0;
 
 static gpio_pin multiplex_0 = GPIO_PIN_INVALID;
@@ -53,20 +70,15 @@ static gpio_pin multiplex_3 = GPIO_PIN_INVALID;
 typedef struct {
 	uintptr_t    offset;
 	param_adc_fn fn;
+	double       (*inverse)(dsp_num value);
 } multiplex_seq_entry;
 
 #define ENTRY(member, the_fn) {\
 	.offset = offsetof(audio_params, member),\
-	.fn = the_fn\
+	.fn = the_fn,\
+	.inverse = the_fn ## _inverse\
 }
 
-/* NOTE: Do to a wiring error, these have been slightly adjusted
- * from the more natural values. */
-#define MULTIPLEX_PIN_0 67
-#define MULTIPLEX_PIN_1 26
-#define MULTIPLEX_PIN_2 44
-#define MULTIPLEX_PIN_3 68
-
 /* NOTE: These have been arranged in a particular order for the actual
  * physical implentation. */
 static multiplex_seq_entry
@@ -110,6 +122,15 @@ audio_params_init_multiplexer() {
 	multiplex_1 = gpio_open(MULTIPLEX_PIN_1, false);
 	multiplex_2 = gpio_open(MULTIPLEX_PIN_2, false);
 	multiplex_3 = gpio_open(MULTIPLEX_PIN_3, false);
+
+	/* Select the first knob, so that the first tick reads what it should */
+	multiplex_gpio_write();
+	pru_adc_reset(1);
+}
+
+bool
+audio_params_wait_multiplexer(uint64_t timeout_ns) {
+	return pru_adc_wait_sampled(1, timeout_ns);
 }
 
 void
@@ -123,7 +144,7 @@ audio_params_tick_multiplexer(audio_params *out, bool verbose) {
 	*out_ptr = seq->fn(input); /* All sequencer values are on channel 1 */
 
 	if(verbose) {
-		printf("audio params: [%02d | %02d]: read ADC value %d => param value %f\n", multiplexer_idx, seq->offset, input, dsp_to_float(*out_ptr));
+		log_ring_post(LOG_AUDIO_PARAM, 4, multiplexer_idx, (int32_t)seq->offset, input, *out_ptr);
 	}
 
 	/* Finally, update the sequencer so that the next tick will udpate the next value */
@@ -139,6 +160,22 @@ audio_params_tick_multiplexer(audio_params *out, bool verbose) {
 	pru_adc_reset(1);
 }
 
+int
+audio_params_knob_count() {
+	return SEQUENCER_LEN;
+}
+
+uint32_t
+audio_params_knob_reading(int index, const audio_params *ap) {
+	const multiplex_seq_entry *seq = &multiplex_sequencer[index];
+	const dsp_num value = *(const dsp_num*)((uintptr_t)ap + seq->offset);
+
+	const double reading = seq->inverse(value);
+	if(!(reading > 0)) return 0;
+	if(reading > INPUT_MAX - 1) return INPUT_MAX - 1;
+	return (uint32_t)(reading + 0.5);
+}
+
 void
 audio_params_default(audio_params *ap) {
 	const double fast = dsp_from_double(0.005);
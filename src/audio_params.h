@@ -9,6 +9,15 @@
 
 typedef dsp_num (*param_adc_fn)(uint32_t value);
 
+/* The GPIO pins that select which knob the multiplexer puts on ADC channel 1,
+ * lowest bit first.
+ * NOTE: Do to a wiring error, these have been slightly adjusted
+ * from the more natural values. */
+#define MULTIPLEX_PIN_0 67
+#define MULTIPLEX_PIN_1 26
+#define MULTIPLEX_PIN_2 44
+#define MULTIPLEX_PIN_3 68
+
 typedef struct {
 	dsp_num attack;
 	dsp_num decay;
@@ -43,4 +52,24 @@ void audio_params_init_multiplexer();
  */
 void audio_params_tick_multiplexer(audio_params *ap, bool verbose);
 
+/**
+ * Waits, for at most timeout_ns, until the ADC has read the knob the
+ * multiplexer was last switched to. Ticking on a clock leaves it time for
+ * that; anything ticking faster than real time has to wait for it instead.
+ * Returns false if it timed out.
+ */
+bool audio_params_wait_multiplexer(uint64_t timeout_ns);
+
+/**
+ * Returns the number of knobs behind the multiplexer.
+ */
+int audio_params_knob_count();
+
+/**
+ * Returns the ADC reading that the knob at the given multiplexer index would
+ * have to give for its parameter to come out as the one in ap. Used by the
+ * emulated hardware to stand in for the knobs.
+ */
+uint32_t audio_params_knob_reading(int index, const audio_params *ap);
+
 #endif
\ No newline at end of file
@@ -3,8 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "dsp/synth.h"
 #include "gpio.h"
+#include "log_ring.h"
 
 #define BUTTON(pin_number_val, note_val) { \
 	.gpio = GPIO_PIN_INVALID, \
@@ -111,33 +111,44 @@ button_update_debounce(button *b, bool *new_value) {
 	return false;
 }
 
-void button_tick(synth *syn, int which, bool verbose)
+button_change button_tick(int which, bool verbose)
 {
   //int16_t arr_length = sizeof(button_arr)/sizeof(button_arr[0]);
   //for (int i=0; i < arr_length; i++) {
 	bool curr_btn_read = false;
 	if(!button_update_debounce(&button_arr[which], &curr_btn_read)) {
 		/* If there is no valid state for the button, just skip it. */
-		return;
+		return BUTTON_NO_CHANGE;
 	}
 
 	if (curr_btn_read) {
 		if (!button_arr[which].pressed) { 
-			synth_press(syn, button_arr[which].note); 
 			if(verbose) {
-				printf("Button %d pressed\n", button_arr[which].pin_number);
+				log_ring_post(LOG_BUTTON_PRESSED, 1, button_arr[which].pin_number, 0, 0, 0);
 			}
 			button_arr[which].pressed = true;
+			return BUTTON_PRESSED;
 		}
 	}
 	else {
 		if ((button_arr[which].pressed)) {
-			synth_release(syn, button_arr[which].note); 
 			if(verbose) {
-				printf("Button %d released\n", button_arr[which].pin_number);
+				log_ring_post(LOG_BUTTON_RELEASED, 1, button_arr[which].pin_number, 0, 0, 0);
 			}
 			button_arr[which].pressed = false;
+			return BUTTON_RELEASED;
 		}
 	}
   //}
+	return BUTTON_NO_CHANGE;
+}
+
+int button_note(int which)
+{
+	return button_arr[which].note;
+}
+
+int button_pin_number(int which)
+{
+	return button_arr[which].pin_number;
 }
@@ -4,8 +4,6 @@
 #include "gpio.h"
 #include "types.h"
 
-#include "dsp/synth.h"
-
 #define BUTTON_DEBOUNCE 8
 #define BUTTON_DEBOUNCE_MAJORITY 8
 
@@ -25,10 +23,27 @@ typedef struct
 */
 void init_button_arr();
 
+typedef enum {
+	BUTTON_NO_CHANGE,
+	BUTTON_PRESSED,
+	BUTTON_RELEASED,
+} button_change;
+
 /**
  * Polls the specified button in the synth button array to detect if a button has been changed from released to pressed or vice versa
+ * Returns what changed. The note for the button is given by button_note().
 */
-void button_tick(synth *syn, int which, bool verbose);
+button_change button_tick(int which, bool verbose);
+
+/**
+ * Returns the synth note played by the specified button.
+ */
+int button_note(int which);
+
+/**
+ * Returns the GPIO pin the specified button is wired to.
+ */
+int button_pin_number(int which);
 
 #define BUTTON_COUNT 24 /* Must be up to date for polling buttons correctly */
 
@@ -0,0 +1,178 @@
+#include "control.h"
+
+#include <time.h>
+
+#include "app.h"
+#include "buttons.h"
+#include "dsp/dsp_perf.h"
+#include "log_ring.h"
+
+/* How often the control thread scans all of the buttons. With
+ * BUTTON_DEBOUNCE = 8 this gives 8ms of debouncing. */
+#define CONTROL_PERIOD_NS 1000000
+
+/* How many scans between each knob read. Each read only updates one knob, as
+ * the multiplexer needs time to settle on the next one. */
+#define CONTROL_PARAM_TICKS 4
+
+/* Set in control.middle when the snapshot there hasn't been taken yet. */
+#define CONTROL_PARAMS_FRESH 0x4
+
+void
+control_init(control *ctl, const audio_params *params, bool verbose) {
+	atomic_init(&ctl->head, 0);
+	atomic_init(&ctl->tail, 0);
+
+	for(int i = 0; i < 3; ++i) {
+		ctl->params[i] = *params;
+	}
+	ctl->back = 0;
+	atomic_init(&ctl->middle, 1);
+	ctl->front = 2;
+
+	ctl->knobs = *params;
+	ctl->param_tick = 0;
+	ctl->elapsed = 0;
+
+	atomic_init(&ctl->running, false);
+	ctl->verbose = verbose;
+}
+
+bool
+control_push_event(control *ctl, control_event_kind kind, int note) {
+	const uint32_t h = atomic_load_explicit(&ctl->head, memory_order_relaxed);
+	const uint32_t t = atomic_load_explicit(&ctl->tail, memory_order_acquire);
+	if(h - t >= CONTROL_QUEUE_SIZE) return false;
+
+	control_event *e = &ctl->events[h & (CONTROL_QUEUE_SIZE - 1)];
+	e->kind = kind;
+	e->note = note;
+	atomic_store_explicit(&ctl->head, h + 1, memory_order_release);
+	return true;
+}
+
+void
+control_publish_params(control *ctl, const audio_params *params) {
+	ctl->params[ctl->back] = *params;
+
+	/* Swap our buffer into the middle, and take whatever was there. */
+	const uint32_t old = atomic_exchange_explicit(&ctl->middle,
+		ctl->back | CONTROL_PARAMS_FRESH, memory_order_acq_rel);
+	ctl->back = old & ~CONTROL_PARAMS_FRESH;
+}
+
+void
+control_apply(control *ctl, synth *syn, audio_params *params) {
+	uint32_t t = atomic_load_explicit(&ctl->tail, memory_order_relaxed);
+	const uint32_t h = atomic_load_explicit(&ctl->head, memory_order_acquire);
+	for(; t != h; ++t) {
+		const control_event *e = &ctl->events[t & (CONTROL_QUEUE_SIZE - 1)];
+		if(e->kind == CONTROL_NOTE_ON) {
+			synth_press(syn, e->note);
+		}
+		else {
+			synth_release(syn, e->note);
+		}
+	}
+	atomic_store_explicit(&ctl->tail, t, memory_order_release);
+
+	if(atomic_load_explicit(&ctl->middle, memory_order_relaxed) & CONTROL_PARAMS_FRESH) {
+		const uint32_t old = atomic_exchange_explicit(&ctl->middle, ctl->front, memory_order_acq_rel);
+		ctl->front = old & ~CONTROL_PARAMS_FRESH;
+		*params = ctl->params[ctl->front];
+	}
+}
+
+static void
+control_push_or_wait(control *ctl, control_event_kind kind, int note) {
+	/* Dropping a note off would leave the note stuck, so wait for the DSP
+	 * thread to make room instead. We're not the real-time thread. */
+	while(!control_push_event(ctl, kind, note)) {
+		if(!atomic_load(&ctl->running)) return;
+
+		struct timespec ts = { .tv_sec = 0, .tv_nsec = CONTROL_PERIOD_NS };
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* One scan of the buttons, and every CONTROL_PARAM_TICKS scans, of one knob.
+ * With settle, the knob is only read once the ADC has caught up with the
+ * multiplexer, for when the scans come faster than the clock would have them. */
+static void
+control_tick(control *ctl, bool settle) {
+	for(int i = 0; i < BUTTON_COUNT; ++i) {
+		switch(button_tick(i, ctl->verbose)) {
+		case BUTTON_PRESSED:
+			control_push_or_wait(ctl, CONTROL_NOTE_ON, button_note(i));
+			break;
+		case BUTTON_RELEASED:
+			control_push_or_wait(ctl, CONTROL_NOTE_OFF, button_note(i));
+			break;
+		default:
+			break;
+		}
+	}
+
+	ctl->param_tick += 1;
+	if(ctl->param_tick >= CONTROL_PARAM_TICKS) {
+		ctl->param_tick = 0;
+		if(settle) {
+			audio_params_wait_multiplexer((uint64_t)CONTROL_PARAM_TICKS * CONTROL_PERIOD_NS);
+		}
+		audio_params_tick_multiplexer(&ctl->knobs, false);
+		control_publish_params(ctl, &ctl->knobs);
+	}
+}
+
+static void*
+control_thread(void *arg) {
+	control *ctl = arg;
+
+	log_ring_set_channel(LOG_CHANNEL_CONTROL);
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while(atomic_load(&ctl->running)) {
+		control_tick(ctl, false);
+
+		next.tv_nsec += CONTROL_PERIOD_NS;
+		if(next.tv_nsec >= 1000000000) {
+			next.tv_sec += 1;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return NULL;
+}
+
+void
+control_advance(control *ctl, synth *syn, audio_params *params, uint32_t samples) {
+	/* Kept in nanoseconds times SAMPLE_RATE, so nothing is lost to rounding */
+	const uint64_t period = (uint64_t)CONTROL_PERIOD_NS * SAMPLE_RATE;
+	ctl->elapsed += (uint64_t)samples * 1000000000ull;
+	while(ctl->elapsed >= period) {
+		ctl->elapsed -= period;
+
+		/* Applied after every scan, as nothing else empties the queue */
+		control_tick(ctl, true);
+		control_apply(ctl, syn, params);
+	}
+}
+
+void
+control_start(control *ctl) {
+	atomic_store(&ctl->running, true);
+	if(pthread_create(&ctl->thread, NULL, control_thread, ctl) != 0) {
+		app_fatal_error("could not start the control thread");
+	}
+}
+
+void
+control_stop(control *ctl) {
+	if(!atomic_load(&ctl->running)) return;
+
+	atomic_store(&ctl->running, false);
+	pthread_join(ctl->thread, NULL);
+}
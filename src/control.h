@@ -0,0 +1,112 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "types.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "audio_params.h"
+#include "dsp/synth.h"
+
+/* control.h: the control side of main_app. A control thread scans the buttons
+ * and knobs, and hands the results to the DSP thread without any locks: note
+ * events go through a single-producer single-consumer queue, and the knob
+ * values are published as whole audio_params snapshots through a triple
+ * buffer. The DSP thread picks both up at block boundaries with
+ * control_apply(). When the audio runs faster than real time, the DSP thread
+ * does the scanning itself instead, with control_advance(). */
+
+/* Must be a power of two. */
+#define CONTROL_QUEUE_SIZE 64
+
+typedef enum {
+	CONTROL_NOTE_ON,
+	CONTROL_NOTE_OFF,
+} control_event_kind;
+
+typedef struct {
+	int16_t kind;
+	int16_t note;
+} control_event;
+
+typedef struct {
+	/* Note events, with free-running indices. head is only written by the
+	 * control thread and tail only by the DSP thread. */
+	control_event events[CONTROL_QUEUE_SIZE];
+	_Alignas(64) atomic_uint head;
+	_Alignas(64) atomic_uint tail;
+
+	/* The audio_params triple buffer. The control thread owns params[back],
+	 * the DSP thread owns params[front], and middle holds the index of the
+	 * third, along with CONTROL_PARAMS_FRESH if it was published since the DSP
+	 * thread last took it. */
+	_Alignas(64) audio_params params[3];
+	_Alignas(64) atomic_uint middle;
+	int back;
+	int front;
+
+	/* Whether the thread should keep going, separately from app_running so
+	 * that it can be stopped on its own. */
+	atomic_bool running;
+	pthread_t thread;
+
+	/* The control side's own copy of the knobs, which is published whole,
+	 * and how many scans it has been since the last knob was read. */
+	audio_params knobs;
+	int param_tick;
+
+	/* For control_advance(): the time not yet scanned for, in nanoseconds
+	 * times SAMPLE_RATE. */
+	uint64_t elapsed;
+
+	/* Whether to log button presses and releases. */
+	bool verbose;
+} control;
+
+/**
+ * Sets up the queue and the triple buffer, with every snapshot set to params.
+ */
+void control_init(control *ctl, const audio_params *params, bool verbose);
+
+/**
+ * Starts the control thread, which scans the buttons and knobs until
+ * control_stop() is called. The buttons and the multiplexer must already be
+ * initialized.
+ */
+void control_start(control *ctl);
+
+/**
+ * Instead of control_start(), for audio that doesn't move in real time (see
+ * audio_backend_realtime()): scans the buttons and knobs on the calling
+ * thread, as often as the control thread would over the given number of
+ * samples, and applies the results as control_apply() does. This way the
+ * debouncing and the knobs keep time with the audio, and the same input gives
+ * the same output every run.
+ */
+void control_advance(control *ctl, synth *syn, audio_params *params, uint32_t samples);
+
+/**
+ * Stops the control thread and waits for it to exit. Does nothing if it was
+ * never started.
+ */
+void control_stop(control *ctl);
+
+/**
+ * Control thread side: queues a note event. Returns false if the queue is full.
+ */
+bool control_push_event(control *ctl, control_event_kind kind, int note);
+
+/**
+ * Control thread side: publishes a new audio_params snapshot.
+ */
+void control_publish_params(control *ctl, const audio_params *params);
+
+/**
+ * DSP thread side: presses and releases every queued note on the synth, and
+ * copies the latest audio_params snapshot into params if there is a new one.
+ * Never blocks.
+ */
+void control_apply(control *ctl, synth *syn, audio_params *params);
+
+#endif
@@ -42,13 +42,13 @@ typedef struct {
 } complex_pair;
 
 typedef struct {
-	pole_zero_pair poles[NUM_STAGES / 2];
+	pole_zero_pair poles[BPF_MAX_STAGES / 2];
 	double w;
 	double gain;
 } analog_layout;
 
 typedef struct {
-	pole_zero_pair poles[NUM_STAGES];
+	pole_zero_pair poles[BPF_MAX_STAGES];
 	double w;
 	double gain;
 } digital_layout;
@@ -84,10 +84,10 @@ norm(complex c) {
 }
 
 static void
-analog_design(analog_layout *analog) {
+analog_design(analog_layout *analog, int stages) {
 	/* Appears to perform the analog filter design. */
-	const double n2 = 2 * NUM_STAGES;
-	const int pairs = NUM_STAGES / 2;
+	const double n2 = 2 * stages;
+	const int pairs = stages / 2;
 	for (int i = 0; i < pairs; ++i)
 	{
 		complex pole = polar(1., pi2 + (2 * i + 1) * pi / n2);
@@ -128,7 +128,7 @@ bp_transform_pair(complex c, double b, double a2, double b2, double ab_2) {
 }
 
 static void
-band_pass_transform(analog_layout *analog, digital_layout *digital, double fc, double fw) {
+band_pass_transform(analog_layout *analog, digital_layout *digital, double fc, double fw, int stages) {
 	if (!(fc < 0.5)) app_fatal_error("filter design bug: fc must be < 0.5");
 	if (fc < 0.0)    app_fatal_error("filter design bug: fc must be >= 0.0");
 	
@@ -152,7 +152,7 @@ band_pass_transform(analog_layout *analog, digital_layout *digital, double fc, d
 	double ab = a * b;
 	double ab_2 = 2 * ab;
 	
-	const int numPoles = NUM_STAGES;
+	const int numPoles = stages;
 	const int pairs = numPoles / 2;
 	for (int i = 0; i < pairs; ++i)
 	{
@@ -229,7 +229,7 @@ bq_from_pzp(double_biquad *bq, pole_zero_pair *pzp) {
 }
 
 static complex
-cbq_response(bpf_cascaded_biquad *cbq, double_biquad *dbqs, double normalized_frequency) {
+cbq_response(double_biquad *dbqs, int stages, double normalized_frequency) {
 	if(normalized_frequency > 0.5) app_fatal_error("filter design bug: normalized_frequency must be <= 0.5");
 	if(normalized_frequency < 0.0) app_fatal_error("filter design bug: normalized_frequency must be >= 0.0");
 
@@ -239,7 +239,7 @@ cbq_response(bpf_cascaded_biquad *cbq, double_biquad *dbqs, double normalized_fr
 	complex ch = 1.0;
 	complex cbot = 1.0;
 
-	for (int i = 0; i < NUM_STAGES; ++i) {
+	for (int i = 0; i < stages; ++i) {
 		double_biquad *bq = &dbqs[i];
 
 		complex cb = 1.0;
@@ -269,27 +269,269 @@ bq_from_dbq(bpf_biquad *bq, double_biquad *dbq) {
 	//bq->b2 = dsp_from_double(dbq->b2);
 }
 
+/* The number of frequencies we check for the peak gain of each stage, when
+ * staging the gain of a cascade (here and in bpf_bank_q15_set_band). */
+#define BPF_GAIN_SWEEP 4096
+
+/* The peak gain we aim for at the output of every stage but the last of a
+ * dsp_num cascade with staged gain. Stages whose peak sits near the input
+ * level lose the least to rounding, and this leaves plenty of headroom. */
+#define BPF_STAGE_PEAK 0.5
+
+/* The response of stage s of a cascade, with b = {1, +-2, 1} and the given a
+ * coefficients. */
+static complex
+bpf_stage_response(int s, double a1, double a2, double f) {
+	const complex z1 = polar(1., -2 * pi * f);
+	const complex z2 = z1 * z1;
+	const double b1 = (s & 1) ? -2 : 2;
+
+	return (1 + b1 * z1 + z2) / (1 + a1 * z1 + a2 * z2);
+}
+
+/* Stage by stage, picks the input gain that brings the peak of the cascade so
+ * far to BPF_STAGE_PEAK, and for the last stage, the gain that brings the
+ * response at fc to BPF_STAGED_GAIN. The gains are worked out with the
+ * quantized coefficients, and the quantized gains. Every gain but the first is
+ * stored shifted down by BPF_STAGE_GAIN_SHIFT. */
+static void
+bpf_stage_gains(bpf_cascaded_biquad *cbq, double fc) {
+	const double one = (double)dsp_one;
+
+	/* The magnitude response of the cascade so far, with the gains so far. */
+	double prev[BPF_GAIN_SWEEP];
+	for(int k = 0; k < BPF_GAIN_SWEEP; ++k) {
+		prev[k] = 1.0;
+	}
+	double center = 1.0;
+
+	for(int s = 0; s < cbq->stages; ++s) {
+		const double a1 = cbq->biquads[s].a1 / one;
+		const double a2 = cbq->biquads[s].a2 / one;
+
+		double peak = 0;
+		for(int k = 0; k < BPF_GAIN_SWEEP; ++k) {
+			const double f = (k + 0.5) / (2.0 * BPF_GAIN_SWEEP);
+			prev[k] *= cabs(bpf_stage_response(s, a1, a2, f));
+			if(prev[k] > peak) peak = prev[k];
+		}
+		center *= cabs(bpf_stage_response(s, a1, a2, fc));
+
+		const double target = (s < cbq->stages - 1) ? BPF_STAGE_PEAK / peak : BPF_STAGED_GAIN / center;
+		const int shift = (s == 0) ? 0 : BPF_STAGE_GAIN_SHIFT;
+		if(target >= (4 << shift)) {
+			app_fatal_error("bpf: band is too wide for staged gain");
+		}
+		const dsp_num gain = dsp_from_double(target / (1 << shift));
+		if(gain < BPF_MIN_SCALE) {
+			app_fatal_error("bpf: band is too narrow for this many stages (a stage gain underflows); use fewer bands or stages");
+		}
+
+		if(s == 0) cbq->scale = gain;
+		else cbq->stage_gain[s] = gain;
+
+		const double actual = gain / one * (1 << shift);
+		for(int k = 0; k < BPF_GAIN_SWEEP; ++k) {
+			prev[k] *= actual;
+		}
+		center *= actual;
+	}
+}
+
 void
-design_bpf(bpf_cascaded_biquad *cbq, double fc, double fw) {
+design_bpf(bpf_cascaded_biquad *cbq, double fc, double fw, int stages) {
+	if(stages < 2 || stages > BPF_MAX_STAGES || (stages & 1)) {
+		app_fatal_error("bpf: the number of stages must be even, and between 2 and BPF_MAX_STAGES");
+	}
+
 	analog_layout analog = {0};
 	digital_layout digital = {0};
-	analog_design(&analog);
+	analog_design(&analog, stages);
 
-	double_biquad d_biquads[NUM_STAGES] = {0};
+	double_biquad d_biquads[BPF_MAX_STAGES] = {0};
 
-	band_pass_transform(&analog, &digital, fc, fw);
+	band_pass_transform(&analog, &digital, fc, fw, stages);
 
-	for(int i = 0; i < NUM_STAGES; ++i) {
+	for(int i = 0; i < stages; ++i) {
 		bq_from_pzp(&d_biquads[i], &digital.poles[i]);
 	}
 
-	double response = sqrt(norm(cbq_response(cbq, d_biquads, digital.w / (2 * pi))));
+	cbq->stages = stages;
+	for(int i = 0; i < stages; ++i) {
+		bq_from_dbq(&cbq->biquads[i], &d_biquads[i]);
+		cbq->stage_gain[i] = 0;
+	}
+
+	if(bpf_staged_gain(stages)) {
+		bpf_stage_gains(cbq, digital.w / (2 * pi));
+		return;
+	}
+
+	double response = sqrt(norm(cbq_response(d_biquads, stages, digital.w / (2 * pi))));
 
 	/* Scale will be applied separately. Do not apply the scale to the coefficients
 	 * directly like IIR1 does. This ensures we get higher precision later. */
 	cbq->scale = dsp_from_double(digital.gain / response);
 
-	for(int i = 0; i < NUM_STAGES; ++i) {
-		bq_from_dbq(&cbq->biquads[i], &d_biquads[i]);
+	/* The whole attenuation of the cascade is in the scale, which shrinks
+	 * roughly as fw^stages. Past this point the rounding of the scale alone is
+	 * a gain error of several percent, and soon after it rounds to 0 and the
+	 * band is silent. (This is why longer cascades stage their gain.) */
+	if(cbq->scale < BPF_MIN_SCALE) {
+		app_fatal_error("bpf: band is too narrow for this many stages (the scale underflows); use fewer bands or stages");
+	}
+}
+void
+bpf_bank_init(bpf_bank *bank, int bands, int stages) {
+	if(bands > BPF_BANK_MAX_BANDS) app_fatal_error("bpf_bank: too many bands");
+	if(stages > BPF_MAX_STAGES) app_fatal_error("bpf_bank: too many stages");
+
+	memset(bank, 0, sizeof(*bank));
+	bank->bands = (bands + BPF_BANK_LANES - 1) / BPF_BANK_LANES * BPF_BANK_LANES;
+	bank->stages = stages;
+}
+
+void
+bpf_bank_set_band(bpf_bank *bank, int band, const bpf_cascaded_biquad *cbq) {
+	if(cbq->stages != bank->stages) app_fatal_error("bpf_bank: band has the wrong number of stages");
+
+	for(int i = 0; i < bank->stages; ++i) {
+		bank->a1[i][band] = cbq->biquads[i].a1;
+		bank->a2[i][band] = cbq->biquads[i].a2;
+		bank->gain[i][band] = cbq->stage_gain[i];
+
+		bank->y1[i][band] = 0;
+		bank->y2[i][band] = 0;
+	}
+	bank->scale[band] = cbq->scale;
+}
+
+/* The bound we aim for on the output of each stage of a bpf_bank_q15, for any
+ * input in [-1, 1]: the sum of the absolute values of the impulse response of
+ * the cascade up to that stage. The stage accumulators hold Q30 in 32 bits, so
+ * they wrap beyond 2.0. Between 1.0 and 2.0 the output just saturates, which
+ * takes an input close to the worst case (a full scale square wave at the
+ * center of the band only gets to about 4/pi times the peak gain). */
+#define BPF_Q15_STAGE_BOUND 1.5
+
+/* Where the stage accumulators of a bpf_bank_q15 wrap. */
+#define BPF_Q15_ACC_LIMIT 2.0
+
+/* The number of samples of the impulse response summed up for the bound. The
+ * narrowest bands of the default vocoder have decayed well before this. */
+#define BPF_Q15_IMPULSE_LENGTH 8192
+
+/* Works out, for every stage of a bpf_bank_q15 band with the given
+ * (quantized) coefficients, the sum of the absolute values of the impulse
+ * response of the cascade up to that stage, with every stage gain at 1. The
+ * gains just scale these, so the sums with the real gains follow from them. */
+static void
+bpf_q15_impulse_l1(const double *a1, const double *a2, int stages, double *l1) {
+	double x1[BPF_MAX_STAGES] = { 0 };
+	double x2[BPF_MAX_STAGES] = { 0 };
+	double y1[BPF_MAX_STAGES] = { 0 };
+	double y2[BPF_MAX_STAGES] = { 0 };
+
+	for(int s = 0; s < stages; ++s) {
+		l1[s] = 0;
+	}
+
+	for(int n = 0; n < BPF_Q15_IMPULSE_LENGTH; ++n) {
+		double x = (n == 0) ? 1.0 : 0.0;
+		for(int s = 0; s < stages; ++s) {
+			const double b1 = (s & 1) ? -2 : 2;
+			const double y = x + b1 * x1[s] + x2[s] - a1[s] * y1[s] - a2[s] * y2[s];
+
+			x2[s] = x1[s];
+			x1[s] = x;
+			y2[s] = y1[s];
+			y1[s] = y;
+			l1[s] += fabs(y);
+			x = y;
+		}
+	}
+}
+
+void
+bpf_bank_q15_init(bpf_bank_q15 *bank, int bands, int stages) {
+	if(bands > BPF_BANK_MAX_BANDS) app_fatal_error("bpf_bank_q15: too many bands");
+	if(stages > BPF_MAX_STAGES) app_fatal_error("bpf_bank_q15: too many stages");
+
+	memset(bank, 0, sizeof(*bank));
+	bank->bands = (bands + BPF_BANK_Q15_LANES - 1) / BPF_BANK_Q15_LANES * BPF_BANK_Q15_LANES;
+	bank->stages = stages;
+}
+
+void
+bpf_bank_q15_set_band(bpf_bank_q15 *bank, int band, const bpf_cascaded_biquad *cbq) {
+	if(cbq->stages != bank->stages) app_fatal_error("bpf_bank_q15: band has the wrong number of stages");
+
+	const int stages = bank->stages;
+	const double one = (double)dsp_one;
+
+	/* The quantized coefficients. All of the responses below use these, so
+	 * that the gains account for the quantization. */
+	double a1[BPF_MAX_STAGES];
+	double a2[BPF_MAX_STAGES];
+	for(int s = 0; s < stages; ++s) {
+		bank->na1h[s][band] = dsp_q15_from_double(-cbq->biquads[s].a1 / one / 2);
+		bank->na2[s][band]  = dsp_q15_from_double(-cbq->biquads[s].a2 / one);
+
+		a1[s] = -bank->na1h[s][band] / 32768.0 * 2;
+		a2[s] = -bank->na2[s][band] / 32768.0;
+	}
+
+	/* The magnitude response of the cascade so far, with the gains so far. */
+	double prev[BPF_GAIN_SWEEP];
+	for(int k = 0; k < BPF_GAIN_SWEEP; ++k) {
+		prev[k] = 1.0;
+	}
+
+	/* Stage by stage, pick the gain that brings the bound on the output of the
+	 * cascade so far to BPF_Q15_STAGE_BOUND. Spreading the gain out like this
+	 * (instead of applying all of it at the input, like the default dsp_num
+	 * cascade) keeps every stage's state near full scale, where the rounding
+	 * matters least. */
+	double l1[BPF_MAX_STAGES];
+	bpf_q15_impulse_l1(a1, a2, stages, l1);
+
+	double gain_so_far = 1.0;
+	int peak_k = 0;
+	for(int s = 0; s < stages; ++s) {
+		const dsp_q15 gain = dsp_q15_from_double(BPF_Q15_STAGE_BOUND / (l1[s] * gain_so_far));
+		if(gain < 1) app_fatal_error("bpf_bank_q15: band is too narrow for Q15");
+		gain_so_far *= gain / 32768.0;
+		if(l1[s] * gain_so_far >= BPF_Q15_ACC_LIMIT) app_fatal_error("bpf_bank_q15: a stage can overflow its accumulator");
+		bank->gain[s][band] = gain;
+
+		double peak = 0;
+		for(int k = 0; k < BPF_GAIN_SWEEP; ++k) {
+			const double f = (k + 0.5) / (2.0 * BPF_GAIN_SWEEP);
+			prev[k] *= cabs(bpf_stage_response(s, a1[s], a2[s], f)) * gain / 32768.0;
+			if(prev[k] > peak) {
+				peak = prev[k];
+				peak_k = k;
+			}
+		}
+	}
+
+	/* Match the level of the dsp_num cascade at the peak of the Q15 one. The
+	 * dsp_num cascade applies scale to the first stage, and either an input
+	 * gain of 2 (see bpf_input_gains in bpf_impl.c) or its stage gain to every
+	 * other stage. */
+	const double f = (peak_k + 0.5) / (2.0 * BPF_GAIN_SWEEP);
+	double ref = cbq->scale / one;
+	for(int s = 0; s < stages; ++s) {
+		ref *= cabs(bpf_stage_response(s, cbq->biquads[s].a1 / one, cbq->biquads[s].a2 / one, f));
+		if(s > 0) ref *= bpf_staged_gain(stages) ? cbq->stage_gain[s] / one * (1 << BPF_STAGE_GAIN_SHIFT) : 2;
 	}
-}
\ No newline at end of file
+
+	const double out_scale = ref / prev[peak_k];
+	bank->out_scale[band] = (int32_t)lround(out_scale * (1 << BPF_Q15_OUT_SCALE_BITS));
+
+	for(int s = 0; s < stages; ++s) {
+		bank->y1[s][band] = 0;
+		bank->y2[s][band] = 0;
+		bank->r1[s][band] = 0;
+	}
+}
@@ -7,6 +7,8 @@ extern "C" {
 
 #include "dsp.h"
 
+#include <stdbool.h>
+
 typedef struct {
 	/* All coefficients normalized by a0 */
 
@@ -22,15 +24,194 @@ typedef struct {
 	dsp_num a2;
 } bpf_biquad;
 
-/* Note: NUM_STAGES *must* be even */
-#define NUM_STAGES 4
+/* The number of biquad stages in each band pass filter is chosen at design
+ * time. It *must* be even, and between 2 and BPF_MAX_STAGES. */
+#define BPF_MAX_STAGES 6
+
+/* The number of stages used unless configured otherwise. */
+#define BPF_DEFAULT_STAGES 4
+
+/* Cascades with up to this many stages apply all of their attenuation to the
+ * input of the first stage (scale), and a fixed gain of 2 to the input of every
+ * other stage (bpf_input_gains in bpf_impl.c). Past this, the attenuation is
+ * too much for one dsp_num: it shrinks roughly as fw^stages, and rounds to 0
+ * for all but the widest bands. Those cascades stage their gain instead, with
+ * a dsp_num gain at the input of every stage (see stage_gain below). */
+#define BPF_SCALE_MAX_STAGES 4
+
+/* The passband gain of a cascade with staged gain: the same as the default
+ * cascade (2^(BPF_DEFAULT_STAGES - 1)), so that it comes out at the same
+ * level. */
+#define BPF_STAGED_GAIN 8.0
+
+/* The stage gains of a cascade with staged gain are stored shifted down by
+ * this many bits, as the last stage can need a gain beyond the range of a
+ * dsp_num: odd stages have their zeros at DC, so in the low bands they
+ * attenuate even at the center frequency, and the last one has to make up the
+ * whole passband gain. */
+#define BPF_STAGE_GAIN_SHIFT 3
+
+static inline bool
+bpf_staged_gain(int stages) {
+	return stages > BPF_SCALE_MAX_STAGES;
+}
 
 typedef struct {
-	bpf_biquad biquads[NUM_STAGES];
-	dsp_num    y_array[NUM_STAGES][3];
+	bpf_biquad biquads[BPF_MAX_STAGES];
+	dsp_num    y_array[BPF_MAX_STAGES][3];
 	dsp_num    scale;
+
+	/* The number of stages actually in use. */
+	int        stages;
+
+	/* With staged gain, the gain applied to the input of each stage s >= 1,
+	 * in place of bpf_input_gains[s], divided by 2^BPF_STAGE_GAIN_SHIFT. (Stage
+	 * 0 uses scale either way.) Unused otherwise. */
+	dsp_num    stage_gain[BPF_MAX_STAGES];
+
+	/* The state for the Transposed Direct Form II update functions. Only two
+	 * words per stage, and nothing needs to be shifted between samples. Not
+	 * used by the Direct Form I functions. */
+	dsp_num    tdf2_state[BPF_MAX_STAGES][2];
 } bpf_cascaded_biquad;
 
-void design_bpf(bpf_cascaded_biquad *cbq, double fc, double fw);
+/* The maximum number of bands in a bpf_bank. Must be a multiple of
+ * BPF_BANK_LANES. */
+#define BPF_BANK_MAX_BANDS 40
+
+/* The bands in a bpf_bank are padded up to a multiple of this, so that the
+ * band loop always covers whole SIMD registers (8 x 32-bit on AVX2). */
+#define BPF_BANK_LANES 8
+
+/**
+ * A structure-of-arrays filterbank: the same cascade as bpf_cascaded_biquad,
+ * but for many bands at once. For each stage, the coefficients and state of
+ * every band are stored contiguously, so that a single update step can advance
+ * several bands in SIMD lanes.
+ * 
+ * Padding bands have all-zero coefficients and scale, so they always output 0.
+ */
+typedef struct {
+	dsp_num a1[BPF_MAX_STAGES][BPF_BANK_MAX_BANDS];
+	dsp_num a2[BPF_MAX_STAGES][BPF_BANK_MAX_BANDS];
+	dsp_num scale[BPF_BANK_MAX_BANDS];
+
+	/* The stage_gain of each band, for staged gain. */
+	dsp_num gain[BPF_MAX_STAGES][BPF_BANK_MAX_BANDS];
+
+	/* y[n-1] and y[n-2] for each stage. (The input history of each stage is
+	 * the output history of the previous one, so this is all the state.) */
+	dsp_num y1[BPF_MAX_STAGES][BPF_BANK_MAX_BANDS];
+	dsp_num y2[BPF_MAX_STAGES][BPF_BANK_MAX_BANDS];
+
+	/* The number of bands actually updated, rounded up to BPF_BANK_LANES. */
+	int bands;
+
+	/* The number of stages in every band. */
+	int stages;
+} bpf_bank;
+
+/* The bands in a bpf_bank_q15 are padded up to a multiple of this (16 x 16-bit
+ * on AVX2). */
+#define BPF_BANK_Q15_LANES 16
+
+/* The maximum number of bands in a bpf_bank_q15: BPF_BANK_MAX_BANDS, rounded up
+ * to BPF_BANK_Q15_LANES. */
+#define BPF_BANK_Q15_MAX_BANDS 48
+
+/* The number of fractional bits in bpf_bank_q15.out_scale. */
+#define BPF_Q15_OUT_SCALE_BITS 23
+
+/**
+ * A reduced precision version of bpf_bank, with 16-bit (dsp_q15) coefficients
+ * and state, and a 32-bit accumulator inside each stage. This fits twice as
+ * many bands into each SIMD register, at the cost of noise: see
+ * bpf_bank_q15_set_band for how the gain is staged to keep the noise down.
+ *
+ * The input is the dsp_num input shifted down to Q15 (see bpf_q15_from_dsp),
+ * and each band's output is converted back to the same
+ * level as the bpf_bank output with out_scale (see bpf_q15_to_dsp).
+ */
+typedef struct {
+	/* -a1 / 2 (a1 itself does not fit), and -a2. Negated so that every term
+	 * of the update is a multiply-add. */
+	dsp_q15 na1h[BPF_MAX_STAGES][BPF_BANK_Q15_MAX_BANDS];
+	dsp_q15 na2[BPF_MAX_STAGES][BPF_BANK_Q15_MAX_BANDS];
+
+	/* The gain applied to the input of each stage. This takes the place of the
+	 * scale and the input gains of the dsp_num cascade. */
+	dsp_q15 gain[BPF_MAX_STAGES][BPF_BANK_Q15_MAX_BANDS];
+
+	/* y[n-1] and y[n-2] for each stage, the same as bpf_bank. */
+	dsp_q15 y1[BPF_MAX_STAGES][BPF_BANK_Q15_MAX_BANDS];
+	dsp_q15 y2[BPF_MAX_STAGES][BPF_BANK_Q15_MAX_BANDS];
+
+	/* The part of each stage's last sum below the LSB of y, which is added
+	 * back into the next sum (see bpf_bank_q15_update). */
+	dsp_q15 r1[BPF_MAX_STAGES][BPF_BANK_Q15_MAX_BANDS];
+
+	/* Converts the output of each band back to dsp_num, with
+	 * BPF_Q15_OUT_SCALE_BITS fractional bits. */
+	int32_t out_scale[BPF_BANK_Q15_MAX_BANDS];
+
+	/* The number of bands actually updated, rounded up to BPF_BANK_Q15_LANES. */
+	int bands;
+
+	/* The number of stages in every band. */
+	int stages;
+} bpf_bank_q15;
+
+/* The smallest scale (or stage gain) design_bpf accepts, in dsp_num units. */
+#define BPF_MIN_SCALE 16
+
+/**
+ * Designs a Butterworth band pass filter with the given center frequency and
+ * width (normalized to the sample rate), as a cascade of the given number of
+ * biquad stages. Exits with a fatal error if the band is too narrow for its
+ * gains to be represented (see BPF_MIN_SCALE).
+ */
+void design_bpf(bpf_cascaded_biquad *cbq, double fc, double fw, int stages);
+
+/**
+ * Clears the given filterbank and sizes it for the given number of bands and
+ * stages.
+ */
+void bpf_bank_init(bpf_bank *bank, int bands, int stages);
+
+/**
+ * Copies the coefficients of a designed cascade into one band of the bank.
+ */
+void bpf_bank_set_band(bpf_bank *bank, int band, const bpf_cascaded_biquad *cbq);
+
+/**
+ * Clears the given Q15 filterbank and sizes it for the given number of bands and
+ * stages.
+ */
+void bpf_bank_q15_init(bpf_bank_q15 *bank, int bands, int stages);
+
+/**
+ * Quantizes the coefficients of a designed cascade into one band of the Q15
+ * bank, and works out the gain for each stage. Exits with a fatal error if the
+ * band is too narrow to be represented in Q15.
+ */
+void bpf_bank_q15_set_band(bpf_bank_q15 *bank, int band, const bpf_cascaded_biquad *cbq);
+
+/**
+ * Converts a dsp_num filter input to the Q15 input of a bpf_bank_q15. Inputs
+ * outside of [-1, 1) are clipped.
+ */
+static inline dsp_q15
+bpf_q15_from_dsp(dsp_num x) {
+	return dsp_q15_sat(x >> (DSP_POINT_IDX - 15));
+}
+
+/**
+ * Converts the output of one band of a bpf_bank_q15 back to dsp_num, at the
+ * same level as the corresponding bpf_bank output.
+ */
+static inline dsp_num
+bpf_q15_to_dsp(dsp_q15 y, int32_t out_scale) {
+	return (dsp_num)(((int64_t)y * out_scale) >> (BPF_Q15_OUT_SCALE_BITS + 15 - DSP_POINT_IDX));
+}
 
 #endif
\ No newline at end of file
@@ -83,19 +83,59 @@ bpf_input_gains[] = {
 	1, 2, 2, 2, 2, 2, 2, 2
 };
 
+/* Cascades with staged gain (see BPF_SCALE_MAX_STAGES in bpf.h) use a dsp_num
+ * gain at the input of stage s >= 1 instead of bpf_input_gains[s]. It is
+ * applied like the scale of the first stage, one product per input, and then
+ * shifted back up by BPF_STAGE_GAIN_SHIFT. For odd stages the middle product
+ * is subtracted, rather than computed from -x[1], so that every kernel rounds
+ * it the same way. */
+static inline dsp_num
+bpf_staged_input(dsp_num x0, dsp_num x1, dsp_num x2, dsp_num gain, int s) {
+	const dsp_num mid = dsp_mul(dsp_lshift(x1, 1), gain);
+	return dsp_lshift(dsp_mul(x0, gain)
+	     + ((s & 1) ? -mid : mid)
+	     + dsp_mul(x2, gain), BPF_STAGE_GAIN_SHIFT);
+}
+
+static inline void
+bpf_bq_update_staged(bpf_biquad *bq, dsp_num *x, dsp_num *y, dsp_num gain, int s) {
+	memmove(y + 1, y, sizeof(*y) * 2);
+
+	y[0] = bpf_staged_input(x[0], x[1], x[2], gain, s)
+		 - dsp_mul(bq->a1, y[1])
+		 - dsp_mul(bq->a2, y[2]);
+}
+
+/* A note on the stage count: each cascade function below takes the number of
+ * stages as an argument, instead of reading bq->stages. The specialised kernels
+ * in vocoder.c pass a constant, so that once these are inlined the stage loops
+ * have a constant trip count and can be fully unrolled. (They are marked
+ * always_inline, as GCC otherwise tends to give up on inlining the larger ones
+ * into every kernel.) The versions without the _n suffix just use bq->stages. */
+
 /* Assume x was already updated */
+__attribute__((always_inline))
 static inline dsp_num
-bpf_cbq_update(bpf_cascaded_biquad *bq, dsp_num *x) {
+bpf_cbq_update_n(bpf_cascaded_biquad *bq, dsp_num *x, int stages) {
 	/* First biquad in the chain is scaled. */
 	bpf_bq_update_scaled_even(&bq->biquads[0], x, bq->y_array[0], bq->scale);
 
-	/* Note: NUM_STAGES must be at least 2 */
+	if(bpf_staged_gain(stages)) {
+		for(int i = 1; i < stages; ++i) {
+			bpf_bq_update_staged(&bq->biquads[i],
+				bq->y_array[i - 1],
+				bq->y_array[i], bq->stage_gain[i], i);
+		}
+		return bq->y_array[stages - 1][0];
+	}
+
+	/* Note: stages must be at least 2 */
 	bpf_bq_update_odd(&bq->biquads[1],
 			bq->y_array[0],
 			bq->y_array[1], bpf_input_gains[1]);
 
 	/* Update the rest of the stages using the normal update functions. */
-	for(int i = 2; i < NUM_STAGES; i += 2) {
+	for(int i = 2; i < stages; i += 2) {
 		bpf_bq_update_even(&bq->biquads[i],
 			bq->y_array[i - 1],
 			bq->y_array[i], bpf_input_gains[i]);
@@ -105,5 +145,352 @@ bpf_cbq_update(bpf_cascaded_biquad *bq, dsp_num *x) {
 	}
 	
 	/* The result is in the last stage y[0]. */
-	return bq->y_array[NUM_STAGES - 1][0];
+	return bq->y_array[stages - 1][0];
+}
+
+static inline dsp_num
+bpf_cbq_update(bpf_cascaded_biquad *bq, dsp_num *x) {
+	return bpf_cbq_update_n(bq, x, bq->stages);
+}
+
+/* Block version of bpf_cbq_update.
+ *
+ * x must contain n + 2 samples: the first two are the inputs preceding the
+ * block (x[0] is the oldest), and the remaining n are the new inputs. The
+ * filtered output for each new input is written to out[0..n).
+ *
+ * The arithmetic is identical to calling bpf_cbq_update once per sample, but
+ * the filter history for every stage is held in locals for the whole block.
+ * This means we don't pay for the memmove, the y_array loads/stores, or the
+ * function call on every sample. Note that in a DF-I cascade, the input history
+ * of each stage is exactly the output history of the previous stage, so we
+ * only need to carry the last two outputs of each stage.
+ *
+ * Only y_array[i][0] and y_array[i][1] are written back at the end of the
+ * block. y_array[i][2] is always overwritten by the memmove before it is read,
+ * so it is not part of the filter state. */
+__attribute__((always_inline))
+static inline void
+bpf_cbq_update_block_n(bpf_cascaded_biquad *bq, const dsp_num *x, dsp_num *out, size_t n, int stages) {
+	dsp_num a1[BPF_MAX_STAGES];
+	dsp_num a2[BPF_MAX_STAGES];
+	dsp_num gains[BPF_MAX_STAGES];
+	dsp_num y1[BPF_MAX_STAGES];
+	dsp_num y2[BPF_MAX_STAGES];
+
+	for(int s = 0; s < stages; ++s) {
+		a1[s] = bq->biquads[s].a1;
+		a2[s] = bq->biquads[s].a2;
+		gains[s] = bq->stage_gain[s];
+		y1[s] = bq->y_array[s][0];
+		y2[s] = bq->y_array[s][1];
+	}
+
+	const dsp_num scale = bq->scale;
+
+	for(size_t k = 0; k < n; ++k) {
+		dsp_num x0 = x[k + 2];
+		dsp_num x1 = x[k + 1];
+		dsp_num x2 = x[k];
+
+		for(int s = 0; s < stages; ++s) {
+			dsp_num y;
+			if(s == 0) {
+				/* Same as bpf_bq_update_scaled_even */
+				y = dsp_mul(x0, scale)
+				  + dsp_mul(dsp_lshift(x1, 1), scale)
+				  + dsp_mul(x2, scale);
+			}
+			else if(bpf_staged_gain(stages)) {
+				y = bpf_staged_input(x0, x1, x2, gains[s], s);
+			}
+			else {
+				const int gain = bpf_input_gains[s];
+				if(s & 1) {
+					y = (x0 * gain) - dsp_lshift(x1 * gain, 1) + (x2 * gain);
+				}
+				else {
+					y = (x0 * gain) + dsp_lshift(x1 * gain, 1) + (x2 * gain);
+				}
+			}
+			y = y - dsp_mul(a1[s], y1[s]) - dsp_mul(a2[s], y2[s]);
+
+#ifdef DSP_FLOAT
+			if(dsp_abs(y) < 1.175494350822287508e-38) {
+				y = 0.0;
+			}
+#endif
+
+			/* The next stage sees this stage's output history as its input. */
+			x0 = y;
+			x1 = y1[s];
+			x2 = y2[s];
+
+			y2[s] = y1[s];
+			y1[s] = y;
+		}
+
+		out[k] = x0;
+	}
+
+	for(int s = 0; s < stages; ++s) {
+		bq->y_array[s][0] = y1[s];
+		bq->y_array[s][1] = y2[s];
+	}
+}
+
+static inline void
+bpf_cbq_update_block(bpf_cascaded_biquad *bq, const dsp_num *x, dsp_num *out, size_t n) {
+	bpf_cbq_update_block_n(bq, x, out, n, bq->stages);
+}
+
+/* Updates every band of a bpf_bank with one new input sample. x is the input
+ * history, the same as for bpf_cbq_update (x[0] is the new sample), and the
+ * output of each band is written to out[band].
+ *
+ * The arithmetic for each band is identical to bpf_cbq_update. The difference
+ * is that the band loop is the inner loop, and it runs over contiguous arrays,
+ * so the compiler can advance several bands per instruction. */
+static inline void
+bpf_bank_update(bpf_bank *bank, const dsp_num *x, dsp_num *out) {
+	/* The input history for the current stage, for each band. */
+	dsp_num in0[BPF_BANK_MAX_BANDS];
+	dsp_num in1[BPF_BANK_MAX_BANDS];
+	dsp_num in2[BPF_BANK_MAX_BANDS];
+
+	const int bands = bank->bands;
+
+	/* First stage: the input is the same for every band, and is scaled. */
+	const dsp_num x0 = x[0];
+	const dsp_num x1 = dsp_lshift(x[1], 1); /* even index: b1 = 2 */
+	const dsp_num x2 = x[2];
+	for(int b = 0; b < bands; ++b) {
+		const dsp_num scale = bank->scale[b];
+		const dsp_num y1 = bank->y1[0][b];
+		const dsp_num y2 = bank->y2[0][b];
+
+		const dsp_num y = dsp_mul(x0, scale)
+			+ dsp_mul(x1, scale)
+			+ dsp_mul(x2, scale)
+			- dsp_mul(bank->a1[0][b], y1)
+			- dsp_mul(bank->a2[0][b], y2);
+
+		in0[b] = y;
+		in1[b] = y1;
+		in2[b] = y2;
+		bank->y2[0][b] = y1;
+		bank->y1[0][b] = y;
+	}
+
+	const bool staged = bpf_staged_gain(bank->stages);
+
+	for(int s = 1; s < bank->stages; ++s) {
+		const int gain = bpf_input_gains[s];
+		/* even index: b1 = 2, odd index: b1 = -2 */
+		const int b1 = (s & 1) ? -2 : 2;
+
+		for(int b = 0; b < bands; ++b) {
+			const dsp_num y1 = bank->y1[s][b];
+			const dsp_num y2 = bank->y2[s][b];
+
+			const dsp_num in = staged
+				? bpf_staged_input(in0[b], in1[b], in2[b], bank->gain[s][b], s)
+				: (in0[b] * gain) + (in1[b] * gain) * b1 + (in2[b] * gain);
+
+			const dsp_num y = in
+				- dsp_mul(bank->a1[s][b], y1)
+				- dsp_mul(bank->a2[s][b], y2);
+
+			in0[b] = y;
+			in1[b] = y1;
+			in2[b] = y2;
+			bank->y2[s][b] = y1;
+			bank->y1[s][b] = y;
+		}
+	}
+
+	for(int b = 0; b < bands; ++b) {
+		out[b] = in0[b];
+	}
+}
+
+/* Updates every band of a bpf_bank_q15 with one new input sample. x is the Q15
+ * input history (x[0] is the new sample), and the output of each band is
+ * written to out[band].
+ *
+ * Each stage computes
+ *     y = g x[0] + b1 g x[1] + g x[2] - a1 y[1] - a2 y[2]
+ * as 16 x 16-bit products summed into a 32-bit accumulator, which is shifted
+ * and saturated back to Q15 once. b1 = +-2 and a1 don't fit in Q15, so their
+ * halves are used and that pair of products is doubled, in exactly the order
+ * used by the SIMD kernels in bpf_simd.c (pmaddwd/vmlal pairs). The sums wrap
+ * like the SIMD adds, but the gain staging keeps each final sum inside the
+ * Q30 range (see BPF_Q15_STAGE_BOUND in bpf.c).
+ *
+ * The bits shifted out are kept in r1 and added to the next sum (first order
+ * error feedback). Without this, the input to the narrow low bands is mostly
+ * lost below the LSB of y, and rounding leaves them ringing in limit cycles
+ * after the input goes quiet. */
+static inline void
+bpf_bank_q15_update(bpf_bank_q15 *bank, const dsp_q15 *x, dsp_q15 *out) {
+	dsp_q15 in0[BPF_BANK_Q15_MAX_BANDS];
+	dsp_q15 in1[BPF_BANK_Q15_MAX_BANDS];
+	dsp_q15 in2[BPF_BANK_Q15_MAX_BANDS];
+
+	const int bands = bank->bands;
+
+	/* First stage: the input is the same for every band. */
+	for(int b = 0; b < bands; ++b) {
+		in0[b] = x[0];
+		in1[b] = x[1];
+		in2[b] = x[2];
+	}
+
+	for(int s = 0; s < bank->stages; ++s) {
+		for(int b = 0; b < bands; ++b) {
+			const int32_t g  = bank->gain[s][b];
+			/* even index: b1 = 2, odd index: b1 = -2 */
+			const int32_t bg = (s & 1) ? -g : g;
+			const dsp_q15 y1 = bank->y1[s][b];
+			const dsp_q15 y2 = bank->y2[s][b];
+
+			uint32_t acc = (uint32_t)(g * in0[b] + g * in2[b]);
+			acc += (uint32_t)(bg * in1[b] + bank->na1h[s][b] * y1) << 1;
+			acc += (uint32_t)(bank->na2[s][b] * y2 + bank->r1[s][b]);
+
+			const dsp_q15 y = dsp_q15_sat((int32_t)acc >> 15);
+			bank->r1[s][b] = acc & 0x7fff;
+
+			in0[b] = y;
+			in1[b] = y1;
+			in2[b] = y2;
+			bank->y2[s][b] = y1;
+			bank->y1[s][b] = y;
+		}
+	}
+
+	for(int b = 0; b < bands; ++b) {
+		out[b] = in0[b];
+	}
+}
+
+/* Computes the sum of a[i] * b[i] for i < n, with 32-bit products and a 64-bit
+ * sum: each product can be up to 2^30, so BPF_BANK_Q15_MAX_BANDS of them don't
+ * fit in 32 bits. b must not hold -32768 (the vocoder passes envelopes, which
+ * are never negative), so that the SIMD kernels can add products in pairs in
+ * 32 bits before widening. n must be a multiple of BPF_BANK_Q15_LANES. */
+static inline int64_t
+bpf_q15_dot(const dsp_q15 *a, const dsp_q15 *b, int n) {
+	int64_t sum = 0;
+	for(int i = 0; i < n; ++i) {
+		sum += (int32_t)a[i] * b[i];
+	}
+	return sum;
+}
+
+/* Transposed Direct Form II versions of the cascade update.
+ *
+ * These use the same coefficients and the same b = {1, +-2, 1} specialization
+ * (and the same scale and input or stage gains) as the Direct Form I functions
+ * above.
+ * The difference is in the state: each stage keeps two partial sums in
+ * tdf2_state instead of a history of inputs and outputs, so there is nothing
+ * to memmove, and each stage only needs the current input rather than an array.
+ *
+ * Note that with our fixed point math, this is actually bit-exact with DF-I:
+ * the only rounding is in the individual dsp_mul products, and TDF-II computes
+ * exactly the same products (a1 * y[n-1], a2 * y[n-2], scale * x[...]). It
+ * just adds them up at different times, and integer addition doesn't care. */
+static inline dsp_num
+bpf_bq_update_tdf2(bpf_biquad *bq, dsp_num *state, dsp_num bx, dsp_num b1x) {
+	/* bx = b0 * x = b2 * x, b1x = b1 * x */
+	const dsp_num y = bx + state[0];
+
+	state[0] = b1x - dsp_mul(bq->a1, y) + state[1];
+	state[1] = bx  - dsp_mul(bq->a2, y);
+
+	return y;
+}
+
+/* The b0 x (= b2 x) and b1 x terms for the input x of stage s >= 1: either
+ * with the constant input gain, or, with staged gain, the same products as
+ * bpf_staged_input. */
+static inline void
+bpf_tdf2_stage_input(dsp_num x, dsp_num gain, int s, int stages, dsp_num *bx, dsp_num *b1x) {
+	if(bpf_staged_gain(stages)) {
+		const dsp_num mid = dsp_lshift(dsp_mul(dsp_lshift(x, 1), gain), BPF_STAGE_GAIN_SHIFT);
+		*bx = dsp_lshift(dsp_mul(x, gain), BPF_STAGE_GAIN_SHIFT);
+		*b1x = (s & 1) ? -mid : mid;
+		return;
+	}
+
+	const dsp_num gx = x * bpf_input_gains[s];
+	*bx = gx;
+	*b1x = (s & 1) ? -dsp_lshift(gx, 1) : dsp_lshift(gx, 1);
+}
+
+__attribute__((always_inline))
+static inline dsp_num
+bpf_cbq_update_tdf2_n(bpf_cascaded_biquad *bq, dsp_num x, int stages) {
+	/* First biquad in the chain is scaled. even index: b1 = 2 */
+	dsp_num y = bpf_bq_update_tdf2(&bq->biquads[0], bq->tdf2_state[0],
+		dsp_mul(x, bq->scale),
+		dsp_mul(dsp_lshift(x, 1), bq->scale));
+
+	for(int i = 1; i < stages; ++i) {
+		dsp_num gx;
+		dsp_num b1x;
+		bpf_tdf2_stage_input(y, bq->stage_gain[i], i, stages, &gx, &b1x);
+
+		y = bpf_bq_update_tdf2(&bq->biquads[i], bq->tdf2_state[i], gx, b1x);
+	}
+
+	return y;
+}
+
+static inline dsp_num
+bpf_cbq_update_tdf2(bpf_cascaded_biquad *bq, dsp_num x) {
+	return bpf_cbq_update_tdf2_n(bq, x, bq->stages);
+}
+
+/* Block version of bpf_cbq_update_tdf2, with the same x layout as
+ * bpf_cbq_update_block (the two history entries are simply not needed). */
+__attribute__((always_inline))
+static inline void
+bpf_cbq_update_block_tdf2_n(bpf_cascaded_biquad *bq, const dsp_num *x, dsp_num *out, size_t n, int stages) {
+	bpf_biquad biquads[BPF_MAX_STAGES];
+	dsp_num state[BPF_MAX_STAGES][2];
+
+	dsp_num gains[BPF_MAX_STAGES];
+
+	memcpy(biquads, bq->biquads, sizeof(bpf_biquad) * stages);
+	memcpy(gains, bq->stage_gain, sizeof(gains[0]) * stages);
+	memcpy(state, bq->tdf2_state, sizeof(state[0]) * stages);
+
+	const dsp_num scale = bq->scale;
+
+	for(size_t k = 0; k < n; ++k) {
+		const dsp_num in = x[k + 2];
+
+		dsp_num y = bpf_bq_update_tdf2(&biquads[0], state[0],
+			dsp_mul(in, scale),
+			dsp_mul(dsp_lshift(in, 1), scale));
+
+		for(int i = 1; i < stages; ++i) {
+			dsp_num gx;
+			dsp_num b1x;
+			bpf_tdf2_stage_input(y, gains[i], i, stages, &gx, &b1x);
+
+			y = bpf_bq_update_tdf2(&biquads[i], state[i], gx, b1x);
+		}
+
+		out[k] = y;
+	}
+
+	memcpy(bq->tdf2_state, state, sizeof(state[0]) * stages);
+}
+
+static inline void
+bpf_cbq_update_block_tdf2(bpf_cascaded_biquad *bq, const dsp_num *x, dsp_num *out, size_t n) {
+	bpf_cbq_update_block_tdf2_n(bq, x, out, n, bq->stages);
 }
@@ -0,0 +1,610 @@
+#include "bpf_simd.h"
+
+#include <string.h>
+
+#include "app.h"
+#include "dsp_simd.h"
+
+/* The scalar reference kernel (bpf_bank_update) lives in bpf_impl.c, which is
+ * written to be included directly for inlining. */
+#include "bpf_impl.c"
+
+/* The fixed point multiplies (mul_q29_*) are bit-exact with dsp_mul; see
+ * dsp_simd.h.
+ *
+ * Also, the gain applied to the input of stages >= 1 distributes over the
+ * b = {1, +-2, 1} sum in modular arithmetic, so the kernels apply it once to
+ * the sum instead of to each input. That only holds for the integer
+ * bpf_input_gains: a staged gain (see BPF_SCALE_MAX_STAGES) is a dsp_num, so it
+ * takes a product per input, the same as bpf_staged_input.
+ */
+
+static void
+bpf_bank_update_scalar(bpf_bank *bank, const dsp_num *x, dsp_num *out) {
+	bpf_bank_update(bank, x, out);
+}
+
+static void
+bpf_bank_q15_update_scalar(bpf_bank_q15 *bank, const dsp_q15 *x, dsp_q15 *out) {
+	bpf_bank_q15_update(bank, x, out);
+}
+
+static int64_t
+bpf_q15_dot_scalar(const dsp_q15 *a, const dsp_q15 *b, int n) {
+	return bpf_q15_dot(a, b, n);
+}
+
+#ifdef DSP_SIMD_X86
+#define BPF_HAVE_X86 1
+
+__attribute__((target("sse4.1")))
+static void
+bpf_bank_update_sse41(bpf_bank *bank, const dsp_num *x, dsp_num *out) {
+	__m128i in0[BPF_BANK_MAX_BANDS / 4];
+	__m128i in1[BPF_BANK_MAX_BANDS / 4];
+	__m128i in2[BPF_BANK_MAX_BANDS / 4];
+
+	const int groups = bank->bands / 4;
+
+	const __m128i x0 = _mm_set1_epi32(x[0]);
+	const __m128i x1 = _mm_set1_epi32(dsp_lshift(x[1], 1)); /* even index: b1 = 2 */
+	const __m128i x2 = _mm_set1_epi32(x[2]);
+
+	for(int g = 0; g < groups; ++g) {
+		const __m128i scale = _mm_loadu_si128((const __m128i*)&bank->scale[g * 4]);
+		const __m128i a1 = _mm_loadu_si128((const __m128i*)&bank->a1[0][g * 4]);
+		const __m128i a2 = _mm_loadu_si128((const __m128i*)&bank->a2[0][g * 4]);
+		const __m128i y1 = _mm_loadu_si128((const __m128i*)&bank->y1[0][g * 4]);
+		const __m128i y2 = _mm_loadu_si128((const __m128i*)&bank->y2[0][g * 4]);
+
+		__m128i y = _mm_add_epi32(mul_q29_sse41(x0, scale), mul_q29_sse41(x1, scale));
+		y = _mm_add_epi32(y, mul_q29_sse41(x2, scale));
+		y = _mm_sub_epi32(y, mul_q29_sse41(a1, y1));
+		y = _mm_sub_epi32(y, mul_q29_sse41(a2, y2));
+
+		in0[g] = y;
+		in1[g] = y1;
+		in2[g] = y2;
+		_mm_storeu_si128((__m128i*)&bank->y2[0][g * 4], y1);
+		_mm_storeu_si128((__m128i*)&bank->y1[0][g * 4], y);
+	}
+
+	const bool staged = bpf_staged_gain(bank->stages);
+
+	for(int s = 1; s < bank->stages; ++s) {
+		const __m128i gain = _mm_set1_epi32(bpf_input_gains[s]);
+
+		for(int g = 0; g < groups; ++g) {
+			const __m128i a1 = _mm_loadu_si128((const __m128i*)&bank->a1[s][g * 4]);
+			const __m128i a2 = _mm_loadu_si128((const __m128i*)&bank->a2[s][g * 4]);
+			const __m128i y1 = _mm_loadu_si128((const __m128i*)&bank->y1[s][g * 4]);
+			const __m128i y2 = _mm_loadu_si128((const __m128i*)&bank->y2[s][g * 4]);
+
+			const __m128i mid = _mm_slli_epi32(in1[g], 1);
+			__m128i y;
+			if(staged) {
+				const __m128i sg = _mm_loadu_si128((const __m128i*)&bank->gain[s][g * 4]);
+				const __m128i gmid = mul_q29_sse41(mid, sg);
+				y = _mm_add_epi32(mul_q29_sse41(in0[g], sg), mul_q29_sse41(in2[g], sg));
+				y = (s & 1) ? _mm_sub_epi32(y, gmid) : _mm_add_epi32(y, gmid);
+				y = _mm_slli_epi32(y, BPF_STAGE_GAIN_SHIFT);
+			}
+			else {
+				y = _mm_add_epi32(in0[g], in2[g]);
+				y = (s & 1) ? _mm_sub_epi32(y, mid) : _mm_add_epi32(y, mid);
+				y = _mm_mullo_epi32(y, gain);
+			}
+			y = _mm_sub_epi32(y, mul_q29_sse41(a1, y1));
+			y = _mm_sub_epi32(y, mul_q29_sse41(a2, y2));
+
+			in0[g] = y;
+			in1[g] = y1;
+			in2[g] = y2;
+			_mm_storeu_si128((__m128i*)&bank->y2[s][g * 4], y1);
+			_mm_storeu_si128((__m128i*)&bank->y1[s][g * 4], y);
+		}
+	}
+
+	for(int g = 0; g < groups; ++g) {
+		_mm_storeu_si128((__m128i*)&out[g * 4], in0[g]);
+	}
+}
+
+/* One Q15 stage for 8 bands, as in bpf_bank_q15_update: each pair of terms is
+ * one pmaddwd into 32-bit lanes (the remainder r1 rides along with y2), and
+ * packssdw saturates the result back to 16 bits. */
+__attribute__((target("sse4.1")))
+static inline __m128i
+q15_stage_sse41(__m128i x0, __m128i x1, __m128i x2, __m128i y1, __m128i y2,
+		__m128i g, __m128i bg, __m128i na1h, __m128i na2, __m128i *r1) {
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i frac = _mm_set1_epi32(0x7fff);
+
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(x0, x2), _mm_unpacklo_epi16(g, g));
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(x0, x2), _mm_unpackhi_epi16(g, g));
+
+	lo = _mm_add_epi32(lo, _mm_slli_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x1, y1), _mm_unpacklo_epi16(bg, na1h)), 1));
+	hi = _mm_add_epi32(hi, _mm_slli_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x1, y1), _mm_unpackhi_epi16(bg, na1h)), 1));
+
+	lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(y2, *r1), _mm_unpacklo_epi16(na2, one)));
+	hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(y2, *r1), _mm_unpackhi_epi16(na2, one)));
+
+	*r1 = _mm_packs_epi32(_mm_and_si128(lo, frac), _mm_and_si128(hi, frac));
+	return _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+}
+
+__attribute__((target("sse4.1")))
+static void
+bpf_bank_q15_update_sse41(bpf_bank_q15 *bank, const dsp_q15 *x, dsp_q15 *out) {
+	__m128i in0[BPF_BANK_Q15_MAX_BANDS / 8];
+	__m128i in1[BPF_BANK_Q15_MAX_BANDS / 8];
+	__m128i in2[BPF_BANK_Q15_MAX_BANDS / 8];
+
+	const int groups = bank->bands / 8;
+
+	for(int g = 0; g < groups; ++g) {
+		in0[g] = _mm_set1_epi16(x[0]);
+		in1[g] = _mm_set1_epi16(x[1]);
+		in2[g] = _mm_set1_epi16(x[2]);
+	}
+
+	for(int s = 0; s < bank->stages; ++s) {
+		for(int g = 0; g < groups; ++g) {
+			const __m128i gain = _mm_loadu_si128((const __m128i*)&bank->gain[s][g * 8]);
+			const __m128i na1h = _mm_loadu_si128((const __m128i*)&bank->na1h[s][g * 8]);
+			const __m128i na2 = _mm_loadu_si128((const __m128i*)&bank->na2[s][g * 8]);
+			const __m128i y1 = _mm_loadu_si128((const __m128i*)&bank->y1[s][g * 8]);
+			const __m128i y2 = _mm_loadu_si128((const __m128i*)&bank->y2[s][g * 8]);
+			__m128i r1 = _mm_loadu_si128((const __m128i*)&bank->r1[s][g * 8]);
+
+			/* odd index: b1 = -2 */
+			const __m128i bg = (s & 1) ? _mm_sub_epi16(_mm_setzero_si128(), gain) : gain;
+
+			const __m128i y = q15_stage_sse41(in0[g], in1[g], in2[g], y1, y2, gain, bg, na1h, na2, &r1);
+
+			in0[g] = y;
+			in1[g] = y1;
+			in2[g] = y2;
+			_mm_storeu_si128((__m128i*)&bank->y2[s][g * 8], y1);
+			_mm_storeu_si128((__m128i*)&bank->y1[s][g * 8], y);
+			_mm_storeu_si128((__m128i*)&bank->r1[s][g * 8], r1);
+		}
+	}
+
+	for(int g = 0; g < groups; ++g) {
+		_mm_storeu_si128((__m128i*)&out[g * 8], in0[g]);
+	}
+}
+
+__attribute__((target("sse4.1")))
+static int64_t
+bpf_q15_dot_sse41(const dsp_q15 *a, const dsp_q15 *b, int n) {
+	__m128i sum = _mm_setzero_si128();
+	for(int i = 0; i < n; i += 8) {
+		const __m128i va = _mm_loadu_si128((const __m128i*)&a[i]);
+		const __m128i vb = _mm_loadu_si128((const __m128i*)&b[i]);
+		const __m128i pairs = _mm_madd_epi16(va, vb);
+		sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(pairs));
+		sum = _mm_add_epi64(sum, _mm_cvtepi32_epi64(_mm_unpackhi_epi64(pairs, pairs)));
+	}
+
+	sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+	return _mm_cvtsi128_si64(sum);
+}
+
+__attribute__((target("avx2")))
+static void
+bpf_bank_update_avx2(bpf_bank *bank, const dsp_num *x, dsp_num *out) {
+	__m256i in0[BPF_BANK_MAX_BANDS / 8];
+	__m256i in1[BPF_BANK_MAX_BANDS / 8];
+	__m256i in2[BPF_BANK_MAX_BANDS / 8];
+
+	const int groups = bank->bands / 8;
+
+	const __m256i x0 = _mm256_set1_epi32(x[0]);
+	const __m256i x1 = _mm256_set1_epi32(dsp_lshift(x[1], 1)); /* even index: b1 = 2 */
+	const __m256i x2 = _mm256_set1_epi32(x[2]);
+
+	for(int g = 0; g < groups; ++g) {
+		const __m256i scale = _mm256_loadu_si256((const __m256i*)&bank->scale[g * 8]);
+		const __m256i a1 = _mm256_loadu_si256((const __m256i*)&bank->a1[0][g * 8]);
+		const __m256i a2 = _mm256_loadu_si256((const __m256i*)&bank->a2[0][g * 8]);
+		const __m256i y1 = _mm256_loadu_si256((const __m256i*)&bank->y1[0][g * 8]);
+		const __m256i y2 = _mm256_loadu_si256((const __m256i*)&bank->y2[0][g * 8]);
+
+		__m256i y = _mm256_add_epi32(mul_q29_avx2(x0, scale), mul_q29_avx2(x1, scale));
+		y = _mm256_add_epi32(y, mul_q29_avx2(x2, scale));
+		y = _mm256_sub_epi32(y, mul_q29_avx2(a1, y1));
+		y = _mm256_sub_epi32(y, mul_q29_avx2(a2, y2));
+
+		in0[g] = y;
+		in1[g] = y1;
+		in2[g] = y2;
+		_mm256_storeu_si256((__m256i*)&bank->y2[0][g * 8], y1);
+		_mm256_storeu_si256((__m256i*)&bank->y1[0][g * 8], y);
+	}
+
+	const bool staged = bpf_staged_gain(bank->stages);
+
+	for(int s = 1; s < bank->stages; ++s) {
+		const __m256i gain = _mm256_set1_epi32(bpf_input_gains[s]);
+
+		for(int g = 0; g < groups; ++g) {
+			const __m256i a1 = _mm256_loadu_si256((const __m256i*)&bank->a1[s][g * 8]);
+			const __m256i a2 = _mm256_loadu_si256((const __m256i*)&bank->a2[s][g * 8]);
+			const __m256i y1 = _mm256_loadu_si256((const __m256i*)&bank->y1[s][g * 8]);
+			const __m256i y2 = _mm256_loadu_si256((const __m256i*)&bank->y2[s][g * 8]);
+
+			const __m256i mid = _mm256_slli_epi32(in1[g], 1);
+			__m256i y;
+			if(staged) {
+				const __m256i sg = _mm256_loadu_si256((const __m256i*)&bank->gain[s][g * 8]);
+				const __m256i gmid = mul_q29_avx2(mid, sg);
+				y = _mm256_add_epi32(mul_q29_avx2(in0[g], sg), mul_q29_avx2(in2[g], sg));
+				y = (s & 1) ? _mm256_sub_epi32(y, gmid) : _mm256_add_epi32(y, gmid);
+				y = _mm256_slli_epi32(y, BPF_STAGE_GAIN_SHIFT);
+			}
+			else {
+				y = _mm256_add_epi32(in0[g], in2[g]);
+				y = (s & 1) ? _mm256_sub_epi32(y, mid) : _mm256_add_epi32(y, mid);
+				y = _mm256_mullo_epi32(y, gain);
+			}
+			y = _mm256_sub_epi32(y, mul_q29_avx2(a1, y1));
+			y = _mm256_sub_epi32(y, mul_q29_avx2(a2, y2));
+
+			in0[g] = y;
+			in1[g] = y1;
+			in2[g] = y2;
+			_mm256_storeu_si256((__m256i*)&bank->y2[s][g * 8], y1);
+			_mm256_storeu_si256((__m256i*)&bank->y1[s][g * 8], y);
+		}
+	}
+
+	for(int g = 0; g < groups; ++g) {
+		_mm256_storeu_si256((__m256i*)&out[g * 8], in0[g]);
+	}
+}
+
+/* The same as q15_stage_sse41, for 16 bands. The unpacks and packssdw both
+ * work within each 128-bit half, so the band order comes out unchanged. */
+__attribute__((target("avx2")))
+static inline __m256i
+q15_stage_avx2(__m256i x0, __m256i x1, __m256i x2, __m256i y1, __m256i y2,
+		__m256i g, __m256i bg, __m256i na1h, __m256i na2, __m256i *r1) {
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i frac = _mm256_set1_epi32(0x7fff);
+
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(x0, x2), _mm256_unpacklo_epi16(g, g));
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(x0, x2), _mm256_unpackhi_epi16(g, g));
+
+	lo = _mm256_add_epi32(lo, _mm256_slli_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(x1, y1), _mm256_unpacklo_epi16(bg, na1h)), 1));
+	hi = _mm256_add_epi32(hi, _mm256_slli_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(x1, y1), _mm256_unpackhi_epi16(bg, na1h)), 1));
+
+	lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(y2, *r1), _mm256_unpacklo_epi16(na2, one)));
+	hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(y2, *r1), _mm256_unpackhi_epi16(na2, one)));
+
+	*r1 = _mm256_packs_epi32(_mm256_and_si256(lo, frac), _mm256_and_si256(hi, frac));
+	return _mm256_packs_epi32(_mm256_srai_epi32(lo, 15), _mm256_srai_epi32(hi, 15));
+}
+
+__attribute__((target("avx2")))
+static void
+bpf_bank_q15_update_avx2(bpf_bank_q15 *bank, const dsp_q15 *x, dsp_q15 *out) {
+	__m256i in0[BPF_BANK_Q15_MAX_BANDS / 16];
+	__m256i in1[BPF_BANK_Q15_MAX_BANDS / 16];
+	__m256i in2[BPF_BANK_Q15_MAX_BANDS / 16];
+
+	const int groups = bank->bands / 16;
+
+	for(int g = 0; g < groups; ++g) {
+		in0[g] = _mm256_set1_epi16(x[0]);
+		in1[g] = _mm256_set1_epi16(x[1]);
+		in2[g] = _mm256_set1_epi16(x[2]);
+	}
+
+	for(int s = 0; s < bank->stages; ++s) {
+		for(int g = 0; g < groups; ++g) {
+			const __m256i gain = _mm256_loadu_si256((const __m256i*)&bank->gain[s][g * 16]);
+			const __m256i na1h = _mm256_loadu_si256((const __m256i*)&bank->na1h[s][g * 16]);
+			const __m256i na2 = _mm256_loadu_si256((const __m256i*)&bank->na2[s][g * 16]);
+			const __m256i y1 = _mm256_loadu_si256((const __m256i*)&bank->y1[s][g * 16]);
+			const __m256i y2 = _mm256_loadu_si256((const __m256i*)&bank->y2[s][g * 16]);
+			__m256i r1 = _mm256_loadu_si256((const __m256i*)&bank->r1[s][g * 16]);
+
+			/* odd index: b1 = -2 */
+			const __m256i bg = (s & 1) ? _mm256_sub_epi16(_mm256_setzero_si256(), gain) : gain;
+
+			const __m256i y = q15_stage_avx2(in0[g], in1[g], in2[g], y1, y2, gain, bg, na1h, na2, &r1);
+
+			in0[g] = y;
+			in1[g] = y1;
+			in2[g] = y2;
+			_mm256_storeu_si256((__m256i*)&bank->y2[s][g * 16], y1);
+			_mm256_storeu_si256((__m256i*)&bank->y1[s][g * 16], y);
+			_mm256_storeu_si256((__m256i*)&bank->r1[s][g * 16], r1);
+		}
+	}
+
+	for(int g = 0; g < groups; ++g) {
+		_mm256_storeu_si256((__m256i*)&out[g * 16], in0[g]);
+	}
+}
+
+__attribute__((target("avx2")))
+static int64_t
+bpf_q15_dot_avx2(const dsp_q15 *a, const dsp_q15 *b, int n) {
+	__m256i sum = _mm256_setzero_si256();
+	for(int i = 0; i < n; i += 16) {
+		const __m256i va = _mm256_loadu_si256((const __m256i*)&a[i]);
+		const __m256i vb = _mm256_loadu_si256((const __m256i*)&b[i]);
+		const __m256i pairs = _mm256_madd_epi16(va, vb);
+		sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(pairs)));
+		sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(pairs, 1)));
+	}
+
+	__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+	return _mm_cvtsi128_si64(half);
+}
+
+#endif /* x86 */
+
+#ifdef DSP_SIMD_NEON
+#define BPF_HAVE_NEON 1
+
+static void
+bpf_bank_update_neon(bpf_bank *bank, const dsp_num *x, dsp_num *out) {
+	int32x4_t in0[BPF_BANK_MAX_BANDS / 4];
+	int32x4_t in1[BPF_BANK_MAX_BANDS / 4];
+	int32x4_t in2[BPF_BANK_MAX_BANDS / 4];
+
+	const int groups = bank->bands / 4;
+
+	const int32x4_t x0 = vdupq_n_s32(x[0]);
+	const int32x4_t x1 = vdupq_n_s32(dsp_lshift(x[1], 1)); /* even index: b1 = 2 */
+	const int32x4_t x2 = vdupq_n_s32(x[2]);
+
+	for(int g = 0; g < groups; ++g) {
+		const int32x4_t scale = vld1q_s32(&bank->scale[g * 4]);
+		const int32x4_t a1 = vld1q_s32(&bank->a1[0][g * 4]);
+		const int32x4_t a2 = vld1q_s32(&bank->a2[0][g * 4]);
+		const int32x4_t y1 = vld1q_s32(&bank->y1[0][g * 4]);
+		const int32x4_t y2 = vld1q_s32(&bank->y2[0][g * 4]);
+
+		int32x4_t y = vaddq_s32(mul_q29_neon(x0, scale), mul_q29_neon(x1, scale));
+		y = vaddq_s32(y, mul_q29_neon(x2, scale));
+		y = vsubq_s32(y, mul_q29_neon(a1, y1));
+		y = vsubq_s32(y, mul_q29_neon(a2, y2));
+
+		in0[g] = y;
+		in1[g] = y1;
+		in2[g] = y2;
+		vst1q_s32(&bank->y2[0][g * 4], y1);
+		vst1q_s32(&bank->y1[0][g * 4], y);
+	}
+
+	const bool staged = bpf_staged_gain(bank->stages);
+
+	for(int s = 1; s < bank->stages; ++s) {
+		const int32_t gain = bpf_input_gains[s];
+
+		for(int g = 0; g < groups; ++g) {
+			const int32x4_t a1 = vld1q_s32(&bank->a1[s][g * 4]);
+			const int32x4_t a2 = vld1q_s32(&bank->a2[s][g * 4]);
+			const int32x4_t y1 = vld1q_s32(&bank->y1[s][g * 4]);
+			const int32x4_t y2 = vld1q_s32(&bank->y2[s][g * 4]);
+
+			const int32x4_t mid = vshlq_n_s32(in1[g], 1);
+			int32x4_t y;
+			if(staged) {
+				const int32x4_t sg = vld1q_s32(&bank->gain[s][g * 4]);
+				const int32x4_t gmid = mul_q29_neon(mid, sg);
+				y = vaddq_s32(mul_q29_neon(in0[g], sg), mul_q29_neon(in2[g], sg));
+				y = (s & 1) ? vsubq_s32(y, gmid) : vaddq_s32(y, gmid);
+				y = vshlq_n_s32(y, BPF_STAGE_GAIN_SHIFT);
+			}
+			else {
+				y = vaddq_s32(in0[g], in2[g]);
+				y = (s & 1) ? vsubq_s32(y, mid) : vaddq_s32(y, mid);
+				y = vmulq_n_s32(y, gain);
+			}
+			y = vsubq_s32(y, mul_q29_neon(a1, y1));
+			y = vsubq_s32(y, mul_q29_neon(a2, y2));
+
+			in0[g] = y;
+			in1[g] = y1;
+			in2[g] = y2;
+			vst1q_s32(&bank->y2[s][g * 4], y1);
+			vst1q_s32(&bank->y1[s][g * 4], y);
+		}
+	}
+
+	for(int g = 0; g < groups; ++g) {
+		vst1q_s32(&out[g * 4], in0[g]);
+	}
+}
+
+/* One Q15 stage for 4 bands, as in bpf_bank_q15_update: vmull/vmlal into 32-bit
+ * lanes, then vqshrn saturates back to 16 bits. */
+static inline int16x4_t
+q15_stage_neon(int16x4_t x0, int16x4_t x1, int16x4_t x2, int16x4_t y1, int16x4_t y2,
+		int16x4_t g, int16x4_t bg, int16x4_t na1h, int16x4_t na2, int16x4_t *r1) {
+	int32x4_t acc = vmlal_s16(vmull_s16(x0, g), x2, g);
+	const int32x4_t mid = vmlal_s16(vmull_s16(x1, bg), y1, na1h);
+	acc = vaddq_s32(acc, vshlq_n_s32(mid, 1));
+	acc = vaddw_s16(vmlal_s16(acc, y2, na2), *r1);
+	*r1 = vmovn_s32(vandq_s32(acc, vdupq_n_s32(0x7fff)));
+	return vqshrn_n_s32(acc, 15);
+}
+
+static void
+bpf_bank_q15_update_neon(bpf_bank_q15 *bank, const dsp_q15 *x, dsp_q15 *out) {
+	int16x8_t in0[BPF_BANK_Q15_MAX_BANDS / 8];
+	int16x8_t in1[BPF_BANK_Q15_MAX_BANDS / 8];
+	int16x8_t in2[BPF_BANK_Q15_MAX_BANDS / 8];
+
+	const int groups = bank->bands / 8;
+
+	for(int g = 0; g < groups; ++g) {
+		in0[g] = vdupq_n_s16(x[0]);
+		in1[g] = vdupq_n_s16(x[1]);
+		in2[g] = vdupq_n_s16(x[2]);
+	}
+
+	for(int s = 0; s < bank->stages; ++s) {
+		for(int g = 0; g < groups; ++g) {
+			const int16x8_t gain = vld1q_s16(&bank->gain[s][g * 8]);
+			const int16x8_t na1h = vld1q_s16(&bank->na1h[s][g * 8]);
+			const int16x8_t na2 = vld1q_s16(&bank->na2[s][g * 8]);
+			const int16x8_t y1 = vld1q_s16(&bank->y1[s][g * 8]);
+			const int16x8_t y2 = vld1q_s16(&bank->y2[s][g * 8]);
+			const int16x8_t r1 = vld1q_s16(&bank->r1[s][g * 8]);
+			int16x4_t r1_lo = vget_low_s16(r1);
+			int16x4_t r1_hi = vget_high_s16(r1);
+
+			/* odd index: b1 = -2 */
+			const int16x8_t bg = (s & 1) ? vnegq_s16(gain) : gain;
+
+			const int16x8_t y = vcombine_s16(
+				q15_stage_neon(vget_low_s16(in0[g]), vget_low_s16(in1[g]), vget_low_s16(in2[g]),
+					vget_low_s16(y1), vget_low_s16(y2),
+					vget_low_s16(gain), vget_low_s16(bg), vget_low_s16(na1h), vget_low_s16(na2), &r1_lo),
+				q15_stage_neon(vget_high_s16(in0[g]), vget_high_s16(in1[g]), vget_high_s16(in2[g]),
+					vget_high_s16(y1), vget_high_s16(y2),
+					vget_high_s16(gain), vget_high_s16(bg), vget_high_s16(na1h), vget_high_s16(na2), &r1_hi));
+
+			in0[g] = y;
+			in1[g] = y1;
+			in2[g] = y2;
+			vst1q_s16(&bank->y2[s][g * 8], y1);
+			vst1q_s16(&bank->y1[s][g * 8], y);
+			vst1q_s16(&bank->r1[s][g * 8], vcombine_s16(r1_lo, r1_hi));
+		}
+	}
+
+	for(int g = 0; g < groups; ++g) {
+		vst1q_s16(&out[g * 8], in0[g]);
+	}
+}
+
+static int64_t
+bpf_q15_dot_neon(const dsp_q15 *a, const dsp_q15 *b, int n) {
+	int64x2_t sum = vdupq_n_s64(0);
+	for(int i = 0; i < n; i += 8) {
+		const int16x8_t va = vld1q_s16(&a[i]);
+		const int16x8_t vb = vld1q_s16(&b[i]);
+		sum = vpadalq_s32(sum, vmull_s16(vget_low_s16(va), vget_low_s16(vb)));
+		sum = vpadalq_s32(sum, vmull_s16(vget_high_s16(va), vget_high_s16(vb)));
+	}
+
+	return vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+}
+
+#endif /* NEON */
+
+bool
+bpf_kernel_available(bpf_kernel kernel) {
+	switch(kernel) {
+	case BPF_KERNEL_AUTO:
+	case BPF_KERNEL_SCALAR:
+		return true;
+#ifdef BPF_HAVE_X86
+	case BPF_KERNEL_SSE41:
+		return __builtin_cpu_supports("sse4.1");
+	case BPF_KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+#ifdef BPF_HAVE_NEON
+	case BPF_KERNEL_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bpf_kernel
+bpf_kernel_resolve(bpf_kernel kernel) {
+	if(kernel != BPF_KERNEL_AUTO) return kernel;
+
+	/* In order of preference. The NEON kernels (the filterbank's and the
+	 * synth's) have only been checked against the scalar code through an x86
+	 * stand-in for arm_neon.h, never built for or run on ARM, so they are
+	 * left out until they have been; kernel=neon still asks for them. */
+	if(bpf_kernel_available(BPF_KERNEL_AVX2))  return BPF_KERNEL_AVX2;
+	if(bpf_kernel_available(BPF_KERNEL_SSE41)) return BPF_KERNEL_SSE41;
+
+	return BPF_KERNEL_SCALAR;
+}
+
+bpf_bank_update_fn
+bpf_kernel_get(bpf_kernel kernel) {
+	kernel = bpf_kernel_resolve(kernel);
+	if(!bpf_kernel_available(kernel)) {
+		app_fatal_error("the requested filterbank kernel is not available on this build/CPU");
+	}
+
+	switch(kernel) {
+#ifdef BPF_HAVE_X86
+	case BPF_KERNEL_SSE41: return bpf_bank_update_sse41;
+	case BPF_KERNEL_AVX2:  return bpf_bank_update_avx2;
+#endif
+#ifdef BPF_HAVE_NEON
+	case BPF_KERNEL_NEON:  return bpf_bank_update_neon;
+#endif
+	default:
+		return bpf_bank_update_scalar;
+	}
+}
+
+bpf_bank_q15_update_fn
+bpf_kernel_get_q15(bpf_kernel kernel) {
+	kernel = bpf_kernel_resolve(kernel);
+	if(!bpf_kernel_available(kernel)) {
+		app_fatal_error("the requested filterbank kernel is not available on this build/CPU");
+	}
+
+	switch(kernel) {
+#ifdef BPF_HAVE_X86
+	case BPF_KERNEL_SSE41: return bpf_bank_q15_update_sse41;
+	case BPF_KERNEL_AVX2:  return bpf_bank_q15_update_avx2;
+#endif
+#ifdef BPF_HAVE_NEON
+	case BPF_KERNEL_NEON:  return bpf_bank_q15_update_neon;
+#endif
+	default:
+		return bpf_bank_q15_update_scalar;
+	}
+}
+
+bpf_q15_dot_fn
+bpf_kernel_get_q15_dot(bpf_kernel kernel) {
+	kernel = bpf_kernel_resolve(kernel);
+	if(!bpf_kernel_available(kernel)) {
+		app_fatal_error("the requested filterbank kernel is not available on this build/CPU");
+	}
+
+	switch(kernel) {
+#ifdef BPF_HAVE_X86
+	case BPF_KERNEL_SSE41: return bpf_q15_dot_sse41;
+	case BPF_KERNEL_AVX2:  return bpf_q15_dot_avx2;
+#endif
+#ifdef BPF_HAVE_NEON
+	case BPF_KERNEL_NEON:  return bpf_q15_dot_neon;
+#endif
+	default:
+		return bpf_q15_dot_scalar;
+	}
+}
+
+const char*
+bpf_kernel_name(bpf_kernel kernel) {
+	switch(kernel) {
+	case BPF_KERNEL_AUTO:   return "auto";
+	case BPF_KERNEL_SCALAR: return "scalar";
+	case BPF_KERNEL_SSE41:  return "sse4.1";
+	case BPF_KERNEL_AVX2:   return "avx2";
+	case BPF_KERNEL_NEON:   return "neon";
+	}
+	return "unknown";
+}
@@ -0,0 +1,90 @@
+#ifndef BPF_SIMD_H
+#define BPF_SIMD_H
+
+#include "types.h"
+
+#include "bpf.h"
+
+/**
+ * bpf_simd.h: hand-vectorised versions of bpf_bank_update, and of the Q15
+ * bpf_bank_q15_update and bpf_q15_dot.
+ *
+ * Every kernel computes exactly the same arithmetic as the scalar versions in
+ * bpf_impl.c (which stay as the reference), so the choice of kernel never
+ * changes the output--only the speed.
+ */
+
+typedef enum {
+	/**
+	 * Pick the fastest kernel supported by the CPU we are running on, except
+	 * for NEON, which has to be asked for (see bpf_kernel_resolve).
+	 */
+	BPF_KERNEL_AUTO,
+	/** The scalar reference code from bpf_impl.c. */
+	BPF_KERNEL_SCALAR,
+	/** x86 SSE4.1, 4 bands at a time. */
+	BPF_KERNEL_SSE41,
+	/** x86 AVX2, 8 bands at a time. */
+	BPF_KERNEL_AVX2,
+	/**
+	 * ARM NEON, 4 bands at a time. Only available when built with NEON, and
+	 * not yet tested on ARM, so never picked by BPF_KERNEL_AUTO.
+	 */
+	BPF_KERNEL_NEON,
+} bpf_kernel;
+
+/**
+ * The signature shared by all of the bank kernels. x is the input history
+ * (x[0] is the new sample), and the output of each band is written to
+ * out[band], which must have room for bank->bands entries.
+ */
+typedef void (*bpf_bank_update_fn)(bpf_bank *bank, const dsp_num *x, dsp_num *out);
+
+/**
+ * The signature of the bpf_bank_q15 kernels. The same as bpf_bank_update_fn,
+ * but in Q15.
+ */
+typedef void (*bpf_bank_q15_update_fn)(bpf_bank_q15 *bank, const dsp_q15 *x, dsp_q15 *out);
+
+/**
+ * The signature of the Q15 dot product kernels: returns the sum of a[i] * b[i]
+ * for i < n, accumulated in 64 bits. b must not hold -32768, and n must be a
+ * multiple of BPF_BANK_Q15_LANES.
+ */
+typedef int64_t (*bpf_q15_dot_fn)(const dsp_q15 *a, const dsp_q15 *b, int n);
+
+/**
+ * Returns whether the given kernel was compiled in and is supported by the CPU.
+ */
+bool bpf_kernel_available(bpf_kernel kernel);
+
+/**
+ * Resolves BPF_KERNEL_AUTO to a concrete kernel. Any other kernel is returned
+ * as-is.
+ */
+bpf_kernel bpf_kernel_resolve(bpf_kernel kernel);
+
+/**
+ * Returns the update function for the given kernel. Exits with a fatal error
+ * if the kernel is not available.
+ */
+bpf_bank_update_fn bpf_kernel_get(bpf_kernel kernel);
+
+/**
+ * Returns the bpf_bank_q15 update function for the given kernel. Exits with a
+ * fatal error if the kernel is not available.
+ */
+bpf_bank_q15_update_fn bpf_kernel_get_q15(bpf_kernel kernel);
+
+/**
+ * Returns the Q15 dot product function for the given kernel. Exits with a
+ * fatal error if the kernel is not available.
+ */
+bpf_q15_dot_fn bpf_kernel_get_q15_dot(bpf_kernel kernel);
+
+/**
+ * Returns a short human-readable name for the kernel, e.g. "avx2".
+ */
+const char *bpf_kernel_name(bpf_kernel kernel);
+
+#endif
@@ -2,6 +2,7 @@
 #define DSP_H
 
 #include <stdint.h>
+#include <math.h>
 
 /** 
  * NOTE: DSP_FLOAT IS NOT LONGER SUPPORTED.
@@ -10,7 +11,6 @@
  */
 #ifdef DSP_FLOAT
 
-#include <math.h>
 
 typedef float dsp_num;
 typedef float dsp_largenum;
@@ -187,6 +187,31 @@ dsp_abs(dsp_num f) {
 
 #endif
 
+/* --- Q15 ---
+ *
+ * A 16-bit fixed point format, with values in [-1, 1). Used by the optional
+ * reduced precision filterbank (bpf_bank_q15 in bpf.h), where it doubles the
+ * number of SIMD lanes compared to dsp_num. Products are accumulated in 32
+ * bits, and only the results are saturated back to Q15. */
+typedef int16_t dsp_q15;
+
+#define DSP_Q15_MAX 32767
+#define DSP_Q15_MIN (-32768)
 
+static inline dsp_q15
+dsp_q15_sat(int32_t v) {
+	if(v > DSP_Q15_MAX) return DSP_Q15_MAX;
+	if(v < DSP_Q15_MIN) return DSP_Q15_MIN;
+	return (dsp_q15)v;
+}
+
+/* Coefficients are clamped to +-32767, so that they can always be negated. */
+static inline dsp_q15
+dsp_q15_from_double(double d) {
+	const double v = round(d * 32768.0);
+	if(v > DSP_Q15_MAX) return DSP_Q15_MAX;
+	if(v < -DSP_Q15_MAX) return -DSP_Q15_MAX;
+	return (dsp_q15)v;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef DSP_SIMD_H
+#define DSP_SIMD_H
+
+#include "dsp.h"
+
+/**
+ * dsp_simd.h: the pieces shared by the hand-vectorised kernels (bpf_simd.c,
+ * synth.c): which instruction sets can be compiled in, and the fixed point
+ * multiply for each of them.
+ *
+ * DSP_SIMD_X86 is defined when the SSE4.1 and AVX2 kernels can be built (with
+ * target attributes, so the rest of the build doesn't need -mavx2), and
+ * DSP_SIMD_NEON when building with NEON. Whether the CPU actually supports a
+ * kernel is a run-time question; see bpf_kernel_available().
+ *
+ * Notes on the fixed point multiply:
+ *
+ * dsp_mul computes (int32)(((int64)a * b) >> DSP_POINT_IDX), i.e. bits 29..60
+ * of the full 64-bit product. Every kernel computes exactly those bits, so
+ * that the output is bit-exact with the scalar code.
+ *
+ * This is why we don't use the rounding doubling multiplies (vqrdmulh and
+ * friends) on NEON: they implement a rounded Q31 product, which would change
+ * the output. Instead we use a widening multiply followed by a narrowing shift.
+ *
+ * On x86, there is no 64-bit arithmetic shift before AVX-512, but because we
+ * only keep 32 bits of the result, a logical shift gives the same bits.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSP_SIMD_X86 1
+
+#include <immintrin.h>
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+mul_q29_sse41(__m128i a, __m128i b) {
+	/* _mm_mul_epi32 only multiplies the even lanes, so do the odd ones in
+	 * a second multiply. */
+	__m128i even = _mm_mul_epi32(a, b);
+	__m128i odd  = _mm_mul_epi32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	/* Move bits 29..60 into the low half of each even product, and into the
+	 * high half of each odd product, then interleave the two. */
+	even = _mm_srli_epi64(even, DSP_POINT_IDX);
+	odd  = _mm_slli_epi64(odd, 32 - DSP_POINT_IDX);
+
+	return _mm_blend_epi16(even, odd, 0xCC);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+mul_q29_avx2(__m256i a, __m256i b) {
+	/* Same approach as mul_q29_sse41, with 8 lanes. */
+	__m256i even = _mm256_mul_epi32(a, b);
+	__m256i odd  = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+
+	even = _mm256_srli_epi64(even, DSP_POINT_IDX);
+	odd  = _mm256_slli_epi64(odd, 32 - DSP_POINT_IDX);
+
+	return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+#endif /* x86 */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DSP_SIMD_NEON 1
+
+#include <arm_neon.h>
+
+static inline int32x4_t
+mul_q29_neon(int32x4_t a, int32x4_t b) {
+	/* Widening multiply to 64 bits, then a narrowing shift keeps bits 29..60. */
+	const int64x2_t lo = vmull_s32(vget_low_s32(a), vget_low_s32(b));
+	const int64x2_t hi = vmull_s32(vget_high_s32(a), vget_high_s32(b));
+
+	return vcombine_s32(vshrn_n_s64(lo, DSP_POINT_IDX), vshrn_n_s64(hi, DSP_POINT_IDX));
+}
+
+#endif /* NEON */
+
+#endif
@@ -0,0 +1,76 @@
+#include "fft.h"
+
+#include <math.h>
+
+#include "app.h"
+
+void
+fft_plan_init(fft_plan *plan, int size) {
+	if(size < 2 || size > FFT_MAX_SIZE || (size & (size - 1)) != 0) {
+		app_fatal_error("fft: size must be a power of two <= FFT_MAX_SIZE");
+	}
+
+	plan->size = size;
+	plan->log2_size = 0;
+	while((1 << plan->log2_size) < size) {
+		plan->log2_size += 1;
+	}
+
+	for(int i = 0; i < size / 2; ++i) {
+		const double theta = -2.0 * M_PI * i / size;
+		plan->twiddle[i] = (float)cos(theta) + I * (float)sin(theta);
+	}
+
+	for(int i = 0; i < size; ++i) {
+		int rev = 0;
+		for(int b = 0; b < plan->log2_size; ++b) {
+			rev |= ((i >> b) & 1) << (plan->log2_size - 1 - b);
+		}
+		plan->bitrev[i] = (unsigned short)rev;
+	}
+}
+
+void
+fft_forward(const fft_plan *plan, float complex *data) {
+	const int n = plan->size;
+
+	for(int i = 0; i < n; ++i) {
+		const int j = plan->bitrev[i];
+		if(j > i) {
+			float complex tmp = data[i];
+			data[i] = data[j];
+			data[j] = tmp;
+		}
+	}
+
+	/* Iterative Cooley-Tukey butterflies. At each pass, the twiddle stride
+	 * halves as the butterfly span doubles. */
+	for(int span = 1, stride = n / 2; span < n; span *= 2, stride /= 2) {
+		for(int start = 0; start < n; start += 2 * span) {
+			for(int k = 0; k < span; ++k) {
+				const float complex w = plan->twiddle[k * stride];
+				const float complex a = data[start + k];
+				const float complex b = data[start + k + span] * w;
+
+				data[start + k]        = a + b;
+				data[start + k + span] = a - b;
+			}
+		}
+	}
+}
+
+void
+fft_inverse(const fft_plan *plan, float complex *data) {
+	/* ifft(x) = conj(fft(conj(x))) / n */
+	const int n = plan->size;
+	for(int i = 0; i < n; ++i) {
+		data[i] = conjf(data[i]);
+	}
+
+	fft_forward(plan, data);
+
+	const float scale = 1.0f / n;
+	for(int i = 0; i < n; ++i) {
+		data[i] = conjf(data[i]) * scale;
+	}
+}
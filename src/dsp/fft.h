@@ -0,0 +1,44 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex.h>
+
+/**
+ * fft.h: a small in-place radix-2 complex FFT, in single precision float.
+ *
+ * Used by the STFT vocoder engine. Unlike the rest of the DSP code this is
+ * floating point, as the BeagleBone's VFP/NEON handles float FFTs fine and a
+ * fixed point FFT would need per-stage scaling to avoid overflow.
+ */
+
+/* The largest supported FFT size. */
+#define FFT_MAX_SIZE 2048
+
+typedef struct {
+	int size;
+	int log2_size;
+
+	/* twiddle[i] = exp(-2 pi i / size) for i < size / 2 */
+	float complex twiddle[FFT_MAX_SIZE / 2];
+
+	/* The bit-reversed index for each index. */
+	unsigned short bitrev[FFT_MAX_SIZE];
+} fft_plan;
+
+/**
+ * Prepares the twiddle and bit reversal tables for an FFT of the given size,
+ * which must be a power of two no larger than FFT_MAX_SIZE.
+ */
+void fft_plan_init(fft_plan *plan, int size);
+
+/**
+ * Computes the forward FFT of data (plan->size entries) in place. Unscaled.
+ */
+void fft_forward(const fft_plan *plan, float complex *data);
+
+/**
+ * Computes the inverse FFT of data in place, including the 1 / size scaling.
+ */
+void fft_inverse(const fft_plan *plan, float complex *data);
+
+#endif
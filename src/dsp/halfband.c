@@ -0,0 +1,130 @@
+#include "halfband.h"
+
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+
+#include "app.h"
+
+/* The Kaiser window beta. 7 gives a bit over 50 dB of stopband attenuation. */
+#define HALFBAND_KAISER_BETA 7.0
+
+static double
+bessel_i0(double x) {
+	/* Power series for the zeroth order modified Bessel function. Converges
+	 * quickly for the values of beta we care about. */
+	double sum = 1.0;
+	double term = 1.0;
+	for(int k = 1; k < 50; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+void
+halfband_init(halfband *hb, int taps) {
+	if(taps > HALFBAND_MAX_TAPS || (taps % 4) != 3) {
+		app_fatal_error("halfband: taps must be 4k + 3 and at most HALFBAND_MAX_TAPS");
+	}
+
+	memset(hb, 0, sizeof(*hb));
+
+	const int center = (taps - 1) / 2;
+	hb->taps  = taps;
+	hb->pairs = (taps + 1) / 4;
+
+	/* Windowed sinc. The nonzero off-center taps are at odd distances from the
+	 * center, which are the even indices since the center is odd. */
+	double h[(HALFBAND_MAX_TAPS + 1) / 4];
+	double side = 0;
+	for(int j = 0; j < hb->pairs; ++j) {
+		const int d = center - 2 * j;
+		const double r = (double)d / center;
+		const double w = bessel_i0(HALFBAND_KAISER_BETA * sqrt(1.0 - r * r)) / bessel_i0(HALFBAND_KAISER_BETA);
+
+		h[j] = sin(M_PI * d / 2.0) / (M_PI * d) * w;
+		side += 2 * h[j];
+	}
+
+	/* Normalize so that both polyphase branches have a DC gain of exactly 0.5,
+	 * i.e. the filter has unity gain at DC. */
+	for(int j = 0; j < hb->pairs; ++j) {
+		hb->coeffs[j] = dsp_from_double(h[j] * 0.5 / side);
+	}
+}
+
+double
+halfband_passband_edge(const halfband *hb) {
+	const int center = (hb->taps - 1) / 2;
+
+	double f = 0;
+	for(;;) {
+		const double w = 2 * M_PI * f;
+
+		/* Zero phase response: 0.5 + sum of 2 h cos(w d) */
+		double r = 0.5;
+		for(int j = 0; j < hb->pairs; ++j) {
+			r += 2 * dsp_to_float(hb->coeffs[j]) * cos(w * (center - 2 * j));
+		}
+
+		if(fabs(1.0 - r) > 0.002) return f;
+		f += 0.001;
+	}
+}
+
+int
+halfband_delay(const halfband *hb) {
+	return (hb->taps - 1) / 2;
+}
+
+static inline void
+halfband_push(halfband *hb, dsp_num x, int len) {
+	hb->pos -= 1;
+	if(hb->pos < 0) hb->pos = len - 1;
+
+	hb->hist[hb->pos] = x;
+	hb->hist[hb->pos + len] = x;
+}
+
+dsp_num
+halfband_decimate(halfband *hb, dsp_num x0, dsp_num x1) {
+	/* The decimator keeps a full history of high rate samples, and just
+	 * evaluates the FIR at every other sample. */
+	const int len = hb->taps;
+	halfband_push(hb, x0, len);
+	halfband_push(hb, x1, len);
+
+	const dsp_num *w = &hb->hist[hb->pos];
+	const int center = (len - 1) / 2;
+
+	dsp_largenum suml = dsp_mul_large(w[center], dsp_one / 2);
+	for(int j = 0; j < hb->pairs; ++j) {
+		suml += dsp_mul_large(w[2 * j], hb->coeffs[j]);
+		suml += dsp_mul_large(w[len - 1 - 2 * j], hb->coeffs[j]);
+	}
+
+	return dsp_compact(suml);
+}
+
+void
+halfband_interpolate(halfband *hb, dsp_num u, dsp_num *out) {
+	/* The interpolator filters the zero-stuffed signal (with a gain of 2). The
+	 * even outputs only see the off-center taps, and the odd outputs only see
+	 * the center tap, which is 0.5 * 2 = 1: just a delayed input sample. So
+	 * we only keep a history of the low rate samples. */
+	const int center = (hb->taps - 1) / 2;
+	const int len = center + 1;
+	halfband_push(hb, u, len);
+
+	const dsp_num *w = &hb->hist[hb->pos];
+
+	dsp_largenum suml = 0;
+	for(int j = 0; j < hb->pairs; ++j) {
+		suml += dsp_mul_large(w[j], hb->coeffs[j]);
+		suml += dsp_mul_large(w[center - j], hb->coeffs[j]);
+	}
+
+	out[0] = dsp_compact(suml * 2);
+	out[1] = w[(center - 1) / 2];
+}
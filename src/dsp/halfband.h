@@ -0,0 +1,68 @@
+#ifndef HALFBAND_H
+#define HALFBAND_H
+
+#include "dsp.h"
+
+/**
+ * halfband.h: polyphase halfband FIR filters for 2:1 decimation and 1:2
+ * interpolation.
+ *
+ * A halfband filter has a cutoff at a quarter of the (higher) sample rate, and
+ * every other coefficient is zero except for the center one (which is 0.5).
+ * So both the decimator and the interpolator only need to evaluate about a
+ * quarter of the taps per high-rate sample.
+ */
+
+/* The maximum number of taps. Taps must be of the form 4k + 3. */
+#define HALFBAND_MAX_TAPS 47
+
+/* The number of taps used by the vocoder. At 52 dB of stopband attenuation,
+ * this passes up to about 0.18 of the higher sample rate. */
+#define HALFBAND_DEFAULT_TAPS 31
+
+typedef struct {
+	/* The nonzero off-center coefficients, h[0], h[2], ..., h[center - 1].
+	 * The filter is symmetric, so these are also the coefficients on the
+	 * other side of the center. */
+	dsp_num coeffs[(HALFBAND_MAX_TAPS + 1) / 4];
+	int pairs;
+
+	int taps;
+
+	/* The history, newest first, starting at hist[pos]. Every sample is
+	 * stored twice (at pos and pos + the history length) so the window is always
+	 * contiguous. */
+	dsp_num hist[2 * HALFBAND_MAX_TAPS];
+	int pos;
+} halfband;
+
+/**
+ * Designs a halfband filter with the given (odd, 4k + 3) number of taps, using
+ * a Kaiser-windowed sinc, and clears its history.
+ */
+void halfband_init(halfband *hb, int taps);
+
+/**
+ * Returns the highest frequency (as a fraction of the higher sample rate) that
+ * the filter passes with less than about 0.02 dB of error.
+ */
+double halfband_passband_edge(const halfband *hb);
+
+/**
+ * Returns the group delay of the filter, in samples at the higher rate. The
+ * decimator and interpolator each add this much delay.
+ */
+int halfband_delay(const halfband *hb);
+
+/**
+ * Decimates two high rate samples (x0 first, then x1) into one low rate sample.
+ */
+dsp_num halfband_decimate(halfband *hb, dsp_num x0, dsp_num x1);
+
+/**
+ * Interpolates one low rate sample into two high rate samples, written to
+ * out[0] and then out[1].
+ */
+void halfband_interpolate(halfband *hb, dsp_num u, dsp_num *out);
+
+#endif
@@ -0,0 +1,141 @@
+#include "stft_vocoder.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "app.h"
+
+void
+stft_vocoder_init(stft_vocoder *s, int size, int bands, double max_freq, double ef_lerp, double band_gain) {
+	memset(s, 0, sizeof(*s));
+
+	if(bands < 1 || bands > STFT_MAX_BANDS) {
+		app_fatal_error("vocoder: fft_bands must be between 1 and STFT_MAX_BANDS");
+	}
+
+	fft_plan_init(&s->plan, size);
+
+	s->size  = size;
+	s->hop   = size / 4;
+	s->bands = bands;
+
+	/* Periodic Hann window. With a hop of size / 4, the squared windows add
+	 * up to exactly 1.5 everywhere. */
+	double window_energy = 0;
+	for(int i = 0; i < size; ++i) {
+		s->window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / size));
+		window_energy += (double)s->window[i] * s->window[i];
+	}
+	s->ola_scale = 1.0f / 1.5f;
+
+	/* Same band layout as the IIR filterbank: centers at multiples of
+	 * max_freq / (bands + 1), each one band wide. */
+	const double div = max_freq / (bands + 1) * size;
+	for(int b = 0; b <= bands; ++b) {
+		s->band_start[b] = (int)lround((b + 0.5) * div);
+	}
+
+	/* With a small size, the first band would start at bin 0. Bin 0 has no
+	 * partner bin n - k to split the spectra with, and DC is outside every
+	 * band of the filterbank anyway, so start at bin 1. */
+	if(s->band_start[0] < 1) s->band_start[0] = 1;
+	for(int b = 0; b < bands; ++b) {
+		if(s->band_start[b + 1] <= s->band_start[b]) {
+			app_fatal_error("vocoder: fft_bands is too high for fft_size (a band would be narrower than one bin)");
+		}
+	}
+
+	/* By Parseval, a band with energy E (summed over its positive frequency
+	 * bins) holds a signal with a mean square of 2 E / (size * window_energy).
+	 * For a sinusoid, the mean absolute value (which is what the IIR envelope
+	 * followers measure) is 2 sqrt(2) / pi times the RMS. */
+	s->energy_scale = (float)(2.0 / (size * window_energy));
+	s->energy_scale *= (float)(8.0 / (M_PI * M_PI));
+
+	s->band_gain2 = (float)(band_gain * band_gain);
+	s->env_lerp = (float)(1.0 - pow(1.0 - ef_lerp, s->hop));
+}
+
+static void
+stft_vocoder_frame(stft_vocoder *s) {
+	const int n = s->size;
+	float complex *z = s->spec;
+
+	/* Transform both (real) inputs at once: z = fft(mod + i car). */
+	for(int i = 0; i < n; ++i) {
+		z[i] = s->window[i] * (s->mod_in[i] + I * s->car_in[i]);
+	}
+	fft_forward(&s->plan, z);
+
+	/* Split the spectra (M[k] = (Z[k] + conj(Z[n - k])) / 2, C[k] =
+	 * (Z[k] - conj(Z[n - k])) / 2i), measure the modulator, and scale the
+	 * carrier. Bins k and n - k are rewritten together, so the output
+	 * spectrum stays conjugate symmetric. */
+	for(int b = 0; b < s->bands; ++b) {
+		float energy = 0;
+		for(int k = s->band_start[b]; k < s->band_start[b + 1]; ++k) {
+			const float complex zk = z[k];
+			const float complex zn = conjf(z[n - k]);
+			const float complex m = 0.5f * (zk + zn);
+			energy += crealf(m) * crealf(m) + cimagf(m) * cimagf(m);
+		}
+
+		const float level = sqrtf(energy * s->energy_scale);
+		s->env[b] += (level - s->env[b]) * s->env_lerp;
+
+		const float gain = s->env[b] * s->band_gain2;
+		for(int k = s->band_start[b]; k < s->band_start[b + 1]; ++k) {
+			const float complex zk = z[k];
+			const float complex zn = conjf(z[n - k]);
+			const float complex c = -0.5f * I * (zk - zn) * gain;
+
+			z[k] = c;
+			z[n - k] = conjf(c);
+		}
+	}
+
+	/* Everything outside the bands is silent, like the filterbank. */
+	for(int k = 0; k < s->band_start[0]; ++k) {
+		z[k] = 0;
+		if(k > 0) z[n - k] = 0;
+	}
+	for(int k = s->band_start[s->bands]; k <= n / 2; ++k) {
+		z[k] = 0;
+		z[n - k] = 0;
+	}
+
+	fft_inverse(&s->plan, z);
+
+	for(int i = 0; i < n; ++i) {
+		s->ola[i] += crealf(z[i]) * s->window[i] * s->ola_scale;
+	}
+
+	/* The first hop samples have now had every overlapping frame added. */
+	memcpy(s->out, s->ola, sizeof(float) * s->hop);
+	memmove(s->ola, s->ola + s->hop, sizeof(float) * (n - s->hop));
+	memset(s->ola + n - s->hop, 0, sizeof(float) * s->hop);
+
+	memmove(s->mod_in, s->mod_in + s->hop, sizeof(float) * (n - s->hop));
+	memmove(s->car_in, s->car_in + s->hop, sizeof(float) * (n - s->hop));
+}
+
+dsp_num
+stft_vocoder_process(stft_vocoder *s, dsp_num mod, dsp_num car) {
+	const int pos = s->size - s->hop + s->fill;
+	s->mod_in[pos] = dsp_to_float(mod);
+	s->car_in[pos] = dsp_to_float(car);
+
+	float y = s->out[s->fill];
+
+	s->fill += 1;
+	if(s->fill == s->hop) {
+		stft_vocoder_frame(s);
+		s->fill = 0;
+	}
+
+	/* Keep clear of the edges of the fixed point range. */
+	if(y > 3.99f) y = 3.99f;
+	if(y < -3.99f) y = -3.99f;
+
+	return dsp_from_double(y);
+}
@@ -0,0 +1,92 @@
+#ifndef STFT_VOCODER_H
+#define STFT_VOCODER_H
+
+#include <complex.h>
+
+#include "dsp.h"
+#include "fft.h"
+
+/**
+ * stft_vocoder.h: a vocoder engine based on the short-time Fourier transform.
+ *
+ * Both inputs are cut into Hann-windowed frames (overlapping by 3/4) and
+ * transformed with a single complex FFT. The modulator bins are grouped into
+ * bands, whose RMS levels become the band envelopes; every carrier bin is then
+ * scaled by the envelope of its band, and the result is transformed back and
+ * overlap-added.
+ *
+ * The cost per sample is O(log size), independent of the number of bands,
+ * which makes 64--256 band vocoding practical. The price is a latency of one
+ * frame (size samples).
+ */
+
+/** The maximum number of bands. */
+#define STFT_MAX_BANDS 256
+
+/** The default frame size: 23ms at 44.1kHz, 43Hz per bin. */
+#define STFT_DEFAULT_SIZE 1024
+
+/** The default number of bands. */
+#define STFT_DEFAULT_BANDS 64
+
+typedef struct {
+	fft_plan plan;
+
+	/** The frame size, and the number of samples between frames. */
+	int size;
+	int hop;
+
+	/** Band b covers bins [band_start[b], band_start[b + 1]). */
+	int bands;
+	int band_start[STFT_MAX_BANDS + 1];
+
+	/** The Hann window, used for both analysis and synthesis. */
+	float window[FFT_MAX_SIZE];
+
+	/** Converts the energy of a band to its mean absolute value in time. */
+	float energy_scale;
+	/** The square of the band gain: once for the modulator, once for the carrier. */
+	float band_gain2;
+	/** The envelope smoothing factor, per frame. */
+	float env_lerp;
+	/** Undoes the gain of the overlapping analysis and synthesis windows. */
+	float ola_scale;
+
+	/** The smoothed envelope of each band. */
+	float env[STFT_MAX_BANDS];
+
+	/** The last size input samples, oldest first. */
+	float mod_in[FFT_MAX_SIZE];
+	float car_in[FFT_MAX_SIZE];
+
+	/** The overlap-add accumulator. The first hop samples are complete after
+	 * each frame. */
+	float ola[FFT_MAX_SIZE];
+
+	/** The completed output for the current hop. */
+	float out[FFT_MAX_SIZE];
+
+	/** The number of samples taken since the last frame. */
+	int fill;
+
+	float complex spec[FFT_MAX_SIZE];
+} stft_vocoder;
+
+/**
+ * Initializes the engine with the given frame size (a power of two, at most
+ * FFT_MAX_SIZE) and number of bands, spread evenly between 0 and max_freq
+ * (normalized to the sample rate). ef_lerp is the per-sample envelope follower
+ * lerp factor to match, and band_gain is the passband gain of each band (applied
+ * to both the modulator and the carrier, like a band pass filter would be).
+ *
+ * Exits with a fatal error if a band would end up narrower than one bin.
+ */
+void stft_vocoder_init(stft_vocoder *s, int size, int bands, double max_freq, double ef_lerp, double band_gain);
+
+/**
+ * Takes one sample of each input and returns one output sample. The output is
+ * delayed by s->size samples.
+ */
+dsp_num stft_vocoder_process(stft_vocoder *s, dsp_num mod, dsp_num car);
+
+#endif
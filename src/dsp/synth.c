@@ -1,6 +1,9 @@
 #include "synth.h"
 
 #include "dsp/dsp_perf.h"
+#include "dsp/dsp_simd.h"
+#include "dsp/fft.h"
+#include "app.h"
 
 #include <string.h>
 #include <math.h>
@@ -25,60 +28,148 @@ static dsp_num sinc_table[SINC_SIZE];
 static dsp_num sinc_table_step;
 static dsp_num sinc_first_step;
 
+/* The gain of voice_sinc_waveform() on a constant, which the other oscillators
+ * are scaled by so that they all play at the same level. */
+static dsp_num oscillator_gain;
+
+/* The band-limited saw and square for each octave, side by side so that one
+ * read gets both, with a copy of the first pair at the end so that
+ * interpolation never has to wrap. The samples are twice the waveform's value
+ * in Q15, so that the peaks (0.25 plus the Gibbs overshoot) use most of the
+ * range. */
+static int16_t wavetable[SYNTH_WAVETABLE_OCTAVES][SYNTH_WAVETABLE_SIZE + 1][2]
+	__attribute__((aligned(64)));
+static bool wavetable_ready = false;
+
+/* A wavetable sample to Q29: the Q15 scale, and the factor of two. */
+#define WAVETABLE_SHIFT (DSP_POINT_IDX - 15 - 1)
+
+/* The phase bits below the table index. */
+#define WAVETABLE_FRAC_BITS (DSP_POINT_IDX - 9)
+#define WAVETABLE_FRAC_MASK ((1 << WAVETABLE_FRAC_BITS) - 1)
+
+/* How far the interpolation's product is shifted down. */
+#define WAVETABLE_LERP_SHIFT (WAVETABLE_FRAC_BITS - WAVETABLE_SHIFT)
+_Static_assert(SYNTH_WAVETABLE_SIZE == 1 << 9, "WAVETABLE_FRAC_BITS assumes 512 entries");
+
+/* How far the tuning knob can raise a note, which the tables leave room for:
+ * two semitones (see param_tuning). */
+#define WAVETABLE_MAX_TUNING 1.122462048309373
+
+/* The level of the naive square wave (and of the saw's peaks). */
+#define SQUARE_LEVEL dsp_rshift(dsp_one, 2)
+
+/* Multiplying the noise state by a large prime tries to mix the digits. */
+#define NOISE_MULTIPLIER 12347843
+
+/* How close the envelope has to get to its target to move on to the next
+ * state. */
+#define ENVELOPE_SMALL_DIFFERENCE 0.02
+
+/* polyblep() divides by dt as a multiply by its reciprocal, kept per voice in
+ * synth.dt_recip with this many fraction bits. The smallest dt, of the lowest
+ * note tuned all the way down (see param_tuning), is above 2^20 in Q29, so the
+ * reciprocal stays below 2^31. */
+#define POLYBLEP_RECIP_BITS 21
+
+_Static_assert(MAX_SYNTH_VOICES % SYNTH_VOICE_LANES == 0,
+	"the kernels process SYNTH_VOICE_LANES voices at a time");
+_Static_assert(MAX_SYNTH_VOICES <= 32, "synth.active has a bit per voice");
+
+/* synth.active with every voice set. */
+#define SYNTH_ALL_VOICES ((uint32_t)(((uint64_t)1 << MAX_SYNTH_VOICES) - 1))
+
+/**
+ * Whether voice i is silent, and will stay silent until it is pressed again:
+ * its envelope is 0, and in SYNTH_RELEASE or SYNTH_SUSTAIN, neither of which
+ * moves it away from 0. These are the voices synth_press() takes first, and
+ * the ones synth_process() skips.
+ */
+static inline bool
+synth_voice_idle(const synth *syn, int i) {
+	if(syn->state[i] != SYNTH_RELEASE && syn->state[i] != SYNTH_SUSTAIN) return false;
+	return syn->envelope[i] == 0;
+}
+
+/* The reciprocal of dt for polyblep(), or 0 if there is no step to smooth. */
+static inline dsp_num
+polyblep_recip(dsp_num dt) {
+	if(dt <= 0) return 0;
+	const dsp_largenum r = ((dsp_largenum)1 << (DSP_POINT_IDX + POLYBLEP_RECIP_BITS)) / dt;
+	return (r > INT32_MAX) ? INT32_MAX : (dsp_num)r;
+}
+
 void
 synth_press(synth *syn, int note) {
 	int idx = 0;
 
 	/* First, if there is a voice that is at envelope gain 0 (and in release or sustain),
-	 * then we can simply steal that voice. */
-	for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
-		if(syn->voices[i].state == SYNTH_RELEASE || syn->voices[i].state == SYNTH_SUSTAIN) {
-			if(syn->voices[i].envelope == 0) {
-				idx = i;
-				goto have_a_voice;
-			}
-		}
+	 * then we can simply steal that voice. Those are exactly the ones that
+	 * aren't active; take the lowest, which keeps the sounding voices
+	 * together in as few of the kernels' vectors as possible. */
+	const uint32_t idle = ~syn->active & SYNTH_ALL_VOICES;
+	if(idle) {
+		idx = __builtin_ctz(idle);
+		goto have_a_voice;
 	}
 
 	/* Otherwise, steal an active voice. Init to 0 then check the other ones. */
 	idx = 0;
-	uint32_t age = syn->voices[0].age;
+	uint32_t age = syn->age[0];
 
 	/* Find the voice that has least recently been stolen. */
 	for(int i = 1; i < MAX_SYNTH_VOICES; ++i) {
-		if(syn->voices[i].age < age) {
-			age = syn->voices[i].age;
+		if(syn->age[i] < age) {
+			age = syn->age[i];
 			idx = i;
 		}
 	}
 
 have_a_voice:
 	/* Set state and frequency. */
-	syn->voices[idx].state = SYNTH_ATTACK;
-	syn->voices[idx].envelope = dsp_zero; /* The envelope must reset to 0 */
-	syn->voices[idx].age = syn->next_age;
-	syn->voices[idx].phase_step = phase_offset_table[note];
+	syn->state[idx] = SYNTH_ATTACK;
+	syn->envelope[idx] = dsp_zero; /* The envelope must reset to 0 */
+	syn->age[idx] = syn->next_age;
+	syn->phase_step[idx] = phase_offset_table[note];
+	syn->dt_recip[idx] = polyblep_recip(dsp_mul(syn->phase_step[idx], syn->dt_recip_tuning));
+	syn->octave[idx] = note / 12;
 
 	/* Track the note */
-	syn->voices[idx].note = note;
+	syn->note[idx] = note;
+	syn->active |= 1u << idx;
 
 	/* Track next age value */
 	syn->next_age += 1;
 }
 
 static bool
-synth_voice_active(synth_voice *v) {
-	if(v->state == SYNTH_ATTACK || v->state == SYNTH_DECAY) return false;
-	return v->envelope != 0;
+synth_voice_active(synth *syn, int i) {
+	if(syn->state[i] == SYNTH_ATTACK || syn->state[i] == SYNTH_DECAY) return false;
+	return syn->envelope[i] != 0;
+}
+
+int
+synth_get_active_notes(synth *syn, int32_t *notes, int32_t *voices, int max) {
+	int count = 0;
+	for(int i = 0; i < MAX_SYNTH_VOICES && count < max; ++i) {
+		if(synth_voice_active(syn, i)) {
+			notes[count] = syn->note[i];
+			voices[count] = i;
+			count += 1;
+		}
+	}
+	return count;
 }
 
 void
 synth_print_active_notes(synth *syn) {
+	int32_t notes[MAX_SYNTH_VOICES];
+	int32_t voices[MAX_SYNTH_VOICES];
+	const int count = synth_get_active_notes(syn, notes, voices, MAX_SYNTH_VOICES);
+
 	printf("active notes: ");
-	for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
-		if(synth_voice_active(&syn->voices[i])) {
-			printf("%d (on voice %d) ", syn->voices[i].note, i);
-		}
+	for(int i = 0; i < count; ++i) {
+		printf("%d (on voice %d) ", notes[i], voices[i]);
 	}
 	puts("");
 }
@@ -88,8 +179,13 @@ synth_release(synth *syn, int note) {
 	for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
 		/* Assumption: Only one voice is ever playing a given note at a time 
 		 * (Potential TODO: Make this look for the "most recent" note?) */
-		if(syn->voices[i].note == note) {
-			syn->voices[i].state = SYNTH_RELEASE;
+		if(syn->note[i] == note) {
+			syn->state[i] = SYNTH_RELEASE;
+
+			/* Released before its attack got anywhere */
+			if(synth_voice_idle(syn, i)) {
+				syn->active &= ~(1u << i);
+			}
 		}
 	}
 }
@@ -108,9 +204,9 @@ sawtooth_wave(dsp_num phase) {
 static inline dsp_num
 square_wave(dsp_num phase) {
 	if(phase > (dsp_one / 2)) {
-		return -dsp_rshift(dsp_one, 2);
+		return -SQUARE_LEVEL;
 	}
-	return dsp_rshift(dsp_one, 2);
+	return SQUARE_LEVEL;
 }
 
 static inline dsp_num
@@ -132,7 +228,7 @@ phase_small_decrement(dsp_num in, dsp_num step) {
 }
 
 static inline dsp_num
-voice_sample_waveform(dsp_num phase, audio_params *ap) {
+voice_sample_waveform(dsp_num phase, const audio_params *ap) {
 	dsp_num saw = sawtooth_wave(phase);
 	dsp_num square = square_wave(phase);
 
@@ -140,20 +236,20 @@ voice_sample_waveform(dsp_num phase, audio_params *ap) {
 }
 
 static inline dsp_num
-voice_compute_waveform(synth_voice *v, audio_params *ap) {
-	const dsp_num total_step = v->phase_step;
+voice_sinc_waveform(dsp_num phase, dsp_num phase_step, const audio_params *ap) {
+	const dsp_num total_step = phase_step;
 	const dsp_num first_step = dsp_mul(total_step, sinc_first_step);
 	const dsp_num step       = dsp_mul(total_step, sinc_table_step);
 
-	dsp_num phase_pos = phase_small_increment(v->phase, first_step);
-	dsp_num phase_neg = phase_small_decrement(v->phase, first_step);
+	dsp_num phase_pos = phase_small_increment(phase, first_step);
+	dsp_num phase_neg = phase_small_decrement(phase, first_step);
 
 	/* The sum includes the center sample with weight 1 */
 
 	dsp_largenum suml = 0;
 	int odd = (SINC_SIZE & 1);
 	{
-		dsp_num middle = voice_sample_waveform(v->phase, ap);
+		dsp_num middle = voice_sample_waveform(phase, ap);
 
 		/* The middle sample is multiplied by 4 if we have odd count, by 2 if 
 		 * we have even count */
@@ -184,67 +280,896 @@ voice_compute_waveform(synth_voice *v, audio_params *ap) {
 	return sum;//dsp_div(sum, sinc_weight);
 }
 
-void
-synth_voice_process(synth_voice *v, audio_params *ap) {
-	v->phase += dsp_mul(v->phase_step, ap->tuning);
-	while(v->phase >= dsp_one) {
-		v->phase -= dsp_one;
+/**
+ * The PolyBLEP residual for a unit rising step at phase 0: the difference
+ * between a band-limited step and the naive one, approximated by a polynomial
+ * that is only non-zero within one step (dt) of the discontinuity. A step of
+ * height h is corrected by adding h times this.
+ */
+static inline dsp_num
+polyblep(dsp_num phase, dsp_num dt, dsp_num dt_recip) {
+	if(phase < dt) {
+		/* Just after the step: -(1 - t/dt)^2 / 2 */
+		const dsp_num x = dsp_one - (dsp_num)(((dsp_largenum)phase * dt_recip) >> POLYBLEP_RECIP_BITS);
+		return -dsp_rshift(dsp_mul(x, x), 1);
+	}
+	if(phase > dsp_one - dt) {
+		/* Just before it: (1 - (1 - t)/dt)^2 / 2 */
+		const dsp_num x = dsp_one - (dsp_num)(((dsp_largenum)(dsp_one - phase) * dt_recip) >> POLYBLEP_RECIP_BITS);
+		return dsp_rshift(dsp_mul(x, x), 1);
 	}
+	return 0;
+}
 
-	/* Multiply the value by a large prime to try to mix the digits */
-	v->white_noise_generator = ((v->white_noise_generator + 1) * 12347843);
+/**
+ * The same waveform as voice_sinc_waveform() (before its lowpass), with each
+ * discontinuity smoothed over by polyblep(). Both the saw and the square jump
+ * up by 1/2 at phase 0, so the mix does too, and only the square jumps (down,
+ * by 1/2) at phase 1/2. Scaled by oscillator_gain to play as loud.
+ */
+static inline dsp_num
+voice_polyblep_waveform(dsp_num phase, dsp_num dt, dsp_num dt_recip, const audio_params *ap) {
+	/* The same mix as voice_sample_waveform(), with one multiply */
+	const dsp_num saw = sawtooth_wave(phase);
+	const dsp_num naive = saw + dsp_mul(square_wave(phase) - saw, ap->wave_shape);
+
+	dsp_num half = phase + dsp_one / 2;
+	if(half >= dsp_one) half -= dsp_one;
 
-	/* Keep it within the range -1, 1 for better mixing. */
-	const dsp_num white_noise = dsp_rshift(v->white_noise_generator, 2);
-	const dsp_num sawtooth = voice_compute_waveform(v, ap);
+	const dsp_num up = polyblep(phase, dt, dt_recip);
+	const dsp_num down = polyblep(half, dt, dt_recip);
+	const dsp_num out = naive + dsp_rshift(up, 1) - dsp_mul(dsp_rshift(down, 1), ap->wave_shape);
+	return dsp_mul(out, oscillator_gain);
+}
+
+/* Reads the table at the given phase, interpolating between entries. */
+static inline dsp_num
+wavetable_read(const int16_t (*table)[2], int which, dsp_num phase) {
+	const int idx = phase >> WAVETABLE_FRAC_BITS;
+	const dsp_num frac = phase & WAVETABLE_FRAC_MASK;
 
-	v->sample
-		= dsp_rshift(sawtooth, 1)
-		+ dsp_mul(white_noise, ap->noise_gain);
+	const dsp_num a = table[idx][which];
+	const dsp_num b = table[idx + 1][which];
+	const dsp_num lerp = (dsp_num)(((dsp_largenum)(b - a) * frac) >> WAVETABLE_LERP_SHIFT);
+	return dsp_lshift(a, WAVETABLE_SHIFT) + lerp;
+}
+
+static inline dsp_num
+voice_wavetable_waveform(const int16_t (*table)[2], dsp_num phase, const audio_params *ap) {
+	const dsp_num saw = wavetable_read(table, 0, phase);
+	const dsp_num square = wavetable_read(table, 1, phase);
+	return dsp_mul(saw + dsp_mul(square - saw, ap->wave_shape), oscillator_gain);
+}
 
-	/* Update envelope */
-	const dsp_num small_difference = dsp_from_double(0.02);
+static inline void
+voice_envelope_update(dsp_num *envelope, int32_t *state, const audio_params *ap) {
+	const dsp_num small_difference = dsp_from_double(ENVELOPE_SMALL_DIFFERENCE);
 
-	if(v->state == SYNTH_ATTACK) {
+	if(*state == SYNTH_ATTACK) {
 		/* Ramp up from 0 to 1 */
-		dsp_num dif = dsp_one - v->envelope;
-		v->envelope += dsp_mul(dif, ap->attack);
+		dsp_num dif = dsp_one - *envelope;
+		*envelope += dsp_mul(dif, ap->attack);
 		if(dsp_abs(dif) <= small_difference) {
-			v->envelope = dsp_one;
-			v->state = SYNTH_DECAY;
+			*envelope = dsp_one;
+			*state = SYNTH_DECAY;
 		}
 	}
 
-	if(v->state == SYNTH_DECAY) {
-		dsp_num dif = ap->sustain - v->envelope;
-		v->envelope += dsp_mul(dif, ap->decay);
+	if(*state == SYNTH_DECAY) {
+		dsp_num dif = ap->sustain - *envelope;
+		*envelope += dsp_mul(dif, ap->decay);
 		if(dsp_abs(dif) <= small_difference) {
-			v->envelope = ap->sustain;
-			v->state = SYNTH_SUSTAIN;
+			*envelope = ap->sustain;
+			*state = SYNTH_SUSTAIN;
 		}
 	}
 
-	if(v->state == SYNTH_RELEASE) {
-		dsp_num dif = dsp_zero - v->envelope;
-		v->envelope += dsp_mul(dif, ap->release);
+	if(*state == SYNTH_RELEASE) {
+		dsp_num dif = dsp_zero - *envelope;
+		*envelope += dsp_mul(dif, ap->release);
 		if(dsp_abs(dif) <= small_difference) {
-			v->envelope = dsp_zero;
+			*envelope = dsp_zero;
 		}
 	}
 }
 
-dsp_num
-synth_process(synth *syn, audio_params *ap) {
+/* The scalar reference kernel: one active voice at a time. */
+static dsp_largenum
+synth_voices_scalar(synth *syn, const audio_params *ap) {
 	dsp_largenum suml = 0;
 
-	for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
-		synth_voice *v = &syn->voices[i];
-		synth_voice_process(v, ap);
+	for(uint32_t live = syn->active; live; live &= live - 1) {
+		const int i = __builtin_ctz(live);
+
+		const dsp_num dt = dsp_mul(syn->phase_step[i], ap->tuning);
+		syn->phase[i] += dt;
+		while(syn->phase[i] >= dsp_one) {
+			syn->phase[i] -= dsp_one;
+		}
+
+		syn->white_noise_generator[i] = ((syn->white_noise_generator[i] + 1) * NOISE_MULTIPLIER);
+
+		/* Keep it within the range -1, 1 for better mixing. */
+		const dsp_num white_noise = dsp_rshift(syn->white_noise_generator[i], 2);
+		dsp_num sawtooth;
+		switch(syn->oscillator) {
+		case SYNTH_OSC_POLYBLEP:
+			sawtooth = voice_polyblep_waveform(syn->phase[i], dt, syn->dt_recip[i], ap);
+			break;
+		case SYNTH_OSC_WAVETABLE:
+			sawtooth = voice_wavetable_waveform(wavetable[syn->octave[i]], syn->phase[i], ap);
+			break;
+		default:
+			sawtooth = voice_sinc_waveform(syn->phase[i], syn->phase_step[i], ap);
+			break;
+		}
+
+		const dsp_num sample
+			= dsp_rshift(sawtooth, 1)
+			+ dsp_mul(white_noise, ap->noise_gain);
+
+		voice_envelope_update(&syn->envelope[i], &syn->state[i], ap);
+		if(synth_voice_idle(syn, i)) {
+			syn->active &= ~(1u << i);
+		}
+
+		suml += dsp_mul_large(sample, syn->envelope[i]);
+	}
+
+	return suml;
+}
+
+/**
+ * The vector kernels compute exactly what synth_voices_scalar() does, for 4 or
+ * 8 voices at a time:
+ *
+ * - the phase wraps with one conditional subtraction, not a loop, which is the
+ *   same as the phase step (times the tuning) is always well below one;
+ * - the square wave is only ever +-SQUARE_LEVEL, so its product with the wave
+ *   shape is worked out once per sample instead of per voice;
+ * - the ADSR state machine runs every stage on every lane, and keeps the
+ *   result only on the lanes that are in that stage;
+ * - the 64-bit sums are kept as two vectors, of the even and of the odd lanes,
+ *   as _mm_mul_epi32 gives them;
+ * - polyblep() is worked out on every lane, for both steps, and kept only on
+ *   the lanes within dt of one, so that no lane has to branch;
+ * - groups of voices with none active are skipped, and the phase and noise of
+ *   the inactive voices in the other groups are left as they were, so that
+ *   every kernel leaves every voice in the same state;
+ * - the wavetable entries are fetched one voice at a time, except with AVX2,
+ *   which gathers them; the interpolation's 64-bit product is split in two
+ *   32-bit ones (see wavetable_lerp_sse41()).
+ */
+
+#ifdef DSP_SIMD_X86
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+phase_increment_sse41(__m128i phase, __m128i step) {
+	const __m128i one = _mm_set1_epi32(dsp_one);
+	phase = _mm_add_epi32(phase, step);
+	return _mm_sub_epi32(phase, _mm_and_si128(_mm_cmpgt_epi32(phase, one), one));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+phase_decrement_sse41(__m128i phase, __m128i step) {
+	const __m128i one = _mm_set1_epi32(dsp_one);
+	phase = _mm_sub_epi32(phase, step);
+	return _mm_add_epi32(phase, _mm_and_si128(_mm_cmpgt_epi32(_mm_setzero_si128(), phase), one));
+}
+
+/* voice_sample_waveform(), with square_pos and square_neg the square wave
+ * already multiplied by the wave shape. */
+__attribute__((target("sse4.1")))
+static inline __m128i
+sample_waveform_sse41(__m128i phase, __m128i square_pos, __m128i square_neg, __m128i anti_shape) {
+	const __m128i saw = _mm_srai_epi32(_mm_sub_epi32(_mm_set1_epi32(dsp_one), _mm_slli_epi32(phase, 1)), 2);
+	const __m128i high = _mm_cmpgt_epi32(phase, _mm_set1_epi32(dsp_one / 2));
+	return _mm_add_epi32(_mm_blendv_epi8(square_pos, square_neg, high), mul_q29_sse41(saw, anti_shape));
+}
+
+/* Adds a * b to the 64-bit sums of the even (acc[0]) and odd (acc[1]) lanes. */
+__attribute__((target("sse4.1")))
+static inline void
+mac_sse41(__m128i acc[2], __m128i a, __m128i b) {
+	acc[0] = _mm_add_epi64(acc[0], _mm_mul_epi32(a, b));
+	acc[1] = _mm_add_epi64(acc[1], _mm_mul_epi32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+}
+
+/* dsp_compact() of each lane's sum, as in mul_q29_sse41. */
+__attribute__((target("sse4.1")))
+static inline __m128i
+compact_sse41(const __m128i acc[2]) {
+	const __m128i even = _mm_srli_epi64(acc[0], DSP_POINT_IDX);
+	const __m128i odd  = _mm_slli_epi64(acc[1], 32 - DSP_POINT_IDX);
+	return _mm_blend_epi16(even, odd, 0xCC);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+sinc_waveform_sse41(__m128i phase, __m128i phase_step,
+		__m128i square_pos, __m128i square_neg, __m128i anti_shape) {
+	const __m128i first_step = mul_q29_sse41(phase_step, _mm_set1_epi32(sinc_first_step));
+	const __m128i step = mul_q29_sse41(phase_step, _mm_set1_epi32(sinc_table_step));
+
+	__m128i phase_pos = phase_increment_sse41(phase, first_step);
+	__m128i phase_neg = phase_decrement_sse41(phase, first_step);
+
+	/* The middle sample goes in unweighted, as in voice_sinc_waveform() */
+	int odd = (SINC_SIZE & 1);
+	__m128i acc[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+	const __m128i middle = sample_waveform_sse41(phase, square_pos, square_neg, anti_shape);
+	mac_sse41(acc, _mm_slli_epi32(middle, odd ? 2 : 1), _mm_set1_epi32(1));
+
+	for(int i = 0; i < SINC_SIZE; ++i) {
+		odd = !odd;
+
+		__m128i pair = _mm_add_epi32(
+			sample_waveform_sse41(phase_pos, square_pos, square_neg, anti_shape),
+			sample_waveform_sse41(phase_neg, square_pos, square_neg, anti_shape));
+		if(i < SINC_SIZE - 1) {
+			pair = _mm_slli_epi32(pair, 1 + odd);
+		}
+		mac_sse41(acc, pair, _mm_set1_epi32(sinc_table[i]));
+
+		phase_pos = phase_increment_sse41(phase_pos, step);
+		phase_neg = phase_decrement_sse41(phase_neg, step);
+	}
+
+	return compact_sse41(acc);
+}
+
+/* polyblep() on every lane: the distance to the step times the reciprocal,
+ * then the square, on one side of the step or the other. */
+__attribute__((target("sse4.1")))
+static inline __m128i
+polyblep_sse41(__m128i phase, __m128i dt, __m128i dt_recip) {
+	const __m128i one = _mm_set1_epi32(dsp_one);
+	const __m128i after = _mm_cmpgt_epi32(dt, phase);
+	const __m128i before = _mm_andnot_si128(after, _mm_cmpgt_epi32(phase, _mm_sub_epi32(one, dt)));
+
+	/* As mul_q29_sse41, with the reciprocal's fraction bits */
+	const __m128i dist = _mm_blendv_epi8(_mm_sub_epi32(one, phase), phase, after);
+	const __m128i even = _mm_srli_epi64(_mm_mul_epi32(dist, dt_recip), POLYBLEP_RECIP_BITS);
+	const __m128i odd = _mm_slli_epi64(_mm_mul_epi32(_mm_srli_epi64(dist, 32), _mm_srli_epi64(dt_recip, 32)),
+		32 - POLYBLEP_RECIP_BITS);
+	const __m128i x = _mm_sub_epi32(one, _mm_blend_epi16(even, odd, 0xCC));
+
+	const __m128i square = _mm_srai_epi32(mul_q29_sse41(x, x), 1);
+	return _mm_or_si128(_mm_and_si128(before, square),
+		_mm_and_si128(after, _mm_sub_epi32(_mm_setzero_si128(), square)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+polyblep_waveform_sse41(__m128i phase, __m128i dt, __m128i dt_recip, __m128i shape) {
+	const __m128i one = _mm_set1_epi32(dsp_one);
+	const __m128i half_one = _mm_set1_epi32(dsp_one / 2);
+
+	const __m128i saw = _mm_srai_epi32(_mm_sub_epi32(one, _mm_slli_epi32(phase, 1)), 2);
+	const __m128i square = _mm_blendv_epi8(_mm_set1_epi32(SQUARE_LEVEL), _mm_set1_epi32(-SQUARE_LEVEL),
+		_mm_cmpgt_epi32(phase, half_one));
+	const __m128i naive = _mm_add_epi32(saw, mul_q29_sse41(_mm_sub_epi32(square, saw), shape));
+
+	__m128i half = _mm_add_epi32(phase, half_one);
+	half = _mm_sub_epi32(half, _mm_and_si128(_mm_cmpgt_epi32(half, _mm_sub_epi32(one, _mm_set1_epi32(1))), one));
+
+	const __m128i up = polyblep_sse41(phase, dt, dt_recip);
+	const __m128i down = polyblep_sse41(half, dt, dt_recip);
+	const __m128i out = _mm_sub_epi32(_mm_add_epi32(naive, _mm_srai_epi32(up, 1)),
+		mul_q29_sse41(_mm_srai_epi32(down, 1), shape));
+	return mul_q29_sse41(out, _mm_set1_epi32(oscillator_gain));
+}
+
+/* wavetable_read()'s interpolation. (b - a) takes 17 bits and frac 20, so
+ * their product needs 64, but splitting frac at WAVETABLE_LERP_SHIFT gives two
+ * products that fit in 32 bits, and the same result:
+ *   (d * frac) >> s == d * (frac >> s) + ((d * (frac & (2^s - 1))) >> s) */
+__attribute__((target("sse4.1")))
+static inline __m128i
+wavetable_lerp_sse41(__m128i a, __m128i b, __m128i frac) {
+	const __m128i d = _mm_sub_epi32(b, a);
+	const __m128i high = _mm_mullo_epi32(d, _mm_srli_epi32(frac, WAVETABLE_LERP_SHIFT));
+	const __m128i low = _mm_mullo_epi32(d, _mm_and_si128(frac, _mm_set1_epi32((1 << WAVETABLE_LERP_SHIFT) - 1)));
+	return _mm_add_epi32(_mm_slli_epi32(a, WAVETABLE_SHIFT),
+		_mm_add_epi32(high, _mm_srai_epi32(low, WAVETABLE_LERP_SHIFT)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+wavetable_waveform_sse41(const synth *syn, int v, __m128i phase, __m128i shape) {
+	int32_t saw_a[4], saw_b[4], square_a[4], square_b[4];
+	for(int l = 0; l < 4; ++l) {
+		const int16_t (*entry)[2] = &wavetable[syn->octave[v + l]][syn->phase[v + l] >> WAVETABLE_FRAC_BITS];
+		saw_a[l] = entry[0][0];
+		square_a[l] = entry[0][1];
+		saw_b[l] = entry[1][0];
+		square_b[l] = entry[1][1];
+	}
+
+	const __m128i frac = _mm_and_si128(phase, _mm_set1_epi32(WAVETABLE_FRAC_MASK));
+	const __m128i saw = wavetable_lerp_sse41(_mm_loadu_si128((const __m128i*)saw_a),
+		_mm_loadu_si128((const __m128i*)saw_b), frac);
+	const __m128i square = wavetable_lerp_sse41(_mm_loadu_si128((const __m128i*)square_a),
+		_mm_loadu_si128((const __m128i*)square_b), frac);
+
+	const __m128i mix = _mm_add_epi32(saw, mul_q29_sse41(_mm_sub_epi32(square, saw), shape));
+	return mul_q29_sse41(mix, _mm_set1_epi32(oscillator_gain));
+}
+
+/* One stage of voice_envelope_update(), on the lanes in state which: moves
+ * towards target by rate, and on reaching it, snaps to it and goes to next. */
+__attribute__((target("sse4.1")))
+static inline void
+envelope_stage_sse41(__m128i *envelope, __m128i *state, int32_t which, __m128i target, __m128i rate,
+		int32_t next, __m128i small) {
+	const __m128i in = _mm_cmpeq_epi32(*state, _mm_set1_epi32(which));
+	const __m128i dif = _mm_sub_epi32(target, *envelope);
+	const __m128i done = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_abs_epi32(dif), small), in);
+
+	*envelope = _mm_blendv_epi8(*envelope, _mm_add_epi32(*envelope, mul_q29_sse41(dif, rate)), in);
+	*envelope = _mm_blendv_epi8(*envelope, target, done);
+	*state = _mm_blendv_epi8(*state, _mm_set1_epi32(next), done);
+}
+
+__attribute__((target("sse4.1")))
+static dsp_largenum
+synth_voices_sse41(synth *syn, const audio_params *ap) {
+	const __m128i one = _mm_set1_epi32(dsp_one);
+	const __m128i tuning = _mm_set1_epi32(ap->tuning);
+	const __m128i shape = _mm_set1_epi32(ap->wave_shape);
+	const __m128i anti_shape = _mm_set1_epi32(dsp_one - ap->wave_shape);
+	const __m128i square_pos = _mm_set1_epi32(dsp_mul(SQUARE_LEVEL, ap->wave_shape));
+	const __m128i square_neg = _mm_set1_epi32(dsp_mul(-SQUARE_LEVEL, ap->wave_shape));
+	const __m128i noise_gain = _mm_set1_epi32(ap->noise_gain);
+	const __m128i small = _mm_set1_epi32(dsp_from_double(ENVELOPE_SMALL_DIFFERENCE));
+
+	__m128i sum[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+
+	const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+
+	for(int v = 0; v < MAX_SYNTH_VOICES; v += 4) {
+		const int live = (syn->active >> v) & 0xf;
+		if(!live) continue;
+		const __m128i live_lanes = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(live), lane_bits), lane_bits);
+
+		const __m128i phase_step = _mm_loadu_si128((const __m128i*)&syn->phase_step[v]);
+		const __m128i dt = mul_q29_sse41(phase_step, tuning);
+		const __m128i old_phase = _mm_loadu_si128((const __m128i*)&syn->phase[v]);
+		__m128i phase = _mm_add_epi32(old_phase, dt);
+		phase = _mm_sub_epi32(phase, _mm_and_si128(_mm_cmpgt_epi32(phase, _mm_sub_epi32(one, _mm_set1_epi32(1))), one));
+		phase = _mm_blendv_epi8(old_phase, phase, live_lanes);
+		_mm_storeu_si128((__m128i*)&syn->phase[v], phase);
+
+		const __m128i old_noise = _mm_loadu_si128((const __m128i*)&syn->white_noise_generator[v]);
+		__m128i noise = _mm_mullo_epi32(_mm_add_epi32(old_noise, _mm_set1_epi32(1)), _mm_set1_epi32(NOISE_MULTIPLIER));
+		noise = _mm_blendv_epi8(old_noise, noise, live_lanes);
+		_mm_storeu_si128((__m128i*)&syn->white_noise_generator[v], noise);
+
+		__m128i wave;
+		switch(syn->oscillator) {
+		case SYNTH_OSC_POLYBLEP:
+			wave = polyblep_waveform_sse41(phase, dt,
+				_mm_loadu_si128((const __m128i*)&syn->dt_recip[v]), shape);
+			break;
+		case SYNTH_OSC_WAVETABLE:
+			wave = wavetable_waveform_sse41(syn, v, phase, shape);
+			break;
+		default:
+			wave = sinc_waveform_sse41(phase, phase_step, square_pos, square_neg, anti_shape);
+			break;
+		}
+
+		const __m128i sample = _mm_add_epi32(_mm_srai_epi32(wave, 1),
+			mul_q29_sse41(_mm_srai_epi32(noise, 2), noise_gain));
+
+		__m128i envelope = _mm_loadu_si128((const __m128i*)&syn->envelope[v]);
+		__m128i state = _mm_loadu_si128((const __m128i*)&syn->state[v]);
+		envelope_stage_sse41(&envelope, &state, SYNTH_ATTACK, one, _mm_set1_epi32(ap->attack), SYNTH_DECAY, small);
+		envelope_stage_sse41(&envelope, &state, SYNTH_DECAY, _mm_set1_epi32(ap->sustain), _mm_set1_epi32(ap->decay),
+			SYNTH_SUSTAIN, small);
+		envelope_stage_sse41(&envelope, &state, SYNTH_RELEASE, _mm_setzero_si128(), _mm_set1_epi32(ap->release),
+			SYNTH_RELEASE, small);
+		_mm_storeu_si128((__m128i*)&syn->envelope[v], envelope);
+		_mm_storeu_si128((__m128i*)&syn->state[v], state);
+
+		/* As synth_voice_idle() */
+		const __m128i idle = _mm_and_si128(_mm_cmpeq_epi32(envelope, _mm_setzero_si128()),
+			_mm_or_si128(_mm_cmpeq_epi32(state, _mm_set1_epi32(SYNTH_RELEASE)),
+				_mm_cmpeq_epi32(state, _mm_set1_epi32(SYNTH_SUSTAIN))));
+		syn->active &= ~((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(idle)) << v);
+
+		mac_sse41(sum, sample, envelope);
+	}
+
+	int64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(sum[0], sum[1]));
+	return lanes[0] + lanes[1];
+}
+
+/* The AVX2 kernel is the SSE4.1 one, 8 voices at a time. */
+
+__attribute__((target("avx2")))
+static inline __m256i
+phase_increment_avx2(__m256i phase, __m256i step) {
+	const __m256i one = _mm256_set1_epi32(dsp_one);
+	phase = _mm256_add_epi32(phase, step);
+	return _mm256_sub_epi32(phase, _mm256_and_si256(_mm256_cmpgt_epi32(phase, one), one));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+phase_decrement_avx2(__m256i phase, __m256i step) {
+	const __m256i one = _mm256_set1_epi32(dsp_one);
+	phase = _mm256_sub_epi32(phase, step);
+	return _mm256_add_epi32(phase, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), phase), one));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+sample_waveform_avx2(__m256i phase, __m256i square_pos, __m256i square_neg, __m256i anti_shape) {
+	const __m256i saw = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_set1_epi32(dsp_one), _mm256_slli_epi32(phase, 1)), 2);
+	const __m256i high = _mm256_cmpgt_epi32(phase, _mm256_set1_epi32(dsp_one / 2));
+	return _mm256_add_epi32(_mm256_blendv_epi8(square_pos, square_neg, high), mul_q29_avx2(saw, anti_shape));
+}
+
+__attribute__((target("avx2")))
+static inline void
+mac_avx2(__m256i acc[2], __m256i a, __m256i b) {
+	acc[0] = _mm256_add_epi64(acc[0], _mm256_mul_epi32(a, b));
+	acc[1] = _mm256_add_epi64(acc[1], _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+compact_avx2(const __m256i acc[2]) {
+	const __m256i even = _mm256_srli_epi64(acc[0], DSP_POINT_IDX);
+	const __m256i odd  = _mm256_slli_epi64(acc[1], 32 - DSP_POINT_IDX);
+	return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+sinc_waveform_avx2(__m256i phase, __m256i phase_step,
+		__m256i square_pos, __m256i square_neg, __m256i anti_shape) {
+	const __m256i first_step = mul_q29_avx2(phase_step, _mm256_set1_epi32(sinc_first_step));
+	const __m256i step = mul_q29_avx2(phase_step, _mm256_set1_epi32(sinc_table_step));
+
+	__m256i phase_pos = phase_increment_avx2(phase, first_step);
+	__m256i phase_neg = phase_decrement_avx2(phase, first_step);
+
+	int odd = (SINC_SIZE & 1);
+	__m256i acc[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+	const __m256i middle = sample_waveform_avx2(phase, square_pos, square_neg, anti_shape);
+	mac_avx2(acc, _mm256_slli_epi32(middle, odd ? 2 : 1), _mm256_set1_epi32(1));
+
+	for(int i = 0; i < SINC_SIZE; ++i) {
+		odd = !odd;
+
+		__m256i pair = _mm256_add_epi32(
+			sample_waveform_avx2(phase_pos, square_pos, square_neg, anti_shape),
+			sample_waveform_avx2(phase_neg, square_pos, square_neg, anti_shape));
+		if(i < SINC_SIZE - 1) {
+			pair = _mm256_slli_epi32(pair, 1 + odd);
+		}
+		mac_avx2(acc, pair, _mm256_set1_epi32(sinc_table[i]));
+
+		phase_pos = phase_increment_avx2(phase_pos, step);
+		phase_neg = phase_decrement_avx2(phase_neg, step);
+	}
+
+	return compact_avx2(acc);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+polyblep_avx2(__m256i phase, __m256i dt, __m256i dt_recip) {
+	const __m256i one = _mm256_set1_epi32(dsp_one);
+	const __m256i after = _mm256_cmpgt_epi32(dt, phase);
+	const __m256i before = _mm256_andnot_si256(after, _mm256_cmpgt_epi32(phase, _mm256_sub_epi32(one, dt)));
+
+	const __m256i dist = _mm256_blendv_epi8(_mm256_sub_epi32(one, phase), phase, after);
+	const __m256i even = _mm256_srli_epi64(_mm256_mul_epi32(dist, dt_recip), POLYBLEP_RECIP_BITS);
+	const __m256i odd = _mm256_slli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(dist, 32), _mm256_srli_epi64(dt_recip, 32)),
+		32 - POLYBLEP_RECIP_BITS);
+	const __m256i x = _mm256_sub_epi32(one, _mm256_blend_epi32(even, odd, 0xAA));
+
+	const __m256i square = _mm256_srai_epi32(mul_q29_avx2(x, x), 1);
+	return _mm256_or_si256(_mm256_and_si256(before, square),
+		_mm256_and_si256(after, _mm256_sub_epi32(_mm256_setzero_si256(), square)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+polyblep_waveform_avx2(__m256i phase, __m256i dt, __m256i dt_recip, __m256i shape) {
+	const __m256i one = _mm256_set1_epi32(dsp_one);
+	const __m256i half_one = _mm256_set1_epi32(dsp_one / 2);
+
+	const __m256i saw = _mm256_srai_epi32(_mm256_sub_epi32(one, _mm256_slli_epi32(phase, 1)), 2);
+	const __m256i square = _mm256_blendv_epi8(_mm256_set1_epi32(SQUARE_LEVEL), _mm256_set1_epi32(-SQUARE_LEVEL),
+		_mm256_cmpgt_epi32(phase, half_one));
+	const __m256i naive = _mm256_add_epi32(saw, mul_q29_avx2(_mm256_sub_epi32(square, saw), shape));
+
+	__m256i half = _mm256_add_epi32(phase, half_one);
+	half = _mm256_sub_epi32(half, _mm256_and_si256(_mm256_cmpgt_epi32(half, _mm256_sub_epi32(one, _mm256_set1_epi32(1))), one));
+
+	const __m256i up = polyblep_avx2(phase, dt, dt_recip);
+	const __m256i down = polyblep_avx2(half, dt, dt_recip);
+	const __m256i out = _mm256_sub_epi32(_mm256_add_epi32(naive, _mm256_srai_epi32(up, 1)),
+		mul_q29_avx2(_mm256_srai_epi32(down, 1), shape));
+	return mul_q29_avx2(out, _mm256_set1_epi32(oscillator_gain));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+wavetable_lerp_avx2(__m256i a, __m256i b, __m256i frac) {
+	const __m256i d = _mm256_sub_epi32(b, a);
+	const __m256i high = _mm256_mullo_epi32(d, _mm256_srli_epi32(frac, WAVETABLE_LERP_SHIFT));
+	const __m256i low = _mm256_mullo_epi32(d, _mm256_and_si256(frac, _mm256_set1_epi32((1 << WAVETABLE_LERP_SHIFT) - 1)));
+	return _mm256_add_epi32(_mm256_slli_epi32(a, WAVETABLE_SHIFT),
+		_mm256_add_epi32(high, _mm256_srai_epi32(low, WAVETABLE_LERP_SHIFT)));
+}
+
+/* Gathers each (saw, square) pair as one 32-bit value: the saw is the low
+ * half, and the square the high half. */
+__attribute__((target("avx2")))
+static inline __m256i
+wavetable_waveform_avx2(const synth *syn, int v, __m256i phase, __m256i shape) {
+	const int *pairs = (const int*)&wavetable[0][0][0];
+	const __m256i octave = _mm256_loadu_si256((const __m256i*)&syn->octave[v]);
+	const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(octave, _mm256_set1_epi32(SYNTH_WAVETABLE_SIZE + 1)),
+		_mm256_srli_epi32(phase, WAVETABLE_FRAC_BITS));
+	const __m256i pair_a = _mm256_i32gather_epi32(pairs, index, 4);
+	const __m256i pair_b = _mm256_i32gather_epi32(pairs + 1, index, 4);
+
+	const __m256i frac = _mm256_and_si256(phase, _mm256_set1_epi32(WAVETABLE_FRAC_MASK));
+	const __m256i saw = wavetable_lerp_avx2(_mm256_srai_epi32(_mm256_slli_epi32(pair_a, 16), 16),
+		_mm256_srai_epi32(_mm256_slli_epi32(pair_b, 16), 16), frac);
+	const __m256i square = wavetable_lerp_avx2(_mm256_srai_epi32(pair_a, 16), _mm256_srai_epi32(pair_b, 16), frac);
 
-		suml += dsp_mul_large(v->sample, v->envelope);
+	const __m256i mix = _mm256_add_epi32(saw, mul_q29_avx2(_mm256_sub_epi32(square, saw), shape));
+	return mul_q29_avx2(mix, _mm256_set1_epi32(oscillator_gain));
+}
+
+__attribute__((target("avx2")))
+static inline void
+envelope_stage_avx2(__m256i *envelope, __m256i *state, int32_t which, __m256i target, __m256i rate,
+		int32_t next, __m256i small) {
+	const __m256i in = _mm256_cmpeq_epi32(*state, _mm256_set1_epi32(which));
+	const __m256i dif = _mm256_sub_epi32(target, *envelope);
+	const __m256i done = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_abs_epi32(dif), small), in);
+
+	*envelope = _mm256_blendv_epi8(*envelope, _mm256_add_epi32(*envelope, mul_q29_avx2(dif, rate)), in);
+	*envelope = _mm256_blendv_epi8(*envelope, target, done);
+	*state = _mm256_blendv_epi8(*state, _mm256_set1_epi32(next), done);
+}
+
+__attribute__((target("avx2")))
+static dsp_largenum
+synth_voices_avx2(synth *syn, const audio_params *ap) {
+	const __m256i one = _mm256_set1_epi32(dsp_one);
+	const __m256i tuning = _mm256_set1_epi32(ap->tuning);
+	const __m256i shape = _mm256_set1_epi32(ap->wave_shape);
+	const __m256i anti_shape = _mm256_set1_epi32(dsp_one - ap->wave_shape);
+	const __m256i square_pos = _mm256_set1_epi32(dsp_mul(SQUARE_LEVEL, ap->wave_shape));
+	const __m256i square_neg = _mm256_set1_epi32(dsp_mul(-SQUARE_LEVEL, ap->wave_shape));
+	const __m256i noise_gain = _mm256_set1_epi32(ap->noise_gain);
+	const __m256i small = _mm256_set1_epi32(dsp_from_double(ENVELOPE_SMALL_DIFFERENCE));
+
+	__m256i sum[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+
+	const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+	for(int v = 0; v < MAX_SYNTH_VOICES; v += 8) {
+		const int live = (syn->active >> v) & 0xff;
+		if(!live) continue;
+		const __m256i live_lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(live), lane_bits), lane_bits);
+
+		const __m256i phase_step = _mm256_loadu_si256((const __m256i*)&syn->phase_step[v]);
+		const __m256i dt = mul_q29_avx2(phase_step, tuning);
+		const __m256i old_phase = _mm256_loadu_si256((const __m256i*)&syn->phase[v]);
+		__m256i phase = _mm256_add_epi32(old_phase, dt);
+		phase = _mm256_sub_epi32(phase, _mm256_and_si256(_mm256_cmpgt_epi32(phase, _mm256_sub_epi32(one, _mm256_set1_epi32(1))), one));
+		phase = _mm256_blendv_epi8(old_phase, phase, live_lanes);
+		_mm256_storeu_si256((__m256i*)&syn->phase[v], phase);
+
+		const __m256i old_noise = _mm256_loadu_si256((const __m256i*)&syn->white_noise_generator[v]);
+		__m256i noise = _mm256_mullo_epi32(_mm256_add_epi32(old_noise, _mm256_set1_epi32(1)), _mm256_set1_epi32(NOISE_MULTIPLIER));
+		noise = _mm256_blendv_epi8(old_noise, noise, live_lanes);
+		_mm256_storeu_si256((__m256i*)&syn->white_noise_generator[v], noise);
+
+		__m256i wave;
+		switch(syn->oscillator) {
+		case SYNTH_OSC_POLYBLEP:
+			wave = polyblep_waveform_avx2(phase, dt,
+				_mm256_loadu_si256((const __m256i*)&syn->dt_recip[v]), shape);
+			break;
+		case SYNTH_OSC_WAVETABLE:
+			wave = wavetable_waveform_avx2(syn, v, phase, shape);
+			break;
+		default:
+			wave = sinc_waveform_avx2(phase, phase_step, square_pos, square_neg, anti_shape);
+			break;
+		}
+
+		const __m256i sample = _mm256_add_epi32(_mm256_srai_epi32(wave, 1),
+			mul_q29_avx2(_mm256_srai_epi32(noise, 2), noise_gain));
+
+		__m256i envelope = _mm256_loadu_si256((const __m256i*)&syn->envelope[v]);
+		__m256i state = _mm256_loadu_si256((const __m256i*)&syn->state[v]);
+		envelope_stage_avx2(&envelope, &state, SYNTH_ATTACK, one, _mm256_set1_epi32(ap->attack), SYNTH_DECAY, small);
+		envelope_stage_avx2(&envelope, &state, SYNTH_DECAY, _mm256_set1_epi32(ap->sustain), _mm256_set1_epi32(ap->decay),
+			SYNTH_SUSTAIN, small);
+		envelope_stage_avx2(&envelope, &state, SYNTH_RELEASE, _mm256_setzero_si256(), _mm256_set1_epi32(ap->release),
+			SYNTH_RELEASE, small);
+		_mm256_storeu_si256((__m256i*)&syn->envelope[v], envelope);
+		_mm256_storeu_si256((__m256i*)&syn->state[v], state);
+
+		const __m256i idle = _mm256_and_si256(_mm256_cmpeq_epi32(envelope, _mm256_setzero_si256()),
+			_mm256_or_si256(_mm256_cmpeq_epi32(state, _mm256_set1_epi32(SYNTH_RELEASE)),
+				_mm256_cmpeq_epi32(state, _mm256_set1_epi32(SYNTH_SUSTAIN))));
+		syn->active &= ~((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(idle)) << v);
+
+		mac_avx2(sum, sample, envelope);
 	}
 
-	return dsp_compact(suml);
+	int64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(sum[0], sum[1]));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#endif /* x86 */
+
+#ifdef DSP_SIMD_NEON
+
+static inline int32x4_t
+phase_increment_neon(int32x4_t phase, int32x4_t step) {
+	const int32x4_t one = vdupq_n_s32(dsp_one);
+	phase = vaddq_s32(phase, step);
+	return vsubq_s32(phase, vandq_s32(vreinterpretq_s32_u32(vcgtq_s32(phase, one)), one));
+}
+
+static inline int32x4_t
+phase_decrement_neon(int32x4_t phase, int32x4_t step) {
+	const int32x4_t one = vdupq_n_s32(dsp_one);
+	phase = vsubq_s32(phase, step);
+	return vaddq_s32(phase, vandq_s32(vreinterpretq_s32_u32(vcltq_s32(phase, vdupq_n_s32(0))), one));
+}
+
+static inline int32x4_t
+sample_waveform_neon(int32x4_t phase, int32x4_t square_pos, int32x4_t square_neg, int32x4_t anti_shape) {
+	const int32x4_t saw = vshrq_n_s32(vsubq_s32(vdupq_n_s32(dsp_one), vshlq_n_s32(phase, 1)), 2);
+	const uint32x4_t high = vcgtq_s32(phase, vdupq_n_s32(dsp_one / 2));
+	return vaddq_s32(vbslq_s32(high, square_neg, square_pos), mul_q29_neon(saw, anti_shape));
+}
+
+/* Adds a * b to the 64-bit sums of the low (acc[0]) and high (acc[1]) lanes. */
+static inline void
+mac_neon(int64x2_t acc[2], int32x4_t a, int32x4_t b) {
+	acc[0] = vmlal_s32(acc[0], vget_low_s32(a), vget_low_s32(b));
+	acc[1] = vmlal_s32(acc[1], vget_high_s32(a), vget_high_s32(b));
+}
+
+static inline int32x4_t
+sinc_waveform_neon(int32x4_t phase, int32x4_t phase_step,
+		int32x4_t square_pos, int32x4_t square_neg, int32x4_t anti_shape) {
+	const int32x4_t first_step = mul_q29_neon(phase_step, vdupq_n_s32(sinc_first_step));
+	const int32x4_t step = mul_q29_neon(phase_step, vdupq_n_s32(sinc_table_step));
+
+	int32x4_t phase_pos = phase_increment_neon(phase, first_step);
+	int32x4_t phase_neg = phase_decrement_neon(phase, first_step);
+
+	int odd = (SINC_SIZE & 1);
+	const int32x4_t middle = sample_waveform_neon(phase, square_pos, square_neg, anti_shape);
+	const int32x4_t shifted = vshlq_s32(middle, vdupq_n_s32(odd ? 2 : 1));
+	int64x2_t acc[2] = { vmovl_s32(vget_low_s32(shifted)), vmovl_s32(vget_high_s32(shifted)) };
+
+	for(int i = 0; i < SINC_SIZE; ++i) {
+		odd = !odd;
+
+		int32x4_t pair = vaddq_s32(
+			sample_waveform_neon(phase_pos, square_pos, square_neg, anti_shape),
+			sample_waveform_neon(phase_neg, square_pos, square_neg, anti_shape));
+		if(i < SINC_SIZE - 1) {
+			pair = vshlq_s32(pair, vdupq_n_s32(1 + odd));
+		}
+		mac_neon(acc, pair, vdupq_n_s32(sinc_table[i]));
+
+		phase_pos = phase_increment_neon(phase_pos, step);
+		phase_neg = phase_decrement_neon(phase_neg, step);
+	}
+
+	return vcombine_s32(vshrn_n_s64(acc[0], DSP_POINT_IDX), vshrn_n_s64(acc[1], DSP_POINT_IDX));
+}
+
+static inline int32x4_t
+polyblep_neon(int32x4_t phase, int32x4_t dt, int32x4_t dt_recip) {
+	const int32x4_t one = vdupq_n_s32(dsp_one);
+	const uint32x4_t after = vcltq_s32(phase, dt);
+	const uint32x4_t before = vbicq_u32(vcgtq_s32(phase, vsubq_s32(one, dt)), after);
+
+	/* As mul_q29_neon, with the reciprocal's fraction bits */
+	const int32x4_t dist = vbslq_s32(after, phase, vsubq_s32(one, phase));
+	const int64x2_t lo = vmull_s32(vget_low_s32(dist), vget_low_s32(dt_recip));
+	const int64x2_t hi = vmull_s32(vget_high_s32(dist), vget_high_s32(dt_recip));
+	const int32x4_t x = vsubq_s32(one,
+		vcombine_s32(vshrn_n_s64(lo, POLYBLEP_RECIP_BITS), vshrn_n_s64(hi, POLYBLEP_RECIP_BITS)));
+
+	const int32x4_t square = vshrq_n_s32(mul_q29_neon(x, x), 1);
+	return vorrq_s32(vandq_s32(vreinterpretq_s32_u32(before), square),
+		vandq_s32(vreinterpretq_s32_u32(after), vnegq_s32(square)));
+}
+
+static inline int32x4_t
+polyblep_waveform_neon(int32x4_t phase, int32x4_t dt, int32x4_t dt_recip, int32x4_t shape) {
+	const int32x4_t one = vdupq_n_s32(dsp_one);
+	const int32x4_t half_one = vdupq_n_s32(dsp_one / 2);
+
+	const int32x4_t saw = vshrq_n_s32(vsubq_s32(one, vshlq_n_s32(phase, 1)), 2);
+	const int32x4_t square = vbslq_s32(vcgtq_s32(phase, half_one), vdupq_n_s32(-SQUARE_LEVEL),
+		vdupq_n_s32(SQUARE_LEVEL));
+	const int32x4_t naive = vaddq_s32(saw, mul_q29_neon(vsubq_s32(square, saw), shape));
+
+	int32x4_t half = vaddq_s32(phase, half_one);
+	half = vsubq_s32(half, vandq_s32(vreinterpretq_s32_u32(vcgeq_s32(half, one)), one));
+
+	const int32x4_t up = polyblep_neon(phase, dt, dt_recip);
+	const int32x4_t down = polyblep_neon(half, dt, dt_recip);
+	const int32x4_t out = vsubq_s32(vaddq_s32(naive, vshrq_n_s32(up, 1)),
+		mul_q29_neon(vshrq_n_s32(down, 1), shape));
+	return mul_q29_neon(out, vdupq_n_s32(oscillator_gain));
+}
+
+static inline int32x4_t
+wavetable_lerp_neon(int32x4_t a, int32x4_t b, int32x4_t frac) {
+	const int32x4_t d = vsubq_s32(b, a);
+	const int32x4_t high = vmulq_s32(d, vshrq_n_s32(frac, WAVETABLE_LERP_SHIFT));
+	const int32x4_t low = vmulq_s32(d, vandq_s32(frac, vdupq_n_s32((1 << WAVETABLE_LERP_SHIFT) - 1)));
+	return vaddq_s32(vshlq_n_s32(a, WAVETABLE_SHIFT), vaddq_s32(high, vshrq_n_s32(low, WAVETABLE_LERP_SHIFT)));
+}
+
+static inline int32x4_t
+wavetable_waveform_neon(const synth *syn, int v, int32x4_t phase, int32x4_t shape) {
+	int32_t saw_a[4], saw_b[4], square_a[4], square_b[4];
+	for(int l = 0; l < 4; ++l) {
+		const int16_t (*entry)[2] = &wavetable[syn->octave[v + l]][syn->phase[v + l] >> WAVETABLE_FRAC_BITS];
+		saw_a[l] = entry[0][0];
+		square_a[l] = entry[0][1];
+		saw_b[l] = entry[1][0];
+		square_b[l] = entry[1][1];
+	}
+
+	const int32x4_t frac = vandq_s32(phase, vdupq_n_s32(WAVETABLE_FRAC_MASK));
+	const int32x4_t saw = wavetable_lerp_neon(vld1q_s32(saw_a), vld1q_s32(saw_b), frac);
+	const int32x4_t square = wavetable_lerp_neon(vld1q_s32(square_a), vld1q_s32(square_b), frac);
+
+	const int32x4_t mix = vaddq_s32(saw, mul_q29_neon(vsubq_s32(square, saw), shape));
+	return mul_q29_neon(mix, vdupq_n_s32(oscillator_gain));
+}
+
+static inline void
+envelope_stage_neon(int32x4_t *envelope, int32x4_t *state, int32_t which, int32x4_t target, int32x4_t rate,
+		int32_t next, int32x4_t small) {
+	const uint32x4_t in = vceqq_s32(*state, vdupq_n_s32(which));
+	const int32x4_t dif = vsubq_s32(target, *envelope);
+	const uint32x4_t done = vbicq_u32(in, vcgtq_s32(vabsq_s32(dif), small));
+
+	*envelope = vbslq_s32(in, vaddq_s32(*envelope, mul_q29_neon(dif, rate)), *envelope);
+	*envelope = vbslq_s32(done, target, *envelope);
+	*state = vbslq_s32(done, vdupq_n_s32(next), *state);
+}
+
+static dsp_largenum
+synth_voices_neon(synth *syn, const audio_params *ap) {
+	const int32x4_t one = vdupq_n_s32(dsp_one);
+	const int32x4_t tuning = vdupq_n_s32(ap->tuning);
+	const int32x4_t shape = vdupq_n_s32(ap->wave_shape);
+	const int32x4_t anti_shape = vdupq_n_s32(dsp_one - ap->wave_shape);
+	const int32x4_t square_pos = vdupq_n_s32(dsp_mul(SQUARE_LEVEL, ap->wave_shape));
+	const int32x4_t square_neg = vdupq_n_s32(dsp_mul(-SQUARE_LEVEL, ap->wave_shape));
+	const int32x4_t noise_gain = vdupq_n_s32(ap->noise_gain);
+	const int32x4_t small = vdupq_n_s32(dsp_from_double(ENVELOPE_SMALL_DIFFERENCE));
+
+	int64x2_t sum[2] = { vdupq_n_s64(0), vdupq_n_s64(0) };
+
+	static const uint32_t lane_bit_values[4] = { 1, 2, 4, 8 };
+	const uint32x4_t lane_bits = vld1q_u32(lane_bit_values);
+
+	for(int v = 0; v < MAX_SYNTH_VOICES; v += 4) {
+		const uint32_t live = (syn->active >> v) & 0xf;
+		if(!live) continue;
+		const uint32x4_t live_lanes = vtstq_u32(vdupq_n_u32(live), lane_bits);
+
+		const int32x4_t phase_step = vld1q_s32(&syn->phase_step[v]);
+		const int32x4_t dt = mul_q29_neon(phase_step, tuning);
+		const int32x4_t old_phase = vld1q_s32(&syn->phase[v]);
+		int32x4_t phase = vaddq_s32(old_phase, dt);
+		phase = vsubq_s32(phase, vandq_s32(vreinterpretq_s32_u32(vcgeq_s32(phase, one)), one));
+		phase = vbslq_s32(live_lanes, phase, old_phase);
+		vst1q_s32(&syn->phase[v], phase);
+
+		const int32x4_t old_noise = vld1q_s32(&syn->white_noise_generator[v]);
+		int32x4_t noise = vmulq_n_s32(vaddq_s32(old_noise, vdupq_n_s32(1)), NOISE_MULTIPLIER);
+		noise = vbslq_s32(live_lanes, noise, old_noise);
+		vst1q_s32(&syn->white_noise_generator[v], noise);
+
+		int32x4_t wave;
+		switch(syn->oscillator) {
+		case SYNTH_OSC_POLYBLEP:
+			wave = polyblep_waveform_neon(phase, dt, vld1q_s32(&syn->dt_recip[v]), shape);
+			break;
+		case SYNTH_OSC_WAVETABLE:
+			wave = wavetable_waveform_neon(syn, v, phase, shape);
+			break;
+		default:
+			wave = sinc_waveform_neon(phase, phase_step, square_pos, square_neg, anti_shape);
+			break;
+		}
+
+		const int32x4_t sample = vaddq_s32(vshrq_n_s32(wave, 1),
+			mul_q29_neon(vshrq_n_s32(noise, 2), noise_gain));
+
+		int32x4_t envelope = vld1q_s32(&syn->envelope[v]);
+		int32x4_t state = vld1q_s32(&syn->state[v]);
+		envelope_stage_neon(&envelope, &state, SYNTH_ATTACK, one, vdupq_n_s32(ap->attack), SYNTH_DECAY, small);
+		envelope_stage_neon(&envelope, &state, SYNTH_DECAY, vdupq_n_s32(ap->sustain), vdupq_n_s32(ap->decay),
+			SYNTH_SUSTAIN, small);
+		envelope_stage_neon(&envelope, &state, SYNTH_RELEASE, vdupq_n_s32(0), vdupq_n_s32(ap->release),
+			SYNTH_RELEASE, small);
+		vst1q_s32(&syn->envelope[v], envelope);
+		vst1q_s32(&syn->state[v], state);
+
+		const uint32x4_t idle = vandq_u32(vceqq_s32(envelope, vdupq_n_s32(0)),
+			vorrq_u32(vceqq_s32(state, vdupq_n_s32(SYNTH_RELEASE)), vceqq_s32(state, vdupq_n_s32(SYNTH_SUSTAIN))));
+		const uint32x4_t idle_bits = vandq_u32(idle, lane_bits);
+		uint32x2_t idle_sum = vadd_u32(vget_low_u32(idle_bits), vget_high_u32(idle_bits));
+		idle_sum = vpadd_u32(idle_sum, idle_sum);
+		syn->active &= ~(vget_lane_u32(idle_sum, 0) << v);
+
+		mac_neon(sum, sample, envelope);
+	}
+
+	const int64x2_t total = vaddq_s64(sum[0], sum[1]);
+	return vgetq_lane_s64(total, 0) + vgetq_lane_s64(total, 1);
+}
+
+#endif /* NEON */
+
+void
+synth_set_kernel(synth *syn, bpf_kernel kernel) {
+	kernel = bpf_kernel_resolve(kernel);
+	if(!bpf_kernel_available(kernel)) {
+		app_fatal_error("the requested synth kernel is not available on this build/CPU");
+	}
+
+	syn->kernel = kernel;
+	switch(kernel) {
+#ifdef DSP_SIMD_X86
+	case BPF_KERNEL_SSE41: syn->process_voices = synth_voices_sse41; break;
+	case BPF_KERNEL_AVX2:  syn->process_voices = synth_voices_avx2; break;
+#endif
+#ifdef DSP_SIMD_NEON
+	case BPF_KERNEL_NEON:  syn->process_voices = synth_voices_neon; break;
+#endif
+	default:               syn->process_voices = synth_voices_scalar; break;
+	}
+}
+
+dsp_num
+synth_process(synth *syn, audio_params *ap) {
+	/* Nothing is sounding */
+	if(!syn->active) return 0;
+
+	/* The tuning knob moved, so every voice's dt did */
+	if(ap->tuning != syn->dt_recip_tuning) {
+		syn->dt_recip_tuning = ap->tuning;
+		for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
+			syn->dt_recip[i] = polyblep_recip(dsp_mul(syn->phase_step[i], ap->tuning));
+		}
+	}
+
+	return dsp_compact(syn->process_voices(syn, ap));
 }
 
 double
@@ -255,6 +1180,87 @@ sinc_eval(double x) {
 
 void
 synth_init(synth *syn) {
+	synth_init_oscillator(syn, SYNTH_OSC_SINC);
+}
+
+/* Fills in the tables by summing the harmonics that fit under Nyquist at the
+ * top of each octave, with an inverse FFT. */
+static void
+wavetable_build(void) {
+	static fft_plan plan;
+	fft_plan_init(&plan, SYNTH_WAVETABLE_SIZE);
+
+	static float complex saw[SYNTH_WAVETABLE_SIZE];
+	static float complex square[SYNTH_WAVETABLE_SIZE];
+
+	const double pi = 3.14159265358979323846264;
+	for(int o = 0; o < SYNTH_WAVETABLE_OCTAVES; ++o) {
+		int top_note = o * 12 + 11;
+		if(top_note >= NUMBER_OF_NOTES) top_note = NUMBER_OF_NOTES - 1;
+		const double top = dsp_to_float(phase_offset_table[top_note]) * WAVETABLE_MAX_TUNING;
+
+		int harmonics = (int)(0.5 / top);
+		if(harmonics > SYNTH_WAVETABLE_SIZE / 2 - 1) harmonics = SYNTH_WAVETABLE_SIZE / 2 - 1;
+
+		memset(saw, 0, sizeof(saw));
+		memset(square, 0, sizeof(square));
+
+		/* Twice sawtooth_wave() and square_wave(): 0.5 * (1 - 2t) is the sum
+		 * of sin(2 pi k t) / (pi k), and the +-0.5 square is the sum of
+		 * 2 sin(2 pi k t) / (pi k) over odd k. A sine of amplitude A is
+		 * -i A N / 2 in bin k, and the conjugate in bin N - k. */
+		const float half_n = SYNTH_WAVETABLE_SIZE / 2.0f;
+		for(int k = 1; k <= harmonics; ++k) {
+			const float a = (float)(1.0 / (pi * k));
+			saw[k] = -I * a * half_n;
+			saw[SYNTH_WAVETABLE_SIZE - k] = I * a * half_n;
+			if(k & 1) {
+				square[k] = -I * 2 * a * half_n;
+				square[SYNTH_WAVETABLE_SIZE - k] = I * 2 * a * half_n;
+			}
+		}
+		fft_inverse(&plan, saw);
+		fft_inverse(&plan, square);
+
+		for(int i = 0; i <= SYNTH_WAVETABLE_SIZE; ++i) {
+			const int j = i % SYNTH_WAVETABLE_SIZE;
+			wavetable[o][i][0] = (int16_t)lrintf(crealf(saw[j]) * 32768.0f);
+			wavetable[o][i][1] = (int16_t)lrintf(crealf(square[j]) * 32768.0f);
+		}
+	}
+
+	wavetable_ready = true;
+}
+
+size_t
+synth_wavetable_bytes(void) {
+	return sizeof(wavetable);
+}
+
+static const char *const synth_oscillator_names[] = {
+	[SYNTH_OSC_SINC]      = "sinc",
+	[SYNTH_OSC_POLYBLEP]  = "polyblep",
+	[SYNTH_OSC_WAVETABLE] = "wavetable",
+};
+
+bool
+synth_oscillator_parse(const char *name, synth_oscillator *out) {
+	for(int i = 0; i < (int)(sizeof(synth_oscillator_names) / sizeof(synth_oscillator_names[0])); ++i) {
+		if(!strcmp(name, synth_oscillator_names[i])) {
+			*out = (synth_oscillator)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char*
+synth_oscillator_name(synth_oscillator oscillator) {
+	return synth_oscillator_names[oscillator];
+}
+
+void
+synth_init_oscillator(synth *syn, synth_oscillator oscillator) {
 	const double semitone = 1.05946309435929526456182529494634170077920431749418;
 
 	/* Start at A2? */
@@ -281,18 +1287,39 @@ synth_init(synth *syn) {
 	
 	sinc_table_step = dsp_from_double(step);
 
+	/* Add up the weights the same way voice_sinc_waveform() does. The middle
+	 * sample goes into its sum without a weight, so it all but vanishes in
+	 * dsp_compact(), and is left out here. */
+	double gain = 0;
+	int odd = (SINC_SIZE & 1);
+	for(int i = 0; i < SINC_SIZE; ++i) {
+		odd = !odd;
+		const int weight = (i < SINC_SIZE - 1) ? (1 << (1 + odd)) : 1;
+		gain += 2 * weight * dsp_to_float(sinc_table[i]);
+	}
+	oscillator_gain = dsp_from_double(gain);
+
+	/* The tables only depend on phase_offset_table, so only build them once */
+	if(oscillator == SYNTH_OSC_WAVETABLE && !wavetable_ready) {
+		wavetable_build();
+	}
+
 	memset(syn, 0, sizeof(*syn));
 	syn->next_age = 1;
+	syn->oscillator = oscillator;
 
 	for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
 		/* All voices start out in release state */
-		syn->voices[i].state = SYNTH_RELEASE;
+		syn->state[i] = SYNTH_RELEASE;
 
-		syn->voices[i].envelope = 0;
+		syn->envelope[i] = 0;
+		syn->octave[i] = 0;
 
 		/* Initialize all white noises with different values for "variety" */
-		syn->voices[i].white_noise_generator = i;
+		syn->white_noise_generator[i] = i;
 	}
 
+	synth_set_kernel(syn, BPF_KERNEL_AUTO);
+
 	
 }
\ No newline at end of file
@@ -2,10 +2,19 @@
 #define SYNTH_H
 
 #include "dsp.h"
+#include "bpf_simd.h"
 #include "audio_params.h"
 
-/** The maximum number of voices impacts the performance of the synth. */
-#define MAX_SYNTH_VOICES 4
+/**
+ * The maximum number of voices impacts the performance of the synth, when
+ * they are all sounding. The voices are processed SYNTH_VOICE_LANES at a time,
+ * so this must be a multiple of it, and tracked in a 32-bit mask, so it can be
+ * no more than 32.
+ */
+#define MAX_SYNTH_VOICES 24
+
+/** The widest kernel's vector: 8 voices for AVX2. */
+#define SYNTH_VOICE_LANES 8
 
 /** 
  * The number of notes mainly impacts the size of the array of note frequency
@@ -13,6 +22,49 @@
  */
 #define NUMBER_OF_NOTES 64
 
+/**
+ * The wavetable oscillator keeps one band-limited saw and one square table per
+ * octave of notes, each SYNTH_WAVETABLE_SIZE 16-bit samples long. 512 gives the
+ * highest harmonic of the lowest octave (the 94th) over 5 samples per cycle for
+ * the linear interpolation, and keeps all of the tables in 12 KB.
+ */
+#define SYNTH_WAVETABLE_SIZE 512
+#define SYNTH_WAVETABLE_OCTAVES ((NUMBER_OF_NOTES + 11) / 12)
+
+/**
+ * Selects how the voices generate their saw/square waveform.
+ */
+typedef enum {
+	/**
+	 * Lowpasses the naive waveform by integrating it against a sinc, with an
+	 * 11 point Simpson's rule sum. The original oscillator, and the default,
+	 * as the regression references were recorded with it.
+	 */
+	SYNTH_OSC_SINC,
+	/**
+	 * The naive waveform with a PolyBLEP (polynomial band-limited step)
+	 * correction at each discontinuity, within one sample period of it.
+	 * Cheaper than the sinc and aliases less, though both by less than the
+	 * wavetable; see -oscalias.
+	 *
+	 * synth_process with every voice playing measures about 1.5x faster than
+	 * with the sinc using the AVX2 kernel (130 against 190 ns/sample) and
+	 * 2.3x with the scalar one (358 against 830), well short of the 5-10x the
+	 * oscillator alone would suggest: the envelopes and the noise generator
+	 * cost the same for every oscillator, and are most of what is left. As
+	 * the sinc is still the default, none of this is seen unless asked for.
+	 */
+	SYNTH_OSC_POLYBLEP,
+	/**
+	 * Linearly interpolated reads from a band-limited saw and square table for
+	 * the note's octave, mixed by wave_shape. Only harmonics that stay below
+	 * Nyquist at the top of the octave (with the tuning all the way up) are in
+	 * the tables, so it doesn't alias, but the lower notes of each octave lose
+	 * some of their top end.
+	 */
+	SYNTH_OSC_WAVETABLE,
+} synth_oscillator;
+
 /**
  * Defines the states used in the ADSR state machine for the synthesizer.
  */
@@ -23,47 +75,100 @@ typedef enum {
 	SYNTH_RELEASE
 } synth_envelope_state;
 
-typedef struct {
-	/* Which note this synth is playing. */
-	int note;
+typedef struct synth synth;
+
+/**
+ * The signature of the voice kernels: computes the next sample of every voice,
+ * and returns the sum of the samples times their envelopes, before
+ * dsp_compact().
+ */
+typedef dsp_largenum (*synth_voices_fn)(synth *syn, const audio_params *ap);
+
+/**
+ * Defines the state for a synthesizer. Similar to the vocoder, this should 
+ * generally be statically allocated somewhere for efficiency.
+ *
+ * The voices are stored as one array per field (voice i is index i of each),
+ * so that the kernels can load the same field of several voices at once.
+ */
+struct synth {
+	/* The next age value to assign to a voice, for voice-stealing. */
+	uint32_t next_age;
+
+	/* How the voices generate their waveform. */
+	synth_oscillator oscillator;
+
+	/* Which kernel processes the voices, resolved (never BPF_KERNEL_AUTO),
+	 * and its function. See synth_set_kernel(). */
+	bpf_kernel kernel;
+	synth_voices_fn process_voices;
+
+	/* Which voices are sounding: bit i is set from when voice i is pressed
+	 * until its envelope is back to 0 (see synth_voice_idle()). The kernels
+	 * skip the others, which leaves them exactly as they were. */
+	uint32_t active;
+
+	/* Which note each voice is playing. */
+	int32_t note[MAX_SYNTH_VOICES];
 
 	/* Used for voice-stealing */
-	uint32_t age;
+	uint32_t age[MAX_SYNTH_VOICES];
 
-	/* The most recently computed sample */
-	dsp_num sample;
+	/* The computed ADSR envelope of each voice */
+	dsp_num envelope[MAX_SYNTH_VOICES];
 
-	/* The computed ADSR envelope of the synth */
-	dsp_num envelope;
+	/* The state of each voice's ADSR, a synth_envelope_state. Stored as 32
+	 * bits to line up with the other fields. */
+	int32_t state[MAX_SYNTH_VOICES];
 
 	/* Internal state used for generating white noise */
-	dsp_num white_noise_generator;
+	dsp_num white_noise_generator[MAX_SYNTH_VOICES];
 
-	/* The phase of the oscillator */
-	dsp_num phase;
+	/* The phase of each oscillator */
+	dsp_num phase[MAX_SYNTH_VOICES];
 	/* How much the phase is incremented per sample. Corresponds to note frequency. */
-	dsp_num phase_step;
+	dsp_num phase_step[MAX_SYNTH_VOICES];
+
+	/* The reciprocal of each voice's phase step times the tuning (its dt),
+	 * for SYNTH_OSC_POLYBLEP, and the tuning they were worked out for. */
+	dsp_num dt_recip[MAX_SYNTH_VOICES];
+	dsp_num dt_recip_tuning;
 
-	/* The state of the voice's ADSR. */
-	synth_envelope_state state;
-} synth_voice;
+	/* The note's octave, which picks the tables for SYNTH_OSC_WAVETABLE. */
+	int32_t octave[MAX_SYNTH_VOICES];
+};
 
 /**
- * Defines the state for a synthesizer. Similar to the vocoder, this should 
- * generally be statically allocated somewhere for efficiency.
+ * Initializes the synthesizer with the necessary state to start playing notes,
+ * using SYNTH_OSC_SINC.
  */
-typedef struct {
-	/* The next age value to assign to a voice, for voice-stealing. */
-	uint32_t next_age;
+void synth_init(synth *syn);
 
-	/* The array of all synth voices. */
-	synth_voice voices[MAX_SYNTH_VOICES];
-} synth;
+/**
+ * Initializes the synthesizer as with synth_init(), with the given oscillator.
+ * The voices are processed with the fastest kernel the CPU supports.
+ */
+void synth_init_oscillator(synth *syn, synth_oscillator oscillator);
 
 /**
- * Initializes the synthesizer with the necessary state to start playing notes.
+ * Selects the kernel that processes the voices. All of them produce exactly
+ * the same output. Exits with a fatal error if the kernel is not available
+ * (see bpf_kernel_available()).
  */
-void synth_init(synth *syn);
+void synth_set_kernel(synth *syn, bpf_kernel kernel);
+
+/**
+ * Returns the memory the SYNTH_OSC_WAVETABLE tables take, in bytes.
+ */
+size_t synth_wavetable_bytes(void);
+
+/**
+ * Parses "sinc", "polyblep" or "wavetable". Returns false if the name is
+ * unknown.
+ */
+bool synth_oscillator_parse(const char *name, synth_oscillator *out);
+
+const char *synth_oscillator_name(synth_oscillator oscillator);
 
 /**
  * Presses a new note on the synthesizer. Will steal a voice if necessary.
@@ -83,7 +188,8 @@ void synth_release(synth *syn, int note);
 
 /**
  * Computes the next sample for the given synth, given the specified audio
- * parameters.
+ * parameters. Only the sounding voices are processed, and when there are none
+ * this returns 0 straight away.
  */
 dsp_num synth_process(synth *syn, audio_params *ap);
 
@@ -93,4 +199,12 @@ dsp_num synth_process(synth *syn, audio_params *ap);
  */
 void synth_print_active_notes(synth *syn);
 
+/**
+ * Debugging method: Fills notes and voices with up to max of the notes that
+ * are currently active and the voices playing them. Returns how many there
+ * were. Unlike synth_print_active_notes(), this is safe to call from the
+ * real-time loop.
+ */
+int synth_get_active_notes(synth *syn, int32_t *notes, int32_t *voices, int max);
+
 #endif
\ No newline at end of file
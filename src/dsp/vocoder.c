@@ -1,36 +1,125 @@
 #include "vocoder.h"
 
+#include "app.h"
+
 #include <math.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 /* We include the actual implementation code for the BPF filters in our vocoder
  * c file. This is to give the compiler the ability to inline more code and
  * optimize more. Results in a ~12% speedup. */
 #include "bpf_impl.c"
 
-dsp_num
-vc_process(vocoder *v, dsp_num mod, dsp_num car) {
-	const dsp_num lerp_factor_ef    = dsp_from_double(0.008);
-	const dsp_num lerp_factor_bigef = dsp_from_double(0.0008);
+/* The lerp factors for the various envelope followers and low passes. Shared
+ * between vc_process and vc_process_block so that they stay bit-exact. */
+#define LERP_FACTOR_EF    dsp_from_double(0.008)
+#define LERP_FACTOR_BIGEF dsp_from_double(0.0008)
+#define LERP_FACTOR_IN    dsp_from_double(0.08)
 
-	const dsp_num lerp_factor_in = dsp_from_double(0.08);
+/* The passband gain of the filters from design_bpf, with the default number of
+ * stages. The FFT engine applies the same gain to its bands, so that both
+ * engines come out at about the same level. */
+#define VC_BAND_GAIN 8.0
 
-	memmove(v->mod_x + 1, v->mod_x, sizeof(dsp_num) * 2);
-	memmove(v->car_x + 1, v->car_x, sizeof(dsp_num) * 2);
+/* vc_process_block works on chunks of at most this many samples, so that its
+ * scratch buffers can live on the stack. */
+#define VC_BLOCK_CHUNK 64
 
-	dsp_num mod_in = mod * INPUT_EXTRA_MUL;
-	dsp_num car_in = car * INPUT_EXTRA_MUL;
-	v->mod_lowpass += dsp_mul((mod_in - v->mod_lowpass), lerp_factor_in);
+/* The Q15 carrier path multiplies each carrier band by its envelope (times the
+ * band's out_scale, so that the bands come out at the same level as in Q29)
+ * shifted down by env_shift_q15 bits. The product then needs to be shifted
+ * back up by this much to line up with the Q29 sum. */
+#define VC_Q15_DOT_SHIFT(env_shift) ((env_shift) - (BPF_Q15_OUT_SCALE_BITS + 15 - DSP_POINT_IDX))
 
-	v->car_lowpass += dsp_mul((car_in - v->car_lowpass), lerp_factor_in);
+/* Picks env_shift_q15: the smallest shift that still fits the largest
+ * envelope (just under 4.0, the largest dsp_num) times the largest out_scale
+ * of the carrier bands into Q15. Any larger, and the quieter bands would lose
+ * bits of their envelope for nothing. */
+static int
+vc_q15_env_shift(const bpf_bank_q15 *bank, int bands) {
+	int32_t out_scale = 1;
+	for(int i = 0; i < bands; ++i) {
+		if(bank->out_scale[i] > out_scale) out_scale = bank->out_scale[i];
+	}
 
-	v->mod_x[0] = mod_in;//v->mod_lowpass;
-	v->car_x[0] = car_in;// v->car_lowpass;
+	const int64_t env = (int64_t)INT32_MAX * out_scale;
+	int shift = 0;
+	while((env >> shift) > DSP_Q15_MAX) {
+		++shift;
+	}
+	return shift;
+}
+
+/* Runs one sample (already pushed into mod_x and car_x) through the bpf_bank
+ * filterbanks, and returns the sum of the carrier bands weighted by the
+ * modulator envelopes. Bit-exact with the cascade loop in vc_process, as long
+ * as both sides are VC_PRECISION_Q29. */
+static inline dsp_largenum
+vc_bank_sum(vocoder *v) {
+	const dsp_num lerp_factor_ef = LERP_FACTOR_EF;
+
+	dsp_num m[BPF_BANK_MAX_BANDS];
+	dsp_num c[BPF_BANK_MAX_BANDS];
+
+	if(v->mod_precision == VC_PRECISION_Q15) {
+		dsp_q15 m_q15[BPF_BANK_Q15_MAX_BANDS];
+		v->bank_update_q15(&v->mod_bank_q15, v->mod_x_q15, m_q15);
+		for(int i = 0; i < v->bands; ++i) {
+			m[i] = bpf_q15_to_dsp(m_q15[i], v->mod_bank_q15.out_scale[i]);
+		}
+	}
+	else {
+		v->bank_update(&v->mod_bank, v->mod_x, m);
+	}
+
+	if(v->car_precision == VC_PRECISION_Q15) {
+		dsp_q15 c_q15[BPF_BANK_Q15_MAX_BANDS];
+		dsp_q15 env_q15[BPF_BANK_Q15_MAX_BANDS] = { 0 };
+		v->bank_update_q15(&v->car_bank_q15, v->car_x_q15, c_q15);
+
+		for(int i = 0; i < v->bands; ++i) {
+			v->envelope_follow[i] += dsp_mul((dsp_abs(m[i]) - v->envelope_follow[i]), lerp_factor_ef);
+
+			const int64_t env = (int64_t)v->envelope_follow[i] * v->car_bank_q15.out_scale[i];
+			env_q15[i] = (dsp_q15)(env >> v->env_shift_q15);
+		}
+
+		const int64_t dot = v->dot_q15(c_q15, env_q15, v->car_bank_q15.bands);
+		return (dsp_largenum)dot << VC_Q15_DOT_SHIFT(v->env_shift_q15);
+	}
+
+	v->bank_update(&v->car_bank, v->car_x, c);
 
 	dsp_largenum suml = dsp_zero;
+	for(int i = 0; i < v->bands; ++i) {
+		v->envelope_follow[i] += dsp_mul((dsp_abs(m[i]) - v->envelope_follow[i]), lerp_factor_ef);
+		suml += dsp_mul_large(c[i], v->envelope_follow[i]);
+	}
+
+	return suml;
+}
+
+/* --- Specialised cascade kernels --- */
 
-	for(int i = 0; i < VOCODER_BANDS; ++i) {
-		dsp_num m = bpf_cbq_update(&v->mod_filters[i], v->mod_x);
+/* The band loop of vc_process for VC_LAYOUT_CASCADE. Runs one sample (already
+ * pushed into mod_x and car_x) through every band, and returns the sum of the
+ * carrier bands weighted by the modulator envelopes.
+ *
+ * bands, stages and form are always constants in the kernels below, so that
+ * each kernel gets its own fully unrolled copy of the loops. This only works if
+ * the function is actually inlined into each kernel, hence always_inline. */
+__attribute__((always_inline))
+static inline dsp_largenum
+vc_cascade_sum(vocoder *v, int bands, int stages, vc_form form) {
+	const dsp_num lerp_factor_ef = LERP_FACTOR_EF;
+
+	dsp_largenum suml = dsp_zero;
+	for(int i = 0; i < bands; ++i) {
+		dsp_num m = (form == VC_FORM_TDF2)
+			? bpf_cbq_update_tdf2_n(&v->mod_filters[i], v->mod_x[0], stages)
+			: bpf_cbq_update_n(&v->mod_filters[i], v->mod_x, stages);
 		/* First, update the eq band for measuring modulator amplitude */
 
 		/* Then, update the envelope follower. We basically low-pass-filter
@@ -40,11 +129,203 @@ vc_process(vocoder *v, dsp_num mod, dsp_num car) {
 
 		/* Finally, update each of the carrier filters, and multiply them
 		 * by the ef value. */
-		dsp_num c = bpf_cbq_update(&v->car_filters[i], v->car_x);
+		dsp_num c = (form == VC_FORM_TDF2)
+			? bpf_cbq_update_tdf2_n(&v->car_filters[i], v->car_x[0], stages)
+			: bpf_cbq_update_n(&v->car_filters[i], v->car_x, stages);
 
 		suml += dsp_mul_large(c, v->envelope_follow[i]);
 	}
 
+	return suml;
+}
+
+/* The band loop of vc_process_chunk. mod_x and car_x hold the n inputs of the
+ * chunk, preceded by two samples of history (see bpf_cbq_update_block), and the
+ * weighted sum of the carrier bands for each sample is added to suml. */
+__attribute__((always_inline))
+static inline void
+vc_cascade_block(vocoder *v, const dsp_num *mod_x, const dsp_num *car_x, dsp_largenum *suml, size_t n,
+		int bands, int stages, vc_form form) {
+	const dsp_num lerp_factor_ef = LERP_FACTOR_EF;
+
+	dsp_num band[VC_BLOCK_CHUNK];
+	dsp_num env[VC_BLOCK_CHUNK];
+
+	for(int i = 0; i < bands; ++i) {
+		/* Modulator band, then its envelope follower for the whole chunk */
+		if(form == VC_FORM_TDF2) {
+			bpf_cbq_update_block_tdf2_n(&v->mod_filters[i], mod_x, band, n, stages);
+		}
+		else {
+			bpf_cbq_update_block_n(&v->mod_filters[i], mod_x, band, n, stages);
+		}
+
+		dsp_num ef = v->envelope_follow[i];
+		for(size_t k = 0; k < n; ++k) {
+			ef += dsp_mul((dsp_abs(band[k]) - ef), lerp_factor_ef);
+			env[k] = ef;
+		}
+		v->envelope_follow[i] = ef;
+
+		/* Carrier band, multiplied by the envelope at each sample */
+		if(form == VC_FORM_TDF2) {
+			bpf_cbq_update_block_tdf2_n(&v->car_filters[i], car_x, band, n, stages);
+		}
+		else {
+			bpf_cbq_update_block_n(&v->car_filters[i], car_x, band, n, stages);
+		}
+
+		for(size_t k = 0; k < n; ++k) {
+			suml[k] += dsp_mul_large(band[k], env[k]);
+		}
+	}
+}
+
+/* Defines the four kernels (per sample and block, DF-I and TDF-II) for one
+ * band count and stage count. */
+#define VC_DEFINE_KERNELS(bands, stages) \
+	static dsp_largenum \
+	vc_cascade_df1_##bands##_##stages(vocoder *v) { \
+		return vc_cascade_sum(v, bands, stages, VC_FORM_DF1); \
+	} \
+	static dsp_largenum \
+	vc_cascade_tdf2_##bands##_##stages(vocoder *v) { \
+		return vc_cascade_sum(v, bands, stages, VC_FORM_TDF2); \
+	} \
+	static void \
+	vc_cascade_block_df1_##bands##_##stages(vocoder *v, const dsp_num *mod_x, const dsp_num *car_x, dsp_largenum *suml, size_t n) { \
+		vc_cascade_block(v, mod_x, car_x, suml, n, bands, stages, VC_FORM_DF1); \
+	} \
+	static void \
+	vc_cascade_block_tdf2_##bands##_##stages(vocoder *v, const dsp_num *mod_x, const dsp_num *car_x, dsp_largenum *suml, size_t n) { \
+		vc_cascade_block(v, mod_x, car_x, suml, n, bands, stages, VC_FORM_TDF2); \
+	}
+
+#define VC_KERNEL_ENTRY(bands, stages) \
+	{ bands, stages, \
+	  { vc_cascade_df1_##bands##_##stages, vc_cascade_tdf2_##bands##_##stages }, \
+	  { vc_cascade_block_df1_##bands##_##stages, vc_cascade_block_tdf2_##bands##_##stages } },
+
+/* The band and stage counts that get specialised kernels. Any other
+ * combination falls back to the generic kernels, which read the counts from
+ * the vocoder. */
+#define VC_KERNEL_LIST(X) \
+	X(16, 2) X(16, 4) X(16, 6) \
+	X(20, 2) X(20, 4) X(20, 6) \
+	X(28, 2) X(28, 4) X(28, 6) \
+	X(32, 2) X(32, 4) X(32, 6) \
+	X(40, 2) X(40, 4) X(40, 6)
+
+VC_KERNEL_LIST(VC_DEFINE_KERNELS)
+
+static dsp_largenum
+vc_cascade_df1_generic(vocoder *v) {
+	return vc_cascade_sum(v, v->bands, v->stages, VC_FORM_DF1);
+}
+
+static dsp_largenum
+vc_cascade_tdf2_generic(vocoder *v) {
+	return vc_cascade_sum(v, v->bands, v->stages, VC_FORM_TDF2);
+}
+
+static void
+vc_cascade_block_df1_generic(vocoder *v, const dsp_num *mod_x, const dsp_num *car_x, dsp_largenum *suml, size_t n) {
+	vc_cascade_block(v, mod_x, car_x, suml, n, v->bands, v->stages, VC_FORM_DF1);
+}
+
+static void
+vc_cascade_block_tdf2_generic(vocoder *v, const dsp_num *mod_x, const dsp_num *car_x, dsp_largenum *suml, size_t n) {
+	vc_cascade_block(v, mod_x, car_x, suml, n, v->bands, v->stages, VC_FORM_TDF2);
+}
+
+typedef struct {
+	int bands;
+	int stages;
+
+	/* Indexed by vc_form. */
+	vc_cascade_fn cascade[2];
+	vc_cascade_block_fn cascade_block[2];
+} vc_kernel_entry;
+
+static const vc_kernel_entry vc_kernels[] = {
+	VC_KERNEL_LIST(VC_KERNEL_ENTRY)
+};
+
+/* Picks the kernels for v->bands, v->stages and v->form. */
+static void
+vc_select_kernels(vocoder *v) {
+	v->cascade = (v->form == VC_FORM_TDF2) ? vc_cascade_tdf2_generic : vc_cascade_df1_generic;
+	v->cascade_block = (v->form == VC_FORM_TDF2) ? vc_cascade_block_tdf2_generic : vc_cascade_block_df1_generic;
+	v->specialised = false;
+
+	for(size_t i = 0; i < sizeof(vc_kernels) / sizeof(vc_kernels[0]); ++i) {
+		const vc_kernel_entry *e = &vc_kernels[i];
+		if(e->bands == v->bands && e->stages == v->stages) {
+			v->cascade = e->cascade[v->form];
+			v->cascade_block = e->cascade_block[v->form];
+			v->specialised = true;
+			return;
+		}
+	}
+}
+
+static dsp_num vc_process_multirate(vocoder *v, dsp_num mod, dsp_num car);
+
+static dsp_num
+vc_process_fft(vocoder *v, dsp_num mod, dsp_num car) {
+	const dsp_num lerp_factor_bigef = LERP_FACTOR_BIGEF;
+
+	dsp_num sum = stft_vocoder_process(&v->stft, mod * INPUT_EXTRA_MUL, car * INPUT_EXTRA_MUL);
+
+	v->mod_ef += dsp_mul((dsp_abs(mod) - v->mod_ef), lerp_factor_bigef);
+	v->sum_ef += dsp_mul((dsp_abs(sum) - v->sum_ef), lerp_factor_bigef);
+
+	return sum;
+}
+
+dsp_num
+vc_process(vocoder *v, dsp_num mod, dsp_num car) {
+	if(v->engine == VC_ENGINE_FFT) {
+		return vc_process_fft(v, mod, car);
+	}
+	if(v->rate != VC_RATE_FULL) {
+		return vc_process_multirate(v, mod, car);
+	}
+
+	const dsp_num lerp_factor_bigef = LERP_FACTOR_BIGEF;
+
+	const dsp_num lerp_factor_in = LERP_FACTOR_IN;
+
+	memmove(v->mod_x + 1, v->mod_x, sizeof(dsp_num) * 2);
+	memmove(v->car_x + 1, v->car_x, sizeof(dsp_num) * 2);
+
+	dsp_num mod_in = mod * INPUT_EXTRA_MUL;
+	dsp_num car_in = car * INPUT_EXTRA_MUL;
+	v->mod_lowpass += dsp_mul((mod_in - v->mod_lowpass), lerp_factor_in);
+
+	v->car_lowpass += dsp_mul((car_in - v->car_lowpass), lerp_factor_in);
+
+	v->mod_x[0] = mod_in;//v->mod_lowpass;
+	v->car_x[0] = car_in;// v->car_lowpass;
+
+	dsp_largenum suml = dsp_zero;
+
+	if(v->layout == VC_LAYOUT_BANK) {
+		if(v->mod_precision == VC_PRECISION_Q15) {
+			memmove(v->mod_x_q15 + 1, v->mod_x_q15, sizeof(dsp_q15) * 2);
+			v->mod_x_q15[0] = bpf_q15_from_dsp(mod_in);
+		}
+		if(v->car_precision == VC_PRECISION_Q15) {
+			memmove(v->car_x_q15 + 1, v->car_x_q15, sizeof(dsp_q15) * 2);
+			v->car_x_q15[0] = bpf_q15_from_dsp(car_in);
+		}
+
+		suml = vc_bank_sum(v);
+	}
+	else {
+		suml = v->cascade(v);
+	}
+
 	dsp_num sum = dsp_compact(suml);
 
 	v->mod_ef += dsp_mul((dsp_abs(mod) - v->mod_ef), lerp_factor_bigef);
@@ -67,26 +348,497 @@ vc_process(vocoder *v, dsp_num mod, dsp_num car) {
 	return sum;////dsp_mul(sum, amp);
 }
 
+static void
+vc_process_chunk(vocoder *v, const dsp_num *mod, const dsp_num *car, dsp_num *out, size_t n) {
+	const dsp_num lerp_factor_bigef = LERP_FACTOR_BIGEF;
+
+	const dsp_num lerp_factor_in = LERP_FACTOR_IN;
+
+	/* The filter inputs for the chunk. The first two entries are the inputs
+	 * from before the chunk, as expected by bpf_cbq_update_block. */
+	dsp_num mod_x[VC_BLOCK_CHUNK + 2];
+	dsp_num car_x[VC_BLOCK_CHUNK + 2];
+
+	mod_x[0] = v->mod_x[1];
+	mod_x[1] = v->mod_x[0];
+	car_x[0] = v->car_x[1];
+	car_x[1] = v->car_x[0];
+
+	for(size_t k = 0; k < n; ++k) {
+		dsp_num mod_in = mod[k] * INPUT_EXTRA_MUL;
+		dsp_num car_in = car[k] * INPUT_EXTRA_MUL;
+		v->mod_lowpass += dsp_mul((mod_in - v->mod_lowpass), lerp_factor_in);
+		v->car_lowpass += dsp_mul((car_in - v->car_lowpass), lerp_factor_in);
+
+		mod_x[k + 2] = mod_in;
+		car_x[k + 2] = car_in;
+	}
+
+	/* Store the history for the next call. */
+	for(int i = 0; i < 3; ++i) {
+		v->mod_x[i] = mod_x[n + 1 - i];
+		v->car_x[i] = car_x[n + 1 - i];
+	}
+
+	dsp_largenum suml[VC_BLOCK_CHUNK] = { 0 };
+
+	v->cascade_block(v, mod_x, car_x, suml, n);
+
+	for(size_t k = 0; k < n; ++k) {
+		dsp_num sum = dsp_compact(suml[k]);
+
+		v->mod_ef += dsp_mul((dsp_abs(mod[k]) - v->mod_ef), lerp_factor_bigef);
+		v->sum_ef += dsp_mul((dsp_abs(sum) - v->sum_ef), lerp_factor_bigef);
+
+		out[k] = sum;
+	}
+}
+
+void
+vc_process_block(vocoder *v, const dsp_num *mod, const dsp_num *car, dsp_num *out, size_t n) {
+	if(v->engine == VC_ENGINE_FFT || v->layout == VC_LAYOUT_BANK || v->rate != VC_RATE_FULL) {
+		/* The bank already keeps its state in contiguous arrays, so it gains
+		 * nothing from the chunked path. The multirate filterbank runs each
+		 * band only every few samples anyway, and the FFT engine does all of
+		 * its work once per hop. */
+		for(size_t k = 0; k < n; ++k) {
+			out[k] = vc_process(v, mod[k], car[k]);
+		}
+		return;
+	}
+
+	while(n > 0) {
+		size_t len = (n < VC_BLOCK_CHUNK) ? n : VC_BLOCK_CHUNK;
+		vc_process_chunk(v, mod, car, out, len);
+
+		mod += len;
+		car += len;
+		out += len;
+		n   -= len;
+	}
+}
+
+/* --- Multirate filterbank --- */
+
+/* Processes one new sample at level k of the multirate filterbank (along with
+ * any deeper levels it triggers), and returns the reconstructed output of
+ * level k and everything below it, at level k's sample rate.
+ *
+ * For level k > 0, the output is instead interpolated and stored in
+ * mr->fifo[k] for level k - 1 to pick up. */
+static dsp_num
+vc_mr_level(vocoder *v, int k, dsp_num mod, dsp_num car) {
+	vc_multirate *mr = &v->mr;
+
+	memmove(mr->mod_x[k] + 1, mr->mod_x[k], sizeof(dsp_num) * 2);
+	memmove(mr->car_x[k] + 1, mr->car_x[k], sizeof(dsp_num) * 2);
+	mr->mod_x[k][0] = mod;
+	mr->car_x[k][0] = car;
+
+	/* Feed the deeper levels first, so that their interpolated output for
+	 * this sample is ready in the fifo. Every second sample at this level
+	 * produces one sample at the next level. */
+	if(k + 1 < mr->levels) {
+		if(!mr->have_pending[k]) {
+			mr->mod_pending[k] = mod;
+			mr->car_pending[k] = car;
+			mr->have_pending[k] = true;
+		}
+		else {
+			dsp_num mod_down = halfband_decimate(&mr->mod_dec[k + 1], mr->mod_pending[k], mod);
+			dsp_num car_down = halfband_decimate(&mr->car_dec[k + 1], mr->car_pending[k], car);
+			mr->have_pending[k] = false;
+
+			vc_mr_level(v, k + 1, mod_down, car_down);
+		}
+	}
+
+	/* The bands for this level. Identical to the full rate loop in vc_process,
+	 * besides the envelope follower rate. */
+	const dsp_num lerp_factor_ef = mr->lerp_ef[k];
+	dsp_largenum suml = dsp_zero;
+	for(int i = mr->band_lo[k]; i < mr->band_hi[k]; ++i) {
+		dsp_num m = bpf_cbq_update(&v->mod_filters[i], mr->mod_x[k]);
+
+		dsp_num ef = dsp_abs(m);
+		v->envelope_follow[i] += dsp_mul((ef - v->envelope_follow[i]), lerp_factor_ef);
+
+		dsp_num c = bpf_cbq_update(&v->car_filters[i], mr->car_x[k]);
+		suml += dsp_mul_large(c, v->envelope_follow[i]);
+	}
+
+	/* Delay this level's output to line up with the levels below it. */
+	/* (Levels without any bands have nothing to delay.) */
+	dsp_num sum = dsp_compact(suml);
+	if(mr->align_len[k] > 0 && mr->band_hi[k] > mr->band_lo[k]) {
+		dsp_num *line = mr->align[k];
+		int pos = mr->align_pos[k];
+
+		dsp_num delayed = line[pos];
+		line[pos] = sum;
+		mr->align_pos[k] = (pos + 1) % mr->align_len[k];
+
+		sum = delayed;
+	}
+
+	/* Add in the interpolated output of the next level down. */
+	if(k + 1 < mr->levels) {
+		sum += mr->fifo[k + 1][0];
+		mr->fifo_count[k + 1] -= 1;
+		memmove(mr->fifo[k + 1], mr->fifo[k + 1] + 1, sizeof(dsp_num) * mr->fifo_count[k + 1]);
+	}
+
+	if(k > 0) {
+		halfband_interpolate(&mr->interp[k], sum, mr->fifo[k] + mr->fifo_count[k]);
+		mr->fifo_count[k] += 2;
+	}
+
+	return sum;
+}
+
+static dsp_num
+vc_process_multirate(vocoder *v, dsp_num mod, dsp_num car) {
+	const dsp_num lerp_factor_bigef = LERP_FACTOR_BIGEF;
+
+	dsp_num sum = vc_mr_level(v, 0, mod * INPUT_EXTRA_MUL, car * INPUT_EXTRA_MUL);
+
+	v->mod_ef += dsp_mul((dsp_abs(mod) - v->mod_ef), lerp_factor_bigef);
+	v->sum_ef += dsp_mul((dsp_abs(sum) - v->sum_ef), lerp_factor_bigef);
+
+	return sum;
+}
+
+/* Sets up the levels of the multirate filterbank, and designs every band's
+ * filters at the sample rate of its level.
+ *
+ * f and fw are the center frequency and width of each band, normalized to
+ * SAMPLE_RATE. max_levels is the number of levels we're allowed to use. */
+static void
+vc_mr_init(vocoder *v, const double *f, double fw, int max_levels) {
+	vc_multirate *mr = &v->mr;
+
+	for(int k = 0; k < VC_MAX_LEVELS; ++k) {
+		halfband_init(&mr->mod_dec[k], HALFBAND_DEFAULT_TAPS);
+		halfband_init(&mr->car_dec[k], HALFBAND_DEFAULT_TAPS);
+		halfband_init(&mr->interp[k], HALFBAND_DEFAULT_TAPS);
+	}
+
+	const double edge = halfband_passband_edge(&mr->mod_dec[0]);
+	const int c = halfband_delay(&mr->mod_dec[0]);
+
+	/* Each band goes to the deepest level where it (plus one band width of
+	 * margin for the filter skirts) is still inside the passband of every
+	 * decimator on the way down. The bands are in increasing frequency order,
+	 * so the deepest level gets the lowest bands. A band that doesn't fit
+	 * inside even the first decimator stays at level 0, the full rate (see
+	 * VC_RATE_MULTI). */
+	int level_of[VC_MAX_BANDS];
+	mr->levels = 1;
+	for(int i = 0; i < v->bands; ++i) {
+		int k = 0;
+		while(k + 1 < max_levels && f[i] + fw <= edge / (1 << k)) {
+			k += 1;
+		}
+
+		level_of[i] = k;
+		if(k + 1 > mr->levels) mr->levels = k + 1;
+	}
+
+	for(int k = 0; k < VC_MAX_LEVELS; ++k) {
+		mr->band_lo[k] = v->bands;
+		mr->band_hi[k] = 0;
+	}
+	for(int i = 0; i < v->bands; ++i) {
+		const int k = level_of[i];
+		if(i < mr->band_lo[k]) mr->band_lo[k] = i;
+		if(i + 1 > mr->band_hi[k]) mr->band_hi[k] = i + 1;
+
+		/* Design the band at its own rate. */
+		const double rate_mul = (double)(1 << k);
+		design_bpf(&v->mod_filters[i], f[i] * rate_mul, fw * rate_mul, v->stages);
+		design_bpf(&v->car_filters[i], f[i] * rate_mul, fw * rate_mul, v->stages);
+	}
+
+	for(int k = 0; k < VC_MAX_LEVELS; ++k) {
+		if(mr->band_hi[k] < mr->band_lo[k]) {
+			mr->band_lo[k] = mr->band_hi[k] = 0;
+		}
+
+		/* Same time constant as the full rate envelope follower */
+		const double alpha = dsp_to_float(LERP_FACTOR_EF);
+		mr->lerp_ef[k] = dsp_from_double(1.0 - pow(1.0 - alpha, (double)(1 << k)));
+
+		/* The interpolators start out with two samples of silence, so that
+		 * each level can always consume the output of the level below it on
+		 * the sample after it was produced. */
+		mr->fifo_count[k] = 2;
+	}
+
+	/* Compute the delays needed to line up the levels.
+	 *
+	 * A sample at level k, index m, holds the input from full rate time
+	 * 2^k m - (c - 1)(2^k - 1), due to the decimators. The reconstructed
+	 * output of level k at index m is from time 2^k m - D_k. The deepest level
+	 * has no alignment delay, so D = (c - 1)(2^K - 1) there. Each interpolator
+	 * then adds c samples of delay at the higher rate, plus the 2 samples of
+	 * buffering in the fifo. */
+	const int deepest = mr->levels - 1;
+	int delay = (c - 1) * ((1 << deepest) - 1);
+	mr->align_len[deepest] = 0;
+
+	for(int k = deepest; k >= 1; --k) {
+		const int step = 1 << (k - 1);
+		const int behind = delay - (c - 1) * (step - 1);
+		if(behind % step != 0) app_fatal_error("vocoder: multirate alignment bug");
+
+		mr->align_len[k - 1] = (2 + c) + behind / step;
+		if(mr->align_len[k - 1] > VC_ALIGN_MAX) app_fatal_error("vocoder: multirate alignment delay too long");
+
+		delay += step * (2 + c);
+	}
+
+	mr->latency = (deepest > 0) ? delay : 0;
+}
+
+int
+vc_latency(const vocoder *v) {
+	if(v->engine == VC_ENGINE_FFT) return v->stft.size;
+	return (v->rate != VC_RATE_FULL) ? v->mr.latency : 0;
+}
+
+void
+vc_config_default(vocoder_config *cfg) {
+	cfg->engine = VC_ENGINE_IIR;
+	cfg->fft_size = STFT_DEFAULT_SIZE;
+	cfg->fft_bands = STFT_DEFAULT_BANDS;
+	cfg->bands = VOCODER_BANDS;
+	cfg->stages = BPF_DEFAULT_STAGES;
+	cfg->layout = VC_LAYOUT_CASCADE;
+	cfg->kernel = BPF_KERNEL_AUTO;
+	cfg->form = VC_FORM_DF1;
+	cfg->rate = VC_RATE_FULL;
+	cfg->mod_precision = VC_PRECISION_Q29;
+	cfg->car_precision = VC_PRECISION_Q29;
+}
+
+/* Parses the integer after "key=" in option. Returns false if option does not
+ * start with key, or the rest is not a number. */
+static bool
+vc_config_parse_int(const char *option, const char *key, int *out) {
+	const size_t len = strlen(key);
+	if(strncmp(option, key, len) != 0 || option[len] != '=') return false;
+
+	char *end;
+	long value = strtol(option + len + 1, &end, 10);
+	if(end == option + len + 1 || *end != '\0') return false;
+
+	*out = (int)value;
+	return true;
+}
+
+bool
+vc_config_parse(vocoder_config *cfg, const char *option) {
+	if(!strcmp(option, "engine=iir")) {
+		cfg->engine = VC_ENGINE_IIR;
+		return true;
+	}
+	if(!strcmp(option, "engine=fft")) {
+		cfg->engine = VC_ENGINE_FFT;
+		return true;
+	}
+	if(vc_config_parse_int(option, "fft_size", &cfg->fft_size)) return true;
+	if(vc_config_parse_int(option, "fft_bands", &cfg->fft_bands)) return true;
+	if(vc_config_parse_int(option, "bands", &cfg->bands)) return true;
+	if(vc_config_parse_int(option, "stages", &cfg->stages)) return true;
+
+	if(!strcmp(option, "layout=cascade")) {
+		cfg->layout = VC_LAYOUT_CASCADE;
+		return true;
+	}
+	if(!strcmp(option, "layout=bank")) {
+		cfg->layout = VC_LAYOUT_BANK;
+		return true;
+	}
+
+	if(!strcmp(option, "form=df1")) {
+		cfg->form = VC_FORM_DF1;
+		return true;
+	}
+	if(!strcmp(option, "form=tdf2")) {
+		cfg->form = VC_FORM_TDF2;
+		return true;
+	}
+
+	if(!strcmp(option, "rate=full")) {
+		cfg->rate = VC_RATE_FULL;
+		return true;
+	}
+	if(!strcmp(option, "rate=multi")) {
+		cfg->rate = VC_RATE_MULTI;
+		return true;
+	}
+	if(!strcmp(option, "rate=half")) {
+		cfg->rate = VC_RATE_HALF;
+		return true;
+	}
+
+	if(!strcmp(option, "mod_precision=q29")) {
+		cfg->mod_precision = VC_PRECISION_Q29;
+		return true;
+	}
+	if(!strcmp(option, "mod_precision=q15")) {
+		cfg->mod_precision = VC_PRECISION_Q15;
+		return true;
+	}
+	if(!strcmp(option, "car_precision=q29")) {
+		cfg->car_precision = VC_PRECISION_Q29;
+		return true;
+	}
+	if(!strcmp(option, "car_precision=q15")) {
+		cfg->car_precision = VC_PRECISION_Q15;
+		return true;
+	}
+
+	if(!strncmp(option, "kernel=", 7)) {
+		for(bpf_kernel k = BPF_KERNEL_AUTO; k <= BPF_KERNEL_NEON; ++k) {
+			if(!strcmp(option + 7, bpf_kernel_name(k))) {
+				cfg->kernel = k;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool
+vc_config_parse_args(vocoder_config *cfg, int argc, char **argv, int first) {
+	for(int i = first; i < argc; ++i) {
+		if(!vc_config_parse(cfg, argv[i])) {
+			printf("error: unknown vocoder option %s\n", argv[i]);
+			vc_config_print_help();
+			return false;
+		}
+	}
+	return true;
+}
+
+void
+vc_config_print_help(void) {
+	puts("vocoder options:\n"
+	"  engine=iir|fft: IIR filterbank (default), or STFT with overlap-add\n"
+	"  fft_size=N: frame size for engine=fft, a power of two <= 2048 (default 1024)\n"
+	"  fft_bands=N: number of bands for engine=fft, up to 256 (default 64; more\n"
+	"    than about 180 needs fft_size=2048)\n"
+	"  bands=N: number of bands for engine=iir, up to 40 (default 28)\n"
+	"  stages=2|4|6: biquad stages per band filter for engine=iir (default 4)\n"
+	"    (16, 20, 28, 32 or 40 bands with 2, 4 or 6 stages use specialised kernels)\n"
+	"  layout=cascade: one cascaded biquad per band, updated band by band (default)\n"
+	"  layout=bank: structure-of-arrays filterbank, all bands updated together\n"
+	"  kernel=auto|scalar|sse4.1|avx2|neon: SIMD kernel for layout=bank, and for the\n"
+	"    synth's voices in -app and -bench (default auto; auto never picks neon,\n"
+	"    which is untested on ARM and has to be asked for)\n"
+	"  mod_precision=q29|q15, car_precision=q29|q15: 32-bit (default) or 16-bit\n"
+	"    filters for each side of layout=bank (see -q15snr for the difference).\n"
+	"    q15 measures about 36 dB SNR on the carrier and 30 dB on the modulator,\n"
+	"    whose upper bands drop to about 0 dB; it is faster with sse4.1, not avx2\n"
+	"  form=df1|tdf2: biquad structure for layout=cascade (default df1)\n"
+	"  rate=full|half|multi: run every band at full rate (default), every band at\n"
+	"    half rate (adds 0.7ms latency), or lower bands at 1/2, 1/4 or 1/8 rate\n"
+	"    (multirate octave filterbank, adds 4.9ms latency)"
+	);
+}
+
 void
 vc_init(vocoder *v) {
+	vocoder_config cfg;
+	vc_config_default(&cfg);
+	vc_init_config(v, &cfg);
+}
+
+void
+vc_init_config(vocoder *v, const vocoder_config *cfg) {
 	memset(v, 0, sizeof(*v));
+
+	v->engine = cfg->engine;
+	v->layout = cfg->layout;
+	v->form = cfg->form;
+	v->rate = cfg->rate;
+	v->bands = cfg->bands;
+	v->stages = cfg->stages;
+	v->bank_update = bpf_kernel_get(cfg->kernel);
+	v->bank_update_q15 = bpf_kernel_get_q15(cfg->kernel);
+	v->dot_q15 = bpf_kernel_get_q15_dot(cfg->kernel);
+	v->mod_precision = cfg->mod_precision;
+	v->car_precision = cfg->car_precision;
+
+	if(v->engine == VC_ENGINE_IIR && (v->bands < 1 || v->bands > VC_MAX_BANDS)) {
+		app_fatal_error("vocoder: bands must be between 1 and VC_MAX_BANDS");
+	}
+	vc_select_kernels(v);
+
+	if((v->mod_precision != VC_PRECISION_Q29 || v->car_precision != VC_PRECISION_Q29) && v->layout != VC_LAYOUT_BANK) {
+		app_fatal_error("vocoder: mod_precision and car_precision only apply to layout=bank");
+	}
+	if(v->layout == VC_LAYOUT_BANK && v->form != VC_FORM_DF1) {
+		app_fatal_error("vocoder: layout=bank only supports form=df1");
+	}
+	if(v->rate != VC_RATE_FULL && (v->layout != VC_LAYOUT_CASCADE || v->form != VC_FORM_DF1)) {
+		app_fatal_error("vocoder: the multirate filterbank only supports layout=cascade, form=df1");
+	}
 	
 	double min_freq = 0;
 	double max_freq = 8000.0 / SAMPLE_RATE;
+
+	if(v->engine == VC_ENGINE_FFT) {
+		if(v->layout != VC_LAYOUT_CASCADE || v->form != VC_FORM_DF1 || v->rate != VC_RATE_FULL) {
+			app_fatal_error("vocoder: layout, form and rate only apply to engine=iir");
+		}
+
+		stft_vocoder_init(&v->stft, cfg->fft_size, cfg->fft_bands, max_freq, dsp_to_float(LERP_FACTOR_EF), VC_BAND_GAIN);
+		return;
+	}
 	double range = (max_freq - min_freq);
 
-	double freq_div = range / (VOCODER_BANDS + 1);
+	double freq_div = range / (v->bands + 1);
 
 	/* Basically: don't create a band at 0 or 0.5, but at evenly spaced
 	 * divisions within 0--0.5 */
-	double f = freq_div;
+	double f[VC_MAX_BANDS];
+	f[0] = freq_div;
+	for(int i = 1; i < v->bands; ++i) {
+		f[i] = f[i - 1] + freq_div;
+	}
 
-	for(int i = 0; i < VOCODER_BANDS; ++i) {
+	bpf_bank_init(&v->mod_bank, v->bands, v->stages);
+	bpf_bank_init(&v->car_bank, v->bands, v->stages);
+	bpf_bank_q15_init(&v->mod_bank_q15, v->bands, v->stages);
+	bpf_bank_q15_init(&v->car_bank_q15, v->bands, v->stages);
+
+	for(int i = 0; i < v->bands; ++i) {
 		v->envelope_follow[i] = 0;
 
-		design_bpf(&v->mod_filters[i], f, freq_div);
-		design_bpf(&v->car_filters[i], f, freq_div);
+		design_bpf(&v->mod_filters[i], f[i], freq_div, v->stages);
+		design_bpf(&v->car_filters[i], f[i], freq_div, v->stages);
+
+		bpf_bank_set_band(&v->mod_bank, i, &v->mod_filters[i]);
+		bpf_bank_set_band(&v->car_bank, i, &v->car_filters[i]);
 
-		f += freq_div;
+		if(v->mod_precision == VC_PRECISION_Q15) {
+			bpf_bank_q15_set_band(&v->mod_bank_q15, i, &v->mod_filters[i]);
+		}
+		if(v->car_precision == VC_PRECISION_Q15) {
+			bpf_bank_q15_set_band(&v->car_bank_q15, i, &v->car_filters[i]);
+		}
+	}
+	v->env_shift_q15 = vc_q15_env_shift(&v->car_bank_q15, v->bands);
+
+	if(v->rate == VC_RATE_MULTI) {
+		vc_mr_init(v, f, freq_div, VC_MAX_LEVELS);
+	}
+	if(v->rate == VC_RATE_HALF) {
+		/* The half rate filterbank is just the multirate filterbank with a
+		 * single extra level. */
+		vc_mr_init(v, f, freq_div, 2);
 	}
 }
\ No newline at end of file
@@ -1,9 +1,215 @@
 #ifndef VOCODER_H
 #define VOCODER_H
 
+#include <stddef.h>
+
+#include "types.h"
+
 #include "dsp.h"
 #include "dsp_perf.h"
 #include "bpf.h"
+#include "bpf_simd.h"
+#include "halfband.h"
+#include "stft_vocoder.h"
+
+/**
+ * Selects how the vocoder splits its inputs into bands.
+ */
+typedef enum {
+	/** The IIR filterbank: one cascaded biquad per band, for each input. */
+	VC_ENGINE_IIR,
+	/**
+	 * The STFT engine (see stft_vocoder.h). Its cost does not depend on the
+	 * number of bands, so it can run many more of them, at the cost of a
+	 * frame of latency.
+	 */
+	VC_ENGINE_FFT,
+} vc_engine;
+
+/**
+ * Selects how the vocoder's filterbank is stored and updated. The output is
+ * bit-exact between layouts; they only differ in speed.
+ */
+typedef enum {
+	/** One bpf_cascaded_biquad per band, updated band by band. */
+	VC_LAYOUT_CASCADE,
+	/** A structure-of-arrays bpf_bank, updating all bands together. */
+	VC_LAYOUT_BANK,
+} vc_layout;
+
+/**
+ * Selects the biquad structure used by VC_LAYOUT_CASCADE. Both forms produce
+ * the same output in fixed point; see bpf_impl.c.
+ */
+typedef enum {
+	/** Direct Form I, the reference implementation. */
+	VC_FORM_DF1,
+	/** Transposed Direct Form II: two state words per stage, no shifting. */
+	VC_FORM_TDF2,
+} vc_form;
+
+/**
+ * Selects the arithmetic used for one side (modulator or carrier) of the
+ * VC_LAYOUT_BANK filterbank.
+ */
+typedef enum {
+	/** dsp_num (Q29, 32-bit) filters, the reference. */
+	VC_PRECISION_Q29,
+	/**
+	 * 16-bit filters (bpf_bank_q15): twice as many bands per SIMD register,
+	 * but noisier. On the carrier side, the band outputs are also multiplied
+	 * by the envelopes and summed in Q15, with a 64-bit sum.
+	 *
+	 * Measured with -q15snr on the default bands, the output SNR against Q29
+	 * is about 36 dB with a Q15 carrier, 30 dB with a Q15 modulator and 27 dB
+	 * with both. The modulator side is the weak one: bands 13 to 26 only carry
+	 * a few LSB of speech in 16 bits, and come out at -0.5 to 2 dB SNR.
+	 *
+	 * Nor is it always faster. End to end, SSE4.1 goes from about 295 to 227
+	 * ns/sample with both sides in Q15, but AVX2 stays at about 190-200 either
+	 * way, as the conversions to and from Q15, the envelopes and the dot
+	 * product use up the faster bank update.
+	 */
+	VC_PRECISION_Q15,
+} vc_precision;
+
+/**
+ * Selects the sample rate(s) the vocoder's filterbank runs at.
+ */
+typedef enum {
+	/** Every band runs at SAMPLE_RATE. */
+	VC_RATE_FULL,
+	/**
+	 * Multirate octave filterbank: the inputs are fed through a tree of
+	 * halfband decimators, and each band runs at the lowest rate (down to
+	 * SAMPLE_RATE / 8) that can still represent it. Adds some latency; see
+	 * vc_latency().
+	 *
+	 * A band only leaves SAMPLE_RATE if its upper edge (center plus one band
+	 * width) is inside the passband of the halfband decimators, which ends at
+	 * about 0.182 * SAMPLE_RATE. The default bands end at 8kHz, so at 44.1kHz
+	 * (edge 8.03kHz) every band moves down, but with SAMPLE_RATE below about
+	 * 43.9kHz the top bands stay at full rate: at 32kHz (edge 5.8kHz), every
+	 * band ending above 5.8kHz does.
+	 */
+	VC_RATE_MULTI,
+	/**
+	 * The whole filterbank runs at SAMPLE_RATE / 2: the inputs are decimated
+	 * 2:1 with a halfband filter, and the output is interpolated back up.
+	 * This works because all of the bands are below 8kHz. Adds 31 samples
+	 * (0.7ms at 44.1kHz) of latency.
+	 */
+	VC_RATE_HALF,
+} vc_rate;
+
+/**
+ * The maximum number of bands for VC_ENGINE_IIR. The default is VOCODER_BANDS.
+ */
+#define VC_MAX_BANDS BPF_BANK_MAX_BANDS
+
+/**
+ * The number of sample rates used by VC_RATE_MULTI: SAMPLE_RATE, and 1/2, 1/4
+ * and 1/8 of it.
+ */
+#define VC_MAX_LEVELS 4
+
+/** The maximum alignment delay for each level of the multirate filterbank. */
+#define VC_ALIGN_MAX 512
+
+/**
+ * The state for VC_RATE_MULTI. Level k runs at SAMPLE_RATE / 2^k.
+ */
+typedef struct {
+	/** The number of levels in use. */
+	int levels;
+
+	/** Bands [band_lo[k], band_hi[k]) run at level k. */
+	int band_lo[VC_MAX_LEVELS];
+	int band_hi[VC_MAX_LEVELS];
+
+	/** mod_dec[k] and car_dec[k] decimate level k - 1 into level k. */
+	halfband mod_dec[VC_MAX_LEVELS];
+	halfband car_dec[VC_MAX_LEVELS];
+	/** interp[k] interpolates the output of level k up to level k - 1. */
+	halfband interp[VC_MAX_LEVELS];
+
+	/** Whether a sample is waiting in mod_pending[k] / car_pending[k] to be
+	 * decimated (together with the next one) into level k + 1. */
+	bool have_pending[VC_MAX_LEVELS];
+	dsp_num mod_pending[VC_MAX_LEVELS];
+	dsp_num car_pending[VC_MAX_LEVELS];
+
+	/** The filter input history at each level. */
+	dsp_num mod_x[VC_MAX_LEVELS][3];
+	dsp_num car_x[VC_MAX_LEVELS][3];
+
+	/** The envelope follower lerp factor at each level's sample rate. */
+	dsp_num lerp_ef[VC_MAX_LEVELS];
+
+	/**
+	 * Delay lines for the output of each level, so that the output of every
+	 * level lines up in time with the (more delayed) interpolated output of the
+	 * levels below it.
+	 */
+	dsp_num align[VC_MAX_LEVELS][VC_ALIGN_MAX];
+	int align_len[VC_MAX_LEVELS];
+	int align_pos[VC_MAX_LEVELS];
+
+	/** Interpolated samples from interp[k] waiting to be used by level k - 1. */
+	dsp_num fifo[VC_MAX_LEVELS][4];
+	int fifo_count[VC_MAX_LEVELS];
+
+	/** The total added latency, in samples at SAMPLE_RATE. */
+	int latency;
+} vc_multirate;
+
+/**
+ * Options for vc_init_config. Should be initialized with vc_config_default
+ * and then modified as needed.
+ */
+typedef struct {
+	vc_engine engine;
+
+	/** The number of bands and biquad stages per band for VC_ENGINE_IIR. */
+	int bands;
+	int stages;
+
+	/** The frame size and number of bands for VC_ENGINE_FFT. */
+	int fft_size;
+	int fft_bands;
+
+	vc_layout layout;
+
+	/** Which bpf_bank kernel to use with VC_LAYOUT_BANK. */
+	bpf_kernel kernel;
+
+	/** Which biquad structure to use with VC_LAYOUT_CASCADE. */
+	vc_form form;
+
+	/** Which sample rate(s) to run the filterbank at. */
+	vc_rate rate;
+
+	/** The arithmetic for each side of the filterbank, with VC_LAYOUT_BANK. */
+	vc_precision mod_precision;
+	vc_precision car_precision;
+} vocoder_config;
+
+struct vocoder;
+
+/**
+ * A kernel for the band loop of VC_LAYOUT_CASCADE, specialised for one band
+ * count, stage count and form. Runs one sample (already pushed into mod_x and
+ * car_x) through every band, and returns the sum of the carrier bands weighted
+ * by the modulator envelopes.
+ */
+typedef dsp_largenum (*vc_cascade_fn)(struct vocoder *v);
+
+/**
+ * The block version of vc_cascade_fn, for n samples. mod_x and car_x hold the
+ * inputs preceded by two samples of history (as for bpf_cbq_update_block), and
+ * the weighted sum for each sample is added to suml[0..n).
+ */
+typedef void (*vc_cascade_block_fn)(struct vocoder *v, const dsp_num *mod_x, const dsp_num *car_x, dsp_largenum *suml, size_t n);
 
 /**
  * The vocoder struct. Contains all the state needed to perform the vocoding
@@ -12,13 +218,27 @@
  * Should generally be stack-allocated or otherwise statically allocated for
  * efficiency.
  */
-typedef struct {
+typedef struct vocoder {
 	/** The BPFs for the modulator signal. */
-	bpf_cascaded_biquad mod_filters[VOCODER_BANDS];
+	bpf_cascaded_biquad mod_filters[VC_MAX_BANDS];
 	/** The BPFs for the carrier signal. */
-	bpf_cascaded_biquad car_filters[VOCODER_BANDS];
+	bpf_cascaded_biquad car_filters[VC_MAX_BANDS];
 	/** The envelope followers for each filtered modulator signal. */
-	dsp_num envelope_follow[VOCODER_BANDS];
+	dsp_num envelope_follow[VC_MAX_BANDS];
+
+	/** The number of bands and stages in use. */
+	int bands;
+	int stages;
+
+	/**
+	 * The band loop kernels for VC_LAYOUT_CASCADE, picked once at init for
+	 * bands, stages and form.
+	 */
+	vc_cascade_fn cascade;
+	vc_cascade_block_fn cascade_block;
+
+	/** Whether cascade and cascade_block are specialised, or generic. */
+	bool specialised;
 
 	/* Slightly low pass the modulator using a lerp */
 	dsp_num mod_lowpass;
@@ -39,18 +259,104 @@ typedef struct {
 	 */
 	dsp_num mod_ef;
 	dsp_num sum_ef;
+
+	/** The same filters as mod_filters and car_filters, for VC_LAYOUT_BANK. */
+	bpf_bank mod_bank;
+	bpf_bank car_bank;
+
+	/** The kernel used to update mod_bank and car_bank. */
+	bpf_bank_update_fn bank_update;
+
+	/** The Q15 versions of mod_bank and car_bank, for VC_PRECISION_Q15. */
+	bpf_bank_q15 mod_bank_q15;
+	bpf_bank_q15 car_bank_q15;
+
+	/** The Q15 versions of mod_x and car_x. */
+	dsp_q15 mod_x_q15[3];
+	dsp_q15 car_x_q15[3];
+
+	/** The kernels used with VC_PRECISION_Q15. */
+	bpf_bank_q15_update_fn bank_update_q15;
+	bpf_q15_dot_fn dot_q15;
+
+	/** How far each envelope, times its carrier band's out_scale, is shifted
+	 * down to Q15 for dot_q15 (see vc_q15_env_shift). */
+	int env_shift_q15;
+
+	vc_precision mod_precision;
+	vc_precision car_precision;
+
+	vc_engine engine;
+	vc_layout layout;
+	vc_form form;
+	vc_rate rate;
+
+	/** Only used with VC_RATE_MULTI. */
+	vc_multirate mr;
+
+	/** Only used with VC_ENGINE_FFT. */
+	stft_vocoder stft;
 } vocoder;
 
+/**
+ * Initializes the vocoder config with the default options.
+ */
+void vc_config_default(vocoder_config *cfg);
+
+/**
+ * Applies a single "key=value" option (for example "layout=bank") to the given
+ * config. Intended for passing options through from the command line. Returns
+ * false if the option is not recognized.
+ */
+bool vc_config_parse(vocoder_config *cfg, const char *option);
+
+/**
+ * Applies every option in argv[first..argc) with vc_config_parse. If any of
+ * them are not recognized, prints an error and the help and returns false.
+ */
+bool vc_config_parse_args(vocoder_config *cfg, int argc, char **argv, int first);
+
+/**
+ * Prints the options accepted by vc_config_parse, for usage messages.
+ */
+void vc_config_print_help(void);
+
 /**
  * Initializes the vocoder with all the necessary state for it to process
- * a signal through vc_process.
+ * a signal through vc_process, using the default config.
  */
 void vc_init(vocoder *v);
 
+/**
+ * Initializes the vocoder with the given config.
+ */
+void vc_init_config(vocoder *v, const vocoder_config *cfg);
+
 /**
  * Computes a single sample run through the vocoder. Requires an input for both
  * the modulator signal and the carrier signal. Returns the vocoded signal.
  */
 dsp_num vc_process(vocoder *v, dsp_num modulator, dsp_num carrier);
 
+/**
+ * Returns the latency added by the vocoder's filterbank structure, in samples
+ * at SAMPLE_RATE. This is 0 for the full rate filterbank, and one frame for
+ * VC_ENGINE_FFT. (The band filters
+ * themselves also delay the signal somewhat, but this is the same for all
+ * configurations.)
+ */
+int vc_latency(const vocoder *v);
+
+/**
+ * Runs a block of n samples through the vocoder. mod[i] and car[i] are the
+ * modulator and carrier inputs for sample i, and the vocoded output is written
+ * to out[i].
+ * 
+ * The output is bit-exact with calling vc_process() once per sample, and the
+ * two can be freely mixed on the same vocoder. However, the block version
+ * keeps the filter state in locals across the block and loops over the bands
+ * on the outside, so it is much cheaper per sample.
+ */
+void vc_process_block(vocoder *v, const dsp_num *mod, const dsp_num *car, dsp_num *out, size_t n);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,241 @@
+#include "emulator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "app.h"
+#include "gpio.h"
+#include "audio_params.h"
+#include "buttons.h"
+#include "dsp/dsp_perf.h"
+#include "pru/pru_interface.h"
+#include "pru/pru_host_ring.h"
+#include "wav/wav.h"
+
+#include <firmware/firmware.h>
+
+static emulator_config emu_config;
+
+static volatile struct pru0_ds *emu_adc = NULL;
+
+static wav_io emu_modulator;
+
+static bool emu_recording = false;
+static wav_io emu_record;
+
+static gpio_pin emu_multiplex[4];
+
+/* ADC readings for each knob, by multiplexer index. */
+#define EMU_MAX_KNOBS 16
+static uint32_t emu_knobs[EMU_MAX_KNOBS];
+static int emu_knob_count = 0;
+
+/* The sample period at which to stop the app, or 0. */
+static uint64_t emu_stop_period = 0;
+
+void
+emulator_config_default(emulator_config *config) {
+	config->modulator_path = "modulator.wav";
+	config->record_path = NULL;
+	config->seconds = 0;
+
+	config->notes[0] = 0;
+	config->notes[1] = 7;
+	config->notes[2] = 12;
+	config->note_count = 3;
+}
+
+static void
+emu_parse_notes(emulator_config *config, const char *list) {
+	config->note_count = 0;
+	while(*list) {
+		char *end;
+		const long note = strtol(list, &end, 10);
+		if(end == list || config->note_count >= EMULATOR_MAX_NOTES) {
+			app_fatal_error("notes= takes a comma separated list of notes");
+		}
+		config->notes[config->note_count++] = (int)note;
+
+		list = end;
+		if(*list == ',') ++list;
+	}
+}
+
+int
+emulator_parse_args(emulator_config *config, int argc, char **argv, int first) {
+	int kept = first;
+	for(int i = first; i < argc; ++i) {
+		const char *arg = argv[i];
+		if(!strncmp(arg, "modulator=", 10)) {
+			config->modulator_path = arg + 10;
+		}
+		else if(!strncmp(arg, "record=", 7)) {
+			config->record_path = arg + 7;
+		}
+		else if(!strncmp(arg, "seconds=", 8)) {
+			config->seconds = atoi(arg + 8);
+			if(config->seconds < 0) {
+				app_fatal_error("seconds= must not be negative");
+			}
+		}
+		else if(!strncmp(arg, "notes=", 6)) {
+			emu_parse_notes(config, arg + 6);
+		}
+		else {
+			argv[kept++] = argv[i];
+		}
+	}
+	return kept;
+}
+
+void
+emulator_print_help(void) {
+	puts("emulated hardware options:\n"
+		"  modulator=<wav>: the microphone input, looped (default modulator.wav)\n"
+		"  record=<wav>: save what the emulated PRU plays\n"
+		"  seconds=N: stop after N seconds (default: run until interrupted)\n"
+		"  notes=N,N,...: the notes whose buttons are held down (default 0,7,12)");
+}
+
+void
+emulator_configure(const emulator_config *config) {
+	emu_config = *config;
+}
+
+/* The PRU plays samples bit reversed, so undo that for the recording. */
+static uint32_t
+emu_bit_reverse(uint32_t u) {
+	uint32_t r = 0;
+	for(int i = 0; i < 32; ++i) {
+		r = (r << 1) | (u & 1);
+		u >>= 1;
+	}
+	return r;
+}
+
+/* Called by the PRU 1 stand-in every sample period. This is PRU 0's side of
+ * things, which PRU 1 then reads channel 0 from, as i2sv1.pru1.c does. */
+static uint32_t
+emu_input(uint64_t n) {
+	/* Channel 1 is whichever knob the multiplexer pins select. The reset flag
+	 * is looked at first: the pins are switched before it is set, so a sample
+	 * taken after seeing it is of the new knob, and only then is it cleared,
+	 * as adc.pru0.c does. */
+	const bool reset = emu_adc->sample_reset[1];
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	int knob = 0;
+	for(int bit = 0; bit < 4; ++bit) {
+		knob |= gpio_read(emu_multiplex[bit]) << bit;
+	}
+	emu_adc->samples[1] = (knob < emu_knob_count) ? emu_knobs[knob] : 0;
+	if(reset) {
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		emu_adc->sample_reset[1] = 0;
+	}
+
+	/* Channel 0 is the microphone, reading the modulator */
+	const uint64_t frame = n % emu_modulator.frames;
+	const dsp_num m = emu_modulator.buffer[frame * emu_modulator.channels];
+	int32_t reading = PRU_AUDIO_IN_CENTER + m / PRU_AUDIO_IN_GAIN;
+	if(reading < 0) reading = 0;
+	if(reading > 2 * PRU_AUDIO_IN_CENTER - 1) reading = 2 * PRU_AUDIO_IN_CENTER - 1;
+	emu_adc->samples[0] = (uint32_t)reading;
+
+	emu_adc->heartbeat += 1;
+	return emu_adc->samples[0];
+}
+
+static void
+emu_output(uint64_t n, uint32_t sample) {
+	if(emu_recording && n < emu_record.frames) {
+		emu_record.buffer[n] = (dsp_num)emu_bit_reverse(sample);
+	}
+
+	if(emu_stop_period && n + 1 == emu_stop_period) {
+		app_graceful_exit();
+	}
+}
+
+/* Holds down the buttons for the configured notes, by setting their bits in
+ * the (emulated) GPIO input registers. */
+static void
+emu_press_notes(void) {
+	for(int i = 0; i < emu_config.note_count; ++i) {
+		int which = 0;
+		while(which < BUTTON_COUNT && button_note(which) != emu_config.notes[i]) {
+			++which;
+		}
+		if(which == BUTTON_COUNT) {
+			printf("no button plays note %d\n", emu_config.notes[i]);
+			app_fatal_error("bad emulated note");
+		}
+
+		gpio_write(gpio_open(button_pin_number(which), true), 1);
+	}
+}
+
+void
+emulator_start_prus(struct pru0_ds *adc, struct pru1_ds *audio) {
+	wav_read_or_die(&emu_modulator, emu_config.modulator_path);
+	if(emu_modulator.frames == 0) {
+		app_fatal_error("the modulator WAV file is empty");
+	}
+	if(emu_modulator.sample_rate != SAMPLE_RATE) {
+		printf("WARNING: modulator sample rate does not match the PRU (%d vs %d)\n",
+			emu_modulator.sample_rate, SAMPLE_RATE);
+	}
+
+	const int record_seconds = emu_config.seconds ? emu_config.seconds : EMULATOR_MAX_RECORD_SECONDS;
+	emu_recording = emu_config.record_path != NULL;
+	if(emu_recording) {
+		wav_blank_or_die(&emu_record, (uint64_t)record_seconds * SAMPLE_RATE, 1, SAMPLE_RATE);
+	}
+	emu_stop_period = (uint64_t)emu_config.seconds * SAMPLE_RATE;
+
+	/* The knobs are left where the defaults are */
+	audio_params defaults;
+	audio_params_default(&defaults);
+	emu_knob_count = audio_params_knob_count();
+	if(emu_knob_count > EMU_MAX_KNOBS) emu_knob_count = EMU_MAX_KNOBS;
+	for(int i = 0; i < emu_knob_count; ++i) {
+		emu_knobs[i] = audio_params_knob_reading(i, &defaults);
+	}
+
+	emu_multiplex[0] = gpio_open(MULTIPLEX_PIN_0, false);
+	emu_multiplex[1] = gpio_open(MULTIPLEX_PIN_1, false);
+	emu_multiplex[2] = gpio_open(MULTIPLEX_PIN_2, false);
+	emu_multiplex[3] = gpio_open(MULTIPLEX_PIN_3, false);
+
+	emu_press_notes();
+
+	/* PRU 0 first, as PRU 1 reads from it. Same as the start of adc.pru0.c */
+	emu_adc = adc;
+	memset(adc, 0, sizeof(*adc));
+	adc->magic = PRU0_MAGIC_NUMBER;
+
+	pru_host_ring_set_hooks(emu_input, emu_output);
+	pru_host_ring_run(audio);
+}
+
+void
+emulator_stop_prus(void) {
+	pru_host_ring_stop();
+	pru_host_ring_set_hooks(NULL, NULL);
+
+	const uint64_t periods = pru_host_ring_periods();
+	printf("emulated PRU: %llu sample periods, %llu with no output sample (start-up included)\n",
+		(unsigned long long)periods,
+		(unsigned long long)pru_host_ring_starved_periods());
+
+	if(emu_recording) {
+		if(periods < emu_record.frames) {
+			emu_record.frames = periods;
+		}
+		wav_write_or_warn(&emu_record, emu_config.record_path);
+		free(emu_record.buffer);
+		emu_recording = false;
+	}
+
+	free(emu_modulator.buffer);
+}
@@ -0,0 +1,79 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include "types.h"
+
+/* emulator.h: emulated PRUs, knobs and buttons, so that the whole app (-app and
+ * -synth) can run, and be timed, on a Linux machine without a BeagleBone.
+ *
+ * hardware_init_emulated() backs every memory mapping with ordinary memory, so
+ * the GPIO code and pru_interface.c run unchanged on top of it. In there:
+ *
+ * - PRU 1 is the host stand-in from pru_host_ring.h, playing one output sample
+ *   and recording one input sample every 1 / SAMPLE_RATE seconds.
+ * - PRU 0 gives it the modulator, a WAV file (looped) converted to ADC units,
+ *   and puts whichever knob the multiplexer pins select on channel 1. The knobs
+ *   sit at the audio_params_default() values.
+ * - The buttons for the given notes are held down (their GPIO input bits are
+ *   set) the whole time. */
+
+#define EMULATOR_MAX_NOTES 24
+
+/* The longest recording kept when no time limit is given. */
+#define EMULATOR_MAX_RECORD_SECONDS 60
+
+typedef struct {
+	/* Played into the modulator input, looped. */
+	const char *modulator_path;
+
+	/* Where to write what the emulated PRU played, or NULL for nowhere. */
+	const char *record_path;
+
+	/* Stop the app after this many seconds of audio, or 0 to run until it is
+	 * interrupted. */
+	int seconds;
+
+	/* The notes whose buttons are held down. */
+	int notes[EMULATOR_MAX_NOTES];
+	int note_count;
+} emulator_config;
+
+/**
+ * The defaults: modulator.wav, no recording, no time limit, and a chord of
+ * notes 0, 7 and 12 held down.
+ */
+void emulator_config_default(emulator_config *config);
+
+/**
+ * Takes the emulator options (modulator=<wav> record=<wav> seconds=N
+ * notes=N,N,...) out of argv[first..argc), closing up the gaps, so that the
+ * rest can go to the app. Returns the new argc. Malformed options are a fatal
+ * error.
+ */
+int emulator_parse_args(emulator_config *config, int argc, char **argv, int first);
+
+void emulator_print_help(void);
+
+/**
+ * Keeps a copy of the config for emulator_start_prus(). Called by
+ * hardware_init_emulated().
+ */
+void emulator_configure(const emulator_config *config);
+
+struct pru0_ds;
+struct pru1_ds;
+
+/**
+ * Sets up adc and audio the way the firmware would, and starts the emulated
+ * PRUs on them. Called by pru_init() in place of installing the firmware, once
+ * the GPIO subsystem is up.
+ */
+void emulator_start_prus(struct pru0_ds *adc, struct pru1_ds *audio);
+
+/**
+ * Stops the emulated PRUs, and writes the recording if one was asked for.
+ * Called by pru_shutdown().
+ */
+void emulator_stop_prus(void);
+
+#endif
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
@@ -13,6 +14,9 @@
 
 static int dev_mem_fd = -1;
 
+/* Whether the mappings are plain memory instead of /dev/mem. */
+static bool emulated = false;
+
 #define MAX_MAPPINGS 16
 
 typedef struct {
@@ -41,6 +45,16 @@ mmap_init() {
 	}
 }
 
+/* Sets up the mappings without /dev/mem, for hardware_init_emulated(). */
+static void
+mmap_init_emulated() {
+	for(int i = 0; i < MAX_MAPPINGS; ++i) {
+		mappings[i].ptr = NULL;
+		mappings[i].key = 0;
+		mappings[i].map_length = 0;
+	}
+}
+
 static void
 mmap_shutdown() {
 	/* Strictly speaking, we can just let the operating system clean up the
@@ -48,7 +62,12 @@ mmap_shutdown() {
 	 * in theory support functionality for e.g. restarting the app or something. */
 	for(int i = 0; i < MAX_MAPPINGS; ++i) {
 		if(mappings[i].ptr) {
-			munmap(mappings[i].ptr, mappings[i].map_length);
+			if(emulated) {
+				free(mappings[i].ptr);
+			}
+			else {
+				munmap(mappings[i].ptr, mappings[i].map_length);
+			}
 			mappings[i].ptr = NULL;
 			mappings[i].key = 0;
 			mappings[i].map_length = 0;
@@ -72,11 +91,21 @@ mmap_get_mapping(uintptr_t key, size_t size) {
 	app_fatal_error("too many memory mappings.");
 
 mmap_the_region:;
-	void *ptr = mmap(NULL, size, 
-		PROT_READ | PROT_WRITE, /* Need to read and write. */
-		MAP_SHARED,             /* We want all our changes to /dev/mem to be visible. */
-		dev_mem_fd,             /* Write to /dev/mem, so that we can write to specific memory addresses. */
-		(off_t)key);
+	void *ptr = NULL;
+	if(emulated) {
+		/* Page aligned and zeroed, like the registers after a reset (more
+		 * or less) */
+		const size_t length = (size + 4095) & ~(size_t)4095;
+		ptr = aligned_alloc(4096, length);
+		if(ptr) memset(ptr, 0, length);
+	}
+	else {
+		ptr = mmap(NULL, size, 
+			PROT_READ | PROT_WRITE, /* Need to read and write. */
+			MAP_SHARED,             /* We want all our changes to /dev/mem to be visible. */
+			dev_mem_fd,             /* Write to /dev/mem, so that we can write to specific memory addresses. */
+			(off_t)key);
+	}
 
 	if(ptr != NULL) {
 		mappings[stored_idx].ptr = ptr;
@@ -112,6 +141,22 @@ hardware_init() {
 	pru_init();
 }
 
+void
+hardware_init_emulated(const emulator_config *config) {
+	emulated = true;
+	emulator_configure(config);
+	mmap_init_emulated();
+
+	/* Exactly as on hardware, from here on */
+	gpio_init();
+	pru_init();
+}
+
+bool
+hardware_is_emulated() {
+	return emulated;
+}
+
 void
 hardware_shutdown() {
 	pru_shutdown();
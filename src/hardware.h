@@ -2,6 +2,7 @@
 #define MMAP_H
 
 #include "types.h"
+#include "emulator.h"
 
 /**
  * Gets a memory address corresponding to the physical memory address "key," with
@@ -36,6 +37,20 @@ int sysfs_write_string(const char *filepath, const char *string);
  */
 void hardware_init();
 
+/**
+ * Like hardware_init(), but for running off the BeagleBone: every mapping is
+ * ordinary memory instead of /dev/mem, and the PRUs are emulated (see
+ * emulator.h) in the memory that stands in for theirs. Everything else, from
+ * the GPIO code to pru_interface.c, runs exactly as it does on hardware.
+ * hardware_shutdown() cleans up the same way.
+ */
+void hardware_init_emulated(const emulator_config *config);
+
+/**
+ * Returns true after hardware_init_emulated().
+ */
+bool hardware_is_emulated();
+
 /**
  * Cleans up hardware resources, including any memory mappings, and stops the
  * PRUs. Does not write to any GPIO pins, so that will have to be done separately
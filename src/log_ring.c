@@ -0,0 +1,201 @@
+#include "log_ring.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "app.h"
+#include "telemetry.h"
+#include "dsp/dsp.h"
+
+/* How long the writer thread sleeps when the ring is empty. */
+#define LOG_POLL_MS 10
+
+/* The nice value of the writer thread. */
+#define LOG_THREAD_NICE 10
+
+/* One ring per producer thread. The indices are free-running; head is only
+ * written by the producer, tail only by the writer thread, and each sits on its
+ * own cache line. */
+typedef struct {
+	log_record ring[LOG_RING_SIZE];
+	_Alignas(64) atomic_uint head;
+	_Alignas(64) atomic_uint tail;
+} log_channel;
+
+static log_channel channels[LOG_RING_CHANNELS];
+
+static _Alignas(64) atomic_uint dropped;
+
+/* The channel the current thread produces into. */
+static _Thread_local int this_channel = LOG_CHANNEL_DSP;
+
+static FILE *log_out = NULL;
+static pthread_t log_thread;
+static atomic_bool log_running = false;
+
+static void
+log_format(const log_record *r, FILE *out) {
+	fprintf(out, "[%10.6f] ", r->time_ns * 1e-9);
+
+	switch((log_kind)r->kind) {
+	case LOG_BUTTON_PRESSED:
+		fprintf(out, "Button %d pressed\n", r->args[0]);
+		break;
+	case LOG_BUTTON_RELEASED:
+		fprintf(out, "Button %d released\n", r->args[0]);
+		break;
+	case LOG_ACTIVE_NOTES:
+	case LOG_ACTIVE_NOTES_MORE:
+		fprintf(out, r->kind == LOG_ACTIVE_NOTES ? "active notes: " : "active notes (cont.): ");
+		for(int i = 0; i < r->count; ++i) {
+			fprintf(out, "%d (on voice %d) ", r->args[i] & 0xffff, r->args[i] >> 16);
+		}
+		fputc('\n', out);
+		break;
+	case LOG_AUDIO_PARAM:
+		fprintf(out, "audio params: [%02d | %02d]: read ADC value %d => param value %f\n",
+			r->args[0], r->args[1], r->args[2], dsp_to_float(r->args[3]));
+		break;
+	case LOG_TELEMETRY:
+		fprintf(out, "telemetry: %d blocks, %d deadline misses, %d underruns, "
+			"work mean %d ns max %d ns, wait max read %d ns write %d ns\n",
+			r->args[0], r->args[1], r->args[2], r->args[3], r->args[4], r->args[5], r->args[6]);
+		break;
+	default:
+		fprintf(out, "unknown log record %d\n", r->kind);
+		break;
+	}
+}
+
+/* Writes out every published record, oldest first across the channels. Returns
+ * whether there were any. */
+static bool
+log_drain(FILE *out) {
+	uint32_t t[LOG_RING_CHANNELS];
+	uint32_t h[LOG_RING_CHANNELS];
+	bool any = false;
+	for(int c = 0; c < LOG_RING_CHANNELS; ++c) {
+		t[c] = atomic_load_explicit(&channels[c].tail, memory_order_relaxed);
+		h[c] = atomic_load_explicit(&channels[c].head, memory_order_acquire);
+		any = any || (t[c] != h[c]);
+	}
+	if(!any) return false;
+
+	for(;;) {
+		const log_record *next = NULL;
+		int next_c = 0;
+		for(int c = 0; c < LOG_RING_CHANNELS; ++c) {
+			if(t[c] == h[c]) continue;
+
+			const log_record *r = &channels[c].ring[t[c] & (LOG_RING_SIZE - 1)];
+			if(!next || r->time_ns < next->time_ns) {
+				next = r;
+				next_c = c;
+			}
+		}
+		if(!next) break;
+
+		log_format(next, out);
+		t[next_c] += 1;
+	}
+
+	for(int c = 0; c < LOG_RING_CHANNELS; ++c) {
+		atomic_store_explicit(&channels[c].tail, t[c], memory_order_release);
+	}
+
+	const uint32_t lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+	if(lost) {
+		fprintf(out, "log: dropped %u records\n", lost);
+	}
+
+	fflush(out);
+	return true;
+}
+
+static void*
+log_thread_main(void *arg) {
+	(void)arg;
+
+	/* On Linux, this only applies to the calling thread. */
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), LOG_THREAD_NICE);
+
+	while(atomic_load(&log_running)) {
+		if(!log_drain(log_out)) {
+			usleep(LOG_POLL_MS * 1000);
+		}
+	}
+	log_drain(log_out);
+
+	return NULL;
+}
+
+void
+log_ring_start(FILE *out) {
+	if(atomic_load(&log_running)) return;
+
+	log_out = out;
+	atomic_store(&log_running, true);
+	if(pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0) {
+		app_fatal_error("could not start the log thread");
+	}
+}
+
+void
+log_ring_stop(void) {
+	if(!atomic_load(&log_running)) return;
+
+	atomic_store(&log_running, false);
+	pthread_join(log_thread, NULL);
+}
+
+void
+log_ring_set_channel(int channel) {
+	this_channel = channel;
+}
+
+log_record*
+log_ring_begin(log_kind kind) {
+	log_channel *ch = &channels[this_channel];
+	const uint32_t h = atomic_load_explicit(&ch->head, memory_order_relaxed);
+	const uint32_t t = atomic_load_explicit(&ch->tail, memory_order_acquire);
+	if(h - t >= LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	log_record *r = &ch->ring[h & (LOG_RING_SIZE - 1)];
+	r->time_ns = telemetry_now_ns();
+	r->kind = kind;
+	r->count = 0;
+	return r;
+}
+
+void
+log_ring_commit(log_record *r) {
+	log_channel *ch = &channels[this_channel];
+	const uint32_t h = atomic_load_explicit(&ch->head, memory_order_relaxed);
+	atomic_store_explicit(&ch->head, h + 1, memory_order_release);
+
+	/* With no writer thread, write it out right away. */
+	if(!atomic_load_explicit(&log_running, memory_order_relaxed)) {
+		log_drain(stdout);
+	}
+	(void)r;
+}
+
+void
+log_ring_post(log_kind kind, int count, int32_t a, int32_t b, int32_t c, int32_t d) {
+	log_record *r = log_ring_begin(kind);
+	if(!r) return;
+
+	r->count = count;
+	r->args[0] = a;
+	r->args[1] = b;
+	r->args[2] = c;
+	r->args[3] = d;
+	log_ring_commit(r);
+}
@@ -0,0 +1,88 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* log_ring.h: logging for the real-time loop. The loop only copies a small
+ * binary record into a lock-free single-producer ring; a separate, low priority
+ * thread turns the records into text and writes them out. That way printing to
+ * a slow terminal or ssh session can never hold up the audio.
+ *
+ * Each thread that logs gets its own ring (a channel), so that every ring keeps
+ * a single producer. */
+
+/* Must be a power of two. */
+#define LOG_RING_SIZE 1024
+
+#define LOG_RECORD_ARGS 13
+
+/* The channels. Threads log to LOG_CHANNEL_DSP unless they call
+ * log_ring_set_channel(). */
+#define LOG_CHANNEL_DSP     0
+#define LOG_CHANNEL_CONTROL 1
+#define LOG_RING_CHANNELS   2
+
+typedef enum {
+	/* args[0] = button pin number */
+	LOG_BUTTON_PRESSED,
+	LOG_BUTTON_RELEASED,
+
+	/* count pairs of (voice << 16) | note in args, for each active voice.
+	 * More voices than LOG_RECORD_ARGS carry on in LOG_ACTIVE_NOTES_MORE
+	 * records, which follow straight after. */
+	LOG_ACTIVE_NOTES,
+	LOG_ACTIVE_NOTES_MORE,
+
+	/* args = multiplexer index, param offset, ADC value, param value (dsp_num) */
+	LOG_AUDIO_PARAM,
+
+	/* args = blocks, deadline misses, underruns, mean work ns, max work ns,
+	 * max read wait ns, max write wait ns, since the loop started */
+	LOG_TELEMETRY,
+} log_kind;
+
+/* 64 bytes, so records never share a cache line. */
+typedef struct {
+	uint64_t time_ns;
+	uint16_t kind;
+	uint16_t count;
+	int32_t args[LOG_RECORD_ARGS];
+} log_record;
+
+/**
+ * Starts the thread that writes records out to the given file. Until this is
+ * called (and after log_ring_stop()), records are printed as soon as they are
+ * committed, so code that logs still works outside of the real-time loop.
+ */
+void log_ring_start(FILE *out);
+
+/**
+ * Writes out whatever is left in the ring, then stops the thread.
+ */
+void log_ring_stop(void);
+
+/**
+ * Sets the channel that the calling thread logs to. No two threads may log to
+ * the same channel at the same time.
+ */
+void log_ring_set_channel(int channel);
+
+/**
+ * Reserves the next record in the calling thread's ring. Returns NULL (and
+ * counts the record as dropped) if the ring is full; the producer never waits.
+ */
+log_record *log_ring_begin(log_kind kind);
+
+/**
+ * Publishes a record returned by log_ring_begin(), with its count set.
+ */
+void log_ring_commit(log_record *r);
+
+/**
+ * Logs a record with up to four arguments.
+ */
+void log_ring_post(log_kind kind, int count, int32_t a, int32_t b, int32_t c, int32_t d);
+
+#endif
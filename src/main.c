@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
 
 #include <sched.h>
 
@@ -14,20 +16,175 @@
 
 #include "pru/pru_interface.h"
 
+#include "audio_backend.h"
 #include "buttons.h"
+#include "control.h"
+#include "rt_setup.h"
+#include "telemetry.h"
+#include "log_ring.h"
+
+#include <firmware/firmware.h>
+
+/* How often the active notes are logged, in samples. */
+#define SYNTH_DEBUG_RATE 512
+
+/* The number of samples gathered before running them through the vocoder with
+ * vc_process_block, unless overridden with block=N. Each block adds its own
+ * length of latency (16 samples is about 0.36ms at 44.1kHz), but means the
+ * per-call overhead of the controls, the vocoder and the audio I/O is only paid
+ * once per block. */
+#define APP_BLOCK_SIZE 16
+#define APP_MAX_BLOCK_SIZE 256
+
+/* How much audio app_measure_block() times, in seconds. */
+#define APP_MEASURE_SECONDS 1
+
+/* How often the loop telemetry is logged, in seconds, unless overridden with
+ * telemetry=N. The full histograms are always printed on exit. */
+#define APP_TELEMETRY_PERIOD 10
+
+/* Logs the notes the synth is playing, without printing from the loop. A
+ * record only has room for LOG_RECORD_ARGS of the MAX_SYNTH_VOICES, so the rest
+ * go in LOG_ACTIVE_NOTES_MORE records. */
+static void
+app_log_active_notes(synth *syn) {
+	int32_t notes[MAX_SYNTH_VOICES];
+	int32_t voices[MAX_SYNTH_VOICES];
+	const int count = synth_get_active_notes(syn, notes, voices, MAX_SYNTH_VOICES);
+
+	int i = 0;
+	do {
+		log_record *r = log_ring_begin(i == 0 ? LOG_ACTIVE_NOTES : LOG_ACTIVE_NOTES_MORE);
+		if(!r) return;
+
+		r->count = 0;
+		for(; i < count && r->count < LOG_RECORD_ARGS; ++i) {
+			r->args[r->count++] = (voices[i] << 16) | notes[i];
+		}
+		log_ring_commit(r);
+	} while(i < count);
+}
+
+/* Times the DSP for one block, before the loop starts, on a scratch vocoder and
+ * synth with every voice playing. Returns the mean in nanoseconds. */
+static uint64_t
+app_measure_block(const vocoder_config *voc_config, synth_oscillator oscillator, int block_size) {
+	static vocoder voc;
+	vc_init_config(&voc, voc_config);
+
+	synth syn;
+	synth_init_oscillator(&syn, oscillator);
+	synth_set_kernel(&syn, voc_config->kernel);
+	for(int i = 0; i < MAX_SYNTH_VOICES; ++i) {
+		synth_press(&syn, (i * 7) % NUMBER_OF_NOTES);
+	}
+
+	audio_params params;
+	audio_params_default(&params);
+
+	dsp_num mod_block[APP_MAX_BLOCK_SIZE];
+	dsp_num car_block[APP_MAX_BLOCK_SIZE];
+	dsp_num out_block[APP_MAX_BLOCK_SIZE];
 
-#define AUDIO_PARAM_TICK_RATE 183
-#define BUTTON_READ_RATE (735 / (BUTTON_COUNT * BUTTON_DEBOUNCE))
+	/* Something for the envelopes to follow */
+	uint32_t noise = 1;
+
+	const int blocks = APP_MEASURE_SECONDS * SAMPLE_RATE / block_size;
+	const uint64_t start_ns = telemetry_now_ns();
+	for(int b = 0; b < blocks; ++b) {
+		for(int k = 0; k < block_size; ++k) {
+			noise = noise * 1664525u + 1013904223u;
+			mod_block[k] = (dsp_num)noise >> 4;
+			car_block[k] = synth_process(&syn, &params);
+		}
+		vc_process_block(&voc, mod_block, car_block, out_block, block_size);
+	}
+	return (telemetry_now_ns() - start_ns) / blocks;
+}
 
 int
 main_app(int argc, char **argv, bool just_synth) {
 	int delay_length = 0;
+	int first_option = 2;
+
+	int telemetry_period = APP_TELEMETRY_PERIOD;
+
+	const char *log_path = NULL;
+
+	pru_wait_policy wait_policy = PRU_WAIT_HYBRID;
+	bool wait_given = false;
+
+	const char *backend_spec = "pru";
+
+	int block_size = APP_BLOCK_SIZE;
+
+	rt_config rt;
+	rt_config_default(&rt);
 
-	if(argc >= 3) {
+	synth_oscillator oscillator = SYNTH_OSC_SINC;
+
+	/* Usage: -app [delay length] [telemetry=N] [log=<file>] [wait=spin|yield|hybrid|sleep]
+	 *             [audio=<backend>] [block=N] [sched=other|fifo|rr] [prio=N] [cpu=N]
+	 *             [mlock=on|off] [osc=sinc|polyblep|wavetable] [vocoder options...] */
+	if(argc >= 3 && (isdigit((unsigned char)argv[2][0]) || argv[2][0] == '-')) {
 		delay_length = atoi(argv[2]);
 		if(delay_length < 0) {
 			app_fatal_error("must provide positive delay length (or none)");
 		}
+		first_option = 3;
+	}
+
+	vocoder_config voc_config;
+	vc_config_default(&voc_config);
+	for(int i = first_option; i < argc; ++i) {
+		if(!strncmp(argv[i], "telemetry=", 10)) {
+			telemetry_period = atoi(argv[i] + 10);
+			continue;
+		}
+		if(!strncmp(argv[i], "log=", 4)) {
+			log_path = argv[i] + 4;
+			continue;
+		}
+		if(!strncmp(argv[i], "wait=", 5) && pru_wait_policy_parse(argv[i] + 5, &wait_policy)) {
+			wait_given = true;
+			continue;
+		}
+		if(!strncmp(argv[i], "audio=", 6)) {
+			backend_spec = argv[i] + 6;
+			continue;
+		}
+		if(!strncmp(argv[i], "block=", 6)) {
+			block_size = atoi(argv[i] + 6);
+			if(block_size < 1 || block_size > APP_MAX_BLOCK_SIZE) {
+				app_fatal_error("block= must be between 1 and 256 samples");
+			}
+			continue;
+		}
+		if(rt_config_parse(&rt, argv[i])) {
+			continue;
+		}
+		if(!strncmp(argv[i], "osc=", 4) && synth_oscillator_parse(argv[i] + 4, &oscillator)) {
+			continue;
+		}
+		if(!vc_config_parse(&voc_config, argv[i])) {
+			printf("error: unknown option %s\n", argv[i]);
+			puts("telemetry=N: log the loop telemetry every N seconds (0 = only print it on exit)");
+			puts("log=<file>: write the log to a file instead of stdout");
+			puts("wait=spin|yield|hybrid|sleep: how to wait for the PRU (default hybrid: sleep, then spin)");
+			audio_backend_print_help();
+			puts("block=N: samples per loop iteration, 1 to 256 (default 16): more costs latency, fewer costs CPU");
+			rt_config_print_help();
+			puts("osc=sinc|polyblep|wavetable: the synth's oscillator (default sinc; the others are cheaper and alias less, the wavetable most of all, see -oscalias)");
+			vc_config_print_help();
+			return 1;
+		}
+	}
+
+	/* Open the backend before printing anything, as the pcm backend needs
+	 * stdout to itself */
+	static audio_backend audio;
+	if(!audio_backend_open(&audio, backend_spec)) {
+		return 1;
 	}
 
 	/* utsname */
@@ -41,13 +198,48 @@ main_app(int argc, char **argv, bool just_synth) {
 	 * stuttering in the output signal for some reason.
 	 * 
 	 * Using the non-real time scheduler reuslts in a perfectly fine signal,
-	 * as can be seen if running -synth. */
+	 * as can be seen if running -synth. So that stays the default, and
+	 * sched=fifo|rr is opt-in. A real-time thread that spins never lets the
+	 * rest of its core run, so it gets a wait policy that only sleeps. */
+	if(rt_config_is_realtime(&rt)) {
+		if(!wait_given) {
+			wait_policy = PRU_WAIT_SLEEP;
+		}
+		else if(wait_policy != PRU_WAIT_SLEEP) {
+			printf("WARNING: wait=%s spins, which at real-time priority starves everything else on the core\n",
+				pru_wait_policy_name(wait_policy));
+		}
+	}
+
+	/* Count the faults and context switches of setting up separately from
+	 * those of the loop, which should have none of the former. */
+	rt_usage usage_start;
+	rt_usage_take(&usage_start);
+
+	/* Lock memory before the big allocations, so they are locked as they are
+	 * mapped */
+	rt_setup_memory(&rt);
 
 	vocoder voc;
-	vc_init(&voc); /* vocoder */
+	vc_init_config(&voc, &voc_config); /* vocoder */
+	printf("vocoder latency: %d samples\n", vc_latency(&voc) + block_size);
+
+	/* Say what the block size costs, so that it can be picked per board: the
+	 * smallest block whose DSP fits comfortably inside its deadline. */
+	const uint64_t deadline_ns = (uint64_t)block_size * 1000000000u / SAMPLE_RATE;
+	const uint64_t block_ns = app_measure_block(&voc_config, oscillator, block_size);
+	printf("block: %d samples, adding %.2f ms of latency; DSP takes %.1f us of its %.1f us deadline (%.0f%%)\n",
+		block_size, block_size * 1000.0 / SAMPLE_RATE, block_ns / 1000.0, deadline_ns / 1000.0,
+		100.0 * block_ns / deadline_ns);
 
 	synth syn;
-	synth_init(&syn); /* synth */
+	synth_init_oscillator(&syn, oscillator); /* synth */
+	synth_set_kernel(&syn, voc_config.kernel);
+	printf("synth: %d voices, %s kernel\n", MAX_SYNTH_VOICES, bpf_kernel_name(syn.kernel));
+	if(oscillator == SYNTH_OSC_WAVETABLE) {
+		printf("synth wavetables: %d octaves of %d samples, %zu bytes\n",
+			SYNTH_WAVETABLE_OCTAVES, SYNTH_WAVETABLE_SIZE, synth_wavetable_bytes());
+	}
 
 	audio_params params;
 	audio_params_default(&params);
@@ -58,16 +250,16 @@ main_app(int argc, char **argv, bool just_synth) {
 	/* Also using the buttons */
 	init_button_arr();
 
-	/* These should be called as close as possible to when we start the loop */
-	pru_audio_prepare_writing();
-	pru_audio_prepare_reading();
+	/* The buttons and knobs are scanned on their own thread, so that none of
+	 * that counts against the audio deadline. This thread only does the DSP.
+	 * A backend that isn't real time runs ahead of that thread's clock,
+	 * though, so then this thread scans them too, counting samples. */
+	static control ctl;
+	control_init(&ctl, &params, true);
+	const bool realtime = audio_backend_realtime(&audio);
 
-	int audio_param_tick = 0;
-	int button_tick_count = 0;
 	int synth_debug_tick = 0;
 
-	int button_inner_loop_count = 0;
-
 	dsp_num *delay = NULL;
 	int delay_write = delay_length - 1;
 	int delay_read = 0;
@@ -76,65 +268,149 @@ main_app(int argc, char **argv, bool just_synth) {
 		if(!delay) {
 			app_fatal_error("could not allocate delay buffer");
 		}
+		rt_prefault(delay, delay_length * sizeof(*delay));
+	}
+
+	dsp_num mod_block[APP_MAX_BLOCK_SIZE];
+	dsp_num car_block[APP_MAX_BLOCK_SIZE];
+	dsp_num out_block[APP_MAX_BLOCK_SIZE];
+
+	telemetry tel;
+	telemetry_init(&tel, block_size, AUDIO_OUT_RINGBUF_SIZE);
+	uint64_t next_dump_ns = tel.start_ns + telemetry_period * 1000000000ull;
+
+	/* Everything the loop prints goes through the log ring, so that a slow
+	 * terminal can't make it miss samples. */
+	FILE *log_file = stdout;
+	if(log_path) {
+		log_file = fopen(log_path, "w");
+		if(!log_file) {
+			app_fatal_error("could not open log file");
+		}
+	}
+	log_ring_start(log_file);
+
+	if(realtime) {
+		control_start(&ctl);
 	}
 
+	/* Only this thread gets the real-time policy and the pinning, so it is
+	 * done after the control and log threads are started */
+	rt_setup_thread(&rt);
+	if(rt.lock_memory) {
+		rt_prefault_stack();
+	}
+
+	pru_audio_set_wait_policy(wait_policy);
+
+	/* This should be called as close as possible to when we start the loop */
+	audio_backend_start(&audio);
+	printf("audio backend: %s, output latency %u samples\n",
+		audio_backend_name(audio.kind), audio_backend_latency(&audio));
+
+	printf("wait policy: %s\n", pru_wait_policy_name(wait_policy));
+
+	rt_usage usage_loop;
+	rt_usage_take(&usage_loop);
+	rt_usage_print("start-up", &usage_start, &usage_loop);
+
+	/* Don't count anything from before the loop */
+	audio_backend_stats stats;
+	audio_backend_take_stats(&audio, &stats);
+
 	while(app_running) {
-		/* Update button and audio params before the main DSP code to slightly
-		 * reduce latency */
-		button_tick_count += 1;
-		if(button_tick_count >= BUTTON_READ_RATE) {
-			button_tick_count = 0;
-			button_tick(&syn, button_inner_loop_count, true);
+		const uint64_t block_start_ns = telemetry_now_ns();
+		const uint32_t in_fill = audio_backend_input_pending(&audio);
 
-			button_inner_loop_count += 1;
-			if(button_inner_loop_count >= BUTTON_COUNT) {
-				button_inner_loop_count = 0;
-			}			
+		/* Pick up note events and knob changes once per block */
+		if(realtime) {
+			control_apply(&ctl, &syn, &params);
 		}
-
-		audio_param_tick += 1;
-		if(audio_param_tick >= AUDIO_PARAM_TICK_RATE) {
-			audio_param_tick = 0;
-			audio_params_tick_multiplexer(&params, false);
+		else {
+			control_advance(&ctl, &syn, &params, block_size);
 		}
 
-		synth_debug_tick += 1;
-		if(synth_debug_tick >= 500) {
-			synth_print_active_notes(&syn);
+		synth_debug_tick += block_size;
+		if(synth_debug_tick >= SYNTH_DEBUG_RATE) {
+			app_log_active_notes(&syn);
 			synth_debug_tick = 0;
 		}
 
-		/* Read the modulator signal from the microphone */
-		uint32_t modulator = pru_audio_read();
+		/* Read the modulator signal from the microphone, a whole block at
+		 * once so that the wait policy can sleep through it */
+		const uint32_t got = audio_backend_read_block(&audio, mod_block, block_size);
+		if(got < (uint32_t)block_size) {
+			/* The input has ended. Finish the block with silence, and stop
+			 * after it. */
+			memset(mod_block + got, 0, (block_size - got) * sizeof(*mod_block));
+			app_graceful_exit();
+		}
 
 		/* Compute the carrier signal from the synthesizer */
-		dsp_num carrier = synth_process(&syn, &params);
+		for(int k = 0; k < block_size; ++k) {
+			car_block[k] = synth_process(&syn, &params);
+		}
 
 		/* The output signal is vocoded */
-		dsp_num out = vc_process(&voc, modulator, carrier);
+		vc_process_block(&voc, mod_block, car_block, out_block, block_size);
 
-		if(just_synth) {
-			/* Note: It's fine that we're wasting a bunch of time also
-			 * computing the vocoder. This makes it easy to figure out if
-			 * the vocoder is taking too long. (Just listen to the synth for
-			 * jank). */
-			out = carrier;
-		}
+		const uint32_t out_fill = audio_backend_latency(&audio);
+
+		for(int k = 0; k < block_size; ++k) {
+			dsp_num out = out_block[k];
 
-		/* Apply output gain then write to the PRU */
-		out = dsp_mul(out, params.output_gain);
+			if(just_synth) {
+				/* Note: It's fine that we're wasting a bunch of time also
+				 * computing the vocoder. This makes it easy to figure out if
+				 * the vocoder is taking too long. (Just listen to the synth for
+				 * jank). */
+				out = car_block[k];
+			}
 
-		if(delay_length > 0) {
-			delay[delay_write] = out;
-			delay_write = (delay_write + 1) % delay_length;
+			/* Apply output gain */
+			out = dsp_mul(out, params.output_gain);
 
-			pru_audio_write(delay[delay_read]);
-			delay_read = (delay_read + 1) % delay_length;
+			if(delay_length > 0) {
+				delay[delay_write] = out;
+				if(++delay_write == delay_length) delay_write = 0;
+
+				out = delay[delay_read];
+				if(++delay_read == delay_length) delay_read = 0;
+			}
+
+			out_block[k] = out;
 		}
-		else {
-			pru_audio_write(out);	
+
+		/* Then write the block out, as much of it as there was input for */
+		audio_backend_write_block(&audio, out_block, got);
+
+		const uint64_t block_end_ns = telemetry_now_ns();
+		audio_backend_take_stats(&audio, &stats);
+		telemetry_record_block(&tel, block_end_ns - block_start_ns,
+			stats.read_wait_ns, stats.write_wait_ns, in_fill, out_fill);
+		tel.underruns += stats.underruns;
+
+		if(telemetry_period > 0 && block_end_ns >= next_dump_ns) {
+			telemetry_post(&tel);
+			next_dump_ns += telemetry_period * 1000000000ull;
 		}
 	}
 
+	rt_usage usage_end;
+	rt_usage_take(&usage_end);
+
+	audio_backend_close(&audio);
+
+	control_stop(&ctl);
+	log_ring_stop();
+	if(log_file != stdout) {
+		fclose(log_file);
+	}
+
+	telemetry_dump(&tel, stdout);
+	rt_usage_print("loop", &usage_loop, &usage_end);
+
+	free(delay);
+
 	return 0;
 }
\ No newline at end of file
@@ -15,6 +15,12 @@
 extern int main_ov(int argc, char **argv);
 extern int main_os(int argc, char **argv);
 extern int main_ovs(int argc, char **argv);
+extern int main_qsnr(int argc, char **argv);
+extern int main_oscalias(int argc, char **argv);
+extern int main_bench(int argc, char **argv);
+extern int main_regress(int argc, char **argv);
+extern int main_rtt(int argc, char **argv);
+extern int main_prs(int argc, char **argv);
 
 extern int main_ppw(int argc, char **argv);
 extern int main_prw(int argc, char **argv);
@@ -36,6 +42,19 @@ do {\
  * initialization and shutdown. */
 #define HARDWARE_SUBAPP(app_name) HARDWARE_SUBAPP_ARGS(app_name, argc, argv)
 
+/* The same, but on emulated hardware (see emulator.h), after taking the
+ * emulator's options out of argv. */
+#define EMULATED_SUBAPP_ARGS(app_name, ...)\
+do {\
+	emulator_config emu_config;\
+	emulator_config_default(&emu_config);\
+	argc = emulator_parse_args(&emu_config, argc, argv, 2);\
+	hardware_init_emulated(&emu_config);\
+	int return_value = app_name(__VA_ARGS__);\
+	hardware_shutdown();\
+	return return_value;\
+} while(0)
+
 
 
 /**
@@ -50,8 +69,12 @@ main(int argc, char **argv) {
 		/* On hardware, running with 0 arguments just starts the main functionality. */
 		HARDWARE_SUBAPP_ARGS(main_app, argc, argv, false);
 #else
-		puts("not on hardware: you must specify -ov, -os, -ovs or -help");
-		return 1;
+		/* Off hardware, run it on emulated hardware instead. */
+		if(argc <= 1) {
+			puts("not on hardware: you must specify -ov, -os, -ovs, -app or -help");
+			return 1;
+		}
+		EMULATED_SUBAPP_ARGS(main_app, argc, argv, false);
 #endif
 	}
 
@@ -70,12 +93,58 @@ main(int argc, char **argv) {
 		return main_ovs(argc, argv);
 	}
 
+	/* Q15 filterbank SNR report */
+	if(!strcmp(argv[1], "-q15snr")) {
+		return main_qsnr(argc, argv);
+	}
+
+	/* Synth oscillator aliasing report */
+	if(!strcmp(argv[1], "-oscalias")) {
+		return main_oscalias(argc, argv);
+	}
+
+	/* DSP benchmarks */
+	if(!strcmp(argv[1], "-bench")) {
+		return main_bench(argc, argv);
+	}
+
+	/* Golden output regression tests */
+	if(!strcmp(argv[1], "-regress")) {
+		return main_regress(argc, argv);
+	}
+
+	/* Real-time loop telemetry against the host PRU stand-in */
+	if(!strcmp(argv[1], "-rtt")) {
+		return main_rtt(argc, argv);
+	}
+
+	/* Two thread stress test of the PRU ring protocol */
+	if(!strcmp(argv[1], "-ringstress")) {
+		return main_prs(argc, argv);
+	}
+
 	if(!strcmp(argv[1], "-help")) {
 		puts("possible options:\n"
 		"  -ov: 'offline vocode': run the vocoder on a modulator.wav and carrier.wav, producing an output.wav\n"
-		"  -os: 'offline synth': run the synthesizer and create an output.wav\n"
+		"  -os: 'offline synth': run the synthesizer and create an output.wav (osc=sinc|polyblep|wavetable after it)\n"
 		"  -ovs: 'offline vocoder synth': run the vocoder on a modulator.wav and the built-in synth, producing an output.wav\n"
+		"  -q15snr: compare the Q15 filterbank against the Q29 one on a modulator.wav and carrier.wav\n"
+		"  -oscalias: measure the aliasing and the cost of each synth oscillator (osc=sinc|polyblep|wavetable)\n"
+		"  -bench: time the DSP code (see 'make bench'); '-bench help' for options\n"
+		"  -regress: check the DSP output against the references in regress/ (see 'make regress')\n"
+		"  -rtt: 'real-time telemetry': run the audio loop against a stand-in for the PRU and print its timing\n"
+		"  -ringstress: stress test the PRU ring protocol with a second thread standing in for the PRU (see 'make ringstress')\n"
 		"  -help: show this help menu\n"
+		"-ov and -ovs also accept vocoder options (e.g. layout=bank) after the file names,\n"
+		"and -app and -synth accept them after the optional delay length.\n"
+		"-app and -synth log loop timing and ring telemetry every 10 s (telemetry=N to change,\n"
+		"log=<file> to redirect the log), and print the full histograms on exit.\n"
+		"audio=wav:<in.wav>,<out.wav>, audio=pcm or audio=null[:seconds] runs them on files, stdin/stdout\n"
+		"or nothing instead of the PRU rings, as fast as possible.\n"
+		"block=N (1 to 256, default 16) sets how many samples they process at a time; they print\n"
+		"the latency this adds and how much of each block's deadline the DSP takes.\n"
+		"sched=fifo|rr prio=N cpu=N mlock=on give their DSP thread a real-time policy, a core and\n"
+		"locked, prefaulted memory, and report the page faults and context switches it took.\n"
 		"if you are on hardware, some additional options are available:\n"
 		"  -ppw: 'PRU play wav': use the PRU audio setup to play a WAV file over i2s\n"
 		"  -prw: 'PRU record wav': use the PRU audio/sampling setup to record a WAV file over the ADC pin 0\n"
@@ -83,10 +152,18 @@ main(int argc, char **argv) {
 		"  -bh: 'button handling test': tests to make sure the button pressed/released functionality works\n"
 		"  -apt: 'audio params test': tests to see if the audio parameter reading works\n"
 		"  -synth: runs the main app, but without the vocoder; essentially makes the app into a synthesizer.\n"
+		"if you are not, -app and -synth run on emulated hardware, which takes these options too:"
 		);
+		emulator_print_help();
 		return 0;
 	}
 
+#ifndef HARDWARE
+	if(!strcmp(argv[1], "-synth")) {
+		EMULATED_SUBAPP_ARGS(main_app, argc, argv, true);
+	}
+#endif
+
 /* These options only work on hardware */
 #ifdef HARDWARE
 	/* PRU play wav */
@@ -0,0 +1,197 @@
+#include "pru_host_ring.h"
+#include "pru_interface.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "app.h"
+#include "dsp/dsp_perf.h"
+
+#include <firmware/firmware.h>
+
+static struct pru1_ds host_ds;
+
+/* The shared struct, seen the way the PRU sees it. Normally host_ds, but see
+ * pru_host_ring_run(). */
+static volatile struct pru1_ds *ds = &host_ds;
+
+static uint32_t (*host_input_hook)(uint64_t n) = NULL;
+static void (*host_output_hook)(uint64_t n, uint32_t sample) = NULL;
+
+static pthread_t host_thread;
+static volatile bool host_running = false;
+
+static volatile uint64_t host_periods = 0;
+static volatile uint64_t host_starved = 0;
+
+/* The n-th input sample: a 220 Hz sine, as an ADC reading, which is unsigned
+ * and centered on 2048 * AUDIO_VIRTUAL_SAMPLECOUNT. */
+static uint32_t
+host_ring_input(uint64_t n) {
+	const double phase = 2.0 * M_PI * 220.0 * n / SAMPLE_RATE;
+	return (uint32_t)(2048 * AUDIO_VIRTUAL_SAMPLECOUNT
+		+ 1024 * AUDIO_VIRTUAL_SAMPLECOUNT * sin(phase));
+}
+
+bool
+pru_host_ring_play(uint32_t *sample) {
+	const uint32_t index = ds->out_read;
+	if(index == ds->out_write) {
+		ds->out_empty = 1;
+		return false;
+	}
+
+	/* Unlike the PRU, we're not in order with the other side. */
+	pru_ring_barrier();
+	*sample = ds->all_data[index];
+	pru_ring_barrier();
+	ds->out_read = (index + 1) % AUDIO_OUT_RINGBUF_SIZE;
+	ds->out_empty = 0;
+	return true;
+}
+
+void
+pru_host_ring_record(uint32_t sample) {
+	const uint32_t index = ds->in_write;
+	ds->all_data[AUDIO_OUT_RINGBUF_SIZE + index] = sample;
+	pru_ring_barrier();
+	ds->in_write = (index + 1) % AUDIO_IN_RINGBUF_SIZE;
+}
+
+/* One sample period of i2sv1.pru1.c: play an output sample if there is one,
+ * then push an input sample. */
+static void
+host_ring_period(uint64_t n) {
+	/* Like the firmware, play silence when there's nothing to play */
+	uint32_t sample = 0;
+	if(!pru_host_ring_play(&sample)) {
+		host_starved += 1;
+	}
+	if(host_output_hook) {
+		host_output_hook(n, sample);
+	}
+
+	pru_host_ring_record(host_input_hook ? host_input_hook(n) : host_ring_input(n));
+}
+
+static void*
+host_ring_thread(void *arg) {
+	(void)arg;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	uint64_t n = 0;
+	while(host_running) {
+		/* Run every period that is due, so that the rate stays exact even if
+		 * this thread wakes up late. */
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const uint64_t elapsed_ns = (uint64_t)(now.tv_sec - start.tv_sec) * 1000000000u
+			+ now.tv_nsec - start.tv_nsec;
+		const uint64_t due = elapsed_ns * SAMPLE_RATE / 1000000000u;
+
+		for(; n < due; ++n) {
+			host_ring_period(n);
+		}
+		host_periods = n;
+
+		/* Then sleep until the next one. */
+		const uint64_t next_ns = (n + 1) * 1000000000u / SAMPLE_RATE;
+		struct timespec wake = start;
+		wake.tv_sec += next_ns / 1000000000u;
+		wake.tv_nsec += next_ns % 1000000000u;
+		if(wake.tv_nsec >= 1000000000) {
+			wake.tv_sec += 1;
+			wake.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+	}
+
+	return NULL;
+}
+
+/* Same as the start of the i2sv1 firmware */
+static void
+host_ring_boot(struct pru1_ds *mem) {
+	memset(mem, 0, sizeof(*mem));
+	mem->out_empty = 1;
+
+	/* Unlike the firmware, start with input data in the whole ring, so that
+	 * pru_host_ring_fill() has something to hand out. */
+	for(int i = 0; i < AUDIO_IN_RINGBUF_SIZE; ++i) {
+		mem->all_data[AUDIO_OUT_RINGBUF_SIZE + i] = host_ring_input(i);
+	}
+	mem->magic = PRU1_MAGIC_NUMBER;
+
+	ds = mem;
+	host_periods = 0;
+	host_starved = 0;
+}
+
+static void
+host_ring_start_thread(void) {
+	host_running = true;
+	if(pthread_create(&host_thread, NULL, host_ring_thread, NULL) != 0) {
+		app_fatal_error("could not start the PRU stand-in thread");
+	}
+}
+
+void
+pru_host_ring_attach(void) {
+	host_ring_boot(&host_ds);
+	pru_audio_attach(&host_ds);
+}
+
+void
+pru_host_ring_start(void) {
+	pru_host_ring_attach();
+	host_ring_start_thread();
+}
+
+void
+pru_host_ring_run(struct pru1_ds *mem) {
+	host_ring_boot(mem);
+	host_ring_start_thread();
+}
+
+void
+pru_host_ring_set_hooks(uint32_t (*input)(uint64_t n), void (*output)(uint64_t n, uint32_t sample)) {
+	host_input_hook = input;
+	host_output_hook = output;
+}
+
+void
+pru_host_ring_stop(void) {
+	if(!host_running) return;
+
+	host_running = false;
+	pthread_join(host_thread, NULL);
+}
+
+void
+pru_host_ring_drain(void) {
+	ds->out_read = ds->out_write;
+}
+
+void
+pru_host_ring_fill(uint32_t count) {
+	ds->in_write = (ds->in_write + count) % AUDIO_IN_RINGBUF_SIZE;
+}
+
+const uint32_t*
+pru_host_ring_out_data(void) {
+	return host_ds.all_data;
+}
+
+uint64_t
+pru_host_ring_periods(void) {
+	return host_periods;
+}
+
+uint64_t
+pru_host_ring_starved_periods(void) {
+	return host_starved;
+}
@@ -0,0 +1,83 @@
+#ifndef PRU_HOST_RING_H
+#define PRU_HOST_RING_H
+
+#include "types.h"
+
+/* pru_host_ring.h: a stand-in for PRU 1 that runs as a thread on the host, so
+ * that the audio ring code in pru_interface.c (and anything timing it) can be
+ * exercised without a BeagleBone. */
+
+/**
+ * Sets up an in-memory pru1_ds the same way the i2sv1 firmware does, points
+ * pru_interface.c at it with pru_audio_attach(), and starts a thread that
+ * plays one output sample and records one input sample (a 220 Hz sine, in ADC
+ * units) every 1 / SAMPLE_RATE seconds, like the real PRU.
+ */
+void pru_host_ring_start(void);
+
+/**
+ * Starts the thread on the given memory instead, after setting it up as the
+ * firmware would, and without attaching it. Used by the emulated hardware (see
+ * emulator.h), where pru_init() finds it the same way it finds the real PRU.
+ */
+struct pru1_ds;
+void pru_host_ring_run(struct pru1_ds *mem);
+
+/**
+ * Replaces what the thread does with the samples, until called again (NULLs
+ * restore the defaults). Both are called from the thread, once per sample
+ * period n: input() returns the input sample in ADC units, instead of the
+ * sine, and output() gets the sample played, exactly as it was written to the
+ * ring (i.e. bit reversed), or 0 if the ring was empty.
+ */
+void pru_host_ring_set_hooks(uint32_t (*input)(uint64_t n), void (*output)(uint64_t n, uint32_t sample));
+
+/**
+ * Sets up and attaches the in-memory pru1_ds without starting the thread, for
+ * tests and benchmarks that move the indices themselves with the functions
+ * below.
+ */
+void pru_host_ring_attach(void);
+
+/**
+ * Without the thread: plays everything in the output ring at once.
+ */
+void pru_host_ring_drain(void);
+
+/**
+ * Without the thread: makes the next count samples of the input ring readable.
+ * The input ring starts out full of the same sine wave the thread produces, and
+ * is reused as it wraps.
+ */
+void pru_host_ring_fill(uint32_t count);
+
+/**
+ * Returns the output ring's data (the start of all_data).
+ */
+const uint32_t *pru_host_ring_out_data(void);
+
+/**
+ * The PRU's side of the rings, done the same way as i2sv1.pru1.c, for anything
+ * that wants to drive them at its own pace instead of the thread's.
+ *
+ * pru_host_ring_play() takes the next output sample, or returns false (and
+ * sets out_empty) if there is none. pru_host_ring_record() adds an input
+ * sample; like the firmware, it doesn't check for room, so a full ring loses
+ * its oldest samples.
+ */
+bool pru_host_ring_play(uint32_t *sample);
+void pru_host_ring_record(uint32_t sample);
+
+/**
+ * Stops the stand-in thread. The pru1_ds stays attached.
+ */
+void pru_host_ring_stop(void);
+
+/**
+ * Returns the number of sample periods the stand-in has run for, and how many
+ * of those it had no output sample to play.
+ */
+uint64_t pru_host_ring_periods(void);
+uint64_t pru_host_ring_starved_periods(void);
+
+#endif
@@ -7,11 +7,16 @@
 #include <string.h>
 
 #include <sched.h>
+#include <time.h>
+#include <sys/prctl.h>
 
 #include "app.h"
 #include "hardware.h"
+#include "pru_interface.h"
 
 #include "dsp/dsp.h"
+#include "dsp/dsp_perf.h"
+#include "telemetry.h"
 
 #include <firmware/firmware.h>
 
@@ -22,8 +27,64 @@
 #define PRU0_FIRMWARE_NAME "vocoder-adc.pru0.firmware"
 #define PRU1_FIRMWARE_NAME "vocoder-i2sv1.pru1.firmware"
 
-static struct pru0_ds *pru_adc = NULL;
-static struct pru1_ds *pru_audio = NULL;
+static volatile struct pru0_ds *pru_adc = NULL;
+static volatile struct pru1_ds *pru_audio = NULL;
+
+static pru_audio_stats audio_stats;
+
+static pru_wait_policy audio_wait_policy = PRU_WAIT_HYBRID;
+
+/* One sample period, in ns. */
+#define PRU_SAMPLE_NS (1000000000u / SAMPLE_RATE)
+
+/* With PRU_WAIT_HYBRID, how long before the expected time we stop sleeping and
+ * start spinning. This has to cover the wakeup latency of clock_nanosleep,
+ * which on a non real-time thread is mostly the timer slack (see
+ * pru_audio_set_wait_policy()). */
+#define PRU_WAIT_SPIN_NS 60000
+
+/* The PRU shifts samples out LSB first, so every sample is bit reversed before
+ * it goes in the ring. */
+#if defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7
+static inline uint32_t
+pru_bit_reverse(uint32_t u) {
+	uint32_t r;
+	__asm__("rbit %0, %1" : "=r"(r) : "r"(u));
+	return r;
+}
+#elif defined(__aarch64__)
+static inline uint32_t
+pru_bit_reverse(uint32_t u) {
+	uint32_t r;
+	__asm__("rbit %w0, %w1" : "=r"(r) : "r"(u));
+	return r;
+}
+#else
+/* Every byte, bit reversed. */
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+static const uint8_t bit_reverse_table[256] = { R6(0), R6(2), R6(1), R6(3) };
+#undef R2
+#undef R4
+#undef R6
+
+static inline uint32_t
+pru_bit_reverse(uint32_t u) {
+	return ((uint32_t)bit_reverse_table[u & 0xff] << 24)
+		| ((uint32_t)bit_reverse_table[(u >> 8) & 0xff] << 16)
+		| ((uint32_t)bit_reverse_table[(u >> 16) & 0xff] << 8)
+		| (uint32_t)bit_reverse_table[u >> 24];
+}
+#endif
+
+/* The largest block moved in one go by the block functions, so that waiting
+ * for space never asks for more than the ring can hold. */
+#define PRU_MAX_CHUNK (AUDIO_OUT_RINGBUF_SIZE / 2)
+
+/* The last value of out_empty seen by pru_audio_write, so that each time the
+ * output runs dry only counts as one underrun. */
+static uint32_t audio_out_was_empty = 1;
 
 static void
 pru_test_firmware_exists() {
@@ -87,13 +148,15 @@ pru_install() {
 
 void
 pru_init() {
-	/* The firmware must be installed before anything else can happen */
-	pru_install();
-
-	/* Do pin muxing */
-	sysfs_write_string("/sys/devices/platform/ocp/ocp:P8_46_pinmux/state", "pruout"); /* BCK */
-	sysfs_write_string("/sys/devices/platform/ocp/ocp:P8_45_pinmux/state", "pruout"); /* DIN */
-	sysfs_write_string("/sys/devices/platform/ocp/ocp:P8_43_pinmux/state", "pruout"); /* LRCK */
+	if(!hardware_is_emulated()) {
+		/* The firmware must be installed before anything else can happen */
+		pru_install();
+
+		/* Do pin muxing */
+		sysfs_write_string("/sys/devices/platform/ocp/ocp:P8_46_pinmux/state", "pruout"); /* BCK */
+		sysfs_write_string("/sys/devices/platform/ocp/ocp:P8_45_pinmux/state", "pruout"); /* DIN */
+		sysfs_write_string("/sys/devices/platform/ocp/ocp:P8_43_pinmux/state", "pruout"); /* LRCK */
+	}
 
 	unsigned char *base = mmap_get_mapping(PRU_START, PRU_SIZE);
 	if(!base) {
@@ -102,6 +165,12 @@ pru_init() {
 	pru_adc   = (void*)(base + PRU0_GLOBAL_DS_OFFSET);
 	pru_audio = (void*)(base + PRU1_GLOBAL_DS_OFFSET);
 
+	if(hardware_is_emulated()) {
+		/* There's no firmware to install, so start the emulated PRUs in the
+		 * memory that stands in for theirs instead */
+		emulator_start_prus((void*)(base + PRU0_GLOBAL_DS_OFFSET), (void*)(base + PRU1_GLOBAL_DS_OFFSET));
+	}
+
 	if(pru_adc->magic != PRU0_MAGIC_NUMBER) {
 		app_fatal_error("PRU 0 magic number is wrong. The firmware may not be installed correctly.");
 	}
@@ -113,6 +182,11 @@ pru_init() {
 
 void
 pru_shutdown() {
+	if(hardware_is_emulated()) {
+		emulator_stop_prus();
+		return;
+	}
+
 	/* Stop both PRUs. You may want to disable this functionality when debugging PRUs. */
 	sysfs_write_string("/sys/class/remoteproc/remoteproc1/state", "stop");
 	sysfs_write_string("/sys/class/remoteproc/remoteproc2/state", "stop");
@@ -127,7 +201,103 @@ pru_audio_prepare_writing() {
 
 	/* Make the output pointer as far as possible from the input pointer
 	 * Note this is essentially write = read - 1 */
+	pru_ring_barrier();
 	pru_audio->out_write = (pru_audio->out_read + AUDIO_OUT_RINGBUF_SIZE - 1) % AUDIO_OUT_RINGBUF_SIZE;
+
+	/* The PRU may have been starved before we got here, which doesn't count */
+	audio_out_was_empty = 1;
+}
+
+/* Lets the other hardware thread (or the memory system) make progress while we
+ * busy-wait. */
+static inline void
+pru_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+/* The indices are written by the PRU, so they must be re-read every time. */
+static uint32_t
+pru_in_fill(void) {
+	return (pru_audio->in_write + AUDIO_IN_RINGBUF_SIZE - pru_audio->in_read) % AUDIO_IN_RINGBUF_SIZE;
+}
+
+static uint32_t
+pru_out_fill(void) {
+	return (pru_audio->out_write + AUDIO_OUT_RINGBUF_SIZE - pru_audio->out_read) % AUDIO_OUT_RINGBUF_SIZE;
+}
+
+/* One slot is always left empty, so that a full ring can be told apart from an
+ * empty one. */
+static uint32_t
+pru_out_space(void) {
+	return AUDIO_OUT_RINGBUF_SIZE - 1 - pru_out_fill();
+}
+
+/* Waits until available() returns at least count, following the wait policy,
+ * and adds the time spent to *waited_ns. */
+static void
+pru_wait(uint32_t (*available)(void), uint32_t count, uint64_t *waited_ns) {
+	uint32_t have = available();
+	if(have >= count) return;
+
+	const uint64_t start = telemetry_now_ns();
+
+	while(have < count) {
+		switch(audio_wait_policy) {
+		case PRU_WAIT_SPIN:
+			pru_cpu_relax();
+			break;
+		case PRU_WAIT_YIELD:
+			sched_yield();
+			break;
+		case PRU_WAIT_HYBRID: {
+			/* The PRU moves one sample per period, so we know roughly how
+			 * long the rest will take. Sleep through most of it. */
+			const uint64_t expected_ns = (uint64_t)(count - have) * PRU_SAMPLE_NS;
+			if(expected_ns > PRU_WAIT_SPIN_NS) {
+				const uint64_t sleep_ns = expected_ns - PRU_WAIT_SPIN_NS;
+				struct timespec ts = {
+					.tv_sec = sleep_ns / 1000000000u,
+					.tv_nsec = sleep_ns % 1000000000u
+				};
+				clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+			}
+			else {
+				/* The BeagleBone has a single core, so spin with yields
+				 * to let the control and log threads run meanwhile. */
+				sched_yield();
+			}
+			break;
+		}
+		case PRU_WAIT_SLEEP: {
+			const uint64_t sleep_ns = (uint64_t)(count - have) * PRU_SAMPLE_NS;
+			struct timespec ts = {
+				.tv_sec = sleep_ns / 1000000000u,
+				.tv_nsec = sleep_ns % 1000000000u
+			};
+			clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+			break;
+		}
+		}
+
+		have = available();
+	}
+
+	*waited_ns += telemetry_now_ns() - start;
+}
+
+/* An underrun is when the PRU has played everything we gave it. */
+static void
+pru_check_underrun(void) {
+	const uint32_t empty = pru_audio->out_empty;
+	if(empty && !audio_out_was_empty) {
+		audio_stats.underruns += 1;
+	}
+	audio_out_was_empty = empty;
 }
 
 void
@@ -135,24 +305,50 @@ pru_audio_write(int32_t sample) {
 	uint32_t u;
 	memcpy(&u, &sample, sizeof(u));
 
-	/* Each sample must be REVERSED for efficient processing by the PRU */
-	uint32_t rev = 0;
-	for(int i = 0; i < 32; ++i) {
-		rev <<= 1;
-		rev |= (u >> i) & 1;
-	}
+	pru_check_underrun();
 
-	/* Compute the pointer value for the next sample */
-	uint32_t next = (pru_audio->out_write + 1) % AUDIO_OUT_RINGBUF_SIZE;
-
-	/* Yield while the buffer is full */
-	while(next == pru_audio->out_read && !pru_audio->out_empty) {
-		sched_yield();
-	}
+	/* Wait while the buffer is full */
+	pru_wait(pru_out_space, 1, &audio_stats.write_spin_ns);
+	pru_ring_barrier();
 
 	/* Write the data into the ring buffer, then increment the output pointer */
-	pru_audio->all_data[pru_audio->out_write] = rev;
-	pru_audio->out_write = next;
+	const uint32_t w = pru_audio->out_write;
+	pru_audio->all_data[w] = pru_bit_reverse(u);
+	pru_ring_barrier();
+	pru_audio->out_write = (w + 1) % AUDIO_OUT_RINGBUF_SIZE;
+}
+
+void
+pru_audio_write_block(const int32_t *samples, uint32_t count) {
+	pru_check_underrun();
+
+	while(count > 0) {
+		const uint32_t n = (count < PRU_MAX_CHUNK) ? count : PRU_MAX_CHUNK;
+
+		/* Wait for space for the whole chunk once. The barrier keeps the
+		 * stores below from overtaking the PRU's reads of those slots. */
+		pru_wait(pru_out_space, n, &audio_stats.write_spin_ns);
+		pru_ring_barrier();
+
+		/* Then copy it in at most two runs, either side of the wrap */
+		const uint32_t w = pru_audio->out_write;
+		const uint32_t first = (n < AUDIO_OUT_RINGBUF_SIZE - w) ? n : AUDIO_OUT_RINGBUF_SIZE - w;
+
+		volatile uint32_t *dst = pru_audio->all_data;
+		for(uint32_t i = 0; i < first; ++i) {
+			dst[w + i] = pru_bit_reverse((uint32_t)samples[i]);
+		}
+		for(uint32_t i = first; i < n; ++i) {
+			dst[i - first] = pru_bit_reverse((uint32_t)samples[i]);
+		}
+
+		/* And publish it with a single index update */
+		pru_ring_barrier();
+		pru_audio->out_write = (w + n) % AUDIO_OUT_RINGBUF_SIZE;
+
+		samples += n;
+		count -= n;
+	}
 }
 
 void
@@ -162,27 +358,119 @@ pru_audio_prepare_reading() {
 		pru_audio->all_data[AUDIO_OUT_RINGBUF_SIZE + i] = 0;
 	}
 
-	/* Make the input pointer as far from the output pointer as possible */
-	pru_audio->in_read = (pru_audio->in_write + 1) % AUDIO_IN_RINGBUF_SIZE;
+	/* Start with the input ring empty. The PRU takes one output sample and
+	 * gives one input sample every period, so the two fill levels always add
+	 * up to about the same amount; the output ring's silence is all the
+	 * buffering there is room for. (The PRU doesn't check for room in the
+	 * input ring, so starting with it full would have it overwrite unread
+	 * samples as soon as we fall behind at all.) */
+	pru_ring_barrier();
+	pru_audio->in_read = pru_audio->in_write;
 }
 
 int32_t
 pru_audio_read() {
-	/* Compute a gain factor to map the values to a "normalized" range of -0.5 to 0.5 */
-	const dsp_num gain = (dsp_one / 2) / (2048 * AUDIO_VIRTUAL_SAMPLECOUNT);
-	
 	/* Wait for new data in the buffer */
-	while(pru_audio->in_read == pru_audio->in_write) {
-		sched_yield();
-	}
+	pru_wait(pru_in_fill, 1, &audio_stats.read_spin_ns);
 
 	/* Read the data and update the ring buffer pointer */
-	int32_t result = pru_audio->all_data[AUDIO_OUT_RINGBUF_SIZE + pru_audio->in_read];
-	pru_audio->in_read = (pru_audio->in_read + 1) % AUDIO_IN_RINGBUF_SIZE;
+	pru_ring_barrier();
+	const uint32_t r = pru_audio->in_read;
+	int32_t result = pru_audio->all_data[AUDIO_OUT_RINGBUF_SIZE + r];
+	pru_ring_barrier();
+	pru_audio->in_read = (r + 1) % AUDIO_IN_RINGBUF_SIZE;
 
 	/* Compute the centered / normalized sample value */
-	result -= (2048 * AUDIO_VIRTUAL_SAMPLECOUNT);
-	return result * gain;
+	result -= PRU_AUDIO_IN_CENTER;
+	return result * PRU_AUDIO_IN_GAIN;
+}
+
+void
+pru_audio_read_block(int32_t *samples, uint32_t count) {
+	while(count > 0) {
+		const uint32_t n = (count < PRU_MAX_CHUNK) ? count : PRU_MAX_CHUNK;
+
+		/* Wait for the whole chunk once. The barrier keeps the loads below
+		 * from being done before we've seen the PRU's index. */
+		pru_wait(pru_in_fill, n, &audio_stats.read_spin_ns);
+		pru_ring_barrier();
+
+		/* Then copy it out in at most two runs, either side of the wrap */
+		const uint32_t r = pru_audio->in_read;
+		const uint32_t first = (n < AUDIO_IN_RINGBUF_SIZE - r) ? n : AUDIO_IN_RINGBUF_SIZE - r;
+
+		const volatile uint32_t *src = pru_audio->all_data + AUDIO_OUT_RINGBUF_SIZE;
+		for(uint32_t i = 0; i < first; ++i) {
+			samples[i] = ((int32_t)src[r + i] - PRU_AUDIO_IN_CENTER) * PRU_AUDIO_IN_GAIN;
+		}
+		for(uint32_t i = first; i < n; ++i) {
+			samples[i] = ((int32_t)src[i - first] - PRU_AUDIO_IN_CENTER) * PRU_AUDIO_IN_GAIN;
+		}
+
+		/* And hand the space back with a single index update, once the
+		 * loads are done */
+		pru_ring_barrier();
+		pru_audio->in_read = (r + n) % AUDIO_IN_RINGBUF_SIZE;
+
+		samples += n;
+		count -= n;
+	}
+}
+
+void
+pru_audio_take_stats(pru_audio_stats *out) {
+	*out = audio_stats;
+	memset(&audio_stats, 0, sizeof(audio_stats));
+}
+
+uint32_t
+pru_audio_in_fill() {
+	return pru_in_fill();
+}
+
+uint32_t
+pru_audio_out_fill() {
+	return pru_out_fill();
+}
+
+void
+pru_audio_set_wait_policy(pru_wait_policy policy) {
+	audio_wait_policy = policy;
+
+	/* The default timer slack of 50us would eat most of the time we leave
+	 * for spinning. This is per thread, so it needs to be called from the
+	 * thread that does the audio. */
+	if(policy == PRU_WAIT_HYBRID || policy == PRU_WAIT_SLEEP) {
+		prctl(PR_SET_TIMERSLACK, 1000, 0, 0, 0);
+	}
+}
+
+static const char *const wait_policy_names[] = {
+	[PRU_WAIT_SPIN]   = "spin",
+	[PRU_WAIT_YIELD]  = "yield",
+	[PRU_WAIT_HYBRID] = "hybrid",
+	[PRU_WAIT_SLEEP]  = "sleep",
+};
+
+bool
+pru_wait_policy_parse(const char *name, pru_wait_policy *out) {
+	for(int i = 0; i < (int)(sizeof(wait_policy_names) / sizeof(wait_policy_names[0])); ++i) {
+		if(!strcmp(name, wait_policy_names[i])) {
+			*out = (pru_wait_policy)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char*
+pru_wait_policy_name(pru_wait_policy policy) {
+	return wait_policy_names[policy];
+}
+
+void
+pru_audio_attach(struct pru1_ds *ds) {
+	pru_audio = ds;
 }
 
 int32_t
@@ -195,6 +483,24 @@ pru_adc_read_without_reset(int32_t channel) {
 void
 pru_adc_reset(int32_t channel) {
 	/* This flags this channel for reset by the PRU the next time it gets a sample
-	 * for this channel. */
+	 * for this channel. Anything done before this (e.g. switching the
+	 * multiplexer) has to be seen by the PRU first, which like the audio rings
+	 * takes a full system barrier rather than a C11 fence (dmb ish). */
+	pru_ring_barrier();
 	pru_adc->sample_reset[channel] = 1;
-}
\ No newline at end of file
+}
+
+bool
+pru_adc_wait_sampled(int32_t channel, uint64_t timeout_ns) {
+	/* The PRU clears the flag when it takes the first sample after the reset
+	 * (see UPDATE_SAMPLE in adc.pru0.c). */
+	const uint64_t give_up_ns = telemetry_now_ns() + timeout_ns;
+	while(pru_adc->sample_reset[channel]) {
+		if(telemetry_now_ns() >= give_up_ns) return false;
+		sched_yield();
+	}
+
+	/* And the sample has to be read after seeing the flag cleared. */
+	pru_ring_barrier();
+	return true;
+}
@@ -2,6 +2,9 @@
 #define PRU_INTERFACE_H
 
 #include "types.h"
+#include "dsp/dsp.h"
+
+#include <firmware/firmware.h>
 
 /**
  * Prepares the PRU input buffer for audio reading. Should be called before
@@ -15,6 +18,11 @@ void pru_audio_prepare_reading();
  */
 void pru_audio_prepare_writing();
 
+/* Maps the raw ADC readings to a "normalized" range of -0.5 to 0.5: a reading
+ * r is read back as (r - PRU_AUDIO_IN_CENTER) * PRU_AUDIO_IN_GAIN. */
+#define PRU_AUDIO_IN_CENTER (2048 * AUDIO_VIRTUAL_SAMPLECOUNT)
+#define PRU_AUDIO_IN_GAIN   ((dsp_num)((dsp_one / 2) / PRU_AUDIO_IN_CENTER))
+
 /**
  * Reads a single sample from the PRU audio system. Blocks if none are available.
  * The returned sample is in the range (-dsp_one / 2) to (dsp_one / 2), essentially.
@@ -27,6 +35,92 @@ int32_t pru_audio_read();
  */
 void pru_audio_write(int32_t sample);
 
+/**
+ * Reads count samples, as with pru_audio_read(). Waits once for the whole block
+ * (in chunks of up to half the ring, for large counts), copies it, then hands
+ * the space back to the PRU with a single index update. Waiting for a whole
+ * block at once also lets PRU_WAIT_HYBRID sleep through most of it.
+ */
+void pru_audio_read_block(int32_t *samples, uint32_t count);
+
+/**
+ * Writes count samples, as with pru_audio_write(), waiting for space for the
+ * whole block once and publishing it with a single index update.
+ */
+void pru_audio_write_block(const int32_t *samples, uint32_t count);
+
+/**
+ * How the read and write functions wait for the PRU.
+ */
+typedef enum {
+	/* Busy-wait. Lowest latency, but burns a whole core. */
+	PRU_WAIT_SPIN,
+	/* Busy-wait with sched_yield(). The original behaviour. */
+	PRU_WAIT_YIELD,
+	/* Work out when the PRU will have produced or consumed enough samples
+	 * from the sample rate and the ring fill, clock_nanosleep() until just
+	 * before then, and spin (with yields) for the rest. The default. */
+	PRU_WAIT_HYBRID,
+	/* As PRU_WAIT_HYBRID, but sleep all the way, a sample period at a time
+	 * at the end. Never spins, so it is the one to use on a SCHED_FIFO or
+	 * SCHED_RR thread, which wakes up on time without spinning and would
+	 * otherwise starve everything else on its core. */
+	PRU_WAIT_SLEEP,
+} pru_wait_policy;
+
+/**
+ * Sets the wait policy. Should be called from the thread that does the audio,
+ * as PRU_WAIT_HYBRID also lowers that thread's timer slack.
+ */
+void pru_audio_set_wait_policy(pru_wait_policy policy);
+
+/**
+ * Parses "spin", "yield", "hybrid" or "sleep". Returns false if the name is unknown.
+ */
+bool pru_wait_policy_parse(const char *name, pru_wait_policy *out);
+
+const char *pru_wait_policy_name(pru_wait_policy policy);
+
+/**
+ * What the audio ring functions have seen since the last call to
+ * pru_audio_take_stats().
+ */
+typedef struct {
+	/* Total time spent waiting (spinning or sleeping) for the input and the
+	 * output ring. */
+	uint64_t read_spin_ns;
+	uint64_t write_spin_ns;
+
+	/* The number of times pru_audio_write() found that the PRU had run out of
+	 * output samples (i.e. out_empty went from 0 to 1 between writes). */
+	uint32_t underruns;
+} pru_audio_stats;
+
+/**
+ * Copies the current stats into out, and resets them.
+ */
+void pru_audio_take_stats(pru_audio_stats *out);
+
+/**
+ * Returns the number of samples in the input ring that have not been read yet.
+ */
+uint32_t pru_audio_in_fill();
+
+/**
+ * Returns the number of samples in the output ring that the PRU has not played
+ * yet.
+ */
+uint32_t pru_audio_out_fill();
+
+struct pru1_ds;
+
+/**
+ * Points the audio functions at a different pru1_ds, instead of the PRU's own
+ * memory. Used for running the audio path against a stand-in for the PRU (see
+ * pru_host_ring.h) when not on hardware.
+ */
+void pru_audio_attach(struct pru1_ds *ds);
+
 /**
  * Reads a single averaged sample from the given ADC channel, but without resetting
  * the running average value. This ensures that the resetting step can be done
@@ -41,6 +135,13 @@ int32_t pru_adc_read_without_reset(int32_t channel);
  */
 void pru_adc_reset(int32_t channel);
 
+/**
+ * Waits until the PRU has taken a sample of the given channel since the last
+ * pru_adc_reset(), so that pru_adc_read_without_reset() no longer returns what
+ * came before the reset. Gives up after timeout_ns, returning false.
+ */
+bool pru_adc_wait_sampled(int32_t channel, uint64_t timeout_ns);
+
 /**
  * Initializes the PRU subsystem and installs all the PRU firmware onto the 
  * BBB. This is necessary for anything else to work.
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE /* RUSAGE_THREAD, pthread_setaffinity_np */
+
+#include "rt_setup.h"
+
+#include "app.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+void
+rt_config_default(rt_config *cfg) {
+	cfg->sched = RT_SCHED_OTHER;
+	cfg->priority = 50;
+	cfg->cpu = -1;
+	cfg->lock_memory = false;
+}
+
+static const char *const rt_sched_names[] = {
+	[RT_SCHED_OTHER] = "other",
+	[RT_SCHED_FIFO]  = "fifo",
+	[RT_SCHED_RR]    = "rr",
+};
+
+bool
+rt_config_parse(rt_config *cfg, const char *option) {
+	if(!strncmp(option, "sched=", 6)) {
+		for(int i = 0; i < (int)(sizeof(rt_sched_names) / sizeof(rt_sched_names[0])); ++i) {
+			if(!strcmp(option + 6, rt_sched_names[i])) {
+				cfg->sched = (rt_sched)i;
+				return true;
+			}
+		}
+		app_fatal_error("sched= takes other, fifo or rr");
+	}
+	if(!strncmp(option, "prio=", 5)) {
+		cfg->priority = atoi(option + 5);
+		if(cfg->priority < 1 || cfg->priority > 99) {
+			app_fatal_error("prio= must be between 1 and 99");
+		}
+		return true;
+	}
+	if(!strncmp(option, "cpu=", 4)) {
+		cfg->cpu = atoi(option + 4);
+		if(cfg->cpu < 0 || cfg->cpu >= CPU_SETSIZE) {
+			app_fatal_error("cpu= must be a core number");
+		}
+		return true;
+	}
+	if(!strncmp(option, "mlock=", 6)) {
+		if(!strcmp(option + 6, "on")) cfg->lock_memory = true;
+		else if(!strcmp(option + 6, "off")) cfg->lock_memory = false;
+		else app_fatal_error("mlock= takes on or off");
+		return true;
+	}
+	return false;
+}
+
+void
+rt_config_print_help(void) {
+	puts("sched=other|fifo|rr: the DSP thread's scheduling policy (default other); fifo and rr\n"
+		"  default to wait=sleep, as spinning at real-time priority starves the rest of the core\n"
+		"prio=N: the priority for sched=fifo or rr, 1 to 99 (default 50)\n"
+		"cpu=N: pin the DSP thread to core N (default: not pinned)\n"
+		"mlock=on|off: lock all memory and prefault the stack and buffers (default off)");
+}
+
+bool
+rt_config_is_realtime(const rt_config *cfg) {
+	return cfg->sched != RT_SCHED_OTHER;
+}
+
+void
+rt_prefault(void *buf, size_t bytes) {
+	if(!buf || !bytes) return;
+
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	volatile unsigned char *p = buf;
+	for(size_t i = 0; i < bytes; i += page) {
+		p[i] = p[i];
+	}
+	p[bytes - 1] = p[bytes - 1];
+}
+
+__attribute__((noinline)) void
+rt_prefault_stack(void) {
+	unsigned char stack[RT_STACK_PREFAULT];
+	rt_prefault(stack, sizeof(stack));
+}
+
+void
+rt_setup_memory(const rt_config *cfg) {
+	if(!cfg->lock_memory) return;
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		printf("WARNING: mlockall failed (%s), memory is not locked\n", strerror(errno));
+	}
+	else {
+		puts("rt: memory locked");
+	}
+	rt_prefault_stack();
+}
+
+void
+rt_setup_thread(const rt_config *cfg) {
+	if(cfg->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cfg->cpu, &set);
+		const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(err) {
+			printf("WARNING: could not pin the DSP thread to core %d (%s)\n", cfg->cpu, strerror(err));
+		}
+		else {
+			printf("rt: DSP thread pinned to core %d\n", cfg->cpu);
+		}
+	}
+
+	if(cfg->sched != RT_SCHED_OTHER) {
+		const int policy = (cfg->sched == RT_SCHED_FIFO) ? SCHED_FIFO : SCHED_RR;
+		const struct sched_param param = { .sched_priority = cfg->priority };
+		const int err = pthread_setschedparam(pthread_self(), policy, &param);
+		if(err) {
+			printf("WARNING: could not set SCHED_%s priority %d (%s), staying on SCHED_OTHER\n",
+				cfg->sched == RT_SCHED_FIFO ? "FIFO" : "RR", cfg->priority, strerror(err));
+		}
+		else {
+			printf("rt: DSP thread on SCHED_%s, priority %d\n",
+				cfg->sched == RT_SCHED_FIFO ? "FIFO" : "RR", cfg->priority);
+		}
+	}
+}
+
+void
+rt_usage_take(rt_usage *u) {
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	u->minor_faults = usage.ru_minflt;
+	u->major_faults = usage.ru_majflt;
+	u->voluntary_switches = usage.ru_nvcsw;
+	u->involuntary_switches = usage.ru_nivcsw;
+}
+
+void
+rt_usage_print(const char *what, const rt_usage *before, const rt_usage *after) {
+	printf("%s: %ld minor and %ld major page faults, %ld voluntary and %ld involuntary context switches\n",
+		what,
+		after->minor_faults - before->minor_faults,
+		after->major_faults - before->major_faults,
+		after->voluntary_switches - before->voluntary_switches,
+		after->involuntary_switches - before->involuntary_switches);
+}
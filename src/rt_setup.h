@@ -0,0 +1,99 @@
+#ifndef RT_SETUP_H
+#define RT_SETUP_H
+
+#include "types.h"
+
+/* rt_setup.h: the real-time precautions for the DSP thread, chosen on the
+ * command line: locking memory, touching the buffers and the stack before the
+ * loop so that it never page faults, pinning the thread to a core, and running
+ * it under SCHED_FIFO or SCHED_RR.
+ *
+ * Everything is off by default, which keeps the plain scheduler main_app has
+ * always used. Any step the process isn't allowed to take (e.g. without
+ * CAP_SYS_NICE or enough RLIMIT_MEMLOCK) prints a warning and is skipped. */
+
+/* How much of the stack rt_prefault_stack() touches. */
+#define RT_STACK_PREFAULT (256 * 1024)
+
+typedef enum {
+	/* The normal time-sharing scheduler. The default. */
+	RT_SCHED_OTHER,
+	RT_SCHED_FIFO,
+	RT_SCHED_RR,
+} rt_sched;
+
+typedef struct {
+	rt_sched sched;
+
+	/* The priority for SCHED_FIFO and SCHED_RR, 1 to 99. */
+	int priority;
+
+	/* The core to pin the DSP thread to, or -1 to leave it to the scheduler. */
+	int cpu;
+
+	/* Whether to mlockall() and prefault the stack. */
+	bool lock_memory;
+} rt_config;
+
+/**
+ * The defaults: SCHED_OTHER, no pinning, no locking. The priority is 50 for
+ * when sched= is given on its own.
+ */
+void rt_config_default(rt_config *cfg);
+
+/**
+ * Parses one of sched=other|fifo|rr, prio=N, cpu=N and mlock=on|off. Returns
+ * false if the option isn't one of those. Bad values are a fatal error.
+ */
+bool rt_config_parse(rt_config *cfg, const char *option);
+
+void rt_config_print_help(void);
+
+/**
+ * Whether cfg asks for a real-time scheduling policy, which should only be
+ * paired with a wait policy that doesn't spin (PRU_WAIT_SLEEP).
+ */
+bool rt_config_is_realtime(const rt_config *cfg);
+
+/**
+ * Locks all current and future memory, if asked to, and touches the stack.
+ * Call it early, before the big buffers are allocated, so that they are
+ * locked as they are mapped.
+ */
+void rt_setup_memory(const rt_config *cfg);
+
+/**
+ * Pins the calling thread and sets its scheduling policy. Threads inherit
+ * both, so call it from the DSP thread after starting the others.
+ */
+void rt_setup_thread(const rt_config *cfg);
+
+/**
+ * Touches every page of [buf, buf + bytes) with a write, without changing it,
+ * so that the first real access doesn't fault.
+ */
+void rt_prefault(void *buf, size_t bytes);
+
+/**
+ * Touches RT_STACK_PREFAULT bytes of the calling thread's stack.
+ */
+void rt_prefault_stack(void);
+
+/**
+ * The calling thread's page faults and context switches, from getrusage().
+ */
+typedef struct {
+	long minor_faults;
+	long major_faults;
+	long voluntary_switches;
+	long involuntary_switches;
+} rt_usage;
+
+void rt_usage_take(rt_usage *u);
+
+/**
+ * Prints what happened between before and after, labelled with what.
+ */
+void rt_usage_print(const char *what, const rt_usage *before, const rt_usage *after);
+
+#endif
@@ -0,0 +1,708 @@
+/**
+ * Benchmarks for the DSP hot paths: vc_process (one sample at a time and in
+ * blocks), synth_process, a single bpf_cbq_update cascade and design_bpf, plus
+ * the PRU audio ring transfers (per sample and in blocks) against an in-memory
+ * stand-in for the PRU.
+ *
+ * Each case runs a few times and keeps its fastest run. The results are in
+ * ns/sample, cycles/sample and real-time factor (the fraction of the 44.1 kHz
+ * per-sample deadline used), and can also be written as JSON so that runs on
+ * different targets (vocoder-dsptest, vocoder-hw) can be compared. See
+ * 'make bench' and 'make bench-hw'.
+ */
+
+#include "dsp/vocoder.h"
+#include "dsp/synth.h"
+#include "dsp/dsp_perf.h"
+#include "wav/wav.h"
+#include "pru/pru_interface.h"
+#include "pru/pru_host_ring.h"
+#include "app.h"
+
+#include <firmware/firmware.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* bpf_cbq_update is only available as an inline function. */
+#include "dsp/bpf_impl.c"
+
+/* The length of the synthetic inputs. */
+#define BENCH_SYNTHETIC_SECONDS 5
+
+/* The maximum number of benchmark results. */
+#define BENCH_MAX_RESULTS 24
+
+/* --- Timing --- */
+
+/* Where the cycle counts come from. perf (the hardware cycle counter) is
+ * preferred, as it counts actual core cycles on both x86 and ARM; on x86 we can
+ * fall back to the TSC, which counts at a fixed reference rate instead. */
+typedef enum {
+	BENCH_CYCLES_NONE,
+	BENCH_CYCLES_PERF,
+	BENCH_CYCLES_TSC,
+} bench_cycle_source;
+
+static bench_cycle_source cycle_source = BENCH_CYCLES_NONE;
+static int cycle_fd = -1;
+
+static void
+bench_cycles_init(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	cycle_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if(cycle_fd >= 0) {
+		cycle_source = BENCH_CYCLES_PERF;
+		return;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	cycle_source = BENCH_CYCLES_TSC;
+#endif
+}
+
+static uint64_t
+bench_cycles(void) {
+	switch(cycle_source) {
+	case BENCH_CYCLES_PERF: {
+		uint64_t count = 0;
+		if(read(cycle_fd, &count, sizeof(count)) != sizeof(count)) return 0;
+		return count;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	case BENCH_CYCLES_TSC:
+		return __rdtsc();
+#endif
+	default:
+		return 0;
+	}
+}
+
+static const char*
+bench_cycle_source_name(void) {
+	switch(cycle_source) {
+	case BENCH_CYCLES_PERF: return "perf";
+	case BENCH_CYCLES_TSC:  return "tsc";
+	default:                return "none";
+	}
+}
+
+static uint64_t
+bench_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+	uint64_t ns;
+	uint64_t cycles;
+} bench_timer;
+
+static void
+bench_start(bench_timer *t) {
+	t->cycles = bench_cycles();
+	t->ns = bench_ns();
+}
+
+static void
+bench_stop(bench_timer *t) {
+	t->ns = bench_ns() - t->ns;
+	t->cycles = bench_cycles() - t->cycles;
+}
+
+/* --- Results --- */
+
+typedef struct {
+	const char *name;
+
+	/* The number of samples (or calls, for per_call results) per run. */
+	uint64_t count;
+
+	/* Whether the result is per call instead of per sample, in which case it
+	 * has no real-time factor. */
+	bool per_call;
+
+	/* The fastest run. */
+	uint64_t ns;
+	uint64_t cycles;
+} bench_result;
+
+static bench_result results[BENCH_MAX_RESULTS];
+static int result_count = 0;
+
+static double
+bench_ns_per(const bench_result *r) {
+	return (double)r->ns / r->count;
+}
+
+static double
+bench_cycles_per(const bench_result *r) {
+	return (double)r->cycles / r->count;
+}
+
+/* The fraction of the per-sample deadline at SAMPLE_RATE that is used. */
+static double
+bench_rt_factor(const bench_result *r) {
+	return bench_ns_per(r) * SAMPLE_RATE / 1e9;
+}
+
+/* Records one run of a case, keeping the fastest. */
+static void
+bench_record(bench_result *r, const bench_timer *t) {
+	if(r->ns == 0 || t->ns < r->ns) {
+		r->ns = t->ns;
+		r->cycles = t->cycles;
+	}
+}
+
+static bench_result*
+bench_new_result(const char *name, uint64_t count, bool per_call) {
+	if(result_count >= BENCH_MAX_RESULTS) app_fatal_error("bench: too many results");
+
+	bench_result *r = &results[result_count++];
+	r->name = name;
+	r->count = count;
+	r->per_call = per_call;
+	r->ns = 0;
+	r->cycles = 0;
+	return r;
+}
+
+/* --- Inputs --- */
+
+typedef struct {
+	dsp_num *mod;
+	dsp_num *car;
+	uint64_t frames;
+} bench_input;
+
+/* Keeps the compiler from optimizing away the work being timed. */
+static volatile dsp_num bench_sink;
+
+/* Reads the leftmost channel of a WAV file, if it exists. Returns NULL (after
+ * printing a note) otherwise, so that the benchmark can still run on a target
+ * that only has some of the WAVs copied over. */
+static dsp_num*
+bench_read_wav(const char *path, uint64_t *frames, bool quiet) {
+	if(access(path, R_OK) != 0) {
+		if(!quiet) printf("note: %s not found, skipping the benchmarks that use it\n", path);
+		return NULL;
+	}
+
+	wav_io io;
+	wav_read_or_die(&io, path);
+
+	dsp_num *out = calloc(io.frames, sizeof(*out));
+	if(!out) app_fatal_error("bench: could not allocate input buffer");
+
+	for(uint64_t i = 0; i < io.frames; ++i) {
+		out[i] = io.buffer[i * io.channels];
+	}
+	free(io.buffer);
+
+	*frames = io.frames;
+	return out;
+}
+
+/* Loops (or truncates) src of length src_frames to fill dst. */
+static void
+bench_loop_into(dsp_num *dst, uint64_t frames, const dsp_num *src, uint64_t src_frames) {
+	for(uint64_t i = 0; i < frames; ++i) {
+		dst[i] = src[i % src_frames];
+	}
+}
+
+static dsp_num*
+bench_alloc(uint64_t frames) {
+	dsp_num *out = calloc(frames, sizeof(*out));
+	if(!out) app_fatal_error("bench: could not allocate input buffer");
+	return out;
+}
+
+/* White noise at about -12 dBFS, from a fixed seed. */
+static void
+bench_noise(dsp_num *dst, uint64_t frames) {
+	uint32_t state = 0x12345678;
+	for(uint64_t i = 0; i < frames; ++i) {
+		state = state * 1664525u + 1013904223u;
+		dst[i] = dsp_from_double(((int32_t)state / 2147483648.0) * 0.25);
+	}
+}
+
+/* A 110 Hz sawtooth at half scale, as a stand-in for the synth. */
+static void
+bench_saw(dsp_num *dst, uint64_t frames) {
+	const double step = 110.0 / SAMPLE_RATE;
+	double phase = 0;
+	for(uint64_t i = 0; i < frames; ++i) {
+		dst[i] = dsp_from_double(phase - 0.5);
+		phase += step;
+		if(phase >= 1.0) phase -= 1.0;
+	}
+}
+
+/* --- Cases --- */
+
+static void
+bench_vc_process(const char *name, const bench_input *in, const vocoder_config *cfg, int reps) {
+	static vocoder voc;
+	bench_result *r = bench_new_result(name, in->frames, false);
+
+	for(int rep = 0; rep < reps; ++rep) {
+		vc_init_config(&voc, cfg);
+
+		dsp_num sum = 0;
+		bench_timer t;
+		bench_start(&t);
+		for(uint64_t i = 0; i < in->frames; ++i) {
+			sum += vc_process(&voc, in->mod[i], in->car[i]);
+		}
+		bench_stop(&t);
+
+		bench_sink = sum;
+		bench_record(r, &t);
+	}
+}
+
+static void
+bench_vc_process_block(const char *name, const bench_input *in, const vocoder_config *cfg, int reps) {
+	static vocoder voc;
+	bench_result *r = bench_new_result(name, in->frames, false);
+
+	dsp_num *out = bench_alloc(in->frames);
+
+	for(int rep = 0; rep < reps; ++rep) {
+		vc_init_config(&voc, cfg);
+
+		bench_timer t;
+		bench_start(&t);
+		vc_process_block(&voc, in->mod, in->car, out, in->frames);
+		bench_stop(&t);
+
+		bench_sink = out[in->frames - 1];
+		bench_record(r, &t);
+	}
+
+	free(out);
+}
+
+static void
+bench_synth_process(const char *name, synth_oscillator oscillator, bpf_kernel kernel, int voices, int reps) {
+	const uint64_t frames = SAMPLE_RATE * BENCH_SYNTHETIC_SECONDS;
+	bench_result *r = bench_new_result(name, frames, false);
+
+	static synth syn;
+	audio_params ap;
+	audio_params_default(&ap);
+
+	for(int rep = 0; rep < reps; ++rep) {
+		synth_init_oscillator(&syn, oscillator);
+		synth_set_kernel(&syn, kernel);
+		/* Keep the voices busy, a fifth apart. The rest stay idle. */
+		for(int v = 0; v < voices; ++v) {
+			synth_press(&syn, (v * 7) % NUMBER_OF_NOTES);
+		}
+
+		dsp_num sum = 0;
+		bench_timer t;
+		bench_start(&t);
+		for(uint64_t i = 0; i < frames; ++i) {
+			sum += synth_process(&syn, &ap);
+		}
+		bench_stop(&t);
+
+		bench_sink = sum;
+		bench_record(r, &t);
+	}
+}
+
+/* One band filter on its own, in the middle of the default filterbank. */
+static void
+bench_bpf_cbq_update(const dsp_num *noise, uint64_t frames, int reps) {
+	bench_result *r = bench_new_result("bpf_cbq_update/noise", frames, false);
+
+	const double fw = 8000.0 / SAMPLE_RATE / (VOCODER_BANDS + 1);
+	static bpf_cascaded_biquad cbq;
+
+	for(int rep = 0; rep < reps; ++rep) {
+		design_bpf(&cbq, fw * (VOCODER_BANDS / 2), fw, BPF_DEFAULT_STAGES);
+		memset(cbq.y_array, 0, sizeof(cbq.y_array));
+
+		dsp_num x[3] = { 0 };
+		dsp_num sum = 0;
+
+		bench_timer t;
+		bench_start(&t);
+		for(uint64_t i = 0; i < frames; ++i) {
+			x[2] = x[1];
+			x[1] = x[0];
+			x[0] = noise[i];
+			sum += bpf_cbq_update(&cbq, x);
+		}
+		bench_stop(&t);
+
+		bench_sink = sum;
+		bench_record(r, &t);
+	}
+}
+
+/* Designs every band of the default filterbank, as vc_init does. */
+static void
+bench_design_bpf(int reps) {
+	const int calls = VOCODER_BANDS * 16;
+	bench_result *r = bench_new_result("design_bpf", calls, true);
+
+	const double fw = 8000.0 / SAMPLE_RATE / (VOCODER_BANDS + 1);
+	static bpf_cascaded_biquad cbq;
+
+	for(int rep = 0; rep < reps; ++rep) {
+		dsp_num sum = 0;
+		bench_timer t;
+		bench_start(&t);
+		for(int i = 0; i < calls; ++i) {
+			design_bpf(&cbq, fw * (i % VOCODER_BANDS + 1), fw, BPF_DEFAULT_STAGES);
+			sum += cbq.scale;
+		}
+		bench_stop(&t);
+
+		bench_sink = sum;
+		bench_record(r, &t);
+	}
+}
+
+/* The block size main_app moves to and from the PRU. */
+#define BENCH_PRU_BLOCK 16
+
+/* Checks that the block transfers move exactly the same data as the per sample
+ * ones, so that the comparison below is a fair one. */
+static void
+bench_pru_check(const dsp_num *in) {
+	const int n = 3 * AUDIO_OUT_RINGBUF_SIZE / 2;
+	static uint32_t expect[AUDIO_OUT_RINGBUF_SIZE];
+	static dsp_num read_expect[3 * AUDIO_IN_RINGBUF_SIZE / 2];
+	static dsp_num read_got[3 * AUDIO_IN_RINGBUF_SIZE / 2];
+
+	/* Odd sized pieces, so that both wrap somewhere in the middle of one. */
+	pru_host_ring_attach();
+	for(int i = 0; i < n; ++i) {
+		pru_audio_write(in[i]);
+		if(i % 37 == 36) pru_host_ring_drain();
+	}
+	for(int i = 0; i < n; ++i) {
+		if(i % 37 == 0) pru_host_ring_fill(37);
+		read_expect[i] = pru_audio_read();
+	}
+	memcpy(expect, pru_host_ring_out_data(), sizeof(expect));
+
+	pru_host_ring_attach();
+	for(int i = 0; i < n; i += 37) {
+		pru_audio_write_block(in + i, (n - i < 37) ? n - i : 37);
+		pru_host_ring_drain();
+	}
+	for(int i = 0; i < n; i += 37) {
+		pru_host_ring_fill(37);
+		pru_audio_read_block(read_got + i, (n - i < 37) ? n - i : 37);
+	}
+
+	if(memcmp(expect, pru_host_ring_out_data(), sizeof(expect)) != 0
+		|| memcmp(read_expect, read_got, sizeof(read_got)) != 0) {
+		app_fatal_error("bench: the PRU block transfers don't match the per sample ones");
+	}
+}
+
+/* Writes the input to the PRU ring, emptying the ring after every block as the
+ * PRU would. */
+static void
+bench_pru_write(const char *name, const dsp_num *in, uint64_t frames, bool block, int reps) {
+	frames -= frames % BENCH_PRU_BLOCK;
+	bench_result *r = bench_new_result(name, frames, false);
+
+	for(int rep = 0; rep < reps; ++rep) {
+		pru_host_ring_attach();
+
+		bench_timer t;
+		bench_start(&t);
+		for(uint64_t i = 0; i < frames; i += BENCH_PRU_BLOCK) {
+			if(block) {
+				pru_audio_write_block(in + i, BENCH_PRU_BLOCK);
+			}
+			else {
+				for(int k = 0; k < BENCH_PRU_BLOCK; ++k) {
+					pru_audio_write(in[i + k]);
+				}
+			}
+			pru_host_ring_drain();
+		}
+		bench_stop(&t);
+
+		bench_record(r, &t);
+	}
+}
+
+/* Reads from the PRU ring, refilling it before every block. */
+static void
+bench_pru_read(const char *name, dsp_num *out, uint64_t frames, bool block, int reps) {
+	frames -= frames % BENCH_PRU_BLOCK;
+	bench_result *r = bench_new_result(name, frames, false);
+
+	for(int rep = 0; rep < reps; ++rep) {
+		pru_host_ring_attach();
+
+		bench_timer t;
+		bench_start(&t);
+		for(uint64_t i = 0; i < frames; i += BENCH_PRU_BLOCK) {
+			pru_host_ring_fill(BENCH_PRU_BLOCK);
+			if(block) {
+				pru_audio_read_block(out + i, BENCH_PRU_BLOCK);
+			}
+			else {
+				for(int k = 0; k < BENCH_PRU_BLOCK; ++k) {
+					out[i + k] = pru_audio_read();
+				}
+			}
+		}
+		bench_stop(&t);
+
+		bench_sink = out[frames - 1];
+		bench_record(r, &t);
+	}
+}
+
+/* --- Output --- */
+
+static void
+bench_print_table(void) {
+	printf("\n%-28s %12s %14s %10s\n", "case", "ns/sample", "cycles/sample", "rt factor");
+	for(int i = 0; i < result_count; ++i) {
+		const bench_result *r = &results[i];
+
+		printf("%-28s %12.1f ", r->name, bench_ns_per(r));
+		if(cycle_source == BENCH_CYCLES_NONE) printf("%14s ", "-");
+		else printf("%14.1f ", bench_cycles_per(r));
+
+		if(r->per_call) printf("%10s  (per call)\n", "-");
+		else printf("%10.4f\n", bench_rt_factor(r));
+	}
+	printf("\nrt factor: the fraction of the %d Hz deadline (%.1f ns/sample) used; must be < 1\n",
+		SAMPLE_RATE, 1e9 / SAMPLE_RATE);
+	printf("cycles: %s\n", bench_cycle_source_name());
+}
+
+/* Writes a string, escaping the characters JSON requires. */
+static void
+bench_json_string(FILE *f, const char *s) {
+	fputc('"', f);
+	for(; *s; ++s) {
+		if(*s == '"' || *s == '\\') fputc('\\', f);
+		if((unsigned char)*s < 0x20) continue;
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void
+bench_write_json(FILE *f, const char *options, bpf_kernel kernel, int reps) {
+	struct utsname sys_info;
+	uname(&sys_info);
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"target\": ");
+	bench_json_string(f, TARGET_NAME);
+#ifdef HARDWARE
+	fprintf(f, ",\n  \"build\": \"hw\",\n");
+#else
+	fprintf(f, ",\n  \"build\": \"dsptest\",\n");
+#endif
+	fprintf(f, "  \"machine\": ");
+	bench_json_string(f, sys_info.machine);
+	fprintf(f, ",\n  \"compiler\": ");
+	bench_json_string(f, __VERSION__);
+	fprintf(f, ",\n  \"bpf_kernel\": ");
+	bench_json_string(f, bpf_kernel_name(bpf_kernel_resolve(kernel)));
+	fprintf(f, ",\n  \"options\": ");
+	bench_json_string(f, options);
+	fprintf(f, ",\n  \"sample_rate\": %d,\n", SAMPLE_RATE);
+	fprintf(f, "  \"deadline_ns\": %.3f,\n", 1e9 / SAMPLE_RATE);
+	fprintf(f, "  \"cycle_counter\": \"%s\",\n", bench_cycle_source_name());
+	fprintf(f, "  \"reps\": %d,\n", reps);
+	fprintf(f, "  \"results\": [\n");
+
+	for(int i = 0; i < result_count; ++i) {
+		const bench_result *r = &results[i];
+		const char *unit = r->per_call ? "call" : "sample";
+
+		fprintf(f, "    { \"name\": ");
+		bench_json_string(f, r->name);
+		fprintf(f, ", \"%ss\": %llu, \"ns_per_%s\": %.3f", unit, (unsigned long long)r->count, unit, bench_ns_per(r));
+
+		if(cycle_source == BENCH_CYCLES_NONE) fprintf(f, ", \"cycles_per_%s\": null", unit);
+		else fprintf(f, ", \"cycles_per_%s\": %.3f", unit, bench_cycles_per(r));
+
+		if(!r->per_call) fprintf(f, ", \"rt_factor\": %.6f", bench_rt_factor(r));
+
+		fprintf(f, " }%s\n", (i + 1 < result_count) ? "," : "");
+	}
+
+	fprintf(f, "  ]\n}\n");
+}
+
+int main_bench(int argc, char **argv) {
+	const char *json_path = NULL;
+	int reps = 3;
+
+	/* The vocoder options, joined back together for the report. */
+	char options[256] = "";
+
+	vocoder_config cfg;
+	vc_config_default(&cfg);
+
+	for(int i = 2; i < argc; ++i) {
+		if(!strncmp(argv[i], "json=", 5)) {
+			json_path = argv[i] + 5;
+			continue;
+		}
+		if(!strncmp(argv[i], "reps=", 5)) {
+			reps = atoi(argv[i] + 5);
+			if(reps < 1) {
+				puts("bench: reps must be at least 1");
+				return 1;
+			}
+			continue;
+		}
+		if(!strcmp(argv[i], "help")) {
+			printf("usage: %s -bench [json=<file>|json=-] [reps=N] [vocoder options...]\n", argv[0]);
+			vc_config_print_help();
+			return 0;
+		}
+
+		if(!vc_config_parse(&cfg, argv[i])) {
+			printf("usage: %s -bench [json=<file>|json=-] [reps=N] [vocoder options...]\n", argv[0]);
+			vc_config_print_help();
+			return 1;
+		}
+		if(options[0]) strncat(options, " ", sizeof(options) - strlen(options) - 1);
+		strncat(options, argv[i], sizeof(options) - strlen(options) - 1);
+	}
+
+	/* With json=-, stdout is only the JSON. */
+	const bool quiet = json_path && !strcmp(json_path, "-");
+
+	bench_cycles_init();
+
+	/* Synthetic inputs */
+	const uint64_t syn_frames = SAMPLE_RATE * BENCH_SYNTHETIC_SECONDS;
+	bench_input noise = { bench_alloc(syn_frames), bench_alloc(syn_frames), syn_frames };
+	bench_noise(noise.mod, syn_frames);
+	bench_saw(noise.car, syn_frames);
+
+	bench_input silence = { bench_alloc(syn_frames), bench_alloc(syn_frames), syn_frames };
+
+	/* The committed WAVs */
+	uint64_t mod_frames = 0;
+	uint64_t car_frames = 0;
+	uint64_t longer_frames = 0;
+	dsp_num *mod = bench_read_wav("modulator.wav", &mod_frames, quiet);
+	dsp_num *car = bench_read_wav("carrier.wav", &car_frames, quiet);
+	dsp_num *longer = bench_read_wav("longer_test.wav", &longer_frames, quiet);
+
+	bench_input wav = { NULL, NULL, 0 };
+	if(mod && car) {
+		/* As in -ov: the longer of the two, with the shorter one padded. */
+		wav.frames = (mod_frames > car_frames) ? mod_frames : car_frames;
+		wav.mod = bench_alloc(wav.frames);
+		wav.car = bench_alloc(wav.frames);
+		memcpy(wav.mod, mod, mod_frames * sizeof(*mod));
+		memcpy(wav.car, car, car_frames * sizeof(*car));
+	}
+
+	bench_input longer_in = { NULL, NULL, 0 };
+	if(longer) {
+		/* longer_test.wav is a voice recording, so pair it with the carrier
+		 * (or the saw if there isn't one). */
+		longer_in.frames = longer_frames;
+		longer_in.mod = longer;
+		longer_in.car = bench_alloc(longer_frames);
+		if(car) bench_loop_into(longer_in.car, longer_frames, car, car_frames);
+		else bench_saw(longer_in.car, longer_frames);
+	}
+
+	if(!quiet) {
+		printf("running each benchmark %d times (fastest run reported)%s%s\n",
+			reps, options[0] ? ", with " : "", options);
+	}
+
+	if(wav.frames) {
+		bench_vc_process("vc_process/wav", &wav, &cfg, reps);
+		bench_vc_process_block("vc_process_block/wav", &wav, &cfg, reps);
+	}
+	if(longer_in.frames) {
+		bench_vc_process("vc_process/longer_test", &longer_in, &cfg, reps);
+	}
+	bench_vc_process("vc_process/noise", &noise, &cfg, reps);
+	bench_vc_process_block("vc_process_block/noise", &noise, &cfg, reps);
+	bench_vc_process("vc_process/silence", &silence, &cfg, reps);
+	bench_synth_process("synth_process/all_voices", SYNTH_OSC_SINC, cfg.kernel, MAX_SYNTH_VOICES, reps);
+	bench_synth_process("synth_process/four_voices", SYNTH_OSC_SINC, cfg.kernel, 4, reps);
+	bench_synth_process("synth_process/idle", SYNTH_OSC_SINC, cfg.kernel, 0, reps);
+	bench_synth_process("synth_process/polyblep", SYNTH_OSC_POLYBLEP, cfg.kernel, MAX_SYNTH_VOICES, reps);
+	bench_synth_process("synth_process/wavetable", SYNTH_OSC_WAVETABLE, cfg.kernel, MAX_SYNTH_VOICES, reps);
+	bench_bpf_cbq_update(noise.mod, syn_frames, reps);
+	bench_design_bpf(reps);
+
+	bench_pru_check(noise.mod);
+	dsp_num *pru_out = bench_alloc(syn_frames);
+	bench_pru_write("pru_audio_write", noise.mod, syn_frames, false, reps);
+	bench_pru_write("pru_audio_write_block", noise.mod, syn_frames, true, reps);
+	bench_pru_read("pru_audio_read", pru_out, syn_frames, false, reps);
+	bench_pru_read("pru_audio_read_block", pru_out, syn_frames, true, reps);
+	free(pru_out);
+
+	if(!quiet) bench_print_table();
+
+	if(json_path) {
+		FILE *f = quiet ? stdout : fopen(json_path, "w");
+		if(!f) {
+			printf("warning: could not write %s\n", json_path);
+		}
+		else {
+			bench_write_json(f, options, cfg.kernel, reps);
+			if(!quiet) {
+				fclose(f);
+				printf("wrote %s\n", json_path);
+			}
+		}
+	}
+
+	free(noise.mod);
+	free(noise.car);
+	free(silence.mod);
+	free(silence.car);
+	free(mod);
+	free(car);
+	free(longer);
+	free(wav.mod);
+	free(wav.car);
+	free(longer_in.car);
+
+	return 0;
+}
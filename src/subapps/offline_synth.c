@@ -9,10 +9,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 int main_os(int argc, char **argv) {
-	if(argc < 3) {
-		printf("usage: %s -os <output.wav>\n", argv[0]);
+	synth_oscillator oscillator = SYNTH_OSC_SINC;
+	const bool osc_ok = argc < 4
+		|| (!strncmp(argv[3], "osc=", 4) && synth_oscillator_parse(argv[3] + 4, &oscillator));
+	if(argc < 3 || argc > 4 || !osc_ok) {
+		printf("usage: %s -os <output.wav> [osc=sinc|polyblep|wavetable]\n", argv[0]);
 		return 1;
 	}
 
@@ -27,7 +31,7 @@ int main_os(int argc, char **argv) {
 
 	/* Initialize the vocoder */
 	synth syn;
-	synth_init(&syn);
+	synth_init_oscillator(&syn, oscillator);
 
 	audio_params ap;
 	audio_params_default(&ap);
@@ -5,6 +5,7 @@
 
 #include "dsp/vocoder.h"
 #include "wav/wav.h"
+#include "app.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -13,7 +14,8 @@
 
 int main_ov(int argc, char **argv) {
 	if(argc < 5) {
-		printf("usage: %s -ov <modulator.wav (voice)> <carrier.wav (synth)> <output.wav>\n", argv[0]);
+		printf("usage: %s -ov <modulator.wav (voice)> <carrier.wav (synth)> <output.wav> [vocoder options...]\n", argv[0]);
+		vc_config_print_help();
 		return 1;
 	}
 
@@ -44,25 +46,41 @@ int main_ov(int argc, char **argv) {
 
 	printf("output frames = %" PRIu64 "\n", out.frames);
 
-	/* Initialize the vocoder */
+	/* Initialize the vocoder, with any options given after the file names */
+	vocoder_config cfg;
+	vc_config_default(&cfg);
+	if(!vc_config_parse_args(&cfg, argc, argv, 5)) {
+		return 1;
+	}
+
 	vocoder voc;
-	vc_init(&voc);
+	vc_init_config(&voc, &cfg);
+
+	/* Gather the leftmost channel of each input into a contiguous buffer, so
+	 * that the whole file can be run through vc_process_block at once. */
+	dsp_num *m = calloc(out.frames, sizeof(*m));
+	dsp_num *c = calloc(out.frames, sizeof(*c));
+	if(!m || !c) {
+		app_fatal_error("could not allocate vocoder input buffers");
+	}
 
 	uint64_t mi = 0;
 	uint64_t ci = 0;
 
 	for(uint64_t i = 0; i < out.frames; ++i) {
-		dsp_num m = (mi < mod.buffer_length) ? mod.buffer[mi] : 0;
-		//if(i > 44330 && i < 82000) printf("mi = %llu mf = %llu m = %d\n", mi, mod.frames, m);
-		dsp_num c = (ci < car.buffer_length) ? car.buffer[ci] : 0;
-
-		out.buffer[i] = vc_process(&voc, m, c);
+		m[i] = (mi < mod.buffer_length) ? mod.buffer[mi] : 0;
+		c[i] = (ci < car.buffer_length) ? car.buffer[ci] : 0;
 
 		/* Only use the leftmost channel */
 		mi += mod.channels;
 		ci += car.channels;
 	}
 
+	vc_process_block(&voc, m, c, out.buffer, out.frames);
+
+	free(m);
+	free(c);
+
 	wav_write_or_warn(&out, out_fp);
 
 	return 0;
@@ -5,6 +5,7 @@
 #include "dsp/vocoder.h"
 #include "dsp/synth.h"
 #include "wav/wav.h"
+#include "app.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,7 +13,8 @@
 
 int main_ovs(int argc, char **argv) {
 	if(argc < 4) {
-		printf("usage: %s -ovs <modulator.wav (voice)> <output.wav>\n", argv[0]);
+		printf("usage: %s -ovs <modulator.wav (voice)> <output.wav> [vocoder options...]\n", argv[0]);
+		vc_config_print_help();
 		return 1;
 	}
 
@@ -33,9 +35,15 @@ int main_ovs(int argc, char **argv) {
 		1,
 		SAMPLE_RATE);
 
-	/* Initialize the vocoder */
+	/* Initialize the vocoder, with any options given after the file names */
+	vocoder_config cfg;
+	vc_config_default(&cfg);
+	if(!vc_config_parse_args(&cfg, argc, argv, 4)) {
+		return 1;
+	}
+
 	vocoder voc;
-	vc_init(&voc);
+	vc_init_config(&voc, &cfg);
 
 	synth syn;
 	synth_init(&syn);
@@ -49,19 +57,27 @@ int main_ovs(int argc, char **argv) {
 	synth_press(&syn, 12);
 	synth_press(&syn, 28);
 
+	dsp_num *m = calloc(out.frames, sizeof(*m));
+	dsp_num *c = calloc(out.frames, sizeof(*c));
+	if(!m || !c) {
+		app_fatal_error("could not allocate vocoder input buffers");
+	}
+
 	uint64_t mi = 0;
 
 	for(uint64_t i = 0; i < out.frames; ++i) {
-		dsp_num m = (mi < mod.buffer_length) ? mod.buffer[mi] : 0;
-
-		dsp_num c = synth_process(&syn, &ap);
-
-		out.buffer[i] = vc_process(&voc, m, c);
+		m[i] = (mi < mod.buffer_length) ? mod.buffer[mi] : 0;
+		c[i] = synth_process(&syn, &ap);
 
 		/* Only use the leftmost channel */
 		mi += mod.channels;
 	}
 
+	vc_process_block(&voc, m, c, out.buffer, out.frames);
+
+	free(m);
+	free(c);
+
 	wav_write_or_warn(&out, out_fp);
 
 	return 0;
@@ -0,0 +1,170 @@
+/**
+ * Compares the synth's oscillators (see synth_oscillator): how much aliasing
+ * each one produces, and how much each costs.
+ *
+ * Aliasing is measured on a single sustained note at a time, with the noise
+ * off. The spectrum is averaged over Blackman-Harris windowed frames; the bins
+ * around each harmonic below Nyquist count as signal, and everything else
+ * (aliases folded back from above Nyquist, mostly) as aliasing. An alias that
+ * happens to land right on a harmonic is missed, so this is a lower bound.
+ */
+
+#include "dsp/synth.h"
+#include "dsp/fft.h"
+#include "dsp/dsp_perf.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* The analysis frame, and how many of them are averaged. */
+#define OSC_FRAME FFT_MAX_SIZE
+#define OSC_FRAMES 64
+
+/* How many bins either side of a harmonic count as that harmonic. The
+ * Blackman-Harris main lobe is 4 bins wide either side. */
+#define OSC_HARMONIC_BINS 5
+
+/* The samples skipped at the start, for the envelope to settle. */
+#define OSC_SETTLE 4096
+
+/* How long the cost of each oscillator is timed for, in seconds. */
+#define OSC_TIMING_SECONDS 5
+
+/* Below 440 Hz the harmonics are too close together for the frame to resolve
+ * anything between them. */
+static const int osc_notes[] = { 24, 36, 48, 54, 60, 63 };
+#define OSC_NOTE_COUNT (int)(sizeof(osc_notes) / sizeof(osc_notes[0]))
+
+static double
+osc_note_freq(int note) {
+	/* As in synth_init(): note 0 is A2 */
+	return 110.0 * pow(2.0, note / 12.0);
+}
+
+static double
+now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Returns the ratio of the aliasing power to the harmonic power, in dB. */
+static double
+osc_alias_db(synth_oscillator oscillator, int note, const fft_plan *plan, const float *window) {
+	static synth syn;
+	synth_init_oscillator(&syn, oscillator);
+
+	audio_params ap;
+	audio_params_default(&ap);
+	ap.noise_gain = 0;
+	ap.attack = dsp_one;
+
+	synth_press(&syn, note);
+	for(int i = 0; i < OSC_SETTLE; ++i) {
+		synth_process(&syn, &ap);
+	}
+
+	static double power[OSC_FRAME / 2];
+	memset(power, 0, sizeof(power));
+
+	static float complex data[OSC_FRAME];
+	for(int f = 0; f < OSC_FRAMES; ++f) {
+		for(int i = 0; i < OSC_FRAME; ++i) {
+			data[i] = dsp_to_float(synth_process(&syn, &ap)) * window[i];
+		}
+		fft_forward(plan, data);
+		for(int b = 0; b < OSC_FRAME / 2; ++b) {
+			power[b] += crealf(data[b]) * crealf(data[b]) + cimagf(data[b]) * cimagf(data[b]);
+		}
+	}
+
+	/* Sort the bins into harmonics and the rest. DC is neither. */
+	static bool harmonic[OSC_FRAME / 2];
+	memset(harmonic, 0, sizeof(harmonic));
+
+	const double bin_hz = (double)SAMPLE_RATE / OSC_FRAME;
+	const double f0 = osc_note_freq(note);
+	for(double f = f0; f < SAMPLE_RATE / 2.0; f += f0) {
+		const int center = (int)lround(f / bin_hz);
+		for(int b = center - OSC_HARMONIC_BINS; b <= center + OSC_HARMONIC_BINS; ++b) {
+			if(b >= 0 && b < OSC_FRAME / 2) harmonic[b] = true;
+		}
+	}
+
+	double signal = 0;
+	double alias = 0;
+	for(int b = OSC_HARMONIC_BINS + 1; b < OSC_FRAME / 2; ++b) {
+		if(harmonic[b]) signal += power[b];
+		else alias += power[b];
+	}
+	return 10.0 * log10(alias / signal);
+}
+
+/* Returns the time synth_process() takes with every voice playing, in ns per
+ * sample. */
+static double
+osc_cost_ns(synth_oscillator oscillator) {
+	static synth syn;
+	synth_init_oscillator(&syn, oscillator);
+	for(int v = 0; v < MAX_SYNTH_VOICES; ++v) {
+		synth_press(&syn, (v * 7) % NUMBER_OF_NOTES);
+	}
+
+	audio_params ap;
+	audio_params_default(&ap);
+
+	const uint64_t frames = (uint64_t)SAMPLE_RATE * OSC_TIMING_SECONDS;
+	volatile dsp_num sink = 0;
+	const double start = now_seconds();
+	for(uint64_t i = 0; i < frames; ++i) {
+		sink += synth_process(&syn, &ap);
+	}
+	return (now_seconds() - start) * 1e9 / frames;
+}
+
+int main_oscalias(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+
+	static fft_plan plan;
+	fft_plan_init(&plan, OSC_FRAME);
+
+	/* 4 term Blackman-Harris, for its low sidelobes (-92 dB) */
+	static float window[OSC_FRAME];
+	for(int i = 0; i < OSC_FRAME; ++i) {
+		const double x = 2.0 * M_PI * i / OSC_FRAME;
+		window[i] = (float)(0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x));
+	}
+
+	puts("aliasing power relative to the harmonics, one voice, default wave shape:");
+	printf("%6s %10s", "note", "freq (Hz)");
+	for(int o = SYNTH_OSC_SINC; o <= SYNTH_OSC_WAVETABLE; ++o) {
+		printf(" %10s", synth_oscillator_name((synth_oscillator)o));
+	}
+	puts("");
+
+	for(int n = 0; n < OSC_NOTE_COUNT; ++n) {
+		printf("%6d %10.1f", osc_notes[n], osc_note_freq(osc_notes[n]));
+		for(int o = SYNTH_OSC_SINC; o <= SYNTH_OSC_WAVETABLE; ++o) {
+			printf(" %7.1f dB", osc_alias_db((synth_oscillator)o, osc_notes[n], &plan, window));
+		}
+		puts("");
+	}
+
+	printf("\nsynth_process with %d voices, %s kernel:\n", MAX_SYNTH_VOICES,
+		bpf_kernel_name(bpf_kernel_resolve(BPF_KERNEL_AUTO)));
+	const double sinc_ns = osc_cost_ns(SYNTH_OSC_SINC);
+	printf("%10s %8.1f ns/sample\n", synth_oscillator_name(SYNTH_OSC_SINC), sinc_ns);
+	for(int o = SYNTH_OSC_SINC + 1; o <= SYNTH_OSC_WAVETABLE; ++o) {
+		const double ns = osc_cost_ns((synth_oscillator)o);
+		printf("%10s %8.1f ns/sample (%.1fx faster)\n", synth_oscillator_name((synth_oscillator)o),
+			ns, sinc_ns / ns);
+	}
+	printf("\nthe wavetables take %zu bytes\n", synth_wavetable_bytes());
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * Stress tests the pru1_ds ring protocol: a thread plays the PRU's side of the
+ * rings as fast as it can, using the same code as the host stand-in, while the
+ * main thread moves samples through pru_interface.c in blocks of random sizes.
+ *
+ * Every output sample is a running count, and so is every input sample (modulo
+ * the ADC range), so any sample that is lost, repeated, torn or read before it
+ * was written shows up as a mismatch on the other side.
+ */
+
+#include "dsp/dsp.h"
+#include "pru/pru_interface.h"
+#include "pru/pru_host_ring.h"
+#include "telemetry.h"
+
+#include <firmware/firmware.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Input samples count up modulo this, which keeps them in the ADC's range. */
+#define PRS_INPUT_RANGE 65536
+
+/* The largest block the main thread moves, more than a ring so that the block
+ * functions have to split it up. */
+#define PRS_MAX_BLOCK (AUDIO_OUT_RINGBUF_SIZE + AUDIO_OUT_RINGBUF_SIZE / 2)
+
+static volatile bool prs_running;
+
+/* Counted by the PRU side thread. */
+static uint64_t prs_played;
+static uint64_t prs_recorded;
+static uint64_t prs_pru_errors;
+
+static uint32_t
+prs_bit_reverse(uint32_t u) {
+	uint32_t r = 0;
+	for(int i = 0; i < 32; ++i) {
+		r = (r << 1) | (u & 1);
+		u >>= 1;
+	}
+	return r;
+}
+
+static uint32_t
+prs_random(uint32_t *state) {
+	/* xorshift32 */
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static void*
+prs_pru_thread(void *arg) {
+	(void)arg;
+
+	while(prs_running) {
+		bool progress = false;
+
+		uint32_t sample;
+		if(pru_host_ring_play(&sample)) {
+			if(prs_bit_reverse(sample) != (uint32_t)prs_played) {
+				if(prs_pru_errors < 10) {
+					printf("output sample %llu: got %u\n",
+						(unsigned long long)prs_played, prs_bit_reverse(sample));
+				}
+				prs_pru_errors += 1;
+			}
+			prs_played += 1;
+			progress = true;
+		}
+
+		/* The firmware overwrites unread input when the ring is full, which
+		 * the protocol leaves to the ARM side to avoid by keeping up, so only
+		 * record when there is room. */
+		if(pru_audio_in_fill() < AUDIO_IN_RINGBUF_SIZE - 1) {
+			pru_host_ring_record((uint32_t)(prs_recorded % PRS_INPUT_RANGE));
+			prs_recorded += 1;
+			progress = true;
+		}
+
+		/* Give the other side the core if there was nothing to do. */
+		if(!progress) sched_yield();
+	}
+
+	return NULL;
+}
+
+static void
+prs_usage(const char *name) {
+	printf("usage: %s -ringstress [seconds=N] [seed=N] [wait=spin|yield|hybrid|sleep]\n"
+		"  seconds=N: how long to run for (default 3)\n"
+		"  seed=N: seed for the block sizes (default 1)\n"
+		"  wait=spin|yield|hybrid|sleep: how to wait for the other side (default yield)\n", name);
+}
+
+int main_prs(int argc, char **argv) {
+	int seconds = 3;
+	uint32_t seed = 1;
+	pru_wait_policy wait_policy = PRU_WAIT_YIELD;
+
+	for(int i = 2; i < argc; ++i) {
+		if(!strncmp(argv[i], "seconds=", 8)) {
+			seconds = atoi(argv[i] + 8);
+			continue;
+		}
+		if(!strncmp(argv[i], "seed=", 5)) {
+			seed = (uint32_t)strtoul(argv[i] + 5, NULL, 0);
+			if(seed == 0) seed = 1;
+			continue;
+		}
+		if(!strncmp(argv[i], "wait=", 5) && pru_wait_policy_parse(argv[i] + 5, &wait_policy)) {
+			continue;
+		}
+		prs_usage(argv[0]);
+		return 1;
+	}
+
+	pru_host_ring_attach();
+	pru_audio_set_wait_policy(wait_policy);
+
+	prs_running = true;
+	pthread_t pru_thread;
+	if(pthread_create(&pru_thread, NULL, prs_pru_thread, NULL) != 0) {
+		puts("could not start the PRU side thread");
+		return 1;
+	}
+
+	static int32_t block[PRS_MAX_BLOCK];
+	uint64_t written = 0;
+	uint64_t read = 0;
+	uint64_t errors = 0;
+	uint64_t bad_fills = 0;
+
+	const uint64_t end_ns = telemetry_now_ns() + seconds * 1000000000ull;
+	while(telemetry_now_ns() < end_ns) {
+		const uint32_t r = prs_random(&seed);
+		const uint32_t n = 1 + (r >> 8) % PRS_MAX_BLOCK;
+
+		/* Mostly blocks, sometimes the per sample functions. */
+		const bool single = (r & 0xf) == 0;
+
+		if(r & 0x10) {
+			for(uint32_t i = 0; i < n; ++i) {
+				block[i] = (int32_t)(uint32_t)(written + i);
+			}
+			if(single) {
+				for(uint32_t i = 0; i < n; ++i) pru_audio_write(block[i]);
+			}
+			else {
+				pru_audio_write_block(block, n);
+			}
+			written += n;
+		}
+		else {
+			if(single) {
+				for(uint32_t i = 0; i < n; ++i) block[i] = pru_audio_read();
+			}
+			else {
+				pru_audio_read_block(block, n);
+			}
+
+			for(uint32_t i = 0; i < n; ++i) {
+				const int32_t expect = (int32_t)((read + i) % PRS_INPUT_RANGE);
+				const int32_t got = block[i] / PRU_AUDIO_IN_GAIN + PRU_AUDIO_IN_CENTER;
+				if(got != expect) {
+					if(errors < 10) {
+						printf("input sample %llu: got %d\n",
+							(unsigned long long)(read + i), got);
+					}
+					errors += 1;
+				}
+			}
+			read += n;
+		}
+
+		/* Whatever the other side is doing, the fill levels can never be
+		 * more than a ring, less the slot that is always left empty. */
+		if(pru_audio_in_fill() > AUDIO_IN_RINGBUF_SIZE - 1
+			|| pru_audio_out_fill() > AUDIO_OUT_RINGBUF_SIZE - 1) {
+			bad_fills += 1;
+		}
+	}
+
+	prs_running = false;
+	pthread_join(pru_thread, NULL);
+
+	pru_audio_stats stats;
+	pru_audio_take_stats(&stats);
+
+	printf("output: %llu samples written, %llu played, %llu wrong\n",
+		(unsigned long long)written, (unsigned long long)prs_played,
+		(unsigned long long)prs_pru_errors);
+	printf("input: %llu samples recorded, %llu read, %llu wrong\n",
+		(unsigned long long)prs_recorded, (unsigned long long)read,
+		(unsigned long long)errors);
+	printf("fill levels out of range: %llu, PRU side idle: %u underruns\n",
+		(unsigned long long)bad_fills, stats.underruns);
+
+	const bool ok = errors == 0 && prs_pru_errors == 0 && bad_fills == 0;
+	puts(ok ? "ring stress test passed" : "ring stress test FAILED");
+	return ok ? 0 : 1;
+}
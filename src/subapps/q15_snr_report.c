@@ -0,0 +1,189 @@
+/**
+ * Compares the Q15 filterbank (mod_precision=q15 / car_precision=q15) against
+ * the Q29 one on a pair of input files, so that we can decide whether the extra
+ * SIMD lanes are worth the noise.
+ *
+ * Reports the SNR of every band's filter output on its own, then the SNR and
+ * speed of the vocoder output with each side (and both) in Q15.
+ */
+
+#include "dsp/vocoder.h"
+#include "wav/wav.h"
+#include "app.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Accumulates the power of a reference signal and of the error against it. */
+typedef struct {
+	double signal;
+	double noise;
+} snr_acc;
+
+static void
+snr_add(snr_acc *acc, dsp_num ref, dsp_num test) {
+	const double r = dsp_to_float(ref);
+	const double e = r - dsp_to_float(test);
+	acc->signal += r * r;
+	acc->noise  += e * e;
+}
+
+static double
+snr_db(const snr_acc *acc) {
+	if(acc->noise == 0) return INFINITY;
+	return 10.0 * log10(acc->signal / acc->noise);
+}
+
+static double
+now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Runs the input through the Q29 bank and the Q15 bank of the same vocoder
+ * side, and accumulates the SNR of each band. */
+static void
+band_snr(const bpf_bank *bank_init, const bpf_bank_q15 *bank_q15_init, bpf_kernel kernel,
+		const dsp_num *in, uint64_t frames, snr_acc *acc) {
+	static bpf_bank bank;
+	static bpf_bank_q15 bank_q15;
+	bank = *bank_init;
+	bank_q15 = *bank_q15_init;
+
+	bpf_bank_update_fn update = bpf_kernel_get(kernel);
+	bpf_bank_q15_update_fn update_q15 = bpf_kernel_get_q15(kernel);
+
+	dsp_num x[3] = { 0 };
+	dsp_q15 x_q15[3] = { 0 };
+
+	for(uint64_t i = 0; i < frames; ++i) {
+		x[2] = x[1];
+		x[1] = x[0];
+		x[0] = in[i] * INPUT_EXTRA_MUL;
+
+		x_q15[2] = x_q15[1];
+		x_q15[1] = x_q15[0];
+		x_q15[0] = bpf_q15_from_dsp(x[0]);
+
+		dsp_num out[BPF_BANK_MAX_BANDS];
+		dsp_q15 out_q15[BPF_BANK_Q15_MAX_BANDS];
+		update(&bank, x, out);
+		update_q15(&bank_q15, x_q15, out_q15);
+
+		for(int b = 0; b < bank_q15_init->bands && b < bank_init->bands; ++b) {
+			snr_add(&acc[b], out[b], bpf_q15_to_dsp(out_q15[b], bank_q15.out_scale[b]));
+		}
+	}
+}
+
+/* Renders the whole input through a vocoder with the given config. Returns the
+ * time taken per sample, in ns. */
+static double
+render(const vocoder_config *cfg, const dsp_num *m, const dsp_num *c, dsp_num *out, uint64_t frames) {
+	static vocoder voc;
+	vc_init_config(&voc, cfg);
+
+	const double start = now_seconds();
+	vc_process_block(&voc, m, c, out, frames);
+	const double end = now_seconds();
+
+	return (end - start) * 1e9 / frames;
+}
+
+int main_qsnr(int argc, char **argv) {
+	if(argc < 4) {
+		printf("usage: %s -q15snr <modulator.wav> <carrier.wav> [vocoder options...]\n", argv[0]);
+		vc_config_print_help();
+		return 1;
+	}
+
+	wav_io mod;
+	wav_io car;
+	wav_read_or_die(&mod, argv[2]);
+	wav_read_or_die(&car, argv[3]);
+
+	vocoder_config cfg;
+	vc_config_default(&cfg);
+	if(!vc_config_parse_args(&cfg, argc, argv, 4)) {
+		return 1;
+	}
+
+	/* The Q15 banks only exist for layout=bank. */
+	cfg.layout = VC_LAYOUT_BANK;
+
+	const uint64_t frames = (mod.frames > car.frames) ? mod.frames : car.frames;
+
+	/* Gather the leftmost channel of each input, as in -ov. */
+	dsp_num *m = calloc(frames, sizeof(*m));
+	dsp_num *c = calloc(frames, sizeof(*c));
+	dsp_num *ref = calloc(frames, sizeof(*ref));
+	dsp_num *test = calloc(frames, sizeof(*test));
+	if(!m || !c || !ref || !test) {
+		app_fatal_error("could not allocate buffers");
+	}
+
+	for(uint64_t i = 0; i < frames; ++i) {
+		m[i] = (i < mod.frames) ? mod.buffer[i * mod.channels] : 0;
+		c[i] = (i < car.frames) ? car.buffer[i * car.channels] : 0;
+	}
+
+	/* Design both versions of both banks. */
+	static vocoder voc;
+	vocoder_config design_cfg = cfg;
+	design_cfg.mod_precision = VC_PRECISION_Q15;
+	design_cfg.car_precision = VC_PRECISION_Q15;
+	vc_init_config(&voc, &design_cfg);
+
+	snr_acc mod_acc[BPF_BANK_MAX_BANDS] = { 0 };
+	snr_acc car_acc[BPF_BANK_MAX_BANDS] = { 0 };
+	/* Only over each file's own length, so the zero padding doesn't count. */
+	band_snr(&voc.mod_bank, &voc.mod_bank_q15, cfg.kernel, m, mod.frames, mod_acc);
+	band_snr(&voc.car_bank, &voc.car_bank_q15, cfg.kernel, c, car.frames, car_acc);
+
+	printf("kernel: %s, %d bands, %d stages\n\n",
+		bpf_kernel_name(bpf_kernel_resolve(cfg.kernel)), voc.bands, voc.stages);
+
+	puts("band  center (Hz)  modulator SNR (dB)  carrier SNR (dB)");
+	for(int b = 0; b < voc.bands; ++b) {
+		/* The same band spacing as vc_init_config. */
+		const double center = 8000.0 * (b + 1) / (voc.bands + 1);
+		printf("%4d  %11.0f  %18.1f  %16.1f\n", b, center, snr_db(&mod_acc[b]), snr_db(&car_acc[b]));
+	}
+
+	/* The vocoder output, with the reference first. */
+	vocoder_config run = cfg;
+	run.mod_precision = VC_PRECISION_Q29;
+	run.car_precision = VC_PRECISION_Q29;
+	const double ref_ns = render(&run, m, c, ref, frames);
+
+	puts("\nmod  car  output SNR (dB)  ns/sample");
+	printf("q29  q29  %15s  %9.1f\n", "(reference)", ref_ns);
+
+	for(int k = 1; k < 4; ++k) {
+		run.mod_precision = (k & 1) ? VC_PRECISION_Q15 : VC_PRECISION_Q29;
+		run.car_precision = (k & 2) ? VC_PRECISION_Q15 : VC_PRECISION_Q29;
+
+		const double ns = render(&run, m, c, test, frames);
+
+		snr_acc acc = { 0 };
+		for(uint64_t i = 0; i < frames; ++i) {
+			snr_add(&acc, ref[i], test[i]);
+		}
+
+		printf("%s  %s  %15.1f  %9.1f\n",
+			(k & 1) ? "q15" : "q29",
+			(k & 2) ? "q15" : "q29",
+			snr_db(&acc), ns);
+	}
+
+	free(m);
+	free(c);
+	free(ref);
+	free(test);
+
+	return 0;
+}
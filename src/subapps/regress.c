@@ -0,0 +1,500 @@
+/**
+ * Golden output regression tests for the DSP code.
+ *
+ * Renders a fixed set of cases (the same pipelines as -ov, -ovs and -os, on the
+ * committed WAVs, with various vocoder options) and compares them against the
+ * reference outputs stored in regress/. Each case is either bit-exact with its
+ * reference (at the precision of the stored 32-bit float WAV), or we report the
+ * maximum error and the SNR overall and in each band of the vocoder's default
+ * filterbank.
+ *
+ * Whether a difference is acceptable depends on the mode of the case (see
+ * regress_mode): by default everything must be bit-exact except engine=fft,
+ * which uses floating point and may differ slightly between targets. The
+ * tolerances can be changed on the command line, e.g. tol.q15=30, so that a
+ * faster approximate path can be accepted or rejected mechanically.
+ *
+ * -regress record rewrites the references from the current code, and should
+ * only be run when a change in the output is intended.
+ */
+
+#include "dsp/vocoder.h"
+#include "dsp/synth.h"
+#include "dsp/dsp_perf.h"
+#include "wav/wav.h"
+#include "app.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* The length of every rendered case. Kept short so the references stay small. */
+#define REGRESS_SECONDS 2
+
+#define REGRESS_DEFAULT_DIR "regress"
+
+/* Which of the offline subapps a case mirrors. */
+typedef enum {
+	/* -ov: modulator and carrier WAVs through vc_process_block. */
+	REGRESS_OV,
+	/* -ovs: modulator WAV, with the synth as the carrier. */
+	REGRESS_OVS,
+	/* -os: just the synth. */
+	REGRESS_OS,
+} regress_pipeline;
+
+/* The modes that tolerances are given for. */
+typedef enum {
+	/* engine=iir with dsp_num filters (every layout, form and rate). */
+	REGRESS_MODE_IIR,
+	/* engine=iir with mod_precision=q15 and/or car_precision=q15. */
+	REGRESS_MODE_Q15,
+	/* engine=fft. */
+	REGRESS_MODE_FFT,
+	/* The synth on its own. */
+	REGRESS_MODE_SYNTH,
+
+	REGRESS_MODE_COUNT,
+} regress_mode;
+
+static const char *regress_mode_names[REGRESS_MODE_COUNT] = {
+	"iir", "q15", "fft", "synth",
+};
+
+/* The minimum SNR (in dB) accepted for each mode, or INFINITY if the output
+ * must be bit-exact. */
+static double regress_tolerance[REGRESS_MODE_COUNT] = {
+	INFINITY, INFINITY, 100.0, INFINITY,
+};
+
+typedef struct {
+	const char *name;
+	regress_pipeline pipeline;
+	const char *mod_path;
+	const char *car_path;
+
+	/* Vocoder options, separated by spaces. */
+	const char *options;
+
+	/* Render with vc_process one sample at a time, instead of
+	 * vc_process_block. */
+	bool per_sample;
+
+	/* The reference to compare against, if it is shared with another case.
+	 * Otherwise the case's own name is used. */
+	const char *ref;
+} regress_case;
+
+static const regress_case regress_cases[] = {
+	{ "ov_default",        REGRESS_OV,  "modulator.wav",   "carrier.wav", "",                  false, NULL },
+	{ "ov_per_sample",     REGRESS_OV,  "modulator.wav",   "carrier.wav", "",                  true,  "ov_default" },
+	{ "ov_bank",           REGRESS_OV,  "modulator.wav",   "carrier.wav", "layout=bank",       false, "ov_default" },
+	{ "ov_bank_scalar",    REGRESS_OV,  "modulator.wav",   "carrier.wav", "layout=bank kernel=scalar", false, "ov_default" },
+	{ "ov_tdf2",           REGRESS_OV,  "modulator.wav",   "carrier.wav", "form=tdf2",         false, NULL },
+	{ "ov_half",           REGRESS_OV,  "modulator.wav",   "carrier.wav", "rate=half",         false, NULL },
+	{ "ov_multi",          REGRESS_OV,  "modulator.wav",   "carrier.wav", "rate=multi",        false, NULL },
+	{ "ov_bands16_2",      REGRESS_OV,  "modulator.wav",   "carrier.wav", "bands=16 stages=2", false, NULL },
+	{ "ov_bands40_6",      REGRESS_OV,  "modulator.wav",   "carrier.wav", "bands=40 stages=6", false, NULL },
+	{ "ov_bands40_6_bank", REGRESS_OV,  "modulator.wav",   "carrier.wav", "bands=40 stages=6 layout=bank", false, "ov_bands40_6" },
+	{ "ov_q15",            REGRESS_OV,  "modulator.wav",   "carrier.wav", "layout=bank mod_precision=q15 car_precision=q15", false, NULL },
+	{ "ov_fft",            REGRESS_OV,  "modulator.wav",   "carrier.wav", "engine=fft",        false, NULL },
+	{ "ov_longer_test",    REGRESS_OV,  "longer_test.wav", "carrier.wav", "",                  false, NULL },
+	{ "ovs_default",       REGRESS_OVS, "modulator.wav",   NULL,          "",                  false, NULL },
+	{ "os_default",        REGRESS_OS,  NULL,              NULL,          "",                  false, NULL },
+};
+
+#define REGRESS_CASE_COUNT (sizeof(regress_cases) / sizeof(regress_cases[0]))
+
+/* --- Rendering --- */
+
+/* Reads the first frames of the leftmost channel of a WAV file, padded with
+ * zeros. */
+static void
+regress_read_input(const char *path, dsp_num *out, uint64_t frames) {
+	wav_io io;
+	wav_read_or_die(&io, path);
+
+	for(uint64_t i = 0; i < frames; ++i) {
+		out[i] = (i < io.frames) ? io.buffer[i * io.channels] : 0;
+	}
+
+	free(io.buffer);
+}
+
+/* The notes played by -ovs and -os. */
+static void
+regress_synth_start(synth *syn) {
+	synth_init(syn);
+	synth_press(syn, 0);
+	synth_press(syn, 7);
+	synth_press(syn, 12);
+	synth_press(syn, 28);
+}
+
+/* Parses the space separated options of a case into cfg. */
+static void
+regress_parse_options(const regress_case *rc, vocoder_config *cfg) {
+	char options[256];
+	snprintf(options, sizeof(options), "%s", rc->options);
+
+	vc_config_default(cfg);
+	for(char *opt = strtok(options, " "); opt; opt = strtok(NULL, " ")) {
+		if(!vc_config_parse(cfg, opt)) {
+			app_fatal_error("regress: bad option in a test case");
+		}
+	}
+}
+
+static regress_mode
+regress_mode_of(const regress_case *rc, const vocoder_config *cfg) {
+	if(rc->pipeline == REGRESS_OS) return REGRESS_MODE_SYNTH;
+	if(cfg->engine == VC_ENGINE_FFT) return REGRESS_MODE_FFT;
+	if(cfg->mod_precision == VC_PRECISION_Q15 || cfg->car_precision == VC_PRECISION_Q15) {
+		return REGRESS_MODE_Q15;
+	}
+	return REGRESS_MODE_IIR;
+}
+
+/* Renders a case into out (frames long). */
+static void
+regress_render(const regress_case *rc, const vocoder_config *cfg, dsp_num *out, uint64_t frames) {
+	static vocoder voc;
+	static synth syn;
+
+	audio_params ap;
+	audio_params_default(&ap);
+
+	if(rc->pipeline == REGRESS_OS) {
+		/* The envelope -os plays its notes with (see offline_synth.c). */
+		ap.attack = dsp_from_double(0.00001);
+		ap.decay = dsp_from_double(1);
+		ap.sustain = dsp_from_double(0.0);
+
+		regress_synth_start(&syn);
+		for(uint64_t i = 0; i < frames; ++i) {
+			out[i] = synth_process(&syn, &ap);
+		}
+		return;
+	}
+
+	dsp_num *m = calloc(frames, sizeof(*m));
+	dsp_num *c = calloc(frames, sizeof(*c));
+	if(!m || !c) {
+		app_fatal_error("regress: could not allocate input buffers");
+	}
+
+	regress_read_input(rc->mod_path, m, frames);
+	if(rc->pipeline == REGRESS_OVS) {
+		regress_synth_start(&syn);
+		for(uint64_t i = 0; i < frames; ++i) {
+			c[i] = synth_process(&syn, &ap);
+		}
+	}
+	else {
+		regress_read_input(rc->car_path, c, frames);
+	}
+
+	vc_init_config(&voc, cfg);
+	if(rc->per_sample) {
+		for(uint64_t i = 0; i < frames; ++i) {
+			out[i] = vc_process(&voc, m[i], c[i]);
+		}
+	}
+	else {
+		vc_process_block(&voc, m, c, out, frames);
+	}
+
+	free(m);
+	free(c);
+}
+
+/* --- Comparison --- */
+
+/* A double precision copy of one band of the default filterbank, used to
+ * split the reference and the error into bands. */
+typedef struct {
+	double a1[BPF_MAX_STAGES];
+	double a2[BPF_MAX_STAGES];
+	double scale;
+	double x[BPF_MAX_STAGES][3];
+	double y[BPF_MAX_STAGES][3];
+} regress_band;
+
+static void
+regress_band_init(regress_band *band, int index) {
+	const double fw = 8000.0 / SAMPLE_RATE / (VOCODER_BANDS + 1);
+
+	bpf_cascaded_biquad cbq;
+	design_bpf(&cbq, fw * (index + 1), fw, BPF_DEFAULT_STAGES);
+
+	memset(band, 0, sizeof(*band));
+	for(int s = 0; s < BPF_DEFAULT_STAGES; ++s) {
+		band->a1[s] = dsp_to_float(cbq.biquads[s].a1);
+		band->a2[s] = dsp_to_float(cbq.biquads[s].a2);
+	}
+	band->scale = dsp_to_float(cbq.scale);
+}
+
+/* The same cascade as bpf_cbq_update (including the input gain of 2 on every
+ * stage after the first), in double precision. */
+static double
+regress_band_update(regress_band *band, double in) {
+	for(int s = 0; s < BPF_DEFAULT_STAGES; ++s) {
+		double *x = band->x[s];
+		double *y = band->y[s];
+
+		x[2] = x[1];
+		x[1] = x[0];
+		x[0] = (s == 0) ? in * band->scale : in * 2;
+
+		const double b1 = (s & 1) ? -2 : 2;
+		y[2] = y[1];
+		y[1] = y[0];
+		y[0] = x[0] + b1 * x[1] + x[2] - band->a1[s] * y[1] - band->a2[s] * y[2];
+
+		in = y[0];
+	}
+	return in;
+}
+
+static double
+regress_snr_db(double signal, double noise) {
+	if(noise == 0) return INFINITY;
+	if(signal == 0) return -INFINITY;
+	return 10.0 * log10(signal / noise);
+}
+
+typedef struct {
+	bool exact;
+	double max_abs;
+	double snr;
+	double band_snr[VOCODER_BANDS];
+} regress_diff;
+
+static void
+regress_compare(const dsp_num *ref, const dsp_num *test, uint64_t frames, regress_diff *diff) {
+	static regress_band ref_bands[VOCODER_BANDS];
+	static regress_band err_bands[VOCODER_BANDS];
+
+	double band_signal[VOCODER_BANDS] = { 0 };
+	double band_noise[VOCODER_BANDS] = { 0 };
+	for(int b = 0; b < VOCODER_BANDS; ++b) {
+		regress_band_init(&ref_bands[b], b);
+		regress_band_init(&err_bands[b], b);
+	}
+
+	diff->exact = true;
+	diff->max_abs = 0;
+
+	double signal = 0;
+	double noise = 0;
+	for(uint64_t i = 0; i < frames; ++i) {
+		if(ref[i] != test[i]) diff->exact = false;
+
+		const double r = dsp_to_float(ref[i]);
+		const double e = r - dsp_to_float(test[i]);
+		if(fabs(e) > diff->max_abs) diff->max_abs = fabs(e);
+
+		signal += r * r;
+		noise += e * e;
+
+		/* The filters are linear, so filtering the error gives the error of
+		 * each band. */
+		for(int b = 0; b < VOCODER_BANDS; ++b) {
+			const double rb = regress_band_update(&ref_bands[b], r);
+			const double eb = regress_band_update(&err_bands[b], e);
+			band_signal[b] += rb * rb;
+			band_noise[b] += eb * eb;
+		}
+	}
+
+	diff->snr = regress_snr_db(signal, noise);
+	for(int b = 0; b < VOCODER_BANDS; ++b) {
+		diff->band_snr[b] = regress_snr_db(band_signal[b], band_noise[b]);
+	}
+}
+
+/* --- Main --- */
+
+static void
+regress_usage(const char *argv0) {
+	printf("usage: %s -regress [record|check] [dir=<dir>] [only=<case>] [tol.<mode>=exact|<min SNR dB>...]\n", argv0);
+	printf("  record: render every case and write the references to dir (default " REGRESS_DEFAULT_DIR ")\n");
+	printf("  check:  render every case and compare against the references (default)\n");
+	printf("  modes:");
+	for(int m = 0; m < REGRESS_MODE_COUNT; ++m) {
+		printf(" %s", regress_mode_names[m]);
+	}
+	printf("\n  cases:");
+	for(size_t i = 0; i < REGRESS_CASE_COUNT; ++i) {
+		printf(" %s", regress_cases[i].name);
+	}
+	printf("\n");
+}
+
+/* Parses a "tol.<mode>=<value>" option. */
+static bool
+regress_parse_tolerance(const char *option) {
+	for(int m = 0; m < REGRESS_MODE_COUNT; ++m) {
+		const size_t len = strlen(regress_mode_names[m]);
+		if(strncmp(option + 4, regress_mode_names[m], len) || option[4 + len] != '=') continue;
+
+		const char *value = option + 4 + len + 1;
+		if(!strcmp(value, "exact")) {
+			regress_tolerance[m] = INFINITY;
+			return true;
+		}
+
+		char *end;
+		const double db = strtod(value, &end);
+		if(end == value || *end) return false;
+
+		regress_tolerance[m] = db;
+		return true;
+	}
+	return false;
+}
+
+int main_regress(int argc, char **argv) {
+	bool record = false;
+	const char *dir = REGRESS_DEFAULT_DIR;
+	const char *only = NULL;
+
+	for(int i = 2; i < argc; ++i) {
+		if(!strcmp(argv[i], "record")) {
+			record = true;
+		}
+		else if(!strcmp(argv[i], "check")) {
+			record = false;
+		}
+		else if(!strncmp(argv[i], "dir=", 4)) {
+			dir = argv[i] + 4;
+		}
+		else if(!strncmp(argv[i], "only=", 5)) {
+			only = argv[i] + 5;
+		}
+		else if(!strncmp(argv[i], "tol.", 4) && regress_parse_tolerance(argv[i])) {
+			/* parsed */
+		}
+		else {
+			regress_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(record && mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		printf("regress: could not create %s\n", dir);
+		return 1;
+	}
+
+	const uint64_t frames = SAMPLE_RATE * REGRESS_SECONDS;
+	dsp_num *out = calloc(frames, sizeof(*out));
+	dsp_num *ref = calloc(frames, sizeof(*ref));
+	if(!out || !ref) {
+		app_fatal_error("regress: could not allocate output buffers");
+	}
+
+	int failures = 0;
+	int ran = 0;
+
+	for(size_t i = 0; i < REGRESS_CASE_COUNT; ++i) {
+		const regress_case *rc = &regress_cases[i];
+		if(only && strcmp(only, rc->name)) continue;
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s.wav", dir, rc->ref ? rc->ref : rc->name);
+
+		vocoder_config cfg;
+		regress_parse_options(rc, &cfg);
+		const regress_mode mode = regress_mode_of(rc, &cfg);
+
+		regress_render(rc, &cfg, out, frames);
+		ran += 1;
+
+		/* Round through float, the same as writing and reading the WAV. */
+		for(uint64_t k = 0; k < frames; ++k) {
+			out[k] = dsp_from_double(dsp_to_float(out[k]));
+		}
+
+		if(record) {
+			/* Cases that share a reference only check it. */
+			if(rc->ref) continue;
+
+			wav_io io = { out, frames, 1, SAMPLE_RATE, frames };
+			wav_write_or_warn(&io, path);
+			printf("%-18s recorded %s\n", rc->name, path);
+			continue;
+		}
+
+		FILE *f = fopen(path, "rb");
+		if(!f) {
+			printf("%-18s FAIL: no reference %s (run -regress record)\n", rc->name, path);
+			failures += 1;
+			continue;
+		}
+		fclose(f);
+
+		wav_io ref_io;
+		wav_read_or_die(&ref_io, path);
+		for(uint64_t k = 0; k < frames; ++k) {
+			ref[k] = (k < ref_io.frames) ? ref_io.buffer[k * ref_io.channels] : 0;
+		}
+		const bool length_ok = (ref_io.frames == frames);
+		free(ref_io.buffer);
+
+		regress_diff diff;
+		regress_compare(ref, out, frames, &diff);
+
+		const double tol = regress_tolerance[mode];
+		const bool pass = length_ok && (diff.exact || (!isinf(tol) && diff.snr >= tol));
+		if(!pass) failures += 1;
+
+		if(diff.exact) {
+			printf("%-18s %-5s %-52s %s\n", rc->name, regress_mode_names[mode], "bit-exact",
+				length_ok ? "PASS" : "FAIL (reference length differs)");
+			continue;
+		}
+
+		/* Find the worst band, for the summary. */
+		int worst = 0;
+		for(int b = 1; b < VOCODER_BANDS; ++b) {
+			if(diff.band_snr[b] < diff.band_snr[worst]) worst = b;
+		}
+		const double band_hz = 8000.0 * (worst + 1) / (VOCODER_BANDS + 1);
+
+		char summary[128];
+		snprintf(summary, sizeof(summary), "max_abs %.3g, SNR %.1f dB (worst band %.1f dB @ %.0f Hz)",
+			diff.max_abs, diff.snr, diff.band_snr[worst], band_hz);
+
+		char tol_text[32];
+		if(isinf(tol)) snprintf(tol_text, sizeof(tol_text), "needs exact");
+		else snprintf(tol_text, sizeof(tol_text), "needs >= %.1f dB", tol);
+
+		printf("%-18s %-5s %-52s %s (%s)\n", rc->name, regress_mode_names[mode], summary,
+			pass ? "PASS" : "FAIL", tol_text);
+
+		printf("    band SNR (dB):");
+		for(int b = 0; b < VOCODER_BANDS; ++b) {
+			if(b % 7 == 0) printf("\n   ");
+			printf(" %4.0fHz %6.1f", 8000.0 * (b + 1) / (VOCODER_BANDS + 1), diff.band_snr[b]);
+		}
+		printf("\n");
+	}
+
+	free(out);
+	free(ref);
+
+	if(ran == 0) {
+		printf("regress: no case named %s\n", only);
+		return 1;
+	}
+	if(!record) {
+		printf("\n%d of %d cases passed\n", ran - failures, ran);
+	}
+
+	return failures ? 1 : 0;
+}
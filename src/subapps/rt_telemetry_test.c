@@ -0,0 +1,158 @@
+/**
+ * Runs the main_app audio loop (without the buttons and knobs) against the host
+ * stand-in for PRU 1, so that the loop telemetry can be checked off-hardware.
+ *
+ * The telemetry summary is also logged once a second through the log ring, as
+ * main_app does.
+ *
+ * stall=N busy-waits for N microseconds once a second, which should show up as
+ * deadline misses and, if long enough to drain the output ring, underruns.
+ */
+
+#define _GNU_SOURCE /* RUSAGE_THREAD */
+
+#include "dsp/vocoder.h"
+#include "dsp/synth.h"
+#include "pru/pru_interface.h"
+#include "pru/pru_host_ring.h"
+#include "telemetry.h"
+#include "log_ring.h"
+#include "app.h"
+
+#include <firmware/firmware.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+/* The same as main_app */
+#define RTT_BLOCK_SIZE 16
+
+static void
+rtt_usage(const char *name) {
+	printf("usage: %s -rtt [seconds=N] [stall=N] [wait=spin|yield|hybrid|sleep] [vocoder options...]\n"
+		"  seconds=N: how long to run for (default 5)\n"
+		"  stall=N: busy-wait for N microseconds once a second (default 0)\n"
+		"  wait=spin|yield|hybrid|sleep: how to wait for the PRU, as in -app (default hybrid)\n", name);
+	vc_config_print_help();
+}
+
+int main_rtt(int argc, char **argv) {
+	int seconds = 5;
+	int stall_us = 0;
+	pru_wait_policy wait_policy = PRU_WAIT_HYBRID;
+
+	vocoder_config cfg;
+	vc_config_default(&cfg);
+
+	for(int i = 2; i < argc; ++i) {
+		if(!strncmp(argv[i], "seconds=", 8)) {
+			seconds = atoi(argv[i] + 8);
+			continue;
+		}
+		if(!strncmp(argv[i], "stall=", 6)) {
+			stall_us = atoi(argv[i] + 6);
+			continue;
+		}
+		if(!strncmp(argv[i], "wait=", 5) && pru_wait_policy_parse(argv[i] + 5, &wait_policy)) {
+			continue;
+		}
+		if(!strcmp(argv[i], "help") || !vc_config_parse(&cfg, argv[i])) {
+			rtt_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	vocoder voc;
+	vc_init_config(&voc, &cfg);
+
+	synth syn;
+	synth_init(&syn);
+
+	audio_params params;
+	audio_params_default(&params);
+
+	synth_press(&syn, 0);
+	synth_press(&syn, 7);
+	synth_press(&syn, 12);
+
+	pru_host_ring_start();
+	pru_audio_set_wait_policy(wait_policy);
+	pru_audio_prepare_writing();
+	pru_audio_prepare_reading();
+
+	const uint64_t starved_before = pru_host_ring_starved_periods();
+
+	telemetry tel;
+	telemetry_init(&tel, RTT_BLOCK_SIZE, AUDIO_OUT_RINGBUF_SIZE);
+	const uint64_t end_ns = tel.start_ns + seconds * 1000000000ull;
+	uint64_t next_stall_ns = tel.start_ns + 1000000000ull;
+	uint64_t next_post_ns = tel.start_ns + 1000000000ull;
+
+	log_ring_start(stdout);
+
+	pru_audio_stats stats;
+	pru_audio_take_stats(&stats);
+
+	dsp_num mod_block[RTT_BLOCK_SIZE];
+	dsp_num car_block[RTT_BLOCK_SIZE];
+	dsp_num out_block[RTT_BLOCK_SIZE];
+
+	for(;;) {
+		const uint64_t block_start_ns = telemetry_now_ns();
+		if(block_start_ns >= end_ns) break;
+
+		const uint32_t in_fill = pru_audio_in_fill();
+
+		pru_audio_read_block(mod_block, RTT_BLOCK_SIZE);
+		for(int k = 0; k < RTT_BLOCK_SIZE; ++k) {
+			car_block[k] = synth_process(&syn, &params);
+		}
+
+		vc_process_block(&voc, mod_block, car_block, out_block, RTT_BLOCK_SIZE);
+
+		if(stall_us > 0 && block_start_ns >= next_stall_ns) {
+			const uint64_t until = telemetry_now_ns() + stall_us * 1000ull;
+			while(telemetry_now_ns() < until) { }
+			next_stall_ns += 1000000000ull;
+		}
+
+		const uint32_t out_fill = pru_audio_out_fill();
+
+		for(int k = 0; k < RTT_BLOCK_SIZE; ++k) {
+			out_block[k] = dsp_mul(out_block[k], params.output_gain);
+		}
+		pru_audio_write_block(out_block, RTT_BLOCK_SIZE);
+
+		const uint64_t block_end_ns = telemetry_now_ns();
+		pru_audio_take_stats(&stats);
+		telemetry_record_block(&tel, block_end_ns - block_start_ns,
+			stats.read_spin_ns, stats.write_spin_ns, in_fill, out_fill);
+		tel.underruns += stats.underruns;
+
+		if(block_end_ns >= next_post_ns) {
+			telemetry_post(&tel);
+			next_post_ns += 1000000000ull;
+		}
+	}
+
+	/* How much of a core the loop used, waiting included. */
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	const double cpu_s = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+		+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+	const double wall_s = (telemetry_now_ns() - tel.start_ns) * 1e-9;
+
+	log_ring_stop();
+	pru_host_ring_stop();
+
+	telemetry_dump(&tel, stdout);
+	printf("wait policy: %s, loop thread CPU use: %.0f%%\n", pru_wait_policy_name(wait_policy), 100.0 * cpu_s / wall_s);
+	printf("stand-in PRU: %llu sample periods, %llu with no output sample\n",
+		(unsigned long long)pru_host_ring_periods(),
+		(unsigned long long)(pru_host_ring_starved_periods() - starved_before));
+
+	return 0;
+}
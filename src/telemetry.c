@@ -0,0 +1,157 @@
+#include "telemetry.h"
+
+#include "dsp/dsp_perf.h"
+#include "log_ring.h"
+
+#include <string.h>
+
+void
+telemetry_hist_init(telemetry_hist *h, const char *name, const char *unit, uint32_t linear_width) {
+	memset(h, 0, sizeof(*h));
+	h->name = name;
+	h->unit = unit;
+	h->linear_width = linear_width;
+	h->min = UINT64_MAX;
+}
+
+static int
+telemetry_bucket(const telemetry_hist *h, uint64_t value) {
+	uint64_t bucket;
+	if(h->linear_width) {
+		bucket = value / h->linear_width;
+	}
+	else {
+		/* The number of significant bits, so 0 -> 0, 1 -> 1, 2..3 -> 2, ... */
+		bucket = value ? 64 - __builtin_clzll(value) : 0;
+	}
+	return (bucket < TELEMETRY_BUCKETS) ? (int)bucket : TELEMETRY_BUCKETS - 1;
+}
+
+void
+telemetry_hist_add(telemetry_hist *h, uint64_t value) {
+	h->counts[telemetry_bucket(h, value)] += 1;
+	h->n += 1;
+	h->total += value;
+	if(value < h->min) h->min = value;
+	if(value > h->max) h->max = value;
+}
+
+void
+telemetry_hist_print(const telemetry_hist *h, FILE *out) {
+	if(h->n == 0) {
+		fprintf(out, "%s: no samples\n", h->name);
+		return;
+	}
+
+	fprintf(out, "%s (%s): n=%llu min=%llu mean=%llu max=%llu\n",
+		h->name, h->unit,
+		(unsigned long long)h->n,
+		(unsigned long long)h->min,
+		(unsigned long long)(h->total / h->n),
+		(unsigned long long)h->max);
+
+	/* Only print the buckets between the first and last non-empty ones. */
+	int first = 0;
+	int last = TELEMETRY_BUCKETS - 1;
+	while(h->counts[first] == 0) ++first;
+	while(h->counts[last] == 0) --last;
+
+	for(int k = first; k <= last; ++k) {
+		uint64_t lo, hi;
+		if(h->linear_width) {
+			lo = (uint64_t)k * h->linear_width;
+			hi = lo + h->linear_width;
+		}
+		else {
+			lo = k ? (1ull << (k - 1)) : 0;
+			hi = 1ull << k;
+		}
+
+		/* A bar of up to 40 characters, relative to the whole count. */
+		char bar[41];
+		int len = (int)((h->counts[k] * 40 + h->n - 1) / h->n);
+		memset(bar, '#', len);
+		bar[len] = '\0';
+
+		fprintf(out, "  [%9llu, %9llu%s %10llu %s\n",
+			(unsigned long long)lo, (unsigned long long)hi,
+			(k == TELEMETRY_BUCKETS - 1) ? "+)" : ") ",
+			(unsigned long long)h->counts[k], bar);
+	}
+}
+
+void
+telemetry_init(telemetry *t, int block_size, int ring_size) {
+	telemetry_hist_init(&t->work_ns,       "block work time", "ns", 0);
+	telemetry_hist_init(&t->read_spin_ns,  "read wait time",  "ns", 0);
+	telemetry_hist_init(&t->write_spin_ns, "write wait time", "ns", 0);
+
+	/* Fill levels get linear buckets, as many as fit across the whole ring. */
+	uint32_t width = (ring_size + TELEMETRY_BUCKETS - 1) / TELEMETRY_BUCKETS;
+	telemetry_hist_init(&t->in_fill,  "input ring fill",  "samples", width);
+	telemetry_hist_init(&t->out_fill, "output ring fill", "samples", width);
+
+	t->deadline_ns = (uint64_t)block_size * 1000000000u / SAMPLE_RATE;
+	t->deadline_misses = 0;
+	t->underruns = 0;
+	t->start_ns = telemetry_now_ns();
+}
+
+void
+telemetry_record_block(telemetry *t, uint64_t total_ns,
+		uint64_t read_spin_ns, uint64_t write_spin_ns,
+		uint32_t in_fill, uint32_t out_fill) {
+	const uint64_t spin = read_spin_ns + write_spin_ns;
+	const uint64_t work = (total_ns > spin) ? total_ns - spin : 0;
+
+	telemetry_hist_add(&t->work_ns, work);
+	telemetry_hist_add(&t->read_spin_ns, read_spin_ns);
+	telemetry_hist_add(&t->write_spin_ns, write_spin_ns);
+	telemetry_hist_add(&t->in_fill, in_fill);
+	telemetry_hist_add(&t->out_fill, out_fill);
+
+	if(work > t->deadline_ns) {
+		t->deadline_misses += 1;
+	}
+}
+
+void
+telemetry_dump(const telemetry *t, FILE *out) {
+	const double elapsed = (telemetry_now_ns() - t->start_ns) * 1e-9;
+	const double worst = t->work_ns.n ? 100.0 * t->work_ns.max / t->deadline_ns : 0;
+
+	fprintf(out, "--- telemetry: %.1f s, %llu blocks, deadline %llu ns per block ---\n",
+		elapsed, (unsigned long long)t->work_ns.n, (unsigned long long)t->deadline_ns);
+	fprintf(out, "deadline misses: %llu, underruns: %llu, worst block: %.0f%% of deadline\n",
+		(unsigned long long)t->deadline_misses, (unsigned long long)t->underruns, worst);
+
+	telemetry_hist_print(&t->work_ns, out);
+	telemetry_hist_print(&t->read_spin_ns, out);
+	telemetry_hist_print(&t->write_spin_ns, out);
+	telemetry_hist_print(&t->in_fill, out);
+	telemetry_hist_print(&t->out_fill, out);
+	fflush(out);
+}
+
+/* Durations in a log record are int32_t, which is plenty for anything that
+ * isn't already a disaster. */
+static int32_t
+telemetry_clamp(uint64_t value) {
+	return (value > INT32_MAX) ? INT32_MAX : (int32_t)value;
+}
+
+void
+telemetry_post(const telemetry *t) {
+	log_record *r = log_ring_begin(LOG_TELEMETRY);
+	if(!r) return;
+
+	r->count = 7;
+	r->args[0] = telemetry_clamp(t->work_ns.n);
+	r->args[1] = telemetry_clamp(t->deadline_misses);
+	r->args[2] = telemetry_clamp(t->underruns);
+	r->args[3] = telemetry_clamp(t->work_ns.n ? t->work_ns.total / t->work_ns.n : 0);
+	r->args[4] = telemetry_clamp(t->work_ns.max);
+	r->args[5] = telemetry_clamp(t->read_spin_ns.max);
+	r->args[6] = telemetry_clamp(t->write_spin_ns.max);
+	log_ring_commit(r);
+}
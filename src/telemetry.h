@@ -0,0 +1,101 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "types.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/* telemetry.h: cheap histograms for watching the real-time loop, so that we can
+ * tell how close it is to missing its deadline without having to listen for
+ * stutter. */
+
+#define TELEMETRY_BUCKETS 32
+
+/**
+ * A histogram of unsigned values. With linear_width == 0 the buckets are
+ * powers of two (bucket k holds values in [2^(k-1), 2^k), bucket 0 holds 0),
+ * which suits durations. Otherwise bucket k holds values in
+ * [k * linear_width, (k + 1) * linear_width), which suits ring fill levels.
+ * Values past the last bucket are counted in the last bucket.
+ */
+typedef struct {
+	const char *name;
+	const char *unit;
+	uint32_t linear_width;
+
+	uint64_t counts[TELEMETRY_BUCKETS];
+	uint64_t n;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+} telemetry_hist;
+
+/**
+ * Everything main_app records. The durations are per block of samples, and the
+ * fill levels are sampled once per block.
+ */
+typedef struct {
+	/* Time spent on everything but waiting for the PRU, per block. */
+	telemetry_hist work_ns;
+	/* Time spent waiting for the PRU to fill the input ring / drain the
+	 * output ring, per block. */
+	telemetry_hist read_spin_ns;
+	telemetry_hist write_spin_ns;
+	/* Samples waiting in the input ring before the block is read, and samples
+	 * still queued in the output ring before the block is written. */
+	telemetry_hist in_fill;
+	telemetry_hist out_fill;
+
+	/* The time budget for one block, and how many blocks went over it. */
+	uint64_t deadline_ns;
+	uint64_t deadline_misses;
+
+	/* Times the PRU was seen to have run out of output samples. */
+	uint64_t underruns;
+
+	uint64_t start_ns;
+} telemetry;
+
+/**
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+static inline uint64_t
+telemetry_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void telemetry_hist_init(telemetry_hist *h, const char *name, const char *unit, uint32_t linear_width);
+
+void telemetry_hist_add(telemetry_hist *h, uint64_t value);
+
+void telemetry_hist_print(const telemetry_hist *h, FILE *out);
+
+/**
+ * Sets up the histograms for a loop that processes block_size samples at a
+ * time, with rings of ring_size samples.
+ */
+void telemetry_init(telemetry *t, int block_size, int ring_size);
+
+/**
+ * Records one block. The spin times are included in total_ns, and are taken
+ * out of it to get the work time.
+ */
+void telemetry_record_block(telemetry *t, uint64_t total_ns,
+	uint64_t read_spin_ns, uint64_t write_spin_ns,
+	uint32_t in_fill, uint32_t out_fill);
+
+/**
+ * Prints a summary and all of the histograms.
+ */
+void telemetry_dump(const telemetry *t, FILE *out);
+
+/**
+ * Logs the summary line of telemetry_dump() through the log ring, which is
+ * cheap enough to do from the real-time loop.
+ */
+void telemetry_post(const telemetry *t);
+
+#endif